@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include "tests.h"
+
+#include <kernel/event.h>
+#include <kernel/mp.h>
+#include <kernel/mutex.h>
+#include <kernel/port.h>
+#include <kernel/thread.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Lock contention benchmark. Runs mutex, event and port traffic on every cpu at
+ * once and reports the throughput, so scheduler and wait queue lock contention
+ * shows up as a drop in per cpu numbers as more cpus are added.
+ */
+
+#define LOCK_BENCH_DURATION 1000 /* ms */
+#define LOCK_BENCH_MAX_THREADS (SMP_MAX_CPUS * 2)
+
+static volatile bool lock_bench_stop;
+
+struct lock_bench_args {
+    mutex_t *mutex;
+    event_t *wait_event;
+    event_t *signal_event;
+    port_t port;
+    ulong count;
+};
+
+static uint lock_bench_active_cpus(void) {
+    uint count = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (mp_is_cpu_active(i))
+            count++;
+    }
+    return count;
+}
+
+/* nth active cpu */
+static int lock_bench_cpu(uint n) {
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (mp_is_cpu_active(i) && n-- == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int mutex_bencher(void *arg) {
+    struct lock_bench_args *args = (struct lock_bench_args *)arg;
+
+    while (!lock_bench_stop) {
+        mutex_acquire(args->mutex);
+        args->count++;
+        mutex_release(args->mutex);
+    }
+
+    return 0;
+}
+
+static int event_bencher(void *arg) {
+    struct lock_bench_args *args = (struct lock_bench_args *)arg;
+
+    while (!lock_bench_stop) {
+        event_wait(args->wait_event);
+        if (lock_bench_stop)
+            break;
+        args->count++;
+        event_signal(args->signal_event, false);
+    }
+
+    return 0;
+}
+
+static int port_writer(void *arg) {
+    struct lock_bench_args *args = (struct lock_bench_args *)arg;
+    port_packet_t packet = {{0}};
+
+    while (!lock_bench_stop) {
+        if (port_write(args->port, &packet, 1) < 0) {
+            /* buffer full, let the reader catch up */
+            thread_yield();
+            continue;
+        }
+        args->count++;
+    }
+
+    /* make sure the reader wakes up to see the stop flag */
+    while (port_write(args->port, &packet, 1) < 0)
+        thread_yield();
+
+    return 0;
+}
+
+static int port_reader(void *arg) {
+    struct lock_bench_args *args = (struct lock_bench_args *)arg;
+    port_result_t result;
+
+    while (port_read(args->port, INFINITE_TIME, &result) == NO_ERROR) {
+        if (lock_bench_stop)
+            break;
+        args->count++;
+    }
+
+    return 0;
+}
+
+/* start the threads pinned round robin across the first cpus, let them run and collect the counts */
+static ulong lock_bench_run(thread_t **threads, struct lock_bench_args *args, uint count, uint cpus,
+                            void (*kick)(struct lock_bench_args *, uint)) {
+    for (uint i = 0; i < count; i++)
+        thread_set_pinned_cpu(threads[i], lock_bench_cpu(i % cpus));
+
+    for (uint i = 0; i < count; i++)
+        thread_resume(threads[i]);
+
+    if (kick)
+        kick(args, count);
+
+    thread_sleep(LOCK_BENCH_DURATION);
+    lock_bench_stop = true;
+
+    if (kick)
+        kick(args, count);
+
+    ulong total = 0;
+    for (uint i = 0; i < count; i++) {
+        thread_join(threads[i], NULL, INFINITE_TIME);
+        total += args[i].count;
+    }
+
+    return total;
+}
+
+/* one thread per cpu, all fighting over the same mutex */
+static ulong mutex_shared_bench(uint cpus) {
+    thread_t *threads[LOCK_BENCH_MAX_THREADS];
+    struct lock_bench_args args[LOCK_BENCH_MAX_THREADS];
+    mutex_t m;
+
+    mutex_init(&m);
+    lock_bench_stop = false;
+    for (uint i = 0; i < cpus; i++) {
+        args[i].mutex = &m;
+        args[i].count = 0;
+        threads[i] = thread_create("mutex bencher", &mutex_bencher, &args[i], DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    }
+
+    ulong total = lock_bench_run(threads, args, cpus, cpus, NULL);
+
+    mutex_destroy(&m);
+    return total;
+}
+
+/* two threads per cpu sharing a mutex private to that cpu */
+static ulong mutex_private_bench(uint cpus) {
+    thread_t *threads[LOCK_BENCH_MAX_THREADS];
+    struct lock_bench_args args[LOCK_BENCH_MAX_THREADS];
+    mutex_t m[SMP_MAX_CPUS];
+
+    lock_bench_stop = false;
+    for (uint i = 0; i < cpus; i++)
+        mutex_init(&m[i]);
+
+    for (uint i = 0; i < cpus * 2; i++) {
+        args[i].mutex = &m[i % cpus];
+        args[i].count = 0;
+        threads[i] = thread_create("mutex bencher", &mutex_bencher, &args[i], DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    }
+
+    ulong total = lock_bench_run(threads, args, cpus * 2, cpus, NULL);
+
+    for (uint i = 0; i < cpus; i++)
+        mutex_destroy(&m[i]);
+    return total;
+}
+
+static void event_kick(struct lock_bench_args *args, uint count) {
+    /* start each ping-pong pair, or wake anyone still blocked once stopping */
+    for (uint i = 0; i < count; i++) {
+        if (lock_bench_stop || i < count / 2)
+            event_signal(args[i].wait_event, false);
+    }
+}
+
+/* one pair of threads per cpu waking each other up through a pair of events */
+static ulong event_bench(uint cpus) {
+    thread_t *threads[LOCK_BENCH_MAX_THREADS];
+    struct lock_bench_args args[LOCK_BENCH_MAX_THREADS];
+    event_t events[LOCK_BENCH_MAX_THREADS];
+
+    lock_bench_stop = false;
+    for (uint i = 0; i < cpus * 2; i++)
+        event_init(&events[i], false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    /* pair up threads i and i + cpus so both halves land on the same cpu */
+    for (uint i = 0; i < cpus * 2; i++) {
+        uint peer = (i < cpus) ? i + cpus : i - cpus;
+        args[i].wait_event = &events[i];
+        args[i].signal_event = &events[peer];
+        args[i].count = 0;
+        threads[i] = thread_create("event bencher", &event_bencher, &args[i], DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    }
+
+    ulong total = lock_bench_run(threads, args, cpus * 2, cpus, &event_kick);
+
+    for (uint i = 0; i < cpus * 2; i++)
+        event_destroy(&events[i]);
+    return total;
+}
+
+/* one writer and one reader per cpu on a port private to that cpu */
+static ulong port_bench(uint cpus) {
+    thread_t *threads[LOCK_BENCH_MAX_THREADS];
+    struct lock_bench_args args[LOCK_BENCH_MAX_THREADS];
+    port_t w_ports[SMP_MAX_CPUS];
+    port_t r_ports[SMP_MAX_CPUS];
+
+    lock_bench_stop = false;
+    for (uint i = 0; i < cpus; i++) {
+        char name[PORT_NAME_LEN];
+        snprintf(name, sizeof(name), "lkbench%u", i);
+
+        status_t err = port_create(name, PORT_MODE_UNICAST | PORT_MODE_BIG_BUFFER, &w_ports[i]);
+        if (err == NO_ERROR)
+            err = port_open(name, NULL, &r_ports[i]);
+        if (err < 0) {
+            printf("failed to set up port %s, err %d\n", name, err);
+            return 0;
+        }
+
+        args[i].port = w_ports[i];
+        args[i].count = 0;
+        threads[i] = thread_create("port writer", &port_writer, &args[i], DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+
+        args[i + cpus].port = r_ports[i];
+        args[i + cpus].count = 0;
+        threads[i + cpus] = thread_create("port reader", &port_reader, &args[i + cpus], DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    }
+
+    lock_bench_run(threads, args, cpus * 2, cpus, NULL);
+
+    /* count what made it through the readers */
+    ulong total = 0;
+    for (uint i = 0; i < cpus; i++) {
+        total += args[i + cpus].count;
+        port_close(r_ports[i]);
+        port_close(w_ports[i]);
+        port_destroy(w_ports[i]);
+    }
+    return total;
+}
+
+static void lock_bench_print(const char *name, ulong ops, uint cpus) {
+    ulong per_sec = ops * 1000 / LOCK_BENCH_DURATION;
+    printf("\t%-16s %10lu ops/sec (%lu per cpu)\n", name, per_sec, per_sec / cpus);
+}
+
+int lock_tests(int argc, const console_cmd_args *argv) {
+    uint max_cpus = lock_bench_active_cpus();
+
+    printf("testing lock contention across %u cpus\n", max_cpus);
+
+    for (uint cpus = 1; ; cpus = MIN(cpus * 2, max_cpus)) {
+        printf("%u cpus:\n", cpus);
+
+        lock_bench_print("mutex shared", mutex_shared_bench(cpus), cpus);
+        lock_bench_print("mutex per cpu", mutex_private_bench(cpus), cpus);
+        lock_bench_print("event ping-pong", event_bench(cpus), cpus);
+        lock_bench_print("port write/read", port_bench(cpus), cpus);
+
+        if (cpus == max_cpus)
+            break;
+    }
+
+    printf("done with lock contention test\n");
+
+    return 0;
+}
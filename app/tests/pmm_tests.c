@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include "tests.h"
+
+#include <kernel/mutex.h>
+#include <lk/err.h>
+#include <lk/list.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+
+/*
+ * Physical allocator tests. Checks the alignment and contiguity of runs handed out by
+ * pmm_alloc_contiguous() and that pmm_alloc_range() can take them back once freed, then
+ * times the buddy allocator against the single free list allocator it replaced.
+ */
+
+#define PMM_BENCH_ITER 10000
+#define PMM_BENCH_BATCH 1024
+#define PMM_BENCH_HOLES 4096
+#define PMM_BENCH_MAX_PAGES 65536
+
+static int pmm_contiguous_test(void) {
+    static const struct {
+        uint count;
+        uint8_t align_log2;
+    } runs[] = {
+        { 1, 0 }, { 3, 0 }, { 16, 16 }, { 17, 12 }, { 64, 20 }, { 256, 16 }, { 1024, 22 }, { 1500, 12 },
+    };
+
+    printf("testing contiguous allocations\n");
+
+    for (uint i = 0; i < countof(runs); i++) {
+        struct list_node list = LIST_INITIAL_VALUE(list);
+        paddr_t pa;
+
+        size_t count = pmm_alloc_contiguous(runs[i].count, runs[i].align_log2, &pa, &list);
+        if (count != runs[i].count) {
+            printf("\tFAIL: allocating %u pages aligned to 2^%u returned %zu\n",
+                   runs[i].count, runs[i].align_log2, count);
+            pmm_free(&list);
+            return ERR_GENERIC;
+        }
+
+        if (pa & ((1UL << MAX(runs[i].align_log2, PAGE_SIZE_SHIFT)) - 1)) {
+            printf("\tFAIL: run at 0x%lx isn't aligned to 2^%u\n", pa, runs[i].align_log2);
+            pmm_free(&list);
+            return ERR_GENERIC;
+        }
+
+        paddr_t expected = pa;
+        vm_page_t *p;
+        list_for_every_entry(&list, p, vm_page_t, node) {
+            if (vm_page_to_paddr(p) != expected || !(p->flags & VM_PAGE_FLAG_NONFREE)) {
+                printf("\tFAIL: page %p at 0x%lx in run at 0x%lx\n", p, vm_page_to_paddr(p), pa);
+                pmm_free(&list);
+                return ERR_GENERIC;
+            }
+            expected += PAGE_SIZE;
+        }
+
+        /* give it back and take the same range again */
+        pmm_free(&list);
+        count = pmm_alloc_range(pa, runs[i].count, &list);
+        pmm_free(&list);
+        if (count != runs[i].count) {
+            printf("\tFAIL: reallocating %u pages at 0x%lx returned %zu\n", runs[i].count, pa, count);
+            return ERR_GENERIC;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ * The allocator pmm used before the buddy allocator, to compare against: one free
+ * list per arena, and a scan of the page array for contiguous runs.
+ */
+struct list_arena {
+    mutex_t lock;
+    paddr_t base;
+    size_t page_count;
+    vm_page_t *page_array;
+    struct list_node free_list;
+};
+
+static vm_page_t *list_alloc_page(struct list_arena *a) {
+    mutex_acquire(&a->lock);
+    vm_page_t *page = list_remove_head_type(&a->free_list, vm_page_t, node);
+    if (page)
+        page->flags |= VM_PAGE_FLAG_NONFREE;
+    mutex_release(&a->lock);
+    return page;
+}
+
+static void list_free_page(struct list_arena *a, vm_page_t *page) {
+    mutex_acquire(&a->lock);
+    page->flags &= ~VM_PAGE_FLAG_NONFREE;
+    list_add_head(&a->free_list, &page->node);
+    mutex_release(&a->lock);
+}
+
+static ssize_t list_alloc_contiguous(struct list_arena *a, uint count, uint8_t alignment_log2) {
+    mutex_acquire(&a->lock);
+
+    paddr_t rounded_base = ROUNDUP(a->base, 1UL << alignment_log2);
+    uint aligned_offset = (rounded_base - a->base) / PAGE_SIZE;
+    uint start = aligned_offset;
+
+retry:
+    while (start + count <= a->page_count) {
+        for (uint i = 0; i < count; i++) {
+            if (a->page_array[start + i].flags & VM_PAGE_FLAG_NONFREE) {
+                start = ROUNDUP(start - aligned_offset + i + 1, 1UL << (alignment_log2 - PAGE_SIZE_SHIFT)) + aligned_offset;
+                goto retry;
+            }
+        }
+
+        for (uint i = start; i < start + count; i++) {
+            list_delete(&a->page_array[i].node);
+            a->page_array[i].flags |= VM_PAGE_FLAG_NONFREE;
+        }
+
+        mutex_release(&a->lock);
+        return start;
+    }
+
+    mutex_release(&a->lock);
+    return -1;
+}
+
+/* set up a list arena with the same free pages as the first kmap arena */
+static int list_arena_snapshot(struct list_arena *la) {
+    pmm_arena_t *a = NULL;
+    pmm_arena_t *arena;
+    list_for_every_entry(get_arena_list(), arena, pmm_arena_t, node) {
+        if (arena->flags & PMM_ARENA_FLAG_KMAP) {
+            a = arena;
+            break;
+        }
+    }
+    if (!a)
+        return ERR_NOT_FOUND;
+
+    mutex_init(&la->lock);
+    la->base = a->base;
+    la->page_count = MIN(a->size / PAGE_SIZE, PMM_BENCH_MAX_PAGES);
+    la->page_array = calloc(la->page_count, sizeof(vm_page_t));
+    if (!la->page_array)
+        return ERR_NO_MEMORY;
+
+    list_initialize(&la->free_list);
+    for (size_t i = 0; i < la->page_count; i++) {
+        la->page_array[i].flags = a->page_array[i].flags & VM_PAGE_FLAG_NONFREE;
+        if (!(la->page_array[i].flags & VM_PAGE_FLAG_NONFREE))
+            list_add_tail(&la->free_list, &la->page_array[i].node);
+    }
+
+    return NO_ERROR;
+}
+
+static void pmm_bench_pages(struct list_arena *la) {
+    vm_page_t **pages = calloc(PMM_BENCH_BATCH, sizeof(vm_page_t *));
+    if (!pages)
+        return;
+
+    lk_bigtime_t buddy = current_time_hires();
+    for (uint i = 0; i < PMM_BENCH_ITER; i++) {
+        vm_page_t *p = pmm_alloc_page();
+        if (p)
+            pmm_free_page(p);
+    }
+    buddy = current_time_hires() - buddy;
+
+    lk_bigtime_t list = current_time_hires();
+    for (uint i = 0; i < PMM_BENCH_ITER; i++) {
+        vm_page_t *p = list_alloc_page(la);
+        if (p)
+            list_free_page(la, p);
+    }
+    list = current_time_hires() - list;
+
+    printf("\tsingle page alloc/free: buddy %llu nsecs, list %llu nsecs per pair\n",
+           buddy * 1000 / PMM_BENCH_ITER, list * 1000 / PMM_BENCH_ITER);
+
+    buddy = current_time_hires();
+    for (uint i = 0; i < PMM_BENCH_BATCH; i++)
+        pages[i] = pmm_alloc_page();
+    for (uint i = 0; i < PMM_BENCH_BATCH; i++) {
+        if (pages[i])
+            pmm_free_page(pages[i]);
+    }
+    buddy = current_time_hires() - buddy;
+
+    list = current_time_hires();
+    for (uint i = 0; i < PMM_BENCH_BATCH; i++)
+        pages[i] = list_alloc_page(la);
+    for (uint i = 0; i < PMM_BENCH_BATCH; i++) {
+        if (pages[i])
+            list_free_page(la, pages[i]);
+    }
+    list = current_time_hires() - list;
+
+    printf("\t%u pages then free:    buddy %llu usecs, list %llu usecs\n", PMM_BENCH_BATCH, buddy, list);
+
+    free(pages);
+}
+
+static void pmm_bench_contiguous(struct list_arena *la) {
+    static const struct {
+        uint count;
+        uint8_t align_log2;
+    } runs[] = {
+        { 4, 14 }, { 16, 16 }, { 64, 16 }, { 256, 20 },
+    };
+
+    for (uint i = 0; i < countof(runs); i++) {
+        uint count = runs[i].count;
+        uint8_t align_log2 = runs[i].align_log2;
+
+        /* keep taking runs until either allocator runs out or has done 64 */
+        struct list_node list = LIST_INITIAL_VALUE(list);
+        uint buddy_runs = 0;
+        lk_bigtime_t buddy = current_time_hires();
+        for (; buddy_runs < 64; buddy_runs++) {
+            if (pmm_alloc_contiguous(count, align_log2, NULL, &list) == 0)
+                break;
+        }
+        buddy = current_time_hires() - buddy;
+        pmm_free(&list);
+
+        ssize_t starts[64];
+        uint list_runs = 0;
+        lk_bigtime_t lt = current_time_hires();
+        for (; list_runs < countof(starts); list_runs++) {
+            starts[list_runs] = list_alloc_contiguous(la, count, align_log2);
+            if (starts[list_runs] < 0)
+                break;
+        }
+        lt = current_time_hires() - lt;
+        for (uint r = 0; r < list_runs; r++) {
+            for (size_t j = starts[r]; j < (size_t)starts[r] + count; j++)
+                list_free_page(la, &la->page_array[j]);
+        }
+
+        printf("\t%4u pages aligned 2^%u: buddy %llu usecs for %u runs, list %llu usecs for %u runs\n",
+               count, align_log2, buddy, buddy_runs, lt, list_runs);
+    }
+}
+
+static int pmm_bench(void) {
+    struct list_arena la;
+
+    printf("timing the buddy allocator against a single free list\n");
+
+    /* punch holes in memory so contiguous runs have to be searched for */
+    struct list_node held = LIST_INITIAL_VALUE(held);
+    struct list_node holes = LIST_INITIAL_VALUE(holes);
+    for (uint i = 0; i < PMM_BENCH_HOLES; i++) {
+        vm_page_t *p = pmm_alloc_page();
+        if (!p)
+            break;
+        list_add_tail((i & 1) ? &holes : &held, &p->node);
+    }
+    pmm_free(&holes);
+
+    int err = list_arena_snapshot(&la);
+    if (err < 0) {
+        printf("\tno kmap arena to compare against\n");
+        pmm_free(&held);
+        return err;
+    }
+
+    pmm_bench_pages(&la);
+    pmm_bench_contiguous(&la);
+
+    pmm_free(&held);
+    free(la.page_array);
+
+    return NO_ERROR;
+}
+
+int pmm_tests(int argc, const console_cmd_args *argv) {
+    int err = pmm_contiguous_test();
+    if (err == NO_ERROR)
+        err = pmm_bench();
+
+    printf("done with pmm tests, %s\n", (err == NO_ERROR) ? "passed" : "failed");
+
+    return err;
+}
+
+#endif // WITH_KERNEL_VM
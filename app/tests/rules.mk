@@ -6,10 +6,16 @@ MODULE_SRCS := \
     $(LOCAL_DIR)/cache_tests.c \
     $(LOCAL_DIR)/clock_tests.c \
     $(LOCAL_DIR)/fibo.c \
+    $(LOCAL_DIR)/lock_tests.c \
     $(LOCAL_DIR)/mem_tests.c \
+    $(LOCAL_DIR)/pmm_tests.c \
     $(LOCAL_DIR)/port_tests.c \
+    $(LOCAL_DIR)/slab_tests.c \
     $(LOCAL_DIR)/tests.c \
     $(LOCAL_DIR)/thread_tests.c \
+    $(LOCAL_DIR)/timer_tests.c \
+    $(LOCAL_DIR)/tlb_tests.c \
+    $(LOCAL_DIR)/vmm_tests.c \
 
 MODULE_FLOAT_SRCS := \
     $(LOCAL_DIR)/benchmarks.c \
@@ -18,7 +24,8 @@ MODULE_FLOAT_SRCS := \
 
 MODULE_DEPS += \
     lib/cbuf \
-    lib/libm
+    lib/libm \
+    lib/unittest
 
 MODULE_COMPILEFLAGS += -fno-builtin
 
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include "tests.h"
+
+#include <lib/slab.h>
+#include <lib/unittest.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Slab allocator tests. Checks that objects come back aligned, distinct and passed
+ * through the constructor, hammers one cache from several threads at once, then times
+ * allocating and freeing objects against malloc.
+ */
+
+#define SLAB_TEST_OBJECTS 1000
+#define SLAB_TEST_SIZE 72
+#define SLAB_TEST_ALIGN 32
+
+#define SLAB_MT_THREADS 4
+#define SLAB_MT_SLOTS 64
+#define SLAB_MT_ITERS 20000
+
+#define SLAB_BENCH_ITER 100000
+#define SLAB_BENCH_BATCH 256
+
+static volatile uint slab_test_ctor_count;
+
+static void slab_test_ctor(void *object) {
+    slab_test_ctor_count++;
+}
+
+static bool slab_basic_test(void) {
+    BEGIN_TEST;
+
+    uint8_t **objects = calloc(SLAB_TEST_OBJECTS, sizeof(uint8_t *));
+    ASSERT_NONNULL(objects, "");
+
+    slab_cache_t cache;
+    slab_test_ctor_count = 0;
+    slab_cache_init(&cache, "slab test", SLAB_TEST_SIZE, SLAB_TEST_ALIGN, 0, &slab_test_ctor);
+
+    /* fill each object with its index so any overlap shows up */
+    uint allocated;
+    for (allocated = 0; allocated < SLAB_TEST_OBJECTS; allocated++) {
+        uint8_t *p = slab_alloc(&cache);
+        if (!p)
+            break;
+        EXPECT_EQ(0u, (uintptr_t)p % SLAB_TEST_ALIGN, "misaligned object");
+        memset(p, (uint8_t)allocated, SLAB_TEST_SIZE);
+        objects[allocated] = p;
+    }
+    EXPECT_EQ(SLAB_TEST_OBJECTS, allocated, "allocation failed");
+
+    for (uint i = 0; i < allocated; i++) {
+        for (uint j = 0; j < SLAB_TEST_SIZE; j++) {
+            if (objects[i][j] != (uint8_t)i) {
+                EXPECT_EQ((uint8_t)i, objects[i][j], "object overwritten");
+                break;
+            }
+        }
+    }
+
+    EXPECT_EQ(allocated, slab_test_ctor_count, "constructor calls");
+
+    unittest_printf("\t%u objects in %u slabs of %zu bytes\n", allocated, cache.slab_count,
+                    cache.slab_size);
+
+    for (uint i = 0; i < allocated; i++) {
+        slab_free(&cache, objects[i]);
+    }
+    slab_cache_destroy(&cache);
+    free(objects);
+
+    END_TEST;
+}
+
+struct slab_mt_thread {
+    slab_cache_t *cache;
+    uint32_t seed;
+    uint8_t tag;
+    bool failed;
+    uint8_t *slots[SLAB_MT_SLOTS];
+};
+
+static int slab_mt_thread_routine(void *arg) {
+    struct slab_mt_thread *t = arg;
+
+    for (uint i = 0; i < SLAB_MT_ITERS; i++) {
+        t->seed = t->seed * 1664525 + 1013904223;
+        uint slot = (t->seed >> 16) % SLAB_MT_SLOTS;
+
+        if (t->slots[slot]) {
+            if (t->slots[slot][0] != t->tag || t->slots[slot][SLAB_TEST_SIZE - 1] != t->tag)
+                t->failed = true;
+            slab_free(t->cache, t->slots[slot]);
+            t->slots[slot] = NULL;
+        } else {
+            t->slots[slot] = slab_alloc(t->cache);
+            if (!t->slots[slot]) {
+                t->failed = true;
+                continue;
+            }
+            memset(t->slots[slot], t->tag, SLAB_TEST_SIZE);
+        }
+    }
+
+    for (uint slot = 0; slot < SLAB_MT_SLOTS; slot++) {
+        if (t->slots[slot])
+            slab_free(t->cache, t->slots[slot]);
+    }
+
+    return 0;
+}
+
+static bool slab_threads_test(void) {
+    BEGIN_TEST;
+
+    struct slab_mt_thread *state = calloc(SLAB_MT_THREADS, sizeof(*state));
+    ASSERT_NONNULL(state, "");
+
+    slab_cache_t cache;
+    slab_cache_init(&cache, "slab mt test", SLAB_TEST_SIZE, sizeof(void *), SLAB_FLAG_CACHE_ALIGN, NULL);
+
+    for (uint i = 0; i < SLAB_MT_THREADS; i++) {
+        state[i].cache = &cache;
+        state[i].seed = i + 1;
+        state[i].tag = (uint8_t)(0x50 + i);
+    }
+
+    lk_bigtime_t t = unittest_run_threads("slab stress", SLAB_MT_THREADS, &slab_mt_thread_routine,
+                                          state, sizeof(*state));
+    EXPECT_NE(0ull, t, "couldn't start the threads");
+    for (uint i = 0; i < SLAB_MT_THREADS; i++) {
+        EXPECT_FALSE(state[i].failed, "bad object or failed allocation");
+    }
+
+    unittest_printf("\t%u ops in %llu usecs across %u slabs\n", SLAB_MT_ITERS * SLAB_MT_THREADS, t,
+                    cache.slab_count);
+
+    slab_cache_destroy(&cache);
+    free(state);
+
+    END_TEST;
+}
+
+static bool slab_bench(void) {
+    BEGIN_TEST;
+
+    void **objects = calloc(SLAB_BENCH_BATCH, sizeof(void *));
+    ASSERT_NONNULL(objects, "");
+
+    slab_cache_t cache;
+    slab_cache_init(&cache, "slab bench", SLAB_TEST_SIZE, sizeof(void *), 0, NULL);
+
+    /* warm up the cache so the first pass doesn't pay for growing it */
+    for (uint i = 0; i < SLAB_BENCH_BATCH; i++)
+        objects[i] = slab_alloc(&cache);
+    for (uint i = 0; i < SLAB_BENCH_BATCH; i++)
+        slab_free(&cache, objects[i]);
+
+    lk_bigtime_t slab = current_time_hires();
+    for (uint i = 0; i < SLAB_BENCH_ITER; i++)
+        slab_free(&cache, slab_alloc(&cache));
+    slab = current_time_hires() - slab;
+
+    lk_bigtime_t heap = current_time_hires();
+    for (uint i = 0; i < SLAB_BENCH_ITER; i++)
+        free(malloc(SLAB_TEST_SIZE));
+    heap = current_time_hires() - heap;
+
+    unittest_printf("\talloc/free pair:   slab %llu nsecs, malloc %llu nsecs\n",
+                    slab * 1000 / SLAB_BENCH_ITER, heap * 1000 / SLAB_BENCH_ITER);
+
+    slab = current_time_hires();
+    for (uint i = 0; i < SLAB_BENCH_BATCH; i++)
+        objects[i] = slab_alloc(&cache);
+    for (uint i = 0; i < SLAB_BENCH_BATCH; i++)
+        slab_free(&cache, objects[i]);
+    slab = current_time_hires() - slab;
+
+    heap = current_time_hires();
+    for (uint i = 0; i < SLAB_BENCH_BATCH; i++)
+        objects[i] = malloc(SLAB_TEST_SIZE);
+    for (uint i = 0; i < SLAB_BENCH_BATCH; i++)
+        free(objects[i]);
+    heap = current_time_hires() - heap;
+
+    unittest_printf("\t%u allocs then free: slab %llu usecs, malloc %llu usecs\n", SLAB_BENCH_BATCH,
+                    slab, heap);
+
+    slab_cache_destroy(&cache);
+    free(objects);
+
+    END_TEST;
+}
+
+int slab_tests(int argc, const console_cmd_args *argv) {
+    bool ok = slab_basic_test();
+    if (ok)
+        ok = slab_threads_test();
+    if (ok)
+        ok = slab_bench();
+
+    printf("done with slab tests, %s\n", ok ? "passed" : "failed");
+
+    return ok ? NO_ERROR : ERR_GENERIC;
+}
@@ -16,6 +16,14 @@
 STATIC_COMMAND_START
 STATIC_COMMAND("thread_tests", "test the scheduler", &thread_tests)
 STATIC_COMMAND("port_tests", "test the ports", &port_tests)
+STATIC_COMMAND("timer_tests", "test the timer queue", &timer_tests)
+STATIC_COMMAND("slab_tests", "test and benchmark the slab allocator", &slab_tests)
+#if WITH_KERNEL_VM
+STATIC_COMMAND("pmm_tests", "test and benchmark the physical allocator", &pmm_tests)
+STATIC_COMMAND("tlb_tests", "benchmark large and small page mappings", &tlb_tests)
+STATIC_COMMAND("vmm_tests", "test the virtual memory manager", &vmm_tests)
+#endif
+STATIC_COMMAND("lock_tests", "lock contention benchmark", &lock_tests)
 STATIC_COMMAND("clock_tests", "test clocks", &clock_tests)
 STATIC_COMMAND("bench", "miscellaneous benchmarks", &benchmarks)
 STATIC_COMMAND("fibo", "threaded fibonacci", &fibo)
@@ -12,6 +12,12 @@
 int benchmarks(int argc, const console_cmd_args *argv);
 int clock_tests(int argc, const console_cmd_args *argv);
 int fibo(int argc, const console_cmd_args *argv);
+int lock_tests(int argc, const console_cmd_args *argv);
 int mem_test(int argc, const console_cmd_args *argv);
+int pmm_tests(int argc, const console_cmd_args *argv);
 int port_tests(int argc, const console_cmd_args *argv);
+int slab_tests(int argc, const console_cmd_args *argv);
 int thread_tests(int argc, const console_cmd_args *argv);
+int timer_tests(int argc, const console_cmd_args *argv);
+int tlb_tests(int argc, const console_cmd_args *argv);
+int vmm_tests(int argc, const console_cmd_args *argv);
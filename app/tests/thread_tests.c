@@ -16,9 +16,11 @@
 #include <kernel/mutex.h>
 #include <kernel/semaphore.h>
 #include <kernel/event.h>
+#include <kernel/mp.h>
 #include <platform.h>
 #include <platform/time.h>
 #include <arch/atomic.h>
+#include <stdlib.h>
 
 static int sleep_thread(void *arg) {
     for (;;) {
@@ -370,6 +372,150 @@ static void context_switch_test(void) {
     thread_sleep(100);
 }
 
+#if WITH_SMP
+/* measure how context switch and wakeup throughput scale as more cpus are put to work */
+#define SMP_BENCH_DURATION 1000 /* ms */
+
+static volatile bool smp_bench_stop;
+
+struct smp_bench_args {
+    event_t *wait_event;
+    event_t *signal_event;
+    ulong count;
+};
+
+static int smp_yield_bencher(void *arg) {
+    struct smp_bench_args *args = (struct smp_bench_args *)arg;
+
+    while (!smp_bench_stop) {
+        thread_yield();
+        args->count++;
+    }
+
+    return 0;
+}
+
+static int smp_wakeup_bencher(void *arg) {
+    struct smp_bench_args *args = (struct smp_bench_args *)arg;
+
+    while (!smp_bench_stop) {
+        event_wait(args->wait_event);
+        if (smp_bench_stop)
+            break;
+        args->count++;
+        event_signal(args->signal_event, false);
+    }
+
+    return 0;
+}
+
+static uint smp_bench_active_cpus(void) {
+    uint count = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        if (mp_is_cpu_active(i))
+            count++;
+    }
+    return count;
+}
+
+/* run two threads per cpu yielding to each other, each pair pinned to its own cpu */
+static ulong smp_yield_bench(uint cpus) {
+    thread_t *threads[SMP_MAX_CPUS * 2];
+    struct smp_bench_args args[SMP_MAX_CPUS * 2];
+    uint cpu = 0;
+
+    smp_bench_stop = false;
+    for (uint i = 0; i < cpus * 2; i++) {
+        /* skip over cpus that aren't online */
+        while (!mp_is_cpu_active(cpu))
+            cpu++;
+
+        args[i].count = 0;
+        threads[i] = thread_create("smp yield bencher", &smp_yield_bencher, &args[i], DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_set_pinned_cpu(threads[i], cpu);
+        if (i & 1)
+            cpu++;
+    }
+
+    for (uint i = 0; i < cpus * 2; i++)
+        thread_resume(threads[i]);
+
+    thread_sleep(SMP_BENCH_DURATION);
+    smp_bench_stop = true;
+
+    ulong total = 0;
+    for (uint i = 0; i < cpus * 2; i++) {
+        thread_join(threads[i], NULL, INFINITE_TIME);
+        total += args[i].count;
+    }
+
+    return total;
+}
+
+/* run one pair of unpinned threads per cpu that wake each other up through events */
+static ulong smp_wakeup_bench(uint cpus) {
+    thread_t *threads[SMP_MAX_CPUS * 2];
+    struct smp_bench_args args[SMP_MAX_CPUS * 2];
+    event_t events[SMP_MAX_CPUS * 2];
+
+    smp_bench_stop = false;
+    for (uint i = 0; i < cpus * 2; i++)
+        event_init(&events[i], false, EVENT_FLAG_AUTOUNSIGNAL);
+
+    for (uint i = 0; i < cpus * 2; i++) {
+        args[i].count = 0;
+        args[i].wait_event = &events[i];
+        args[i].signal_event = &events[i ^ 1];
+        threads[i] = thread_create("smp wakeup bencher", &smp_wakeup_bencher, &args[i], DEFAULT_PRIORITY, DEFAULT_STACK_SIZE);
+    }
+
+    for (uint i = 0; i < cpus * 2; i++)
+        thread_resume(threads[i]);
+
+    /* start each ping-pong pair */
+    for (uint i = 0; i < cpus * 2; i += 2)
+        event_signal(&events[i], false);
+
+    thread_sleep(SMP_BENCH_DURATION);
+    smp_bench_stop = true;
+
+    /* kick anyone still blocked */
+    for (uint i = 0; i < cpus * 2; i++)
+        event_signal(&events[i], false);
+
+    ulong total = 0;
+    for (uint i = 0; i < cpus * 2; i++) {
+        thread_join(threads[i], NULL, INFINITE_TIME);
+        total += args[i].count;
+    }
+
+    for (uint i = 0; i < cpus * 2; i++)
+        event_destroy(&events[i]);
+
+    return total;
+}
+
+static void smp_scaling_bench(void) {
+    uint max_cpus = smp_bench_active_cpus();
+
+    printf("testing scheduler scaling across %u cpus\n", max_cpus);
+
+    for (uint cpus = 1; ; cpus = MIN(cpus * 2, max_cpus)) {
+        ulong yields = smp_yield_bench(cpus);
+        ulong wakeups = smp_wakeup_bench(cpus);
+
+        printf("%2u cpus: %lu yields/sec (%lu per cpu), %lu wakeups/sec (%lu per cpu)\n", cpus,
+               yields * 1000 / SMP_BENCH_DURATION, yields * 1000 / SMP_BENCH_DURATION / cpus,
+               wakeups * 1000 / SMP_BENCH_DURATION, wakeups * 1000 / SMP_BENCH_DURATION / cpus);
+
+        if (cpus == max_cpus)
+            break;
+    }
+
+    printf("done with scheduler scaling test\n");
+}
+#endif
+
 static volatile int atomic;
 static volatile int atomic_count;
 
@@ -469,6 +615,87 @@ static void preempt_test(void) {
     printf("done with real-time preempt test, above time stamps should be 1 second apart\n");
 }
 
+static volatile bool deadline_test_stop;
+
+static int deadline_hog(void *arg) {
+    while (!deadline_test_stop)
+        ;
+    return 0;
+}
+
+static int deadline_nop(void *arg) {
+    return 0;
+}
+
+static int deadline_tester(void *arg) {
+    int periods = 0;
+
+    while (!deadline_test_stop) {
+        spin(1000); /* 1ms of work per period */
+        periods++;
+        thread_deadline_yield();
+    }
+
+    return periods;
+}
+
+static void deadline_test(void) {
+    thread_t *hogs[SMP_MAX_CPUS];
+    thread_t *testers[2];
+
+    /* two control loops doing 1ms of work every 10ms on a 2ms budget, due within 5ms
+     * of the start of each period, next to a high priority cpu hog on every cpu */
+    printf("testing deadline scheduling\n");
+
+    /* stay above the hogs to be able to stop them */
+    int old_priority = get_current_thread()->priority;
+    thread_set_priority(HIGHEST_PRIORITY);
+
+    deadline_test_stop = false;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        hogs[i] = thread_create("deadline hog", &deadline_hog, NULL, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+        thread_resume(hogs[i]);
+    }
+
+    for (uint i = 0; i < countof(testers); i++) {
+        testers[i] = thread_create("deadline tester", &deadline_tester, NULL, LOW_PRIORITY, DEFAULT_STACK_SIZE);
+        status_t err = thread_set_deadline(testers[i], 2, 10, 5);
+        printf("\tthread_set_deadline returns %d (should be 0)\n", err);
+        thread_resume(testers[i]);
+    }
+
+    /* a cpu can only be reserved up to 90% by deadline threads */
+    thread_t *t = thread_create("deadline nop", &deadline_nop, NULL, LOW_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_set_pinned_cpu(t, thread_pinned_cpu(testers[0]));
+    status_t err = thread_set_deadline(t, 90, 100, 0);
+    printf("\tthread_set_deadline over capacity returns %d (should be %d)\n", err, ERR_NO_RESOURCES);
+    thread_resume(t);
+    thread_join(t, NULL, INFINITE_TIME);
+
+    thread_sleep(1000);
+    deadline_test_stop = true;
+
+    for (uint i = 0; i < countof(testers); i++) {
+#if THREAD_STATS
+        ulong jobs = testers[i]->stats.deadline_jobs;
+        ulong misses = testers[i]->stats.deadline_misses;
+#endif
+        int periods;
+        thread_join(testers[i], &periods, INFINITE_TIME);
+        printf("\tdeadline tester %u ran %d periods in 1 second (should be about 100)\n", i, periods);
+#if THREAD_STATS
+        printf("\t\t%lu periods released, %lu deadlines missed\n", jobs, misses);
+#endif
+    }
+
+    for (uint i = 0; i < SMP_MAX_CPUS; i++)
+        thread_join(hogs[i], NULL, INFINITE_TIME);
+
+    thread_set_priority(old_priority);
+
+    printf("done with deadline test\n");
+}
+
 static int join_tester(void *arg) {
     long val = (long)arg;
 
@@ -591,8 +818,12 @@ int thread_tests(int argc, const console_cmd_args *argv) {
 
     thread_sleep(200);
     context_switch_test();
+#if WITH_SMP
+    smp_scaling_bench();
+#endif
 
     preempt_test();
+    deadline_test();
 
     join_test();
 
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include "tests.h"
+
+#include <arch/ops.h>
+#include <kernel/thread.h>
+#include <kernel/timer.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <rand.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Timer queue tests. Checks that timers spread across the levels of the timer wheel
+ * and the long timeout heap fire in order and on time, and that timers with slack fire
+ * within their window, then times setting, canceling and expiring a large number of
+ * concurrent timers.
+ */
+
+#define TIMER_BENCH_COUNT 10000
+
+static volatile uint timer_test_fired;
+static volatile lk_time_t timer_test_last;
+static volatile lk_time_t timer_test_max_late;
+static volatile bool timer_test_early;
+
+static enum handler_return timer_test_cb(struct timer *t, lk_time_t now, void *arg) {
+    lk_time_t scheduled = (lk_time_t)(uintptr_t)arg;
+
+    if (TIME_LT(now, scheduled))
+        timer_test_early = true;
+    else if (now - scheduled > timer_test_max_late)
+        timer_test_max_late = now - scheduled;
+
+    if (TIME_LT(now, timer_test_last))
+        timer_test_early = true;
+    timer_test_last = now;
+
+    timer_test_fired++;
+    return INT_NO_RESCHEDULE;
+}
+
+static void timer_test_reset(void) {
+    timer_test_fired = 0;
+    timer_test_last = current_time();
+    timer_test_max_late = 0;
+    timer_test_early = false;
+}
+
+/* delays straddling the slot boundaries of the first few wheel levels */
+static int timer_order_test(void) {
+    static const lk_time_t delays[] = {
+        1, 2, 63, 64, 65, 100, 127, 128, 129, 500, 1000, 4095, 4096, 4097, 5000,
+    };
+    timer_t timers[countof(delays)];
+
+    printf("testing timer ordering\n");
+
+    timer_test_reset();
+    lk_time_t now = current_time();
+    for (uint i = 0; i < countof(delays); i++) {
+        timer_initialize(&timers[i]);
+        timer_set_oneshot(&timers[i], delays[i], &timer_test_cb, (void *)(uintptr_t)(now + delays[i]));
+    }
+
+    thread_sleep(delays[countof(delays) - 1] + 100);
+
+    printf("\t%u of %zu fired, max %u ms late\n", timer_test_fired, countof(delays), timer_test_max_late);
+    if (timer_test_fired != countof(delays) || timer_test_early) {
+        printf("\tFAIL: timers fired early, out of order or not at all\n");
+        for (uint i = 0; i < countof(delays); i++)
+            timer_cancel(&timers[i]);
+        return ERR_GENERIC;
+    }
+
+    return NO_ERROR;
+}
+
+#define TIMER_SLACK_COUNT 64
+#define TIMER_SLACK 50
+
+static volatile lk_time_t timer_slack_fired_at[TIMER_SLACK_COUNT];
+
+static enum handler_return timer_slack_cb(struct timer *t, lk_time_t now, void *arg) {
+    uint i = (uint)(uintptr_t)arg;
+
+    timer_slack_fired_at[i] = now;
+    timer_test_fired++;
+    return INT_NO_RESCHEDULE;
+}
+
+/* timers with overlapping slack windows should fire inside their window and share interrupts */
+static int timer_slack_test(void) {
+    timer_t timers[TIMER_SLACK_COUNT];
+    lk_time_t scheduled[TIMER_SLACK_COUNT];
+
+    printf("testing timer slack\n");
+
+    timer_test_reset();
+    lk_time_t now = current_time();
+    for (uint i = 0; i < TIMER_SLACK_COUNT; i++) {
+        lk_time_t delay = 100 + i * 3;
+        scheduled[i] = now + delay;
+        timer_initialize(&timers[i]);
+        timer_set_oneshot_slack(&timers[i], delay, TIMER_SLACK, &timer_slack_cb, (void *)(uintptr_t)i);
+    }
+
+    thread_sleep(100 + TIMER_SLACK_COUNT * 3 + TIMER_SLACK + 100);
+
+    int err = NO_ERROR;
+    uint distinct = 0;
+    for (uint i = 0; i < TIMER_SLACK_COUNT; i++) {
+        timer_cancel(&timers[i]);
+
+        lk_time_t fired_at = timer_slack_fired_at[i];
+        if (TIME_LT(fired_at, scheduled[i]) || TIME_GT(fired_at, scheduled[i] + TIMER_SLACK + 10)) {
+            printf("\tFAIL: timer %u scheduled at %u with %u slack fired at %u\n", i, scheduled[i], TIMER_SLACK, fired_at);
+            err = ERR_GENERIC;
+        }
+
+        bool seen = false;
+        for (uint j = 0; j < i; j++) {
+            if (timer_slack_fired_at[j] == fired_at)
+                seen = true;
+        }
+        if (!seen)
+            distinct++;
+    }
+
+    printf("\t%u of %u fired at %u distinct times\n", timer_test_fired, TIMER_SLACK_COUNT, distinct);
+    if (timer_test_fired != TIMER_SLACK_COUNT)
+        err = ERR_GENERIC;
+
+    return err;
+}
+
+/* a random delay, mostly short with a tail long enough to land in the heap */
+static lk_time_t timer_bench_delay(void) {
+    switch (rand() % 4) {
+        case 0:
+            return 1 + rand() % 64;
+        case 1:
+            return 1 + rand() % (60 * 1000);
+        case 2:
+            return 1 + rand() % (60 * 60 * 1000);
+        default:
+            return 1 + rand() % (24 * 60 * 60 * 1000);
+    }
+}
+
+static int timer_bench(void) {
+    timer_t *timers = calloc(TIMER_BENCH_COUNT, sizeof(timer_t));
+    if (!timers) {
+        printf("failed to allocate %u timers\n", TIMER_BENCH_COUNT);
+        return ERR_NO_MEMORY;
+    }
+
+    printf("timing %u concurrent timers\n", TIMER_BENCH_COUNT);
+
+    for (uint i = 0; i < TIMER_BENCH_COUNT; i++)
+        timer_initialize(&timers[i]);
+
+    /* set and cancel a spread of delays, none of which get to fire */
+    lk_time_t now = current_time();
+    lk_bigtime_t t = current_time_hires();
+    for (uint i = 0; i < TIMER_BENCH_COUNT; i++) {
+        lk_time_t delay = 1000 + timer_bench_delay();
+        timer_set_oneshot(&timers[i], delay, &timer_test_cb, (void *)(uintptr_t)(now + delay));
+    }
+    t = current_time_hires() - t;
+    printf("\tset:    %llu usecs, %llu nsecs per timer\n", t, t * 1000 / TIMER_BENCH_COUNT);
+
+    t = current_time_hires();
+    for (uint i = 0; i < TIMER_BENCH_COUNT; i++)
+        timer_cancel(&timers[i]);
+    t = current_time_hires() - t;
+    printf("\tcancel: %llu usecs, %llu nsecs per timer\n", t, t * 1000 / TIMER_BENCH_COUNT);
+
+    /* let them all expire over the next second */
+    timer_test_reset();
+    now = current_time();
+    for (uint i = 0; i < TIMER_BENCH_COUNT; i++) {
+        lk_time_t delay = 1 + rand() % 1000;
+        timer_set_oneshot(&timers[i], delay, &timer_test_cb, (void *)(uintptr_t)(now + delay));
+    }
+
+    thread_sleep(1100);
+
+    printf("\texpire: %u of %u fired, max %u ms late\n", timer_test_fired, TIMER_BENCH_COUNT, timer_test_max_late);
+
+    for (uint i = 0; i < TIMER_BENCH_COUNT; i++)
+        timer_cancel(&timers[i]);
+
+    int err = NO_ERROR;
+    if (timer_test_fired != TIMER_BENCH_COUNT || timer_test_early) {
+        printf("\tFAIL: timers fired early, out of order or not at all\n");
+        err = ERR_GENERIC;
+    }
+
+    free(timers);
+    return err;
+}
+
+int timer_tests(int argc, const console_cmd_args *argv) {
+    /* keep everything on one cpu's queue so ordering can be checked */
+    thread_t *t = get_current_thread();
+    int old_pinned = thread_pinned_cpu(t);
+    thread_set_pinned_cpu(t, arch_curr_cpu_num());
+
+    int err = timer_order_test();
+    if (err == NO_ERROR)
+        err = timer_slack_test();
+    if (err == NO_ERROR)
+        err = timer_bench();
+
+    thread_set_pinned_cpu(t, old_pinned);
+
+    printf("done with timer tests, %s\n", (err == NO_ERROR) ? "passed" : "failed");
+
+    return err;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include "tests.h"
+
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+#include <string.h>
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+
+/*
+ * TLB benchmark. Maps the same physically contiguous buffer twice, once lined up so the
+ * arch can use large pages and once offset by a page so it has to use small ones, checks
+ * both views see the same memory, then times touching one word per page across the
+ * buffer through each view. The stride is chosen so every access lands on a different
+ * page than the last few, which with small pages means nearly every access misses the TLB.
+ */
+
+#define TLB_BENCH_SIZE (32 * 1024 * 1024)
+#define TLB_BENCH_PASSES 16
+#define TLB_BENCH_STRIDE 257 /* pages, prime */
+
+static lk_bigtime_t tlb_bench_touch(volatile uint8_t *buf, size_t pages) {
+    lk_bigtime_t t = current_time_hires();
+    for (uint pass = 0; pass < TLB_BENCH_PASSES; pass++) {
+        size_t page = pass;
+        for (size_t i = 0; i < pages; i++) {
+            buf[page * PAGE_SIZE + (i & 0x3f) * 64]++;
+            page = (page + TLB_BENCH_STRIDE) % pages;
+        }
+    }
+    return current_time_hires() - t;
+}
+
+int tlb_tests(int argc, const console_cmd_args *argv) {
+#if ARCH_MMU_LARGE_PAGE_SHIFT
+    const uint large_shift = ARCH_MMU_LARGE_PAGE_SHIFT;
+#else
+    const uint large_shift = PAGE_SIZE_SHIFT;
+#endif
+    const size_t large_page = 1UL << large_shift;
+    const size_t pages = TLB_BENCH_SIZE / PAGE_SIZE;
+    int err = NO_ERROR;
+
+    printf("timing %u MB of page strided accesses through large and small pages\n",
+           TLB_BENCH_SIZE / (1024 * 1024));
+
+    /* one extra large page so the offset view fits in the run */
+    struct list_node list = LIST_INITIAL_VALUE(list);
+    paddr_t pa;
+    size_t count = pmm_alloc_contiguous((TLB_BENCH_SIZE + large_page) / PAGE_SIZE,
+                                        large_shift, &pa, &list);
+    if (count == 0) {
+        printf("\tfailed to allocate %zu contiguous bytes\n", TLB_BENCH_SIZE + large_page);
+        return ERR_NO_MEMORY;
+    }
+
+    void *large = NULL;
+    void *small = NULL;
+    err = vmm_alloc_physical(vmm_get_kernel_aspace(), "tlb large", TLB_BENCH_SIZE, &large,
+                             0, pa, 0, ARCH_MMU_FLAG_CACHED);
+    if (err < 0)
+        goto out;
+    err = vmm_alloc_physical(vmm_get_kernel_aspace(), "tlb small", TLB_BENCH_SIZE, &small,
+                             0, pa + PAGE_SIZE, 0, ARCH_MMU_FLAG_CACHED);
+    if (err < 0)
+        goto out;
+
+    /* the small view starts a page into the large one */
+    memset(large, 0, TLB_BENCH_SIZE);
+    ((volatile uint32_t *)small)[0] = 0x12345678;
+    if (((volatile uint32_t *)large)[PAGE_SIZE / sizeof(uint32_t)] != 0x12345678) {
+        printf("\tFAIL: views of the buffer at %p and %p don't alias\n", large, small);
+        err = ERR_GENERIC;
+        goto out;
+    }
+
+    /* warm the caches once through each view before timing */
+    tlb_bench_touch(large, pages - 1);
+    tlb_bench_touch(small, pages - 1);
+
+    lk_bigtime_t large_time = tlb_bench_touch(large, pages - 1);
+    lk_bigtime_t small_time = tlb_bench_touch(small, pages - 1);
+    size_t accesses = (pages - 1) * TLB_BENCH_PASSES;
+
+    printf("\t%zu KB pages: %llu usecs, %llu nsecs per access\n", large_page / 1024,
+           large_time, large_time * 1000 / accesses);
+    printf("\t%u KB pages: %llu usecs, %llu nsecs per access\n", (uint)PAGE_SIZE / 1024,
+           small_time, small_time * 1000 / accesses);
+
+out:
+    if (small)
+        vmm_free_region(vmm_get_kernel_aspace(), (vaddr_t)small);
+    if (large)
+        vmm_free_region(vmm_get_kernel_aspace(), (vaddr_t)large);
+    pmm_free(&list);
+
+    printf("done with tlb tests, %s\n", (err == NO_ERROR) ? "passed" : "failed");
+
+    return err;
+}
+
+#endif // WITH_KERNEL_VM
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include "tests.h"
+
+#include <lk/err.h>
+#include <platform.h>
+#include <stdio.h>
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+
+/*
+ * Virtual memory manager tests. Checks that a commit on demand region starts out with
+ * nothing mapped, that pages appear zeroed and only where they're touched, and times
+ * creating one against committing the same size up front.
+ */
+
+#define DEMAND_TEST_SIZE (16 * 1024 * 1024)
+#define DEMAND_TEST_STRIDE 37 /* pages */
+
+static size_t count_mapped_pages(vaddr_t base, size_t size) {
+    size_t mapped = 0;
+    for (size_t off = 0; off < size; off += PAGE_SIZE) {
+        paddr_t pa;
+        if (arch_mmu_query(&vmm_get_kernel_aspace()->arch_aspace, base + off, &pa, NULL) == NO_ERROR)
+            mapped++;
+    }
+    return mapped;
+}
+
+static int vmm_demand_test(void) {
+    vmm_aspace_t *aspace = vmm_get_kernel_aspace();
+    void *ptr;
+
+    printf("testing commit on demand regions\n");
+
+    lk_bigtime_t t = current_time_hires();
+    status_t err = vmm_alloc(aspace, "demand test", DEMAND_TEST_SIZE, &ptr, 0, VMM_FLAG_COMMIT_ON_DEMAND, 0);
+    lk_bigtime_t demand_time = current_time_hires() - t;
+    if (err < 0) {
+        printf("\tFAIL: vmm_alloc returns %d\n", err);
+        return err;
+    }
+
+    vaddr_t base = (vaddr_t)ptr;
+    size_t mapped = count_mapped_pages(base, DEMAND_TEST_SIZE);
+    if (mapped != 0) {
+        printf("\tFAIL: %zu pages mapped before being touched\n", mapped);
+        err = ERR_GENERIC;
+        goto out;
+    }
+
+    /* read then write a spread of pages, each should come in zeroed */
+    size_t touched = 0;
+    for (size_t page = 0; page < DEMAND_TEST_SIZE / PAGE_SIZE; page += DEMAND_TEST_STRIDE) {
+        volatile uint32_t *word = (volatile uint32_t *)(base + page * PAGE_SIZE + (page % 64) * 64);
+        if (*word != 0) {
+            printf("\tFAIL: page %zu not zeroed, 0x%x\n", page, *word);
+            err = ERR_GENERIC;
+            goto out;
+        }
+        *word = (uint32_t)page;
+        touched++;
+    }
+
+    for (size_t page = 0; page < DEMAND_TEST_SIZE / PAGE_SIZE; page += DEMAND_TEST_STRIDE) {
+        volatile uint32_t *word = (volatile uint32_t *)(base + page * PAGE_SIZE + (page % 64) * 64);
+        if (*word != (uint32_t)page) {
+            printf("\tFAIL: page %zu reads back 0x%x\n", page, *word);
+            err = ERR_GENERIC;
+            goto out;
+        }
+    }
+
+    mapped = count_mapped_pages(base, DEMAND_TEST_SIZE);
+    printf("\ttouched %zu pages, %zu mapped\n", touched, mapped);
+    if (mapped != touched) {
+        printf("\tFAIL: expected %zu mapped pages\n", touched);
+        err = ERR_GENERIC;
+        goto out;
+    }
+
+    /* compare against committing the whole thing up front */
+    void *committed;
+    t = current_time_hires();
+    status_t err2 = vmm_alloc(aspace, "commit test", DEMAND_TEST_SIZE, &committed, 0, 0, 0);
+    lk_bigtime_t commit_time = current_time_hires() - t;
+    if (err2 == NO_ERROR)
+        vmm_free_region(aspace, (vaddr_t)committed);
+
+    printf("\t%u KB: %llu usecs on demand, %llu usecs committed up front\n",
+           DEMAND_TEST_SIZE / 1024, demand_time, commit_time);
+
+out:
+    vmm_free_region(aspace, base);
+    return err;
+}
+
+int vmm_tests(int argc, const console_cmd_args *argv) {
+    int err = vmm_demand_test();
+
+    printf("done with vmm tests, %s\n", (err == NO_ERROR) ? "passed" : "failed");
+
+    return err;
+}
+
+#endif // WITH_KERNEL_VM
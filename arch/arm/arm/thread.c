@@ -32,8 +32,8 @@ static void initial_thread_func(void) {
 //  dprintf("initial_thread_func: thread %p calling %p with arg %p\n", current_thread, current_thread->entry, current_thread->arg);
 //  dump_thread(current_thread);
 
-    /* release the thread lock that was implicitly held across the reschedule */
-    spin_unlock(&thread_lock);
+    /* release the scheduler lock that was implicitly held across the reschedule */
+    spin_unlock(thread_sched_lock(arch_curr_cpu_num()));
     arch_enable_ints();
 
     thread_t *ct = get_current_thread();
@@ -10,6 +10,10 @@
 #include <lk/bits.h>
 #include <arch/arch_ops.h>
 #include <arch/arm64.h>
+#include <lk/err.h>
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
 
 #define SHUTDOWN_ON_FATAL 1
 
@@ -153,6 +157,24 @@ static void dump_iframe(const struct arm64_iframe_long *iframe) {
     arch_stacktrace(iframe->r[29], iframe->elr);
 }
 
+#if WITH_KERNEL_VM
+/* translation faults may just be the first touch of a commit on demand region */
+static bool arm64_demand_fault(struct arm64_iframe_long *iframe, uint32_t iss, uint pf_flags) {
+    /* DFSC/IFSC 0b0001xx, translation fault at any level */
+    if ((BITS(iss, 5, 0) & ~0x3u) != 0b000100)
+        return false;
+
+    uint64_t far = ARM64_READ_SYSREG(far_el1);
+
+    if (!(iframe->spsr & (1 << 7)))
+        arch_enable_ints();
+    status_t err = vmm_page_fault_handler(far, pf_flags);
+    arch_disable_ints();
+
+    return err == NO_ERROR;
+}
+#endif
+
 __WEAK void arm64_syscall(struct arm64_iframe_long *iframe, bool is_64bit) {
     panic("unhandled syscall vector\n");
 }
@@ -183,11 +205,21 @@ void arm64_sync_exception(struct arm64_iframe_long *iframe) {
 #endif
         case 0b100000: /* instruction abort from lower level */
         case 0b100001: /* instruction abort from same level */
+#if WITH_KERNEL_VM
+            if (arm64_demand_fault(iframe, iss, VMM_PF_FLAG_INSTRUCTION |
+                                   ((ec == 0b100000) ? VMM_PF_FLAG_USER : 0)))
+                return;
+#endif
             printf("instruction abort: PC at 0x%llx\n", iframe->elr);
             print_fault_msg(BITS(iss, 5, 0));
             break;
         case 0b100100: /* data abort from lower level */
         case 0b100101: { /* data abort from same level */
+#if WITH_KERNEL_VM
+            if (arm64_demand_fault(iframe, iss, (BIT(iss, 6) ? VMM_PF_FLAG_WRITE : 0) |
+                                   ((ec == 0b100100) ? VMM_PF_FLAG_USER : 0)))
+                return;
+#endif
             for (fault_handler = __fault_handler_table_start;
                     fault_handler < __fault_handler_table_end;
                     fault_handler++) {
@@ -24,6 +24,9 @@
 #define PAGE_SIZE      (1UL << PAGE_SIZE_SHIFT)
 #define USER_PAGE_SIZE (1UL << USER_PAGE_SIZE_SHIFT)
 
+/* size of the block mapped by a level 2 descriptor */
+#define ARCH_MMU_LARGE_PAGE_SHIFT (PAGE_SIZE_SHIFT * 2 - 3)
+
 // TODO: for all practical purposes the default should be 64
 #if ARM64_CPU_CORTEX_A53 || ARM64_CPU_CORTEX_A57 || ARM64_CPU_CORTEX_A72
 #define CACHE_LINE 64
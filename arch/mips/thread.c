@@ -26,8 +26,8 @@ static void initial_thread_func(void) {
     dump_thread(ct);
 #endif
 
-    /* release the thread lock that was implicitly held across the reschedule */
-    spin_unlock(&thread_lock);
+    /* release the scheduler lock that was implicitly held across the reschedule */
+    spin_unlock(thread_sched_lock(arch_curr_cpu_num()));
     arch_enable_ints();
 
     int ret = ct->entry(ct->arg);
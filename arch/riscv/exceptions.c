@@ -10,8 +10,12 @@
 #include <lk/trace.h>
 #include <arch/riscv.h>
 #include <kernel/thread.h>
+#include <lk/err.h>
 #include <platform.h>
 #include <arch/riscv/iframe.h>
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
 
 #define LOCAL_TRACE 0
 
@@ -114,6 +118,25 @@ void riscv_syscall_handler(struct riscv_short_iframe *frame) {
     platform_halt(HALT_ACTION_HALT, HALT_REASON_SW_PANIC);
 }
 
+#if WITH_KERNEL_VM
+// page faults may just be the first touch of a commit on demand region
+static bool riscv_demand_fault(long cause, struct riscv_short_iframe *frame, bool kernel) {
+    vaddr_t fault_addr = riscv_csr_read(RISCV_CSR_XTVAL);
+    uint pf_flags = kernel ? 0 : VMM_PF_FLAG_USER;
+    if (cause == RISCV_EXCEPTION_STORE_PAGE_FAULT)
+        pf_flags |= VMM_PF_FLAG_WRITE;
+    else if (cause == RISCV_EXCEPTION_INS_PAGE_FAULT)
+        pf_flags |= VMM_PF_FLAG_INSTRUCTION;
+
+    if (frame->status & RISCV_CSR_XSTATUS_PIE)
+        arch_enable_ints();
+    status_t err = vmm_page_fault_handler(fault_addr, pf_flags);
+    arch_disable_ints();
+
+    return err == NO_ERROR;
+}
+#endif
+
 // called from assembly
 void riscv_exception_handler(long cause, ulong epc, struct riscv_short_iframe *frame, bool kernel);
 void riscv_exception_handler(long cause, ulong epc, struct riscv_short_iframe *frame, bool kernel) {
@@ -145,6 +168,14 @@ void riscv_exception_handler(long cause, ulong epc, struct riscv_short_iframe *f
             case RISCV_EXCEPTION_ENV_CALL_U_MODE: // ecall from user mode
                 riscv_syscall_handler(frame);
                 break;
+#if WITH_KERNEL_VM
+            case RISCV_EXCEPTION_INS_PAGE_FAULT:
+            case RISCV_EXCEPTION_LOAD_PAGE_FAULT:
+            case RISCV_EXCEPTION_STORE_PAGE_FAULT:
+                if (!riscv_demand_fault(cause, frame, kernel))
+                    fatal_exception(cause, epc, frame, kernel);
+                break;
+#endif
             default:
                 fatal_exception(cause, epc, frame, kernel);
         }
@@ -13,6 +13,13 @@
 // XXX is this right?
 #define CACHE_LINE 32
 
+// size of the megapages mapped by a level 1 page table entry
+#if __riscv_xlen == 32
+#define ARCH_MMU_LARGE_PAGE_SHIFT 22
+#else
+#define ARCH_MMU_LARGE_PAGE_SHIFT 21
+#endif
+
 #if ARCH_RISCV_EMBEDDED
 #define ARCH_DEFAULT_STACK_SIZE 1024
 #else
@@ -94,6 +94,9 @@ uintptr_t constexpr page_mask_per_level(uint level) {
     return page_size_per_level(level) - 1;
 }
 
+// highest level we'll put a terminal entry in: up to 1GB pages
+constexpr uint max_large_page_level = 2;
+
 // compute the starting and stopping index of the kernel aspace
 constexpr uint kernel_start_index = vaddr_to_index(KERNEL_ASPACE_BASE, RISCV_MMU_PT_LEVELS - 1);
 constexpr uint kernel_end_index = vaddr_to_index(KERNEL_ASPACE_BASE + KERNEL_ASPACE_SIZE - 1UL, RISCV_MMU_PT_LEVELS - 1);
@@ -435,25 +438,31 @@ int arch_mmu_map(arch_aspace_t *aspace, const vaddr_t _vaddr, paddr_t paddr, uin
 
         // hit an open pate table entry
         if (level > 0) {
-            // level is > 0, allocate a page table here
-            // TODO: optimize by allocating large page here if possible
-            return walk_cb_ret::OpAllocPT();
+            // use a large page here if the run is aligned to and covers one
+            const uintptr_t page_size = page_size_per_level(level);
+            if (level > max_large_page_level ||
+                ((*vaddr | paddr) & page_mask_per_level(level)) ||
+                count < page_size / PAGE_SIZE) {
+                // allocate a page table here
+                return walk_cb_ret::OpAllocPT();
+            }
         }
 
-        // adding a terminal page at level 0
+        // adding a terminal page at this level
+        const uintptr_t page_size = page_size_per_level(level);
         riscv_pte_t temp_pte = RISCV_PTE_PPN_TO_PTE(paddr);
         temp_pte |= mmu_flags_to_pte(flags);
         temp_pte |= RISCV_PTE_A | RISCV_PTE_D | RISCV_PTE_V;
         temp_pte |= (aspace->flags & ARCH_ASPACE_FLAG_KERNEL) ? RISCV_PTE_G : 0;
 
-        LTRACEF_LEVEL(2, "added new terminal entry: pte %#lx\n", temp_pte);
+        LTRACEF_LEVEL(2, "added new terminal entry at level %u: pte %#lx\n", level, temp_pte);
 
         // modify what the walker handed us
-        *vaddr += PAGE_SIZE;
+        *vaddr += page_size;
 
         // bump our state forward
-        paddr += PAGE_SIZE;
-        count--;
+        paddr += page_size;
+        count -= page_size / PAGE_SIZE;
 
         // if we're done, tell the caller to commit our changes and either restart the walk or halt
         if (count == 0) {
@@ -542,15 +551,16 @@ int arch_mmu_unmap(arch_aspace_t *aspace, const vaddr_t _vaddr, const uint _coun
             // assert that it's not a page table pointer, which we shouldn't be hitting in the callback
             DEBUG_ASSERT(pte & RISCV_PTE_PERM_MASK);
 
-            if (level > 0) {
-                PANIC_UNIMPLEMENTED_MSG("cannot handle unmapping of large page");
+            const uintptr_t page_size = page_size_per_level(level);
+            if (level > 0 && ((*vaddr & page_mask_per_level(level)) || count < page_size / PAGE_SIZE)) {
+                PANIC_UNIMPLEMENTED_MSG("cannot handle unmapping part of a large page");
             }
 
             // zero it out, which should unmap the page
             // TODO: handle freeing upper level page tables
             // make sure we dont free kernel 2nd level pts
-            *vaddr += PAGE_SIZE;
-            count--;
+            *vaddr += page_size;
+            count -= page_size / PAGE_SIZE;
             if (count == 0) {
                 return walk_cb_ret::OpCommitHalt(0, true, NO_ERROR);
             } else {
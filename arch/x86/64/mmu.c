@@ -240,6 +240,14 @@ static status_t x86_mmu_get_mapping(uint64_t *const pml4_table, const vaddr_t va
     }
     LTRACEF_LEVEL(2, "pdpe 0x%llx\n", pdpe);
 
+    /* 1 GB pages */
+    if (pdpe & X86_MMU_PG_PS) {
+        *paddr = (pdpe & X86_1GB_PAGE_FRAME) + ((uint64_t)vaddr & PAGE_OFFSET_MASK_1GB);
+        *mmu_flags = get_arch_mmu_flags(pdpe & X86_FLAGS_MASK);
+        LTRACEF("getting flags from 1GB pte %#llx, flags %#llx\n", pdpe, *mmu_flags);
+        goto last;
+    }
+
     pde = get_pd_entry_from_pd_table(vaddr, pdpe);
     if (!is_pte_present(pde)) {
         *ret_level = PD_L;
@@ -327,6 +335,29 @@ static void update_pml4_entry(vaddr_t vaddr, uint64_t *pml4_table, map_addr_t pa
                   pml4_table, pml4_index);
 }
 
+/* write a 2MB or 1GB page entry into a pd or pdp table */
+static void update_large_page_entry(uint64_t *table, uint32_t index, paddr_t paddr, arch_flags_t flags) {
+    table[index] = paddr;
+    table[index] |= flags | X86_MMU_PG_PS | X86_MMU_PG_P;
+    if (!(flags & X86_MMU_PG_U)) {
+        table[index] |= X86_MMU_PG_G; /* setting global flag for kernel pages */
+    }
+    LTRACEF_LEVEL(2, "writing large page entry %#llx in table %p at index %u\n", table[index], table,
+                  index);
+}
+
+/* size of the page mapped by a leaf entry at a given level */
+static size_t page_size_at_level(int level) {
+    switch (level) {
+        case PDP_L:
+            return 1UL << PDP_SHIFT;
+        case PD_L:
+            return 1UL << PD_SHIFT;
+        default:
+            return PAGE_SIZE;
+    }
+}
+
 /**
  * @brief Allocating a new page table
  */
@@ -357,15 +388,17 @@ static map_addr_t *alloc_page_table(paddr_t *pa_out) {
  * either by checking if the mapping already exists and is valid OR by adding a
  * new mapping with the required flags.
  *
- * In this scenario, we are considering the paging scheme to be a PAE mode with
- * 4KB pages.
+ * The mapping is a 4KB page for PT_L, a 2MB page for PD_L or a 1GB page for PDP_L.
+ * For large pages the entry they go in must be empty.
  *
  */
 static status_t x86_mmu_add_mapping(uint64_t *const pml4, const map_addr_t paddr,
-                                    const vaddr_t vaddr, const arch_flags_t mmu_flags) {
+                                    const vaddr_t vaddr, const int level,
+                                    const arch_flags_t mmu_flags) {
     status_t ret = NO_ERROR;
 
-    LTRACEF("pml4 %p paddr %#llx vaddr %#lx flags %#llx\n", pml4, paddr, vaddr, mmu_flags);
+    LTRACEF("pml4 %p paddr %#llx vaddr %#lx level %d flags %#llx\n", pml4, paddr, vaddr, level,
+            mmu_flags);
 
     DEBUG_ASSERT(pml4);
     if ((!x86_mmu_check_vaddr(vaddr)) || (!x86_mmu_check_paddr(paddr))) {
@@ -397,6 +430,14 @@ static status_t x86_mmu_add_mapping(uint64_t *const pml4, const map_addr_t paddr
 
     LTRACEF_LEVEL(2, "pdpe %#llx\n", pdpe);
 
+    if (level == PDP_L) {
+        DEBUG_ASSERT(!is_pte_present(pdpe));
+        uint32_t pdp_index = (((uint64_t)vaddr >> PDP_SHIFT) & ((1ul << ADDR_OFFSET) - 1));
+        update_large_page_entry(paddr_to_kvaddr(get_pfn_from_pte(pml4e)), pdp_index, paddr,
+                                get_x86_arch_flags(mmu_flags));
+        return NO_ERROR;
+    }
+
     uint64_t pde = 0;
     if (!is_pte_present(pdpe)) {
         /* Creating a new pd table  */
@@ -421,6 +462,14 @@ static status_t x86_mmu_add_mapping(uint64_t *const pml4, const map_addr_t paddr
 
     LTRACEF_LEVEL(2, "pde %#llx\n", pde);
 
+    if (level == PD_L) {
+        DEBUG_ASSERT(!is_pte_present(pde));
+        uint32_t pd_index = (((uint64_t)vaddr >> PD_SHIFT) & ((1ul << ADDR_OFFSET) - 1));
+        update_large_page_entry(paddr_to_kvaddr(get_pfn_from_pte(pdpe)), pd_index, paddr,
+                                get_x86_arch_flags(mmu_flags));
+        return NO_ERROR;
+    }
+
     if (!is_pte_present(pde)) {
         /* Creating a new pt */
         paddr_t pa;
@@ -457,12 +506,52 @@ clean:
     return ret;
 }
 
+/**
+ * @brief  Split a 2MB or 1GB page into a table of the next smaller page size
+ *
+ * The new table maps the same physical range with the same flags and replaces the large
+ * page entry. Returns the new table, or NULL if there was no memory for it.
+ *
+ */
+static uint64_t *x86_mmu_split_large_page(uint64_t *const table, const uint32_t index,
+                                          const vaddr_t vaddr, const int level) {
+    paddr_t pa;
+    uint64_t *new_table = alloc_page_table(&pa);
+    if (!new_table) {
+        return NULL;
+    }
+
+    const uint64_t entry = table[index];
+    const paddr_t frame = entry & ((level == PDP_L) ? X86_1GB_PAGE_FRAME : X86_2MB_PAGE_FRAME);
+
+    /* a 1GB page splits into 2MB pages, a 2MB page into 4KB ones where bit 7 means PAT, not PS */
+    arch_flags_t flags = entry & X86_FLAGS_MASK;
+    if (level == PD_L) {
+        flags &= ~X86_MMU_PG_PS;
+    }
+    const size_t size = page_size_at_level(level - 1);
+    for (uint32_t i = 0; i < NO_OF_PT_ENTRIES; i++) {
+        new_table[i] = (frame + i * size) | flags;
+    }
+
+    LTRACEF_LEVEL(2, "splitting large page entry %#llx into table %p\n", entry, new_table);
+    table[index] = pa | X86_MMU_PG_P | X86_MMU_PG_RW | (entry & X86_MMU_PG_U);
+    tlbsync_local(vaddr);
+
+    return new_table;
+}
+
 /**
  * @brief  x86-64 MMU unmap an entry in the page tables recursively and clear out tables
  *
+ * Returns the size of the page that was unmapped, or PAGE_SIZE if nothing was mapped.
+ * A large page that only partly falls within the count pages being unmapped is split first,
+ * if there's no memory to do that 0 is returned and nothing is unmapped.
+ *
  */
-static void x86_mmu_unmap_entry(const vaddr_t vaddr, const int level, uint64_t *const table) {
-    LTRACEF("vaddr 0x%lx level %d table %p\n", vaddr, level, table);
+static size_t x86_mmu_unmap_entry(const vaddr_t vaddr, const int level, uint64_t *const table,
+                                  const uint count) {
+    LTRACEF("vaddr 0x%lx level %d table %p count %u\n", vaddr, level, table, count);
 
     uint64_t *next_table_addr = NULL;
     paddr_t next_table_pa = 0;
@@ -472,27 +561,37 @@ static void x86_mmu_unmap_entry(const vaddr_t vaddr, const int level, uint64_t *
             index = (((uint64_t)vaddr >> PML4_SHIFT) & ((1ul << ADDR_OFFSET) - 1));
             LTRACEF_LEVEL(2, "index %u\n", index);
             if (!is_pte_present(table[index])) {
-                return;
+                return PAGE_SIZE;
             }
             next_table_pa = get_pfn_from_pte(table[index]);
             next_table_addr = paddr_to_kvaddr(next_table_pa);
             LTRACEF_LEVEL(2, "next_table_addr %p\n", next_table_addr);
             break;
         case PDP_L:
-            index = (((uint64_t)vaddr >> PDP_SHIFT) & ((1ul << ADDR_OFFSET) - 1));
-            LTRACEF_LEVEL(2, "index %u\n", index);
-            if (!is_pte_present(table[index])) {
-                return;
-            }
-            next_table_pa = get_pfn_from_pte(table[index]);
-            next_table_addr = paddr_to_kvaddr(next_table_pa);
-            LTRACEF_LEVEL(2, "next_table_addr %p\n", next_table_addr);
-            break;
         case PD_L:
-            index = (((uint64_t)vaddr >> PD_SHIFT) & ((1ul << ADDR_OFFSET) - 1));
+            index = (((uint64_t)vaddr >> ((level == PDP_L) ? PDP_SHIFT : PD_SHIFT)) & ((1ul << ADDR_OFFSET) - 1));
             LTRACEF_LEVEL(2, "index %u\n", index);
             if (!is_pte_present(table[index])) {
-                return;
+                return PAGE_SIZE;
+            }
+            if (table[index] & X86_MMU_PG_PS) {
+                const size_t size = page_size_at_level(level);
+                if (IS_ALIGNED(vaddr, size) && count >= size / PAGE_SIZE) {
+                    /* large page, the whole of it is going away */
+                    LTRACEF_LEVEL(2, "writing zero to large page entry, old val %#llx\n", table[index]);
+                    table[index] = 0;
+                    tlbsync_local(vaddr);
+                    return size;
+                }
+
+                /* only part of it is, split it up and unmap from the smaller pages */
+                next_table_addr = x86_mmu_split_large_page(table, index, vaddr, level);
+                if (!next_table_addr) {
+                    return 0;
+                }
+                next_table_pa = get_pfn_from_pte(table[index]);
+                LTRACEF_LEVEL(2, "next_table_addr %p\n", next_table_addr);
+                break;
             }
             next_table_pa = get_pfn_from_pte(table[index]);
             next_table_addr = paddr_to_kvaddr(next_table_pa);
@@ -502,22 +601,26 @@ static void x86_mmu_unmap_entry(const vaddr_t vaddr, const int level, uint64_t *
             index = (((uint64_t)vaddr >> PT_SHIFT) & ((1ul << ADDR_OFFSET) - 1));
             LTRACEF_LEVEL(2, "index %u\n", index);
             if (!is_pte_present(table[index])) {
-                return;
+                return PAGE_SIZE;
             }
 
             /* page frame is present, wipe it out */
             LTRACEF_LEVEL(2, "writing zero to entry, old val %#llx\n", table[index]);
             table[index] = 0;
             tlbsync_local(vaddr);
-            return;
+            return PAGE_SIZE;
         default:
             // shouldn't recurse this far
             DEBUG_ASSERT(0);
+            return PAGE_SIZE;
     }
 
     LTRACEF_LEVEL(2, "recursing\n");
 
-    x86_mmu_unmap_entry(vaddr, level - 1, next_table_addr);
+    size_t size = x86_mmu_unmap_entry(vaddr, level - 1, next_table_addr, count);
+    if (size == 0) {
+        return 0;
+    }
 
     LTRACEF_LEVEL(2, "next_table_addr %p\n", next_table_addr);
 
@@ -526,7 +629,7 @@ static void x86_mmu_unmap_entry(const vaddr_t vaddr, const int level, uint64_t *
         for (uint32_t next_level_offset = 0; next_level_offset < (PAGE_SIZE / 8);
              next_level_offset++) {
             if (is_pte_present(next_table_addr[next_level_offset])) {
-                return; /* There is an entry in the next level table */
+                return size; /* There is an entry in the next level table */
             }
         }
         /* All present bits for all entries in next level table for this address are 0, so we
@@ -538,6 +641,8 @@ static void x86_mmu_unmap_entry(const vaddr_t vaddr, const int level, uint64_t *
         }
         pmm_free_page(paddr_to_vm_page(next_table_pa));
     }
+
+    return size;
 }
 
 static status_t x86_mmu_unmap(uint64_t *const pml4, const vaddr_t vaddr, uint count) {
@@ -552,9 +657,13 @@ static status_t x86_mmu_unmap(uint64_t *const pml4, const vaddr_t vaddr, uint co
 
     vaddr_t next_aligned_v_addr = vaddr;
     while (count > 0) {
-        x86_mmu_unmap_entry(next_aligned_v_addr, X86_PAGING_LEVELS, pml4);
-        next_aligned_v_addr += PAGE_SIZE;
-        count--;
+        size_t size = x86_mmu_unmap_entry(next_aligned_v_addr, X86_PAGING_LEVELS, pml4, count);
+        if (size == 0) {
+            return ERR_NO_MEMORY;
+        }
+        DEBUG_ASSERT(size / PAGE_SIZE <= count);
+        next_aligned_v_addr += size;
+        count -= MIN(count, size / PAGE_SIZE);
     }
     return NO_ERROR;
 }
@@ -575,6 +684,38 @@ int arch_mmu_unmap(arch_aspace_t *const aspace, const vaddr_t vaddr, const uint
     return (x86_mmu_unmap(aspace->cr3, vaddr, count));
 }
 
+/**
+ * @brief  Pick the largest page that can map the start of a range
+ *
+ * Uses a 1GB or 2MB page if both addresses are aligned to it, the range covers it and
+ * nothing is mapped in the table entry it would go in.
+ *
+ */
+static int x86_mmu_pick_level(uint64_t *const pml4, const vaddr_t vaddr, const paddr_t paddr,
+                              const size_t pages) {
+    uint64_t pml4e = get_pml4_entry_from_pml4_table(vaddr, pml4);
+    uint64_t pdpe = is_pte_present(pml4e) ? get_pdp_entry_from_pdp_table(vaddr, pml4e) : 0;
+
+    size_t size = 1UL << PDP_SHIFT;
+    if (supports_huge_pages && IS_ALIGNED(vaddr | paddr, size) && pages >= size / PAGE_SIZE &&
+        !is_pte_present(pdpe)) {
+        return PDP_L;
+    }
+
+    if (is_pte_present(pdpe) && (pdpe & X86_MMU_PG_PS)) {
+        return PT_L;
+    }
+
+    uint64_t pde = is_pte_present(pdpe) ? get_pd_entry_from_pd_table(vaddr, pdpe) : 0;
+
+    size = 1UL << PD_SHIFT;
+    if (IS_ALIGNED(vaddr | paddr, size) && pages >= size / PAGE_SIZE && !is_pte_present(pde)) {
+        return PD_L;
+    }
+
+    return PT_L;
+}
+
 /**
  * @brief  Mapping a section/range with specific permissions
  *
@@ -600,17 +741,21 @@ static status_t x86_mmu_map_range(uint64_t *const pml4, struct map_range *const
     vaddr_t next_aligned_v_addr = range->start_vaddr;
     paddr_t next_aligned_p_addr = range->start_paddr;
 
-    for (uint32_t index = 0; index < no_of_pages; index++) {
+    for (uint32_t index = 0; index < no_of_pages;) {
+        int level = x86_mmu_pick_level(pml4, next_aligned_v_addr, next_aligned_p_addr,
+                                       no_of_pages - index);
         status_t map_status =
-            x86_mmu_add_mapping(pml4, next_aligned_p_addr, next_aligned_v_addr, flags);
+            x86_mmu_add_mapping(pml4, next_aligned_p_addr, next_aligned_v_addr, level, flags);
         if (map_status) {
             dprintf(SPEW, "Add mapping failed with err=%d\n", map_status);
             /* Unmap the partial mapping - if any */
             x86_mmu_unmap(pml4, range->start_vaddr, index);
             return map_status;
         }
-        next_aligned_v_addr += PAGE_SIZE;
-        next_aligned_p_addr += PAGE_SIZE;
+        size_t size = page_size_at_level(level);
+        next_aligned_v_addr += size;
+        next_aligned_p_addr += size;
+        index += size / PAGE_SIZE;
     }
     return NO_ERROR;
 }
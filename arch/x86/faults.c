@@ -10,7 +10,11 @@
 #include <arch/x86.h>
 #include <kernel/thread.h>
 #include <lk/debug.h>
+#include <lk/err.h>
 #include <lk/trace.h>
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#endif
 
 /* exceptions */
 #define INT_DIVIDE_0    0x00
@@ -92,6 +96,27 @@ static void x86_pfe_handler(x86_iframe_t *frame) {
     thread_t *current_thread;
     error_code = frame->err_code;
 
+#if WITH_KERNEL_VM
+    /* faults on unmapped pages may just be the first touch of a commit on demand region */
+    if (!(error_code & PFEX_P)) {
+        vaddr_t fault_addr = x86_get_cr2();
+        uint pf_flags = 0;
+        if (error_code & PFEX_W)
+            pf_flags |= VMM_PF_FLAG_WRITE;
+        if (error_code & PFEX_U)
+            pf_flags |= VMM_PF_FLAG_USER;
+        if (error_code & PFEX_I)
+            pf_flags |= VMM_PF_FLAG_INSTRUCTION;
+
+        if (frame->flags & X86_FLAGS_IF)
+            arch_enable_ints();
+        status_t err = vmm_page_fault_handler(fault_addr, pf_flags);
+        arch_disable_ints();
+        if (err == NO_ERROR)
+            return;
+    }
+#endif
+
 #ifdef PAGE_FAULT_DEBUG_INFO
     addr_t v_addr, ssp, esp, ip, rip;
     v_addr = x86_get_cr2();
@@ -13,6 +13,11 @@
 
 #define CACHE_LINE 64
 
+#if ARCH_X86_64
+/* size of the pages mapped by a page directory entry */
+#define ARCH_MMU_LARGE_PAGE_SHIFT 21
+#endif
+
 #define ARCH_DEFAULT_STACK_SIZE (PAGE_SIZE * 2)
 #define DEFAULT_TSS             PAGE_SIZE
 
@@ -47,8 +47,10 @@
 #define X86_FLAGS_MASK       (0x8000000000000ffful)
 #define X86_PTE_NOT_PRESENT  (0xFFFFFFFFFFFFFFFEul)
 #define X86_2MB_PAGE_FRAME   (0x000fffffffe00000ul)
+#define X86_1GB_PAGE_FRAME   (0x000fffffc0000000ul)
 #define PAGE_OFFSET_MASK_4KB (0x0000000000000ffful)
 #define PAGE_OFFSET_MASK_2MB (0x00000000001ffffful)
+#define PAGE_OFFSET_MASK_1GB (0x000000003ffffffful)
 #define X86_MMU_PG_NX        (1ULL << 63)
 
 #if ARCH_X86_64
@@ -149,3 +149,8 @@ inline FIS_REG_H2D ata_cmd_write_fpdma_queued(uint64_t lba, uint16_t sector_coun
 
     return fis;
 }
+
+// Retag a queued command. AHCI requires the tag to match the command slot it's issued in.
+inline void ata_fpdma_set_tag(FIS_REG_H2D *fis, uint8_t tag) {
+    fis->countl = (tag & 0x1f) << 3;
+}
@@ -54,9 +54,9 @@ status_t ahci_disk::identify() {
     uint16_t identify_data[256];
     FIS_REG_H2D fis = ata_cmd_identify();
 
-    // issue the identify command (not using NCQ, so tag is irrelevant)
+    // issue the identify command
     int slot;
-    auto err = port_.queue_command(&fis, sizeof(fis), identify_data, sizeof(identify_data), false, false, 0, &slot);
+    auto err = port_.queue_command(&fis, sizeof(fis), identify_data, sizeof(identify_data), false, false, &slot);
     if (err != NO_ERROR) {
         printf("ahci_disk::identify: queue_command failed: %d\n", err);
         return err;
@@ -171,42 +171,26 @@ status_t ahci_disk::do_rw_sectors_sync(uint64_t lba, void *buf, size_t buf_len,
         return ERR_INVALID_ARGS;
     }
 
-    // Allocate an NCQ tag if using NCQ, otherwise use tag 0 (unused for non-NCQ)
-    uint8_t tag = 0;
-    bool use_ncq = false;
-    if (supports_ncq_) {
-        int tag_result = port_.allocate_ncq_tag();
-        if (tag_result < 0) {
-            LTRACEF("failed to allocate NCQ tag, falling back to DMA: %d\n", tag_result);
-            // Fall back to DMA if we can't allocate a tag
-        } else {
-            tag = tag_result;
-            use_ncq = true;
-        }
-    }
-
-    // Select appropriate command based on NCQ support
-    FIS_REG_H2D fis = use_ncq
-                          ? (write ? ata_cmd_write_fpdma_queued(lba, sector_count, tag)
-                                   : ata_cmd_read_fpdma_queued(lba, sector_count, tag))
+    // the port fills in the NCQ tag once it has picked a slot
+    FIS_REG_H2D fis = supports_ncq_
+                          ? (write ? ata_cmd_write_fpdma_queued(lba, sector_count, 0)
+                                   : ata_cmd_read_fpdma_queued(lba, sector_count, 0))
                           : (write ? ata_cmd_write_dma_ext(lba, sector_count)
                                    : ata_cmd_read_dma_ext(lba, sector_count));
 
+    // async commands may be holding every slot, wait for one to free up
     int slot;
-    auto err = port_.queue_command(&fis, sizeof(fis), buf, buf_len, write, use_ncq, tag, &slot);
+    status_t err;
+    while ((err = port_.queue_command(&fis, sizeof(fis), buf, buf_len, write, supports_ncq_, &slot)) == ERR_NO_RESOURCES) {
+        port_.wait_for_free_slot();
+    }
     if (err != NO_ERROR) {
-        if (use_ncq) {
-            port_.release_ncq_tag(tag);
-        }
         return err;
     }
 
     // wait for it to complete
     uint32_t error_status;
     err = port_.wait_for_completion(slot, &error_status);
-    if (use_ncq) {
-        port_.release_ncq_tag(tag);
-    }
     if (err != NO_ERROR) {
         return err;
     }
@@ -282,8 +266,14 @@ status_t ahci_disk::bio_handler::initialize_bdev() {
     bdev_.write_block = &bdev_write_block_hook;
     bdev_.read_async = &bdev_read_async_hook;
     bdev_.write_async = &bdev_write_async_hook;
+    bdev_.readv_async = &bdev_readv_async_hook;
+    bdev_.writev_async = &bdev_writev_async_hook;
     bdev_.close = &bdev_close_hook;
 
+    // without NCQ the drive only takes one command at a time, with it one per NCQ tag
+    // the drive and the port both have
+    bdev_.queue_depth = disk_->supports_ncq_ ? MIN(disk_->ncq_queue_depth_, disk_->port_.command_slots()) : 1;
+
     dprintf(INFO, "ahci%d: registering block device '%s'\n",
             disk_->port_.controller_unit(), bdev_name);
 
@@ -297,20 +287,36 @@ status_t ahci_disk::bio_handler::initialize_bdev() {
 status_t ahci_disk::bio_handler::bdev_read_async_hook(struct bdev *dev, void *buf, off_t offset, size_t len,
                                                        bio_async_callback_t callback, void *callback_context) {
     ahci_disk *disk = bdev_to_disk(dev);
-    return disk->do_rw_sectors_async(dev, offset / disk->logical_sector_size_, buf,
+    const iovec_t iov = { buf, len };
+    return disk->do_rw_sectors_async(dev, offset / disk->logical_sector_size_, &iov, 1,
                                      len, false, callback, callback_context);
 }
 
 status_t ahci_disk::bio_handler::bdev_write_async_hook(struct bdev *dev, const void *buf, off_t offset, size_t len,
                                                         bio_async_callback_t callback, void *callback_context) {
     ahci_disk *disk = bdev_to_disk(dev);
-    return disk->do_rw_sectors_async(dev, offset / disk->logical_sector_size_, (void *)buf,
+    const iovec_t iov = { const_cast<void *>(buf), len };
+    return disk->do_rw_sectors_async(dev, offset / disk->logical_sector_size_, &iov, 1,
                                      len, true, callback, callback_context);
 }
 
-status_t ahci_disk::do_rw_sectors_async(bdev_t *bdev, uint64_t lba, void *buf, size_t buf_len, bool write,
-                                        bio_async_callback_t callback, void *callback_context) {
-    LTRACEF("lba %#llx buf %p len %zu write %d\n", lba, buf, buf_len, write);
+status_t ahci_disk::bio_handler::bdev_readv_async_hook(struct bdev *dev, const iovec_t *iov, uint iov_cnt, off_t offset,
+                                                        size_t len, bio_async_callback_t callback, void *callback_context) {
+    ahci_disk *disk = bdev_to_disk(dev);
+    return disk->do_rw_sectors_async(dev, offset / disk->logical_sector_size_, iov, iov_cnt,
+                                     len, false, callback, callback_context);
+}
+
+status_t ahci_disk::bio_handler::bdev_writev_async_hook(struct bdev *dev, const iovec_t *iov, uint iov_cnt, off_t offset,
+                                                         size_t len, bio_async_callback_t callback, void *callback_context) {
+    ahci_disk *disk = bdev_to_disk(dev);
+    return disk->do_rw_sectors_async(dev, offset / disk->logical_sector_size_, iov, iov_cnt,
+                                     len, true, callback, callback_context);
+}
+
+status_t ahci_disk::do_rw_sectors_async(bdev_t *bdev, uint64_t lba, const iovec_t *iov, uint iov_cnt, size_t buf_len,
+                                        bool write, bio_async_callback_t callback, void *callback_context) {
+    LTRACEF("lba %#llx iov %p cnt %u len %zu write %d\n", lba, iov, iov_cnt, buf_len, write);
 
     if (buf_len % logical_sector_size_ != 0) {
         return ERR_INVALID_ARGS;
@@ -321,41 +327,15 @@ status_t ahci_disk::do_rw_sectors_async(bdev_t *bdev, uint64_t lba, void *buf, s
         return ERR_INVALID_ARGS;
     }
 
-    // Allocate an NCQ tag if using NCQ, otherwise use tag 0 (unused for non-NCQ)
-    uint8_t tag = 0;
-    bool use_ncq = false;
-    if (supports_ncq_) {
-        int tag_result = port_.allocate_ncq_tag();
-        if (tag_result < 0) {
-            LTRACEF("failed to allocate NCQ tag, falling back to DMA: %d\n", tag_result);
-            // Fall back to DMA if we can't allocate a tag
-        } else {
-            tag = tag_result;
-            use_ncq = true;
-        }
-    }
-
-    // Select appropriate command based on NCQ support
-    FIS_REG_H2D fis = use_ncq
-                          ? (write ? ata_cmd_write_fpdma_queued(lba, sector_count, tag)
-                                   : ata_cmd_read_fpdma_queued(lba, sector_count, tag))
+    FIS_REG_H2D fis = supports_ncq_
+                          ? (write ? ata_cmd_write_fpdma_queued(lba, sector_count, 0)
+                                   : ata_cmd_read_fpdma_queued(lba, sector_count, 0))
                           : (write ? ata_cmd_write_dma_ext(lba, sector_count)
                                    : ata_cmd_read_dma_ext(lba, sector_count));
 
+    // the callback runs from the port's irq handler. If every slot is busy this returns
+    // ERR_NO_RESOURCES and the bio queue holds on to the request until something completes.
+    const ahci_port::async_completion completion = { callback, bdev, callback_context };
     int slot;
-    auto err = port_.queue_command(&fis, sizeof(fis), buf, buf_len, write, use_ncq, tag, &slot);
-    if (err != NO_ERROR) {
-        if (use_ncq) {
-            port_.release_ncq_tag(tag);
-        }
-        // Invoke callback with error immediately
-        callback(callback_context, bdev, (ssize_t)err);
-        return NO_ERROR;  // Return NO_ERROR since we handled the error via callback
-    }
-
-    // Register async callback with port - will be invoked when command completes
-    port_.register_async_callback(slot, callback, bdev, callback_context, (ssize_t)buf_len);
-
-    // Return NO_ERROR immediately (async operation is queued)
-    return NO_ERROR;
+    return port_.queue_command(&fis, sizeof(fis), iov, iov_cnt, buf_len, write, supports_ncq_, &slot, &completion);
 }
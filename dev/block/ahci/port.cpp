@@ -11,8 +11,10 @@
 #include <lk/bits.h>
 #include <lk/err.h>
 #include <lk/trace.h>
+#include <platform/time.h>
 #include <string.h>
 
+#include "ata.h"
 #include "disk.h"
 
 #define LOCAL_TRACE 0
@@ -21,6 +23,8 @@ ahci_port::ahci_port(ahci &a, uint num) : ahci_(a), index_(num) {
     for (auto &e : cmd_complete_event_) {
         event_init(&e, false, 0);
     }
+    event_init(&recovery_event_, false, EVENT_FLAG_AUTOUNSIGNAL);
+    event_init(&slot_free_event_, true, 0);
 }
 
 ahci_port::~ahci_port() {
@@ -30,6 +34,8 @@ ahci_port::~ahci_port() {
     for (auto &e : cmd_complete_event_) {
         event_destroy(&e);
     }
+    event_destroy(&recovery_event_);
+    event_destroy(&slot_free_event_);
 }
 
 status_t ahci_port::probe(ahci_disk **found_disk) {
@@ -83,7 +89,7 @@ status_t ahci_port::probe(ahci_disk **found_disk) {
     // allocate a block of contiguous memory for
     // up to 32 command list heads (32 * 0x20)
     // a FIS struct (256 bytes)
-    // up to 32 command tables with 16 PRDTs per
+    // up to 32 command tables with PRD_PER_CMD PRDTs per
     command_slots_ = ahci_.num_command_slots_per_port();
     const size_t size = (command_slots_ * sizeof(ahci_cmd_header)) + 256 +
                         (command_slots_ * CMD_TABLE_ENTRY_SIZE);
@@ -128,10 +134,10 @@ status_t ahci_port::probe(ahci_disk **found_disk) {
     for (uint i = 0; i < command_slots_; i++) {
         volatile auto *cmd = &cmd_list_[i];
 
-        // point the cmd header at the corresponding cmd table
-        cmd->ctba = (cmd_table_pa + sizeof(ahci_cmd_table) * i) & 0xffffffff;
+        // point the cmd header at the corresponding cmd table, spaced out the same as cmd_table_ptr()
+        cmd->ctba = (cmd_table_pa + CMD_TABLE_ENTRY_SIZE * i) & 0xffffffff;
 #if __INTPTR_WIDTH__ == 64
-        cmd->ctbau = (cmd_table_pa + sizeof(ahci_cmd_table) * i) >> 32;
+        cmd->ctbau = (cmd_table_pa + CMD_TABLE_ENTRY_SIZE * i) >> 32;
 #else
         cmd->ctbau = 0;
 #endif
@@ -156,6 +162,11 @@ status_t ahci_port::probe(ahci_disk **found_disk) {
                   (1U << 0);  // Device to Host Register FIS (DHRS)
     write_port_reg(ahci_port_reg::PxIE, ie);
 
+    // errors are recovered from outside the irq handler, stopping the engine can take a while
+    snprintf(str, sizeof(str), "ahci%d.%u recovery", ahci_.unit_num(), index_);
+    thread_t *t = thread_create(str, &ahci_port::recovery_thread, this, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    thread_detach_and_resume(t);
+
     // we found a disk above, create an object and pass it back
     auto *disk = new ahci_disk(*this);
     *found_disk = disk;
@@ -166,27 +177,137 @@ status_t ahci_port::probe(ahci_disk **found_disk) {
 status_t ahci_port::find_free_cmdslot(uint *slot_out) {
     DEBUG_ASSERT(spin_lock_held(&lock_));
 
-    uint32_t all_slots = read_port_reg(ahci_port_reg::PxSACT) |
-                         read_port_reg(ahci_port_reg::PxCI);
+    // a slot stays in cmd_pending_ from the time it's queued until it's retired, which
+    // covers everything the hardware still has in PxCI and PxSACT
+    uint32_t all_slots = cmd_pending_;
+
+    // slots past the number the HBA implements are never free
+    if (command_slots_ < 32) {
+        all_slots |= ~((1U << command_slots_) - 1);
+    }
 
     LTRACEF_LEVEL(2, "all_slots %#x\n", all_slots);
 
     if (unlikely(all_slots == 0xffffffff)) {
         // all slots are full
-        return ERR_NOT_FOUND;
+        return ERR_NO_RESOURCES;
     }
 
-    // mask out all the bits for commands that are still pending
-    all_slots |= cmd_pending_;
-
-    uint avail = __builtin_clz(~all_slots);
+    uint avail = __builtin_ctz(~all_slots);
     LTRACEF_LEVEL(2, "avail %u\n", avail);
 
     *slot_out = avail;
     return NO_ERROR;
+}
+
+// Retire the slots in complete, failing the ones also in failed. Async commands are retired
+// right away and their callbacks collected in completed, sync waiters are woken to retire
+// their own slots. Returns the number of waiters woken.
+int ahci_port::complete_commands(uint32_t complete, uint32_t failed, completed_async_cmd *completed, size_t *completed_count) {
+    DEBUG_ASSERT(spin_lock_held(&lock_));
+
+    int woken = 0;
+    while (complete != 0) {
+        const size_t cmd_slot = __builtin_ctz(complete);
+
+        DEBUG_ASSERT(cmd_slot < command_slots_);
+
+        LTRACEF("slot %zu completed\n", cmd_slot);
 
-    // static int next_slot = 0;
-    // return next_slot++ % command_slots_;
+        const ssize_t result = (failed & (1U << cmd_slot)) ? ERR_IO : static_cast<ssize_t>(cmd_len_[cmd_slot]);
+        cmd_results_[cmd_slot] = result;
+
+        if (async_cmds_[cmd_slot].callback) {
+            // Collect async callbacks to invoke later (outside spinlock) and
+            // retire the slot so it can be reused right away
+            completed_async_cmd &c = completed[(*completed_count)++];
+            c.slot = cmd_slot;
+            c.callback = async_cmds_[cmd_slot].callback;
+            c.bdev = async_cmds_[cmd_slot].bdev;
+            c.callback_context = async_cmds_[cmd_slot].callback_context;
+            c.result = result;
+            async_cmds_[cmd_slot].callback = nullptr;
+
+            cmd_pending_ &= ~(1U << cmd_slot);
+            ncq_active_ &= ~(1U << cmd_slot);
+            event_signal(&slot_free_event_, false);
+        } else {
+            // Signal the sync completion event, the waiter retires the slot
+            cmd_done_ |= (1U << cmd_slot);
+            woken += event_signal(&cmd_complete_event_[cmd_slot], false);
+        }
+
+        // move to the next pending slot (if any)
+        complete &= ~(1U << cmd_slot);
+    }
+
+    return woken;
+}
+
+// Stop and restart the command engine after a task file or fatal error, following
+// the recovery sequence in section 6.2.2 of the AHCI spec. Stopping the engine
+// clears PxCI and PxSACT, so every command the device hadn't finished is failed.
+void ahci_port::recover_from_error() {
+    uint32_t cmd_reg;
+    uint32_t done;
+    uint32_t aborted;
+    {
+        AutoSpinLock guard(&lock_);
+
+        DEBUG_ASSERT(recovering_);
+
+        // sort out what the device finished before the error from what it didn't
+        const auto ci = read_port_reg(ahci_port_reg::PxCI);
+        const auto sact = read_port_reg(ahci_port_reg::PxSACT);
+        const auto outstanding = cmd_pending_ & ~cmd_done_;
+        done = ((outstanding & ~ncq_active_) & ~ci) | ((outstanding & ncq_active_) & ~sact);
+        aborted = outstanding & ~done;
+
+        cmd_reg = read_port_reg(ahci_port_reg::PxCMD);
+        write_port_reg(ahci_port_reg::PxCMD, cmd_reg & ~(1U << 0)); // clear CMD.ST (start)
+    }
+
+    // the spec gives CMD.CR 500ms to clear
+    const lk_time_t start = current_time();
+    while (read_port_reg(ahci_port_reg::PxCMD) & (1U << 15)) {
+        if (current_time() - start > 500) {
+            printf("ahci port %u: command engine did not stop\n", index_);
+            break;
+        }
+        thread_sleep(1);
+    }
+
+    LTRACEF("port %u: done slots %#x aborted slots %#x\n", index_, done, aborted);
+
+    completed_async_cmd completed[MAX_CMD_COUNT];
+    size_t completed_count = 0;
+    {
+        AutoSpinLock guard(&lock_);
+
+        // clear the error state and restart
+        write_port_reg(ahci_port_reg::PxSERR, 0xffffffff);
+        write_port_reg(ahci_port_reg::PxIS, 0xffffffff);
+        write_port_reg(ahci_port_reg::PxCMD, cmd_reg | (1U << 0)); // set CMD.ST (start)
+
+        complete_commands(done | aborted, aborted, completed, &completed_count);
+        recovering_ = false;
+        event_signal(&slot_free_event_, false);
+    }
+
+    for (size_t i = 0; i < completed_count; i++) {
+        completed[i].callback(completed[i].callback_context, completed[i].bdev, completed[i].result);
+    }
+}
+
+int ahci_port::recovery_thread(void *arg) {
+    auto *port = static_cast<ahci_port *>(arg);
+
+    for (;;) {
+        event_wait(&port->recovery_event_);
+        port->recover_from_error();
+    }
+
+    return 0;
 }
 
 struct ahci_mem_run {
@@ -196,47 +317,57 @@ struct ahci_mem_run {
 
 namespace {
 
-// convert a virtual buffer into a list of physical runs suitable for programming into AHCI PRDT entries.
+// convert the first len bytes of a list of virtual buffers into a list of physical runs suitable
+// for programming into AHCI PRDT entries.
 // TODO: consider moving into some sort of shared library if needed elsewhere.
-status_t virtual_to_pa_runs(const void *buf, const size_t len,
+status_t virtual_to_pa_runs(const iovec_t *iov, uint iov_cnt, size_t len,
                             struct ahci_mem_run *runs,
                             size_t *run_count) {
     const size_t max_runs = *run_count;
     *run_count = 0;
 
-    const uint8_t *ptr = static_cast<const uint8_t *>(buf);
-
-    LTRACEF("buf %p len %zu\n", buf, len);
+    LTRACEF("iov %p iov_cnt %u len %zu\n", iov, iov_cnt, len);
 
-    size_t remaining = len;
     size_t index = 0;
-    while (remaining > 0) {
-        const paddr_t pa = vaddr_to_paddr((void *)ptr);
-        if (pa == 0) {
-            LTRACEF("virtual_to_pa_runs: could not map va %p to pa\n", ptr);
-            return ERR_INVALID_ARGS;
-        }
-        const size_t run_len = MIN(PAGE_SIZE - (pa & (PAGE_SIZE - 1)), remaining);
-
-        // see if we can merge with the previous run
-        if (index > 0 &&
-            runs[index - 1].address + runs[index - 1].length == pa &&
-            runs[index - 1].length + run_len <= ahci_port::MAX_PRDT_RUN_LENGTH) {
-            runs[index - 1].length += run_len;
-            LTRACEF_LEVEL(2, "  run %zu: addr %#lx len %zu - merged\n", index - 1, runs[index - 1].address, runs[index - 1].length);
-        } else {
-            // set up a new run
-            if (index >= max_runs) {
-                return ERR_NOT_ENOUGH_BUFFER;
+    for (uint i = 0; i < iov_cnt && len > 0; i++) {
+        const uint8_t *ptr = static_cast<const uint8_t *>(iov[i].iov_base);
+        size_t remaining = MIN(iov[i].iov_len, len);
+        len -= remaining;
+
+        while (remaining > 0) {
+            const paddr_t pa = vaddr_to_paddr((void *)ptr);
+            if (pa == 0) {
+                LTRACEF("virtual_to_pa_runs: could not map va %p to pa\n", ptr);
+                return ERR_INVALID_ARGS;
             }
-            runs[index].address = pa;
-            runs[index].length = run_len;
-            LTRACEF_LEVEL(2, "  run %zu: addr %#lx len %zu - new\n", index, runs[index].address, runs[index].length);
-            index++;
-        }
+            const size_t run_len = MIN(PAGE_SIZE - (pa & (PAGE_SIZE - 1)), remaining);
 
-        ptr += run_len;
-        remaining -= run_len;
+            // PRDs have to be word aligned and an even number of bytes long
+            if ((pa | run_len) & 1) {
+                LTRACEF("virtual_to_pa_runs: unaligned run pa %#lx len %zu\n", pa, run_len);
+                return ERR_INVALID_ARGS;
+            }
+
+            // see if we can merge with the previous run
+            if (index > 0 &&
+                runs[index - 1].address + runs[index - 1].length == pa &&
+                runs[index - 1].length + run_len <= ahci_port::MAX_PRDT_RUN_LENGTH) {
+                runs[index - 1].length += run_len;
+                LTRACEF_LEVEL(2, "  run %zu: addr %#lx len %zu - merged\n", index - 1, runs[index - 1].address, runs[index - 1].length);
+            } else {
+                // set up a new run
+                if (index >= max_runs) {
+                    return ERR_NOT_ENOUGH_BUFFER;
+                }
+                runs[index].address = pa;
+                runs[index].length = run_len;
+                LTRACEF_LEVEL(2, "  run %zu: addr %#lx len %zu - new\n", index, runs[index].address, runs[index].length);
+                index++;
+            }
+
+            ptr += run_len;
+            remaining -= run_len;
+        }
     }
     *run_count = index;
 
@@ -247,17 +378,26 @@ status_t virtual_to_pa_runs(const void *buf, const size_t len,
 
 // Queue a command to the AHCI port, finding a slot, setting up the PRDT entries, and kicking the command engine.
 // Returns the slot number used in slot_out.
-status_t ahci_port::queue_command(const void *fis, size_t fis_len, void *buf, size_t buf_len, bool write, bool ncq, uint8_t tag, int *slot_out) {
-    LTRACEF("fis %p len %zu buf %p len %zu write %d ncq %d tag %u\n", fis, fis_len, buf, buf_len, write, ncq, tag);
+status_t ahci_port::queue_command(const void *fis, size_t fis_len, void *buf, size_t buf_len, bool write, bool ncq, int *slot_out) {
+    DEBUG_ASSERT(buf || buf_len == 0);
+
+    const iovec_t iov = { buf, buf_len };
+    return queue_command(fis, fis_len, &iov, 1, buf_len, write, ncq, slot_out);
+}
+
+status_t ahci_port::queue_command(const void *fis, size_t fis_len, const iovec_t *iov, uint iov_cnt, size_t buf_len, bool write, bool ncq,
+                                  int *slot_out, const async_completion *async) {
+    LTRACEF("fis %p len %zu iov %p cnt %u len %zu write %d ncq %d async %p\n", fis, fis_len, iov, iov_cnt, buf_len, write, ncq, async);
 
     DEBUG_ASSERT(fis);
     DEBUG_ASSERT(fis_len > 0 && fis_len <= 64 && IS_ALIGNED(fis_len, 4));
-    DEBUG_ASSERT(buf || buf_len == 0);
+    DEBUG_ASSERT(iov || buf_len == 0);
+    DEBUG_ASSERT(!ncq || fis_len == sizeof(FIS_REG_H2D));
 
     // build a list of physical memory runs
     ahci_mem_run runs[PRD_PER_CMD];
     size_t run_count = countof(runs);
-    status_t err = virtual_to_pa_runs(buf, buf_len, runs, &run_count);
+    status_t err = virtual_to_pa_runs(iov, iov_cnt, buf_len, runs, &run_count);
     if (err != NO_ERROR) {
         return err;
     }
@@ -266,20 +406,27 @@ status_t ahci_port::queue_command(const void *fis, size_t fis_len, void *buf, si
 
     AutoSpinLock guard(&lock_);
 
-    // Allocate a slot
+    // the command engine is stopped until the recovery thread restarts it, and
+    // queued and non queued commands can't be outstanding on the device at the same time
     uint slot;
-    status_t status = find_free_cmdslot(&slot);
-    if (status != NO_ERROR) {
-        return status;
+    if (recovering_ || (ncq ? (cmd_pending_ & ~ncq_active_) != 0 : ncq_active_ != 0) ||
+        find_free_cmdslot(&slot) != NO_ERROR) {
+        // wait_for_free_slot() blocks until the next slot is retired
+        event_unsignal(&slot_free_event_);
+        return ERR_NO_RESOURCES;
     }
 
-    DEBUG_ASSERT((command_slots_ & (1U << slot)) == 0);
-    // TODO: handle the case where we couldn't find a free slot
+    DEBUG_ASSERT(slot < command_slots_);
 
     LTRACEF("slot %u\n", slot);
 
-    // clear interrupt status for this port
-    write_port_reg(ahci_port_reg::PxIS, 0xf);
+    // the NCQ tag is the command slot
+    FIS_REG_H2D tagged_fis;
+    if (ncq) {
+        memcpy(&tagged_fis, fis, sizeof(tagged_fis));
+        ata_fpdma_set_tag(&tagged_fis, slot);
+        fis = &tagged_fis;
+    }
 
     auto *cmd_table = cmd_table_ptr(slot);
 
@@ -319,7 +466,8 @@ status_t ahci_port::queue_command(const void *fis, size_t fis_len, void *buf, si
     // unsignal the command complete event for this slot
     event_unsignal(&cmd_complete_event_[slot]);
 
-    LTRACEF("IS %#x (before kick)\n", read_port_reg(ahci_port_reg::PxIS));
+    async_cmds_[slot] = async ? *async : async_completion{};
+    cmd_len_[slot] = buf_len;
 
     cmd_pending_ |= (1U << slot);
     if (ncq) {
@@ -345,6 +493,10 @@ status_t ahci_port::wait_for_completion(uint slot, uint32_t *error_status) {
 
     AutoSpinLock guard(&lock_);
 
+    if (err == NO_ERROR && cmd_results_[slot] < 0) {
+        err = static_cast<status_t>(cmd_results_[slot]);
+    }
+
     // Return the last error/status register if requested from the
     // Port x Task File Data register.
     if (error_status) {
@@ -354,23 +506,24 @@ status_t ahci_port::wait_for_completion(uint slot, uint32_t *error_status) {
     // mark the command as not pending anymore
     cmd_pending_ &= ~(1u << slot);
     ncq_active_ &= ~(1u << slot);
+    cmd_done_ &= ~(1u << slot);
+    event_signal(&slot_free_event_, false);
 
     return err;
 }
 
+void ahci_port::wait_for_free_slot() {
+    event_wait(&slot_free_event_);
+}
+
 handler_return ahci_port::irq_handler() {
     LTRACE_ENTRY;
 
     // List of completed commands to invoke callbacks for (outside spinlock)
-    struct {
-        size_t slot;
-        bio_async_callback_t callback;
-        bdev_t *bdev;
-        void *callback_context;
-        ssize_t result;
-    } completed_async[MAX_CMD_COUNT];
+    completed_async_cmd completed_async[MAX_CMD_COUNT];
     size_t completed_async_count = 0;
     int sync_waiters_woken = 0;
+    bool start_recovery = false;
 
     {
         AutoSpinLockNoIrqSave guard(&lock_);
@@ -380,65 +533,45 @@ handler_return ahci_port::irq_handler() {
 
         LTRACEF("raw is %#x is %#x\n", raw_is, is);
 
-        if (is & ((1U << 30) | (1U << 29) | (1U << 28) | (1U << 27))) {
-            printf("ahci port %u error: IS %#x\n", index_, is);
-            // TODO: handle error recovery
-        }
-
-        // see if any commands completed
-        const auto ci = read_port_reg(ahci_port_reg::PxCI);
-        const auto sact = read_port_reg(ahci_port_reg::PxSACT);
-
-        // non-NCQ commands are complete when their bit in CI is cleared
-        auto non_ncq_complete = (cmd_pending_ & ~ncq_active_) & ~ci;
-
-        // NCQ commands are complete when their bit in SACT is cleared
-        auto ncq_complete = (cmd_pending_ & ncq_active_) & ~sact;
-
-        auto cmd_complete_bitmap = non_ncq_complete | ncq_complete;
+        // ack before looking at CI/SACT so anything that completes after the reads
+        // below raises a new interrupt instead of being lost
+        write_port_reg(ahci_port_reg::PxIS, is);
 
-        LTRACEF("command complete bitmap %#x\n", cmd_complete_bitmap);
+        // the recovery thread sorts out every outstanding command once the engine is stopped
+        if (recovering_) {
+            return INT_NO_RESCHEDULE;
+        }
 
-        while (cmd_complete_bitmap != 0) {
-            const size_t cmd_slot = __builtin_ctz(cmd_complete_bitmap);
+        if (is & ((1U << 30) | (1U << 29) | (1U << 28) | (1U << 27))) {
+            printf("ahci port %u error: IS %#x TFD %#x SERR %#x\n", index_, is,
+                   read_port_reg(ahci_port_reg::PxTFD), read_port_reg(ahci_port_reg::PxSERR));
+            recovering_ = true;
+            start_recovery = true;
+        } else {
+            // see if any commands completed
+            const auto ci = read_port_reg(ahci_port_reg::PxCI);
+            const auto sact = read_port_reg(ahci_port_reg::PxSACT);
 
-            DEBUG_ASSERT(cmd_slot < command_slots_);
+            // sync commands that completed earlier but haven't been collected by their waiter yet
+            const auto outstanding = cmd_pending_ & ~cmd_done_;
 
-            LTRACEF("slot %zu completed\n", cmd_slot);
+            // non-NCQ commands are complete when their bit in CI is cleared
+            auto non_ncq_complete = (outstanding & ~ncq_active_) & ~ci;
 
-            // Get error status for this command
-            const auto error_status = read_port_reg(ahci_port_reg::PxTFD);
-            LTRACEF("error_status %#x\n", error_status);
+            // NCQ commands are complete when their bit in SACT is cleared
+            auto ncq_complete = (outstanding & ncq_active_) & ~sact;
 
-            // Compute result for async callbacks
-            ssize_t result;
-            if (error_status & (1U << 0)) {  // check ERR bit
-                result = ERR_IO;  // Return error code
-            } else {
-                result = async_cmds_[cmd_slot].bytes_to_read_write;  // Return bytes on success
-            }
-            cmd_results_[cmd_slot] = result;
-
-            // Collect async callbacks to invoke later (outside spinlock)
-            if (async_cmds_[cmd_slot].callback) {
-                completed_async[completed_async_count].slot = cmd_slot;
-                completed_async[completed_async_count].callback = async_cmds_[cmd_slot].callback;
-                completed_async[completed_async_count].bdev = async_cmds_[cmd_slot].bdev;
-                completed_async[completed_async_count].callback_context = async_cmds_[cmd_slot].callback_context;
-                completed_async[completed_async_count].result = result;
-                completed_async_count++;
-                async_cmds_[cmd_slot].callback = nullptr;
-            }
+            auto cmd_complete_bitmap = non_ncq_complete | ncq_complete;
 
-            // Signal the sync completion event
-            sync_waiters_woken += event_signal(&cmd_complete_event_[cmd_slot], false);
+            LTRACEF("command complete bitmap %#x\n", cmd_complete_bitmap);
 
-            // move to the next pending slot (if any)
-            cmd_complete_bitmap &= ~(1U << cmd_slot);
+            sync_waiters_woken = complete_commands(cmd_complete_bitmap, 0, completed_async, &completed_async_count);
         }
+    }
 
-        // ack everything for now
-        write_port_reg(ahci_port_reg::PxIS, is);
+    if (start_recovery) {
+        event_signal(&recovery_event_, false);
+        return INT_RESCHEDULE;
     }
 
     // Invoke async callbacks outside the spinlock to avoid deadlocks
@@ -450,54 +583,3 @@ handler_return ahci_port::irq_handler() {
 
     return (sync_waiters_woken > 0 || completed_async_count > 0) ? INT_RESCHEDULE : INT_NO_RESCHEDULE;
 }
-
-// Allocate an NCQ tag for use by a new queued command.
-// Returns tag number (0-31) on success, or negative error code if no tags available.
-int ahci_port::allocate_ncq_tag() {
-    AutoSpinLock guard(&lock_);
-
-    if (free_ncq_tags_ == 0) {
-        // no free tags available
-        return ERR_BUSY;
-    }
-
-    // find the first set bit (first free tag)
-    int tag = __builtin_ctz(free_ncq_tags_);
-    DEBUG_ASSERT(tag >= 0 && tag < 32);
-
-    // mark this tag as in use
-    free_ncq_tags_ &= ~(1U << tag);
-
-    LTRACEF("allocated tag %d (free_ncq_tags_ now %#x)\n", tag, free_ncq_tags_);
-
-    return tag;
-}
-
-// Release a previously allocated NCQ tag back to the pool.
-void ahci_port::release_ncq_tag(uint8_t tag) {
-    DEBUG_ASSERT(tag < 32);
-
-    AutoSpinLock guard(&lock_);
-
-    DEBUG_ASSERT((free_ncq_tags_ & (1U << tag)) == 0); // tag should be in use
-
-    // mark this tag as free
-    free_ncq_tags_ |= (1U << tag);
-
-    LTRACEF("released tag %u (free_ncq_tags_ now %#x)\n", tag, free_ncq_tags_);
-}
-
-// Register an async completion callback for a command slot.
-void ahci_port::register_async_callback(uint slot, bio_async_callback_t callback, bdev_t *bdev,
-                                        void *callback_context, ssize_t bytes_to_transfer) {
-    DEBUG_ASSERT(slot < command_slots_);
-
-    AutoSpinLock guard(&lock_);
-
-    async_cmds_[slot].callback = callback;
-    async_cmds_[slot].bdev = bdev;
-    async_cmds_[slot].callback_context = callback_context;
-    async_cmds_[slot].bytes_to_read_write = bytes_to_transfer;
-
-    LTRACEF("registered async callback for slot %u, %ld bytes\n", slot, bytes_to_transfer);
-}
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <kernel/event.h>
+#include <iovec.h>
 #include <kernel/spinlock.h>
 #include <lk/cpp.h>
 #include <lib/bio.h>
@@ -29,42 +30,56 @@ class ahci_port final {
 
     status_t probe(ahci_disk **found_disk);
 
-    status_t queue_command(const void *fis, size_t fis_len, void *buf, size_t buf_len, bool write, bool ncq, uint8_t tag, int *slot_out);
-    status_t wait_for_completion(uint slot, uint32_t *error_status);
-
-    // Register async callback for a pending command. Called after queue_command
-    // returns a slot. bytes_to_transfer is the number of bytes to transfer
-    // (returned as result on success).
-    void register_async_callback(uint slot, bio_async_callback_t callback, bdev_t *bdev,
-                                 void *callback_context, ssize_t bytes_to_transfer);
+    // Completion to run from the irq handler instead of waking a waiter in
+    // wait_for_completion(). result is the number of bytes transferred or an error.
+    struct async_completion {
+        bio_async_callback_t callback;
+        bdev_t *bdev;
+        void *callback_context;
+    };
 
-    // Tag allocation for NCQ
-    int allocate_ncq_tag();
-    void release_ncq_tag(uint8_t tag);
+    // Queue a command in a free slot and kick it. NCQ commands are tagged with the
+    // slot number they land in. Returns ERR_NO_RESOURCES if no slot is available or
+    // the command can't be mixed with the ones already in flight.
+    status_t queue_command(const void *fis, size_t fis_len, void *buf, size_t buf_len, bool write, bool ncq, int *slot_out);
+    // As above, transferring the first buf_len bytes of the buffers in iov. If async is
+    // passed the slot is retired by the irq handler and must not be waited on.
+    status_t queue_command(const void *fis, size_t fis_len, const iovec_t *iov, uint iov_cnt, size_t buf_len, bool write, bool ncq,
+                           int *slot_out, const async_completion *async = nullptr);
+    status_t wait_for_completion(uint slot, uint32_t *error_status);
+    // Block until a slot has been retired since queue_command() last returned ERR_NO_RESOURCES.
+    void wait_for_free_slot();
 
     auto index() const { return index_; }
     auto controller_unit() const { return ahci_.unit_num(); }
     bool supports_ncq() const { return (ahci_.get_capabilities() & (1U << 30)) != 0; }
+    uint32_t command_slots() const { return command_slots_; }
 
     // constants
     static const size_t MAX_CMD_COUNT = 32;   // number of active command slots
-    static const size_t PRD_PER_CMD = 16; // physical descriptors per command slot
+    // physical descriptors per command slot, enough for a 128KB transfer gathered
+    // from 64 buffers that each cross a page boundary
+    static const size_t PRD_PER_CMD = 128;
     static const size_t CMD_TABLE_ENTRY_SIZE = sizeof(ahci_cmd_table) + sizeof(ahci_prd) * PRD_PER_CMD;
     static const size_t MAX_PRDT_RUN_LENGTH = 0x400000;  // 4MB AHCI PRDT limit
 
   private:
-    struct async_cmd_info {
-        bio_async_callback_t callback = nullptr;
-        bdev_t *bdev = nullptr;
-        void *callback_context = nullptr;
-        ssize_t bytes_to_read_write = 0;  // bytes to transfer (for result on success)
+    // an async command retired under the spinlock, its callback is run once the lock is dropped
+    struct completed_async_cmd {
+        size_t slot;
+        bio_async_callback_t callback;
+        bdev_t *bdev;
+        void *callback_context;
+        ssize_t result;
     };
 
-  private:
     uint32_t read_port_reg(ahci_port_reg reg);
     void write_port_reg(ahci_port_reg reg, uint32_t val);
 
     status_t find_free_cmdslot(uint *slot_out);
+    int complete_commands(uint32_t complete, uint32_t failed, completed_async_cmd *completed, size_t *completed_count);
+    void recover_from_error();
+    static int recovery_thread(void *arg);
     volatile ahci_cmd_table *cmd_table_ptr(uint cmd_slot);
 
     bool is_command_queued(uint slot) {
@@ -85,15 +100,24 @@ class ahci_port final {
     // pending command bitmap
     uint32_t cmd_pending_ = 0;
     uint32_t ncq_active_ = 0;
-    // bitmap of free NCQ tags (32 tags total)
-    uint32_t free_ncq_tags_ = 0xffffffff;
+    // sync commands that have completed but not yet been collected by wait_for_completion()
+    uint32_t cmd_done_ = 0;
 
     // async command tracking: indexed by command slot
-    async_cmd_info async_cmds_[MAX_CMD_COUNT] = {};
+    async_completion async_cmds_[MAX_CMD_COUNT] = {};
     ssize_t cmd_results_[MAX_CMD_COUNT] = {};  // result (bytes read/written) for each slot
+    size_t cmd_len_[MAX_CMD_COUNT] = {};       // bytes transferred by each slot on success
 
     event cmd_complete_event_[MAX_CMD_COUNT];
 
+    // set by the irq handler when the port reports an error, until the recovery thread has
+    // restarted the command engine. no commands are queued or completed in the meantime.
+    bool recovering_ = false;
+    event recovery_event_;
+
+    // unsignaled when queue_command() runs out of slots, signaled when one is retired
+    event slot_free_event_;
+
     volatile uint8_t *mem_region_ = nullptr;
     paddr_t mem_region_paddr_ = 0;
     volatile ahci_cmd_header *cmd_list_ = nullptr;
@@ -372,8 +372,7 @@ status_t device::allocate_msi(size_t num_requested, uint *msi_base) {
 status_t device::allocate_msix(size_t num_requested, uint *msi_base) {
     LTRACE_ENTRY;
 
-    // for the moment, only deal with 1
-    DEBUG_ASSERT(num_requested == 1);
+    DEBUG_ASSERT(num_requested >= 1);
 
     if (!has_msix()) {
         return ERR_NOT_SUPPORTED;
@@ -478,15 +477,6 @@ status_t device::allocate_msix(size_t num_requested, uint *msi_base) {
 
     LTRACEF("msix table %p, pba table %p\n", msix_table_ptr, msix_pba_ptr);
 
-    // compute the MSI message to construct
-    uint64_t msi_address = 0;
-    uint16_t msi_data = 0;
-    err = platform_compute_msi_values(vector_base, 0, true, &msi_address, &msi_data);
-    if (err != NO_ERROR) {
-        // TODO: return the allocated msi
-        return err;
-    }
-
     // Mask all of the vectors
     for (size_t i = 0; i < table_count; i++) {
         msix_table_ptr[i * 4] = 0;
@@ -495,12 +485,15 @@ status_t device::allocate_msix(size_t num_requested, uint *msi_base) {
         msix_table_ptr[i * 4 + 3] = 1; // masked
     }
 
-    // write the requested vectors
+    // write the requested vectors, all aimed at the boot cpu to start with
+    msix_vector_base = vector_base;
+    msix_vector_count = num_requested;
     for (size_t i = 0; i < num_requested; i++) {
-        msix_table_ptr[i * 4] = msi_address;
-        msix_table_ptr[i * 4 + 1] = msi_address >> 32;
-        msix_table_ptr[i * 4 + 2] = msi_data;
-        msix_table_ptr[i * 4 + 3] = 0; // not masked
+        err = set_msix_target(i, 0);
+        if (err != NO_ERROR) {
+            // TODO: return the allocated msi
+            return err;
+        }
     }
 
     // set up the control register and enable it
@@ -516,6 +509,32 @@ status_t device::allocate_msix(size_t num_requested, uint *msi_base) {
     return NO_ERROR;
 }
 
+status_t device::set_msix_target(size_t index, uint cpu) {
+    LTRACEF("index %zu cpu %u\n", index, cpu);
+
+    if (index >= msix_vector_count) {
+        return ERR_INVALID_ARGS;
+    }
+
+    // compute the MSI message to construct
+    uint64_t msi_address = 0;
+    uint16_t msi_data = 0;
+    status_t err = platform_compute_msi_values(msix_vector_base + index, cpu, true, &msi_address, &msi_data);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    // mask the entry while it's rewritten so the device never sees half of it
+    volatile uint32_t *entry = msix_table_ptr + index * 4;
+    entry[3] = 1;
+    entry[0] = msi_address;
+    entry[1] = msi_address >> 32;
+    entry[2] = msi_data;
+    entry[3] = 0; // not masked
+
+    return NO_ERROR;
+}
+
 status_t device::load_bars() {
     size_t num_bars;
 
@@ -35,6 +35,7 @@ public:
     status_t allocate_irq(uint *irq);
     status_t allocate_msi(size_t num_requested, uint *msi_base);
     status_t allocate_msix(size_t num_requested, uint *msi_base);
+    status_t set_msix_target(size_t index, uint cpu);
     status_t load_config();
     status_t load_bars();
 
@@ -128,6 +129,8 @@ private:
     void *msix_pba_map = nullptr;
     volatile uint32_t *msix_table_ptr = nullptr;
     volatile uint32_t *msix_pba_ptr = nullptr;
+    uint msix_vector_base = {};
+    size_t msix_vector_count = {};
 };
 
 struct capability {
@@ -101,6 +101,9 @@ status_t pci_bus_mgr_allocate_msi(pci_location_t loc, size_t num_requested, uint
 // try to allocate one or more msi-x vectors for this device
 status_t pci_bus_mgr_allocate_msix(const pci_location_t loc, size_t num_requested, uint *irqbase);
 
+// steer msi-x vector index (counting from the irqbase handed out above) at a particular cpu
+status_t pci_bus_mgr_set_msix_target(pci_location_t loc, size_t index, uint cpu);
+
 // allocate a regular irq for this device and return it in irqbase
 status_t pci_bus_mgr_allocate_irq(pci_location_t loc, uint *irqbase);
 
@@ -205,6 +205,17 @@ handler_return e1000::irq_handler() {
                         pkt->dlen = rxd.length;
                         pkt->flags |= PKTBUF_FLAG_EOF; // just to make sure
 
+                        // pass along the checksums the nic verified, errors would have been flagged above
+                        pkt->flags &= ~(PKTBUF_FLAG_CKSUM_IP_GOOD | PKTBUF_FLAG_CKSUM_TCP_GOOD | PKTBUF_FLAG_CKSUM_UDP_GOOD);
+                        if ((rxd.status & (1<<2)) == 0) { // IXSM - ignore checksum indication
+                            if (rxd.status & (1<<6)) { // IPCS - ip checksum calculated
+                                pkt->flags |= PKTBUF_FLAG_CKSUM_IP_GOOD;
+                            }
+                            if (rxd.status & (1<<5)) { // TCPCS - tcp/udp checksum calculated
+                                pkt->flags |= PKTBUF_FLAG_CKSUM_TCP_GOOD | PKTBUF_FLAG_CKSUM_UDP_GOOD;
+                            }
+                        }
+
                         // queue it in the rx queue
                         list_add_tail(&rx_queue_, &pkt->list);
 
@@ -267,27 +278,72 @@ int e1000::rx_worker_routine() {
 
 int e1000::tx(pktbuf_t *p) {
     LTRACE;
+
+    // the ring only takes single part packets for now
+    status_t err = pktbuf_linearize(p);
+    if (err < 0) {
+        pktbuf_free_chain(p, true);
+        return err;
+    }
+
     if (LOCAL_TRACE) {
         pktbuf_dump(p);
     }
 
-    // build a tx descriptor and stuff it in the tx ring
-    tdesc td = {};
-    td.addr = pktbuf_data_phys(p);
-    td.length = p->dlen;
-    td.cmd = (1<<0); // end of packet (EOP)
-    copy(&txring_[tx_tail_], &td);
+    // packets the nic is done with, freed once the lock is dropped
+    list_node done = LIST_INITIAL_VALUE(done);
 
-    // save a copy of the pktbuf in our list
-    tx_pktbuf_[tx_tail_] = p;
+    {
+        AutoSpinLock guard(&lock_);
 
-    // bump tail forward
-    tx_tail_ = (tx_tail_ + 1) % txring_len;
-    write_reg(e1000_reg::TDT, tx_tail_);
+        // reclaim the packets the nic has moved past
+        auto tdh = read_reg(e1000_reg::TDH);
+        while (tx_last_head_ != tdh) {
+            if (tx_pktbuf_[tx_last_head_]) {
+                list_add_tail(&done, &tx_pktbuf_[tx_last_head_]->list);
+                tx_pktbuf_[tx_last_head_] = nullptr;
+            }
+            tx_last_head_ = (tx_last_head_ + 1) % txring_len;
+        }
 
-    LTRACEF("TDH %#x TDT %#x\n", read_reg(e1000_reg::TDH), read_reg(e1000_reg::TDT));
+        // a full ring would look empty, always leave a slot open
+        if ((tx_tail_ + 1) % txring_len == tx_last_head_) {
+            err = ERR_NO_MEMORY;
+        } else {
+            // build a tx descriptor and stuff it in the tx ring
+            tdesc td = {};
+            td.addr = pktbuf_data_phys(p);
+            td.length = p->dlen;
+            td.cmd = (1<<0); // end of packet (EOP)
+            if (p->flags & PKTBUF_FLAG_CSUM_PARTIAL) {
+                // sum from css to the end of the packet and store it at cso
+                DEBUG_ASSERT(p->csum_start + p->csum_offset <= 0xff);
+                td.css = p->csum_start;
+                td.cso = p->csum_start + p->csum_offset;
+                td.cmd |= (1<<2); // insert checksum (IC)
+            }
+            copy(&txring_[tx_tail_], &td);
 
-    return NO_ERROR;
+            // save a copy of the pktbuf in our list
+            tx_pktbuf_[tx_tail_] = p;
+
+            // bump tail forward
+            tx_tail_ = (tx_tail_ + 1) % txring_len;
+            write_reg(e1000_reg::TDT, tx_tail_);
+
+            LTRACEF("TDH %#x TDT %#x\n", read_reg(e1000_reg::TDH), read_reg(e1000_reg::TDT));
+        }
+    }
+
+    pktbuf_t *done_p;
+    while ((done_p = list_remove_head_type(&done, pktbuf_t, list)) != nullptr) {
+        pktbuf_free(done_p, true);
+    }
+    if (err < 0) {
+        pktbuf_free(p, true);
+    }
+
+    return err;
 }
 
 void e1000::add_pktbuf_to_rxring_locked(pktbuf_t *p) {
@@ -459,6 +515,9 @@ status_t e1000::init_device(pci_location_t loc, const e1000_id_features *id) {
     // disable small packet detect
     write_reg(e1000_reg::RSRPD, 0);
 
+    // check ip and tcp/udp checksums on the way in
+    write_reg(e1000_reg::RXCSUM, (1<<9) | (1<<8)); // TUOFL, IPOFL
+
     // set up the flow control thresholds
     write_reg(e1000_reg::FCRTL, 0);
     write_reg(e1000_reg::FCRTH, 0);
@@ -529,6 +588,9 @@ status_t e1000_register_with_minip() {
 
     if (the_e) {
         minip_set_eth(tx_routine, the_e, the_e->mac_addr());
+
+        // legacy descriptors can fill in a checksum, but segmentation takes context descriptors
+        minip_set_eth_caps(MINIP_ETH_CAP_TX_CSUM_TCP | MINIP_ETH_CAP_TX_CSUM_UDP, 0);
         return NO_ERROR;
     }
 
@@ -196,7 +196,7 @@ static void virtio_9p_req_send(struct virtio_9p_dev *p9dev,
     dev->virtio_submit_chain(VIRTIO_9P_RING_IDX, idx);
 
     /* kick it off */
-    dev->bus()->virtio_kick(VIRTIO_9P_RING_IDX);
+    dev->virtio_kick(VIRTIO_9P_RING_IDX);
 
     spin_unlock_irqrestore(&p9dev->lock, state);
 }
@@ -5,6 +5,7 @@
  * license that can be found in the LICENSE file or at
  * https://opensource.org/licenses/MIT
  */
+#include <arch/ops.h>
 #include <assert.h>
 #include <dev/virtio/block.h>
 #include <endian.h>
@@ -12,6 +13,7 @@
 #include <kernel/event.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
+#include <iovec.h>
 #include <lib/bio.h>
 #include <lib/partition.h>
 #include <lk/compiler.h>
@@ -46,7 +48,8 @@ struct virtio_blk_config {
         uint32_t opt_io_size;
     } topology;
     uint8_t writeback;
-    uint8_t unused[3];
+    uint8_t unused0;
+    uint16_t num_queues;
     uint32_t max_discard_sectors;
     uint32_t max_discard_seq;
     uint32_t discard_sector_alignment;
@@ -96,6 +99,9 @@ struct virtio_block_txn {
     /* virtio request structure, must be DMA-able */
     struct virtio_blk_req req;
 
+    /* the one segment of a discard or write zeroes request, must be DMA-able */
+    struct virtio_blk_discard_write_zeroes range;
+
     /* response status, must be DMA-able */
     uint8_t status;
 };
@@ -138,6 +144,7 @@ constexpr uint32_t VIRTIO_BLK_S_IOERR = 1;
 constexpr uint32_t VIRTIO_BLK_S_UNSUPP = 2;
 
 constexpr uint16_t VIRTIO_BLK_RING_LEN = 256;
+constexpr uint32_t VIRTIO_BLK_SECTOR_SIZE = 512;
 
 enum handler_return virtio_block_irq_driver_callback(virtio_device *dev, uint ring, const vring_used_elem *e);
 ssize_t virtio_bdev_read_block(bdev *bdev, void *buf, bnum_t block, uint count);
@@ -148,6 +155,21 @@ status_t virtio_bdev_read_async(
 status_t virtio_bdev_write_async(
     bdev *bdev, const void *buf, off_t offset, size_t len,
     void (*callback)(void *, struct bdev *, ssize_t), void *cookie);
+status_t virtio_bdev_readv_async(
+    bdev *bdev, const iovec_t *iov, uint iov_cnt, off_t offset, size_t len,
+    void (*callback)(void *, struct bdev *, ssize_t), void *cookie);
+status_t virtio_bdev_writev_async(
+    bdev *bdev, const iovec_t *iov, uint iov_cnt, off_t offset, size_t len,
+    void (*callback)(void *, struct bdev *, ssize_t), void *cookie);
+ssize_t virtio_bdev_erase(bdev *bdev, off_t offset, size_t len);
+int virtio_bdev_ioctl(bdev *bdev, int request, void *argp);
+
+/* a request ring, and the transactions of the descriptor chains on it */
+struct virtio_block_queue {
+    /* protects the ring's descriptors, which are freed from the irq handler */
+    spin_lock_t lock;
+    virtio_block_txn *txns;
+};
 
 struct virtio_block_dev {
     virtio_device *dev;
@@ -158,7 +180,15 @@ struct virtio_block_dev {
     /* our negotiated guest features */
     uint32_t guest_features;
     bool readonly;
-    virtio_block_txn *txns;
+
+    /* largest discard and write zeroes requests the device takes, in sectors */
+    uint32_t max_discard_sectors;
+    uint32_t max_write_zeroes_sectors;
+    bool write_zeroes_may_unmap;
+
+    /* with VIRTIO_BLK_F_MQ one queue per cpu, up to what the device offers */
+    uint16_t num_queues;
+    virtio_block_queue queues[virtio_device::MAX_VIRTIO_RINGS];
 };
 
 
@@ -253,7 +283,13 @@ status_t virtio_block_init(virtio_device *dev) {
                              VIRTIO_BLK_F_BLK_SIZE |
                              VIRTIO_BLK_F_GEOMETRY |
                              VIRTIO_BLK_F_TOPOLOGY |
-                             VIRTIO_BLK_F_CONFIG_WCE);
+                             VIRTIO_BLK_F_CONFIG_WCE |
+                             VIRTIO_BLK_F_MQ |
+                             VIRTIO_BLK_F_DISCARD |
+                             VIRTIO_BLK_F_WRITE_ZEROES);
+    if (bdev->readonly) {
+        bdev->guest_features &= ~(VIRTIO_BLK_F_DISCARD | VIRTIO_BLK_F_WRITE_ZEROES);
+    }
     dev->bus()->virtio_set_guest_features(0, bdev->guest_features);
 
     // If supported, prefer writeback mode for better throughput.
@@ -261,15 +297,50 @@ status_t virtio_block_init(virtio_device *dev) {
         dev->config_write8(offsetof(virtio_blk_config, writeback), 1);
     }
 
-    /* allocate a virtio ring */
-    dev->virtio_alloc_ring(0, VIRTIO_BLK_RING_LEN);
+    // A queue per cpu if the device will take that many, so submitters on
+    // different cpus don't fight over one ring and its lock.
+    uint16_t num_queues = 1;
+    if (bdev->guest_features & VIRTIO_BLK_F_MQ) {
+        num_queues = dev->config_read16(offsetof(virtio_blk_config, num_queues));
+        num_queues = MIN(num_queues, MIN(SMP_MAX_CPUS, virtio_device::MAX_VIRTIO_RINGS));
+        num_queues = MAX(num_queues, 1);
+    }
+
+    /* allocate the virtio rings */
+    bdev->num_queues = 0;
+    for (uint16_t q = 0; q < num_queues; q++) {
+        virtio_block_queue *queue = &bdev->queues[q];
+        spin_lock_init(&queue->lock);
+
+        // descriptor index would be used to index into the txns array
+        // This is a simple way to keep track of which transaction entry is
+        // free, and which transaction entry corresponds to which descriptor.
+        // Hence, we allocate txns array with the same size as the ring.
+        // It goes first so a ring is only handed to the device once the
+        // queue is sure to be used.
+        queue->txns = static_cast<struct virtio_block_txn *>(memalign(alignof(struct virtio_block_txn),
+                                                                      VIRTIO_BLK_RING_LEN * sizeof(struct virtio_block_txn)));
+        if (!queue->txns) {
+            break;
+        }
 
-    // descriptor index would be used to index into the txns array
-    // This is a simple way to keep track of which transaction entry is
-    // free, and which transaction entry corresponds to which descriptor.
-    // Hence, we allocate txns array with the same size as the ring.
-    bdev->txns = static_cast<struct virtio_block_txn *>(memalign(alignof(struct virtio_block_txn),
-                                                                 VIRTIO_BLK_RING_LEN * sizeof(struct virtio_block_txn)));
+        status_t err = dev->virtio_alloc_ring(q, VIRTIO_BLK_RING_LEN);
+        if (err < 0) {
+            free(queue->txns);
+            queue->txns = nullptr;
+            break;
+        }
+
+        // Complete requests on the cpu that submits them, where the bus can
+        // steer the ring's interrupt. Anywhere else is still correct, just slower.
+        err = dev->bus()->virtio_set_ring_cpu(q, q);
+        LTRACEF("queue %u steered to cpu %u: %d\n", q, q, err);
+
+        bdev->num_queues++;
+    }
+    if (bdev->num_queues == 0) {
+        return ERR_NO_MEMORY;
+    }
 
     /* set our irq handler */
     dev->set_irq_callbacks(&virtio_block_irq_driver_callback, nullptr);
@@ -302,6 +373,22 @@ status_t virtio_block_init(virtio_device *dev) {
     bdev->bdev.write_block = &virtio_bdev_write_block;
     bdev->bdev.read_async = &virtio_bdev_read_async;
     bdev->bdev.write_async = &virtio_bdev_write_async;
+    bdev->bdev.readv_async = &virtio_bdev_readv_async;
+    bdev->bdev.writev_async = &virtio_bdev_writev_async;
+
+    /* every request takes at least three descriptors, more if the buffer is scattered */
+    bdev->bdev.queue_depth = bdev->num_queues * (VIRTIO_BLK_RING_LEN / 3);
+
+    /* discard through ioctl, erase by having the device write zeroes */
+    if (bdev->guest_features & VIRTIO_BLK_F_DISCARD) {
+        bdev->max_discard_sectors = dev->config_read32(offsetof(virtio_blk_config, max_discard_sectors));
+        bdev->bdev.ioctl = &virtio_bdev_ioctl;
+    }
+    if (bdev->guest_features & VIRTIO_BLK_F_WRITE_ZEROES) {
+        bdev->max_write_zeroes_sectors = dev->config_read32(offsetof(virtio_blk_config, max_write_zeroes_sectors));
+        bdev->write_zeroes_may_unmap = dev->config_read8(offsetof(virtio_blk_config, write_zeros_may_unmap)) != 0;
+        bdev->bdev.erase = &virtio_bdev_erase;
+    }
 
     bio_register_device(&bdev->bdev);
 
@@ -318,6 +405,10 @@ status_t virtio_block_init(virtio_device *dev) {
                dev->config_read8(offsetof(virtio_blk_config, writeback)) ? "enabled" : "disabled");
     }
     printf("\tsize_max %u seg_max %u\n", size_max, seg_max);
+    if (host_features & VIRTIO_BLK_F_MQ) {
+        printf("\tnum_queues %u, using %u\n",
+               dev->config_read16(offsetof(virtio_blk_config, num_queues)), bdev->num_queues);
+    }
     if (host_features & VIRTIO_BLK_F_GEOMETRY) {
         printf("\tgeometry: cyl %u head %u sector %u\n",
                dev->config_read16(offsetof(virtio_blk_config, geometry.cylinders)),
@@ -354,68 +445,140 @@ namespace {
 
 enum handler_return virtio_block_irq_driver_callback(virtio_device *dev, uint ring, const struct vring_used_elem *e) {
     auto *bdev = (virtio_block_dev *)dev->priv();
+    DEBUG_ASSERT(ring < bdev->num_queues);
+    virtio_block_queue *queue = &bdev->queues[ring];
 
-    struct virtio_block_txn *txn = &bdev->txns[e->id];
+    struct virtio_block_txn *txn = &queue->txns[e->id];
     LTRACEF("dev %p, ring %u, e %p, id %u, len %u, status %d\n", dev, ring, e, e->id, e->len, txn->status);
 
-    /* parse our descriptor chain, add back to the free queue */
-    uint16_t i = e->id;
-    for (;;) {
-        int next;
-        vring_desc *desc = dev->virtio_desc_index_to_desc(ring, i);
-
-        // virtio_dump_desc(desc);
-
-        const bool modern = dev->config_is_modern();
-        if (vring_desc_read_flags(desc, modern) & VRING_DESC_F_NEXT) {
-            next = vring_desc_read_next(desc, modern);
-        } else {
-            /* end of chain */
-            next = -1;
-        }
+    /* the txn may be reused as soon as its descriptors are freed, take what we need first */
+    const auto callback = txn->callback;
+    void *cookie = txn->cookie;
+    const ssize_t result = (txn->status == VIRTIO_BLK_S_OK) ? (ssize_t)txn->len : ERR_IO;
 
-        dev->virtio_free_desc(ring, i);
-
-        if (next < 0) {
-            break;
+    /* parse our descriptor chain, add back to the free queue */
+    {
+        AutoSpinLockNoIrqSave guard(&queue->lock);
+
+        uint16_t i = e->id;
+        for (;;) {
+            int next;
+            vring_desc *desc = dev->virtio_desc_index_to_desc(ring, i);
+
+            // virtio_dump_desc(desc);
+
+            const bool modern = dev->config_is_modern();
+            if (vring_desc_read_flags(desc, modern) & VRING_DESC_F_NEXT) {
+                next = vring_desc_read_next(desc, modern);
+            } else {
+                /* end of chain */
+                next = -1;
+            }
+
+            dev->virtio_free_desc(ring, i);
+
+            if (next < 0) {
+                break;
+            }
+            i = next;
         }
-        i = next;
     }
 
-    if (txn->callback) {
+    if (callback) {
         // async
-        ssize_t result =
-            (txn->status == VIRTIO_BLK_S_OK) ? (ssize_t)txn->len : ERR_IO;
-        LTRACEF("calling callback %p with cookie %p, len %ld\n", txn->callback,
-                txn->cookie, result);
-        txn->callback(txn->cookie, &bdev->bdev, result);
+        LTRACEF("calling callback %p with cookie %p, len %ld\n", callback, cookie, result);
+        callback(cookie, &bdev->bdev, result);
     }
 
     return INT_RESCHEDULE;
 }
 
-status_t virtio_block_do_txn(virtio_device *dev, void *buf,
-                             off_t offset, size_t len, bool write,
-                             bio_async_callback_t callback, void *cookie,
-                             virtio_block_txn **txn_out) {
+/*
+ * Call func(pa, len) for each physically contiguous run in the first len bytes of
+ * the buffers in iov, joining up runs that carry straight on from one another even
+ * across buffers.
+ */
+template <typename Func>
+void for_each_phys_run(const iovec_t *iov, uint iov_cnt, size_t len, Func func) {
+    paddr_t run_pa = 0;
+    size_t run_len = 0;
+
+    for (uint i = 0; i < iov_cnt && len > 0; i++) {
+        const uint8_t *va = static_cast<const uint8_t *>(iov[i].iov_base);
+        size_t remaining = MIN(iov[i].iov_len, len);
+        len -= remaining;
+
+        while (remaining > 0) {
+#if WITH_KERNEL_VM
+            /* translate a page at a time */
+            const paddr_t pa = vaddr_to_paddr((void *)va);
+            const size_t chunk = MIN(PAGE_SIZE - (pa & (PAGE_SIZE - 1)), remaining);
+#else
+            /* non VM world simply uses the buffer as is */
+            const paddr_t pa = (paddr_t)(uintptr_t)va;
+            const size_t chunk = remaining;
+#endif
+            if (run_len > 0 && run_pa + run_len == pa) {
+                run_len += chunk;
+            } else {
+                if (run_len > 0) {
+                    func(run_pa, run_len);
+                }
+                run_pa = pa;
+                run_len = chunk;
+            }
+            va += chunk;
+            remaining -= chunk;
+        }
+    }
+
+    if (run_len > 0) {
+        func(run_pa, run_len);
+    }
+}
+
+/*
+ * Queue a request of the given type on the calling cpu's queue. Reads and writes
+ * transfer len bytes at offset to or from the buffers in iov. Discard and write
+ * zeroes requests carry range instead, and no data.
+ */
+status_t virtio_block_do_txn(virtio_device *dev, uint32_t type, const iovec_t *iov, uint iov_cnt,
+                             off_t offset, size_t len, const virtio_blk_discard_write_zeroes *range,
+                             bio_async_callback_t callback, void *cookie) {
     auto *bdev = (virtio_block_dev *)dev->priv();
 
-    uint16_t i;
-    vring_desc *desc;
+    LTRACEF("dev %p, type %u, iov %p, iov_cnt %u, offset 0x%llx, len %zu\n", dev, type, iov, iov_cnt, offset, len);
+
+    /* the device only ever reads the payload of anything but a read */
+    const bool to_device = (type != VIRTIO_BLK_T_IN);
+
+    /* a descriptor for each physically contiguous run of the buffers, or the range,
+     * between the request header and the response */
+    size_t run_count = 0;
+    if (range) {
+        run_count = 1;
+    } else {
+        for_each_phys_run(iov, iov_cnt, len, [&](paddr_t, size_t) { run_count++; });
+    }
+
+    /* the cpu may change under us, that only costs a bit of locality */
+    const uint16_t q = arch_curr_cpu_num() % bdev->num_queues;
+    virtio_block_queue *queue = &bdev->queues[q];
 
-    LTRACEF("dev %p, buf %p, offset 0x%llx, len %zu\n", dev, buf, offset, len);
+    AutoSpinLock guard(&queue->lock);
 
     /* put together a transfer */
-    desc = dev->virtio_alloc_desc_chain(0, 3, &i);
-    LTRACEF("after alloc chain desc %p, i %u\n", desc, i);
+    uint16_t i;
+    vring_desc *desc = dev->virtio_alloc_desc_chain(q, run_count + 2, &i);
+    LTRACEF("after alloc chain queue %u desc %p, i %u, runs %zu\n", q, desc, i, run_count);
     if (!desc) {
         return ERR_NO_RESOURCES;
     }
-    struct virtio_block_txn *txn = &bdev->txns[i];
+    struct virtio_block_txn *txn = &queue->txns[i];
     /* set up the request */
-    txn->req.type = dev->ring_swap32(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN);
+    txn->req.type = dev->ring_swap32(type);
     txn->req.ioprio = dev->ring_swap32(0);
-    txn->req.sector = dev->ring_swap64((uint64_t)offset / 512);
+    txn->req.sector = dev->ring_swap64(range ? 0 : (uint64_t)offset / VIRTIO_BLK_SECTOR_SIZE);
 
     txn->callback = callback;
     txn->cookie = cookie;
@@ -425,10 +588,6 @@ status_t virtio_block_do_txn(virtio_device *dev, void *buf,
 
     const bool modern = dev->config_is_modern();
 
-    if (txn_out) {
-        *txn_out = txn;
-    }
-
     // XXX not cache safe.
     // At the moment only tested on arm qemu, which doesn't emulate cache.
 
@@ -442,66 +601,28 @@ status_t virtio_block_do_txn(virtio_device *dev, void *buf,
     vring_desc_write_len(desc, sizeof(virtio_blk_req), modern);
     vring_desc_write_flags(desc, VRING_DESC_F_NEXT, modern);
 
-    /* set up the descriptor pointing to the buffer */
-    desc = dev->virtio_desc_index_to_desc(0, vring_desc_read_next(desc, modern));
+    const auto add_run = [&](paddr_t pa, size_t run_len) {
+        desc = dev->virtio_desc_index_to_desc(q, vring_desc_read_next(desc, modern));
+        LTRACEF("buffer run pa 0x%lx len %zu\n", pa, run_len);
+        vring_desc_write_addr(desc, (uint64_t)pa, modern);
+        vring_desc_write_len(desc, run_len, modern);
+        vring_desc_write_flags(desc, (to_device ? 0 : VRING_DESC_F_WRITE) | VRING_DESC_F_NEXT, modern);
+    };
+
+    if (range) {
+        /* the range lives in the txn so it stays put until the device is done with it */
+        txn->range.sector = dev->ring_swap64(range->sector);
+        txn->range.num_sectors = dev->ring_swap32(range->num_sectors);
+        txn->range.flags = range->flags;
 #if WITH_KERNEL_VM
-    /* translate the first buffer */
-    vaddr_t va = (vaddr_t)buf;
-    paddr_t pa = vaddr_to_paddr((void *)va);
-    vring_desc_write_addr(desc, (uint64_t)pa, modern);
-    /* desc->len is filled in below */
+        add_run(vaddr_to_paddr(&txn->range), sizeof(txn->range));
 #else
-    /* non VM world simply queues a single buffer that transfers the whole thing */
-    vring_desc_write_addr(desc, (uint64_t)(uintptr_t)buf, modern);
-    vring_desc_write_len(desc, len, modern);
+        add_run((paddr_t)(uintptr_t)&txn->range, sizeof(txn->range));
 #endif
-    vring_desc_write_flags(desc, (write ? 0 : VRING_DESC_F_WRITE) | VRING_DESC_F_NEXT, modern);
-
-#if WITH_KERNEL_VM
-    /* see if we need to add more descriptors due to scatter gather */
-    paddr_t next_pa = PAGE_ALIGN(pa + 1);
-    vring_desc_write_len(desc, MIN(next_pa - pa, len), modern);
-    LTRACEF("first descriptor va 0x%lx desc->addr 0x%llx desc->len %u\n", va,
-            vring_desc_read_addr(desc, modern), vring_desc_read_len(desc, modern));
-
-    size_t remaining_len = len;
-    remaining_len -= vring_desc_read_len(desc, modern);
-    while (remaining_len > 0) {
-        /* amount of source buffer handled by this iteration of the loop */
-        size_t len_tohandle = MIN(remaining_len, PAGE_SIZE);
-
-        /* translate the next page in the buffer */
-        va = PAGE_ALIGN(va + 1);
-        pa = vaddr_to_paddr((void *)va);
-        LTRACEF("va now 0x%lx, pa 0x%lx, next_pa 0x%lx, remaining len %zu\n", va, pa, next_pa, remaining_len);
-
-        /* is the new translated physical address contiguous to the last one? */
-        if (next_pa == pa) {
-            /* we can simply extend the previous descriptor by another page */
-            LTRACEF("extending last one by %zu bytes\n", len_tohandle);
-            vring_desc_write_len(desc, vring_desc_read_len(desc, modern) + len_tohandle, modern);
-        } else {
-            /* new physical page needed, allocate a new descriptor and start again */
-            uint16_t next_i = dev->virtio_alloc_desc(0);
-            vring_desc *next_desc = dev->virtio_desc_index_to_desc(0, next_i);
-            DEBUG_ASSERT(next_desc);
-
-            LTRACEF("doesn't extend, need new desc, allocated desc %i (%p)\n", next_i, next_desc);
-
-            /* fill this descriptor in and put it after the last one but before the response descriptor */
-            vring_desc_write_addr(next_desc, (uint64_t)pa, modern);
-            vring_desc_write_len(next_desc, len_tohandle, modern);
-            vring_desc_write_flags(next_desc,
-                                   (write ? 0 : VRING_DESC_F_WRITE) | VRING_DESC_F_NEXT, modern);
-            vring_desc_write_next(next_desc, vring_desc_read_next(desc, modern), modern);
-            vring_desc_write_next(desc, next_i, modern);
-
-            desc = next_desc;
-        }
-        remaining_len -= len_tohandle;
-        next_pa += PAGE_SIZE;
+    } else {
+        /* then one descriptor per run of the buffers, straight from the caller's memory */
+        for_each_phys_run(iov, iov_cnt, len, add_run);
     }
-#endif
 
     /* set up the descriptor pointing to the response */
 #if WITH_KERNEL_VM
@@ -509,48 +630,141 @@ status_t virtio_block_do_txn(virtio_device *dev, void *buf,
 #else
     paddr_t status_phys = (uint64_t)(uintptr_t)&txn->status;
 #endif
-    desc = dev->virtio_desc_index_to_desc(0, vring_desc_read_next(desc, modern));
+    desc = dev->virtio_desc_index_to_desc(q, vring_desc_read_next(desc, modern));
     vring_desc_write_addr(desc, status_phys, modern);
     vring_desc_write_len(desc, 1, modern);
     vring_desc_write_flags(desc, VRING_DESC_F_WRITE, modern);
 
     /* submit the transfer */
-    dev->virtio_submit_chain(0, i);
+    dev->virtio_submit_chain(q, i);
 
     /* kick it off */
-    dev->bus()->virtio_kick(0);
+    dev->virtio_kick(q);
 
     return NO_ERROR;
 }
 
+struct sync_completion {
+    event_t event;
+    ssize_t result;
+};
+
 // TODO: handle partial block transfers
-void sync_completion_cb(void *cookie, struct bdev *dev, ssize_t bytes) {
+void sync_completion_cb(void *cookie, struct bdev *dev, ssize_t result) {
     DEBUG_ASSERT(cookie);
-    event_t *event = (event_t *)cookie;
-    event_signal(event, false);
+    auto *completion = (sync_completion *)cookie;
+    completion->result = result;
+    event_signal(&completion->event, false);
 }
 
-ssize_t virtio_block_read_write(virtio_device *dev, void *buf,
-                                const off_t offset, const size_t len,
-                                const bool write) {
-    struct virtio_block_txn *txn;
-    event_t event;
-    event_init(&event, false, EVENT_FLAG_AUTOUNSIGNAL);
+/* queue a request with submit(callback, cookie) and wait for it to finish */
+template <typename Func>
+ssize_t virtio_block_sync(Func submit) {
+    sync_completion completion;
+    event_init(&completion.event, false, EVENT_FLAG_AUTOUNSIGNAL);
 
-    status_t err = virtio_block_do_txn(dev, buf, offset, len, write,
-                                       &sync_completion_cb, &event, &txn);
+    status_t err = submit(&sync_completion_cb, &completion);
     if (err < 0) {
+        event_destroy(&completion.event);
         return err;
     }
 
     /* wait for the transfer to complete */
-    event_wait(&event);
+    event_wait(&completion.event);
+    event_destroy(&completion.event);
 
-    LTRACEF("status 0x%hhx\n", txn->status);
+    LTRACEF("result %ld\n", completion.result);
 
-    ssize_t result = (txn->status == VIRTIO_BLK_S_OK) ? (ssize_t)len : ERR_IO;
+    return completion.result;
+}
 
-    return result;
+ssize_t virtio_block_read_write(virtio_device *dev, void *buf,
+                                const off_t offset, const size_t len,
+                                const bool write) {
+    const iovec_t iov = { buf, len };
+    return virtio_block_sync([&](bio_async_callback_t callback, void *cookie) {
+        return virtio_block_do_txn(dev, write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN, &iov, 1,
+                                   offset, len, nullptr, callback, cookie);
+    });
+}
+
+/*
+ * Discard or zero len bytes at offset, in pieces of at most max_sectors, one
+ * request at a time. Returns the bytes done or an error.
+ */
+ssize_t virtio_block_range_op(virtio_block_dev *dev, uint32_t type, off_t offset, size_t len,
+                              uint32_t max_sectors, bool unmap) {
+    len = bio_trim_range(&dev->bdev, offset, len);
+    if (len == 0) {
+        return 0;
+    }
+
+    /* no partial blocks, the device works in whole ones */
+    if ((offset % dev->bdev.block_size) != 0 || (len % dev->bdev.block_size) != 0) {
+        return ERR_INVALID_ARGS;
+    }
+    if (max_sectors == 0) {
+        max_sectors = UINT32_MAX;
+    }
+    /* keep each piece a whole number of blocks */
+    const uint32_t sectors_per_block = dev->bdev.block_size / VIRTIO_BLK_SECTOR_SIZE;
+    max_sectors = ROUNDDOWN(max_sectors, sectors_per_block);
+    if (max_sectors == 0) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    uint64_t sector = (uint64_t)offset / VIRTIO_BLK_SECTOR_SIZE;
+    uint64_t sectors = len / VIRTIO_BLK_SECTOR_SIZE;
+    while (sectors > 0) {
+        virtio_blk_discard_write_zeroes range = {};
+        range.sector = sector;
+        range.num_sectors = (uint32_t)MIN(sectors, (uint64_t)max_sectors);
+        range.flags.unmap = unmap;
+
+        const size_t bytes = (size_t)range.num_sectors * VIRTIO_BLK_SECTOR_SIZE;
+        ssize_t err = virtio_block_sync([&](bio_async_callback_t callback, void *cookie) {
+            return virtio_block_do_txn(dev->dev, type, nullptr, 0, (off_t)sector * VIRTIO_BLK_SECTOR_SIZE,
+                                       bytes, &range, callback, cookie);
+        });
+        if (err < 0) {
+            return err;
+        }
+
+        sector += range.num_sectors;
+        sectors -= range.num_sectors;
+    }
+
+    return len;
+}
+
+ssize_t virtio_bdev_erase(bdev *bdev, off_t offset, size_t len) {
+    virtio_block_dev *dev = containerof(bdev, struct virtio_block_dev, bdev);
+
+    LTRACEF("dev %p, offset 0x%llx, len %zu\n", bdev, offset, len);
+
+    /* reads come back as zeroes either way, so let the device unmap if it can */
+    return virtio_block_range_op(dev, VIRTIO_BLK_T_WRITE_ZEROES, offset, len,
+                                 dev->max_write_zeroes_sectors, dev->write_zeroes_may_unmap);
+}
+
+int virtio_bdev_ioctl(bdev *bdev, int request, void *argp) {
+    virtio_block_dev *dev = containerof(bdev, struct virtio_block_dev, bdev);
+
+    LTRACEF("dev %p, request %d, argp %p\n", bdev, request, argp);
+
+    switch (request) {
+        case BIO_IOCTL_DISCARD: {
+            const auto *range = static_cast<const bio_ioctl_range_t *>(argp);
+            if (!range) {
+                return ERR_INVALID_ARGS;
+            }
+            ssize_t err = virtio_block_range_op(dev, VIRTIO_BLK_T_DISCARD, range->offset, range->len,
+                                                dev->max_discard_sectors, false);
+            return (err < 0) ? (int)err : NO_ERROR;
+        }
+        default:
+            return ERR_NOT_SUPPORTED;
+    }
 }
 
 ssize_t virtio_bdev_read_block(bdev *bdev, void *buf, bnum_t block, uint count) {
@@ -570,8 +784,8 @@ status_t virtio_bdev_read_async(bdev *bdev, void *buf,
     struct virtio_block_dev *dev =
         containerof(bdev, struct virtio_block_dev, bdev);
 
-    return virtio_block_do_txn(dev->dev, buf, offset, len, false, callback,
-                               cookie, NULL);
+    const iovec_t iov = { buf, len };
+    return virtio_block_do_txn(dev->dev, VIRTIO_BLK_T_IN, &iov, 1, offset, len, nullptr, callback, cookie);
 }
 
 status_t virtio_bdev_write_async(bdev *bdev, const void *buf,
@@ -585,8 +799,32 @@ status_t virtio_bdev_write_async(bdev *bdev, const void *buf,
         return ERR_NOT_SUPPORTED;
     }
 
-    return virtio_block_do_txn(dev->dev, (void *)buf, offset, len, true,
-                               callback, cookie, NULL);
+    const iovec_t iov = { (void *)buf, len };
+    return virtio_block_do_txn(dev->dev, VIRTIO_BLK_T_OUT, &iov, 1, offset, len, nullptr, callback, cookie);
+}
+
+status_t virtio_bdev_readv_async(bdev *bdev, const iovec_t *iov, uint iov_cnt,
+                                 off_t offset, size_t len,
+                                 bio_async_callback_t callback,
+                                 void *cookie) {
+    struct virtio_block_dev *dev =
+        containerof(bdev, struct virtio_block_dev, bdev);
+
+    return virtio_block_do_txn(dev->dev, VIRTIO_BLK_T_IN, iov, iov_cnt, offset, len, nullptr, callback, cookie);
+}
+
+status_t virtio_bdev_writev_async(bdev *bdev, const iovec_t *iov, uint iov_cnt,
+                                  off_t offset, size_t len,
+                                  bio_async_callback_t callback,
+                                  void *cookie) {
+    struct virtio_block_dev *dev =
+        containerof(bdev, struct virtio_block_dev, bdev);
+
+    if (dev->readonly) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    return virtio_block_do_txn(dev->dev, VIRTIO_BLK_T_OUT, iov, iov_cnt, offset, len, nullptr, callback, cookie);
 }
 
 ssize_t virtio_bdev_write_block(bdev *bdev, const void *buf, bnum_t block, uint count) {
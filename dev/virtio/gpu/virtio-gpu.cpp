@@ -106,7 +106,7 @@ status_t send_command_response(virtio_gpu_dev *gdev, const void *cmd, size_t cmd
     gdev->dev->virtio_submit_chain(0, i);
 
     /* kick it off */
-    gdev->dev->bus()->virtio_kick(0);
+    gdev->dev->virtio_kick(0);
 
     /* wait for result */
     event_wait(&gdev->io_event);
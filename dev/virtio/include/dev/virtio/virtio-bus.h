@@ -8,6 +8,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <lk/err.h>
 #include <platform/interrupts.h>
 
 class virtio_bus {
@@ -23,6 +24,10 @@ public:
     virtual void virtio_kick(uint16_t ring_index) = 0;
     virtual void register_ring(uint32_t page_size, uint32_t queue_sel, uint32_t queue_num, uint32_t queue_align, uint32_t queue_pfn) = 0;
 
+    // Register a packed ring (VIRTIO_F_RING_PACKED) with its descriptors and
+    // the driver and device event suppression areas. Modern devices only.
+    virtual void register_packed_ring(uint32_t queue_sel, uint32_t queue_num, uint64_t desc_pa, uint64_t driver_pa, uint64_t device_pa) = 0;
+
     // Return if the device is legacy or modern.
     // For virtio-mmio this corresponds to V1 and V2, respectively.
     // For virtio-pci this corresponds to transitional and modern, respectively.
@@ -32,18 +37,36 @@ public:
         return virtio_read_host_feature_word(word) | static_cast<uint64_t>(virtio_read_host_feature_word(word + 1)) << 32;
     }
 
-    // A simple set of routines to handle a single IRQ.
-    // TODO: rethink where this goes in a more complicated MSI based solution.
+    // The feature word last passed to virtio_set_guest_features, for the device
+    // layer to add the ring features it wants to whatever the driver asked for.
+    uint32_t virtio_guest_feature_word(uint32_t word) const {
+        return (word < 2) ? guest_features_[word] : 0;
+    }
+
+    // Aim the interrupt for a ring at a particular cpu. Only possible on busses
+    // that give rings their own vectors, the rest leave it where it is.
+    virtual status_t virtio_set_ring_cpu(uint16_t ring_index, uint cpu) { return ERR_NOT_SUPPORTED; }
+
+    // A simple set of routines to handle a single IRQ. Busses with more than one
+    // vector per device extend them to cover the rest.
     void set_irq(uint32_t irq) { irq_ = irq; }
 
-    void mask_interrupt() {
+    virtual void mask_interrupt() {
         ::mask_interrupt(irq_);
     }
 
-    void unmask_interrupt() {
+    virtual void unmask_interrupt() {
         ::unmask_interrupt(irq_);
     }
 
+protected:
+    void save_guest_features(uint32_t word, uint32_t features) {
+        if (word < 2) {
+            guest_features_[word] = features;
+        }
+    }
+
 private:
     uint32_t irq_ {};
+    uint32_t guest_features_[2] {};
 };
\ No newline at end of file
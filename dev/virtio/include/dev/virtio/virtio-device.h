@@ -45,6 +45,20 @@ public:
     /* submit a chain to the avail list */
     void virtio_submit_chain(uint ring_index, uint16_t desc_index);
 
+    /* submit several chains, making them visible to the device all at once */
+    void virtio_submit_chains(uint ring_index, const uint16_t *desc_indexes, size_t count);
+
+    /* notify the device of chains submitted since the last kick, unless it has
+     * said it doesn't need to hear about them */
+    void virtio_kick(uint ring_index);
+
+    // Chains are always built in the split descriptor table returned by
+    // virtio_desc_index_to_desc. With a packed ring that table is ours alone, and
+    // submitting copies the chains into the ring, using the head index as the
+    // buffer id handed back in the used element.
+    bool ring_is_packed() const { return packed_; }
+    bool ring_has_event_idx() const { return event_idx_; }
+
     // accessors
     void *priv() { return priv_; }
     const void *priv() const { return priv_; }
@@ -137,12 +151,15 @@ public:
     }
 
     // Interrupt handler callbacks from the bus layer, which is responsible
-    // for the first layer of IRQ handling
+    // for the first layer of IRQ handling. handle_queue_interrupt looks at every
+    // active ring, handle_ring_interrupt at just the one, for busses that give
+    // each ring its own vector.
     handler_return handle_queue_interrupt();
+    handler_return handle_ring_interrupt(uint ring_index);
     handler_return handle_config_interrupt();
 
     // TODO: allow an aribitrary number of rings
-    static const size_t MAX_VIRTIO_RINGS = 4;
+    static const size_t MAX_VIRTIO_RINGS = 16;
 
 private:
     // mmio or pci
@@ -160,10 +177,23 @@ private:
     irq_driver_callback irq_driver_callback_ = {};
     config_change_callback config_change_callback_ = {};
 
+    // settle VIRTIO_F_EVENT_IDX and VIRTIO_F_RING_PACKED before the first ring goes in
+    void negotiate_ring_features();
+    void submit_packed_chains(uint ring_index, const uint16_t *desc_indexes, size_t count);
+    handler_return handle_packed_ring_interrupt(uint ring_index);
+
+    bool ring_features_negotiated_ = {};
+    bool event_idx_ = {};
+    bool packed_ = {};
+
     /* virtio rings */
     uint32_t active_rings_bitmap_ = {};
     uint16_t ring_len_[MAX_VIRTIO_RINGS] = {};
     vring ring_[MAX_VIRTIO_RINGS] = {};
+    vring_packed packed_ring_[MAX_VIRTIO_RINGS] = {};
+
+    /* avail entries (split) or descriptors (packed) added since the last kick */
+    uint16_t added_since_kick_[MAX_VIRTIO_RINGS] = {};
 };
 
 
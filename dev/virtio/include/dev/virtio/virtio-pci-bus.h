@@ -11,11 +11,11 @@
 #include <sys/types.h>
 
 #include <dev/virtio/virtio-bus.h>
+#include <dev/virtio/virtio-device.h>
 
 #include <dev/bus/pci.h>
 
 struct virtio_pci_common_cfg;
-class virtio_device;
 
 class virtio_pci_bus final : public virtio_bus {
 public:
@@ -31,6 +31,10 @@ public:
     void virtio_status_driver_ok() override;
     void virtio_kick(uint16_t ring_index) override;
     void register_ring(uint32_t page_size, uint32_t queue_sel, uint32_t queue_num, uint32_t queue_align, uint32_t queue_pfn) override;
+    void register_packed_ring(uint32_t queue_sel, uint32_t queue_num, uint64_t desc_pa, uint64_t driver_pa, uint64_t device_pa) override;
+    status_t virtio_set_ring_cpu(uint16_t ring_index, uint cpu) override;
+    void mask_interrupt() override;
+    void unmask_interrupt() override;
 
     bool virtio_is_legacy() const override { return legacy_; }
 
@@ -44,6 +48,9 @@ public:
 
 private:
     static handler_return virtio_pci_irq(void *arg);
+    static handler_return virtio_pci_ring_irq(void *arg);
+
+    void set_ring_vector(uint32_t queue_sel);
 
     struct config_pointer {
         bool valid;
@@ -72,6 +79,20 @@ private:
 
     uint32_t notify_offset_multiplier_ = {};
 
+    // With MSI-X the first vector takes config changes, and if there were enough
+    // to go round ring n gets vector irq_base_ + 1 + n. Otherwise the first one
+    // takes everything. A ring the device wouldn't give its vector to shares the
+    // first one, and has its bit set in shared_rings_.
+    struct ring_irq {
+        virtio_pci_bus *bus;
+        uint16_t index;
+    };
+    bool msix_ = {};
+    uint irq_base_ = {};
+    uint16_t ring_vectors_ = {};
+    uint32_t shared_rings_ = {};
+    ring_irq ring_irqs_[virtio_device::MAX_VIRTIO_RINGS] = {};
+
     // Given one of the config_pointer structs, return a uint8_t * pointer
     // to its mapping.
     uint8_t *config_ptr(const config_pointer &cfg) {
@@ -308,6 +308,114 @@ static inline int vring_need_event(uint16_t event_idx, uint16_t new_idx, uint16_
     return (uint16_t)(new_idx - event_idx - 1) < (uint16_t)(new_idx - old);
 }
 
+/*
+ * Packed virtqueue layout (VIRTIO_F_RING_PACKED), only available to modern devices
+ * so everything in it is little endian. Descriptors are handed over in ring order,
+ * and the avail and used bits in their flags say whose turn it is, compared against
+ * a wrap counter each side flips every time it goes around the ring.
+ */
+#define VRING_PACKED_DESC_F_AVAIL   (1 << 7)
+#define VRING_PACKED_DESC_F_USED    (1 << 15)
+
+/* Event suppression flags, and the wrap counter bit in off_wrap */
+#define VRING_PACKED_EVENT_FLAG_ENABLE  0x0
+#define VRING_PACKED_EVENT_FLAG_DISABLE 0x1
+#define VRING_PACKED_EVENT_FLAG_DESC    0x2
+#define VRING_PACKED_EVENT_F_WRAP_CTR   15
+
+struct vring_packed_desc {
+    uint64_t addr;
+    uint32_t len;
+    /* Buffer id, returned in the used descriptor */
+    uint16_t id;
+    uint16_t flags;
+};
+
+struct vring_packed_desc_event {
+    /* Descriptor ring offset and wrap counter to notify at */
+    uint16_t off_wrap;
+    uint16_t flags;
+};
+
+static inline uint16_t vring_packed_desc_read_flags(const struct vring_packed_desc *desc) {
+    return LE16(vring_mem_read16((volatile uint16_t *)&desc->flags));
+}
+
+static inline uint16_t vring_packed_desc_read_id(const struct vring_packed_desc *desc) {
+    return LE16(vring_mem_read16((volatile uint16_t *)&desc->id));
+}
+
+static inline uint32_t vring_packed_desc_read_len(const struct vring_packed_desc *desc) {
+    return LE32(vring_mem_read32((volatile uint32_t *)&desc->len));
+}
+
+static inline void vring_packed_desc_write(struct vring_packed_desc *desc, uint64_t addr, uint32_t len, uint16_t id) {
+    vring_mem_write64(&desc->addr, addr, true);
+    vring_mem_write32(&desc->len, LE32(len));
+    vring_mem_write16(&desc->id, LE16(id));
+}
+
+static inline void vring_packed_desc_write_flags(struct vring_packed_desc *desc, uint16_t flags) {
+    vring_mem_write16(&desc->flags, LE16(flags));
+}
+
+static inline uint16_t vring_packed_event_read_off_wrap(const struct vring_packed_desc_event *event) {
+    return LE16(vring_mem_read16((volatile uint16_t *)&event->off_wrap));
+}
+
+static inline uint16_t vring_packed_event_read_flags(const struct vring_packed_desc_event *event) {
+    return LE16(vring_mem_read16((volatile uint16_t *)&event->flags));
+}
+
+static inline void vring_packed_event_write_off_wrap(struct vring_packed_desc_event *event, uint16_t off_wrap) {
+    vring_mem_write16(&event->off_wrap, LE16(off_wrap));
+}
+
+static inline void vring_packed_event_write_flags(struct vring_packed_desc_event *event, uint16_t flags) {
+    vring_mem_write16(&event->flags, LE16(flags));
+}
+
+struct vring_packed {
+    struct vring_packed_desc *desc;
+
+    /* driver area: written by us to say when we want interrupts */
+    struct vring_packed_desc_event *driver;
+
+    /* device area: written by the device to say when it wants kicks */
+    struct vring_packed_desc_event *device;
+
+    uint16_t next_avail;
+    uint16_t next_used;
+    bool avail_wrap;
+    bool used_wrap;
+
+    /* how many ring slots the chain with each buffer id took up */
+    uint16_t *chain_len;
+};
+
+/* The descriptors, then the driver and device event suppression areas */
+static inline unsigned vring_packed_size(unsigned int num) {
+    return sizeof(struct vring_packed_desc) * num + sizeof(struct vring_packed_desc_event) * 2;
+}
+
+static inline void vring_packed_init(struct vring_packed *vr, unsigned int num, void *p) {
+    vr->desc = (struct vring_packed_desc *)p;
+    vr->driver = (struct vring_packed_desc_event *)&vr->desc[num];
+    vr->device = vr->driver + 1;
+    vr->next_avail = 0;
+    vr->next_used = 0;
+    vr->avail_wrap = true;
+    vr->used_wrap = true;
+}
+
+/* has the device handed back the descriptor at next_used yet */
+static inline bool vring_packed_is_used(const struct vring_packed *vr) {
+    uint16_t flags = vring_packed_desc_read_flags(&vr->desc[vr->next_used]);
+    bool avail = (flags & VRING_PACKED_DESC_F_AVAIL) != 0;
+    bool used = (flags & VRING_PACKED_DESC_F_USED) != 0;
+    return avail == used && used == vr->used_wrap;
+}
+
 void virtio_dump_desc(const struct vring_desc *desc);
 
 #endif /* _UAPI_LINUX_VIRTIO_RING_H */
@@ -16,6 +16,7 @@ __BEGIN_CDECLS
 struct virtio_device;
 
 status_t virtio_net_init(struct virtio_device *dev) __NONNULL();
+/* start receiving, and tell minip which offloads the device agreed to */
 status_t virtio_net_start(void);
 
 /* return the count of virtio interfaces found */
@@ -104,7 +104,7 @@ STATIC_ASSERT(sizeof(struct virtio_net_hdr) == 12);
 #define VIRTIO_NET_S_LINK_UP                (1<<0)
 #define VIRTIO_NET_S_ANNOUNCE               (1<<1)
 
-#define TX_RING_SIZE 16
+#define TX_RING_SIZE 128
 #define RX_RING_SIZE 16
 
 #define RING_RX 0
@@ -112,10 +112,15 @@ STATIC_ASSERT(sizeof(struct virtio_net_hdr) == 12);
 
 #define VIRTIO_NET_MSS 1514
 
+/* most tcp payload to take in one TSO packet, bounded so a few fit in the tx ring at once */
+#define VIRTIO_NET_TSO_MAX_SIZE (32 * 1024)
+
 struct virtio_net_dev {
     virtio_device *dev;
     bool started;
 
+    /* our negotiated guest features */
+    uint32_t guest_features;
 
     spin_lock_t lock;
     event_t rx_event;
@@ -199,10 +204,20 @@ status_t virtio_net_init(virtio_device *dev) {
     dprintf(INFO, "virtio-net: modern %u, expecting %s-endian config\n",
             modern, modern ? "little" : "native");
 
-    // XXX check features bits and ack/nak them
     uint64_t host_features = dev->bus()->virtio_read_host_feature_word_64(0);
     dump_feature_bits(host_features);
 
+    /* keep the features we know how to use. the host only splits up segments it
+     * fills in the checksums of */
+    ndev->guest_features = host_features & (VIRTIO_NET_F_MAC |
+                                            VIRTIO_NET_F_CSUM |
+                                            VIRTIO_NET_F_GUEST_CSUM |
+                                            VIRTIO_NET_F_HOST_TSO4);
+    if (!(ndev->guest_features & VIRTIO_NET_F_CSUM)) {
+        ndev->guest_features &= ~VIRTIO_NET_F_HOST_TSO4;
+    }
+    dev->bus()->virtio_set_guest_features(0, ndev->guest_features);
+
     /* set our irq handler */
     dev->set_irq_callbacks(&virtio_net_irq_driver_callback, nullptr);
     dev->bus()->unmask_interrupt();
@@ -236,7 +251,17 @@ status_t virtio_net_start(void) {
         }
     }
     /* kick all at once */
-    the_ndev->dev->bus()->virtio_kick(RING_RX);
+    the_ndev->dev->virtio_kick(RING_RX);
+
+    /* let minip hand us the work the host agreed to do */
+    uint32_t caps = 0;
+    if (the_ndev->guest_features & VIRTIO_NET_F_CSUM) {
+        caps |= MINIP_ETH_CAP_TX_CSUM_TCP | MINIP_ETH_CAP_TX_CSUM_UDP;
+    }
+    if (the_ndev->guest_features & VIRTIO_NET_F_HOST_TSO4) {
+        caps |= MINIP_ETH_CAP_TSO4;
+    }
+    minip_set_eth_caps(caps, VIRTIO_NET_TSO_MAX_SIZE);
 
     return NO_ERROR;
 }
@@ -251,6 +276,19 @@ status_t virtio_net_queue_tx_pktbuf(virtio_net_dev *ndev, pktbuf_t *p2) {
 
     DEBUG_ASSERT(ndev);
 
+    /* one descriptor for the header and one for each part of the packet */
+    uint16_t desc_count = 1;
+    for (pktbuf_t *part = p2; part; part = part->next) {
+        desc_count++;
+    }
+    if (desc_count > TX_RING_SIZE) {
+        /* too many parts to ever fit in the ring, gather them ourselves */
+        status_t err = pktbuf_linearize(p2);
+        if (err < 0)
+            return err;
+        desc_count = 2;
+    }
+
     p = pktbuf_alloc();
     if (!p)
         return ERR_NO_MEMORY;
@@ -259,14 +297,31 @@ status_t virtio_net_queue_tx_pktbuf(virtio_net_dev *ndev, pktbuf_t *p2) {
     virtio_net_hdr *hdr = (virtio_net_hdr *)pktbuf_append(p, sizeof(virtio_net_hdr) - 2);
     memset(hdr, 0, p->dlen);
 
+    const bool modern = vdev->config_is_modern();
+    if (p2->flags & PKTBUF_FLAG_CSUM_PARTIAL) {
+        /* have the host sum from csum_start to the end of the packet */
+        hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        hdr->csum_start = modern ? LE16(p2->csum_start) : p2->csum_start;
+        hdr->csum_offset = modern ? LE16(p2->csum_offset) : p2->csum_offset;
+    }
+    if (p2->flags & PKTBUF_FLAG_TSO) {
+        /* the headers to repeat in each segment run through the end of the tcp header,
+         * which starts where the checksum does */
+        DEBUG_ASSERT(p2->flags & PKTBUF_FLAG_CSUM_PARTIAL);
+        uint16_t hdr_len = p2->csum_start + (p2->data[p2->csum_start + 12] >> 4) * 4;
+        hdr->gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+        hdr->gso_size = modern ? LE16(p2->gso_size) : p2->gso_size;
+        hdr->hdr_len = modern ? LE16(hdr_len) : hdr_len;
+    }
+
     arch_interrupt_saved_state_t state = spin_lock_irqsave(&ndev->lock);
 
     vring_desc *desc = {};
 
     /* only queue if we have enough tx descriptors */
-    if (ndev->tx_pending_count + 2 <= TX_RING_SIZE) {
+    if (ndev->tx_pending_count + desc_count <= TX_RING_SIZE) {
         /* allocate a chain of descriptors for our transfer */
-        desc = vdev->virtio_alloc_desc_chain(RING_TX, 2, &i);
+        desc = vdev->virtio_alloc_desc_chain(RING_TX, desc_count, &i);
     }
     if (!desc) {
         spin_unlock_irqrestore(&ndev->lock, state);
@@ -277,33 +332,37 @@ status_t virtio_net_queue_tx_pktbuf(virtio_net_dev *ndev, pktbuf_t *p2) {
         return ERR_NO_MEMORY;
     }
 
-    ndev->tx_pending_count += 2;
+    ndev->tx_pending_count += desc_count;
 
-    const bool modern = vdev->config_is_modern();
-    /* save a pointer to our pktbufs for the irq handler to free */
-    LTRACEF("saving pointer to pkt in index %u and %u\n", i, vring_desc_read_next(desc, modern));
+    /* save a pointer to our pktbufs for the irq handler to free, one per descriptor */
+    LTRACEF("saving pointer to pkt in index %u\n", i);
     DEBUG_ASSERT(ndev->pending_tx_packet[i] == NULL);
-    DEBUG_ASSERT(ndev->pending_tx_packet[vring_desc_read_next(desc, modern)] == NULL);
     ndev->pending_tx_packet[i] = p;
-    ndev->pending_tx_packet[vring_desc_read_next(desc, modern)] = p2;
-
 
     /* set up the descriptor pointing to the header */
     vring_desc_write_addr(desc, pktbuf_data_phys(p), modern);
     vring_desc_write_len(desc, p->dlen, modern);
     vring_desc_write_flags(desc, vring_desc_read_flags(desc, modern) | VRING_DESC_F_NEXT, modern);
 
-    /* set up the descriptor pointing to the buffer */
-    desc = vdev->virtio_desc_index_to_desc(RING_TX, vring_desc_read_next(desc, modern));
-    vring_desc_write_addr(desc, pktbuf_data_phys(p2), modern);
-    vring_desc_write_len(desc, p2->dlen, modern);
-    vring_desc_write_flags(desc, 0, modern);
+    /* set up a descriptor pointing to each part of the packet */
+    for (pktbuf_t *part = p2; part; part = part->next) {
+        uint16_t index = vring_desc_read_next(desc, modern);
+        desc = vdev->virtio_desc_index_to_desc(RING_TX, index);
+
+        LTRACEF("saving pointer to pkt part in index %u\n", index);
+        DEBUG_ASSERT(ndev->pending_tx_packet[index] == NULL);
+        ndev->pending_tx_packet[index] = part;
+
+        vring_desc_write_addr(desc, pktbuf_data_phys(part), modern);
+        vring_desc_write_len(desc, part->dlen, modern);
+        vring_desc_write_flags(desc, part->next ? VRING_DESC_F_NEXT : 0, modern);
+    }
 
     /* submit the transfer */
     vdev->virtio_submit_chain(RING_TX, i);
 
     /* kick it off */
-    vdev->bus()->virtio_kick(RING_TX);
+    vdev->virtio_kick(RING_TX);
 
     spin_unlock_irqrestore(&ndev->lock, state);
 
@@ -368,7 +427,7 @@ status_t virtio_net_queue_rx(virtio_net_dev *ndev, pktbuf_t *p, bool do_kick) {
 
     /* kick it off */
     if (do_kick) {
-        vdev->bus()->virtio_kick(RING_RX);
+        vdev->virtio_kick(RING_RX);
     }
 
     spin_unlock_irqrestore(&ndev->lock, state);
@@ -465,6 +524,13 @@ int virtio_net_rx_worker(void *arg) {
             /* process our packet */
             virtio_net_hdr *hdr = (virtio_net_hdr *)pktbuf_consume(p, sizeof(virtio_net_hdr) - 2);
             if (hdr) {
+                /* the host vouches for the tcp/udp checksum of packets it has checked, or
+                 * of ones that never left the host and were never summed */
+                p->flags &= ~(PKTBUF_FLAG_CKSUM_TCP_GOOD | PKTBUF_FLAG_CKSUM_UDP_GOOD);
+                if (hdr->flags & (VIRTIO_NET_HDR_F_DATA_VALID | VIRTIO_NET_HDR_F_NEEDS_CSUM)) {
+                    p->flags |= PKTBUF_FLAG_CKSUM_TCP_GOOD | PKTBUF_FLAG_CKSUM_UDP_GOOD;
+                }
+
                 /* call up into the stack */
                 minip_rx_driver_callback(p);
             }
@@ -498,17 +564,11 @@ status_t virtio_net_send_minip_pkt(void *arg, pktbuf_t *p) {
 
     DEBUG_ASSERT(p && p->dlen);
 
-    if ((p->flags & PKTBUF_FLAG_EOF) == 0) {
-        /* can't handle multi part packets yet */
-        PANIC_UNIMPLEMENTED;
-
-        return ERR_NOT_IMPLEMENTED;
-    }
-
-    /* hand the pktbuf off to the nic, it owns the pktbuf from now on out unless it fails */
+    /* hand the pktbuf off to the nic, it owns the pktbuf from now on out unless it fails.
+     * multi part packets are gathered straight out of each part */
     status_t err = virtio_net_queue_tx_pktbuf(the_ndev, p);
     if (err < 0) {
-        pktbuf_free(p, true);
+        pktbuf_free_chain(p, true);
     }
 
     return err;
@@ -112,7 +112,7 @@ ssize_t virtio_rng_read(void *buf, size_t len) {
     event_unsignal(&rng.irq_wait);
 
     rng.dev->virtio_submit_chain(RNG_QUEUE_INDEX, desc_idx);
-    rng.dev->bus()->virtio_kick(RNG_QUEUE_INDEX);
+    rng.dev->virtio_kick(RNG_QUEUE_INDEX);
 
     event_wait(&rng.irq_wait);
 
@@ -98,29 +98,160 @@ vring_desc *virtio_device::virtio_alloc_desc_chain(uint ring_index, size_t count
 }
 
 void virtio_device::virtio_submit_chain(uint ring_index, uint16_t desc_index) {
-    LTRACEF("dev %p, ring %u, desc %u\n", this, ring_index, desc_index);
+    virtio_submit_chains(ring_index, &desc_index, 1);
+}
+
+void virtio_device::virtio_submit_chains(uint ring_index, const uint16_t *desc_indexes, size_t count) {
+    LTRACEF("dev %p, ring %u, count %zu\n", this, ring_index, count);
 
     DEBUG_ASSERT(ring_index < MAX_VIRTIO_RINGS);
-    DEBUG_ASSERT(desc_index < ring_len_[ring_index]);
+
+    if (count == 0)
+        return;
+
+    if (packed_) {
+        submit_packed_chains(ring_index, desc_indexes, count);
+        return;
+    }
 
     vring &ring = ring_[ring_index];
 
-    /* add the chain to the available list */
+    /* add the chains to the available list */
     vring_avail *avail = ring.avail;
     const bool modern = config_is_modern();
 
     uint16_t avail_idx = vring_avail_read_idx(avail, modern);
 
-    vring_avail_write_ring(avail, avail_idx & ring.num_mask, desc_index, modern);
+    for (size_t i = 0; i < count; i++) {
+        DEBUG_ASSERT(desc_indexes[i] < ring_len_[ring_index]);
+        vring_avail_write_ring(avail, (avail_idx + i) & ring.num_mask, desc_indexes[i], modern);
+    }
     // Ensure descriptor and avail ring entry writes are visible before idx update.
     wmb();
-    vring_avail_write_idx(avail, avail_idx + 1, modern);
+    vring_avail_write_idx(avail, avail_idx + count, modern);
+    added_since_kick_[ring_index] += count;
 
 #if LOCAL_TRACE
     hexdump(avail, 16);
 #endif
 }
 
+void virtio_device::submit_packed_chains(uint ring_index, const uint16_t *desc_indexes, size_t count) {
+    vring &ring = ring_[ring_index];
+    vring_packed &packed = packed_ring_[ring_index];
+
+    /* the first head is written last, which hands the whole batch to the device at once */
+    vring_packed_desc *first_head = &packed.desc[packed.next_avail];
+    uint16_t first_head_flags = 0;
+
+    for (size_t c = 0; c < count; c++) {
+        const uint16_t id = desc_indexes[c];
+        DEBUG_ASSERT(id < ring_len_[ring_index]);
+
+        /* copy the chain out of the descriptor table into consecutive ring slots */
+        uint16_t len = 0;
+        uint16_t i = id;
+        for (;;) {
+            const vring_desc *desc = &ring.desc[i];
+            const uint16_t flags = vring_desc_read_flags(desc, true);
+
+            uint16_t packed_flags = flags & (VRING_DESC_F_NEXT | VRING_DESC_F_WRITE);
+            packed_flags |= packed.avail_wrap ? VRING_PACKED_DESC_F_AVAIL : VRING_PACKED_DESC_F_USED;
+
+            vring_packed_desc *pdesc = &packed.desc[packed.next_avail];
+            vring_packed_desc_write(pdesc, vring_desc_read_addr(desc, true), vring_desc_read_len(desc, true), id);
+            if (pdesc == first_head) {
+                first_head_flags = packed_flags;
+            } else {
+                vring_packed_desc_write_flags(pdesc, packed_flags);
+            }
+
+            len++;
+            if (++packed.next_avail == ring.num) {
+                packed.next_avail = 0;
+                packed.avail_wrap = !packed.avail_wrap;
+            }
+
+            if ((flags & VRING_DESC_F_NEXT) == 0)
+                break;
+            i = vring_desc_read_next(desc, true);
+        }
+
+        packed.chain_len[id] = len;
+        added_since_kick_[ring_index] += len;
+    }
+
+    // Ensure the rest of the batch is visible before the first head flips over.
+    wmb();
+    vring_packed_desc_write_flags(first_head, first_head_flags);
+}
+
+void virtio_device::virtio_kick(uint ring_index) {
+    DEBUG_ASSERT(ring_index < MAX_VIRTIO_RINGS);
+
+    vring &ring = ring_[ring_index];
+    const uint16_t added = added_since_kick_[ring_index];
+    added_since_kick_[ring_index] = 0;
+
+    // Make our index update visible before looking at what the device asked for.
+    mb();
+
+    bool kick;
+    if (packed_) {
+        vring_packed &packed = packed_ring_[ring_index];
+        const uint16_t flags = vring_packed_event_read_flags(packed.device);
+        if (flags == VRING_PACKED_EVENT_FLAG_DESC) {
+            const uint16_t off_wrap = vring_packed_event_read_off_wrap(packed.device);
+            uint16_t event = off_wrap & ~(1u << VRING_PACKED_EVENT_F_WRAP_CTR);
+            /* an event from the previous lap sits a ring length back */
+            if ((bool)(off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != packed.avail_wrap) {
+                event -= ring.num;
+            }
+            kick = vring_need_event(event, packed.next_avail, packed.next_avail - added);
+        } else {
+            kick = (flags != VRING_PACKED_EVENT_FLAG_DISABLE);
+        }
+    } else {
+        const bool modern = config_is_modern();
+        if (event_idx_) {
+            const uint16_t new_idx = vring_avail_read_idx(ring.avail, modern);
+            /* vring_avail_event(), the slot past the end of the used ring */
+            const uint16_t event = vring_mem_read16((volatile uint16_t *)&ring.used->ring[ring.num]);
+            kick = vring_need_event(modern ? LE16(event) : event, new_idx, new_idx - added);
+        } else {
+            kick = (vring_used_read_flags(ring.used, modern) & VRING_USED_F_NO_NOTIFY) == 0;
+        }
+    }
+
+    LTRACEF("dev %p, ring %u, added %u, kick %d\n", this, ring_index, added, kick);
+
+    if (kick) {
+        bus_->virtio_kick(ring_index);
+    }
+}
+
+void virtio_device::negotiate_ring_features() {
+    const uint64_t host_features = bus_->virtio_read_host_feature_word_64(0);
+    uint32_t word0 = bus_->virtio_guest_feature_word(0);
+    uint32_t word1 = bus_->virtio_guest_feature_word(1);
+
+    if (host_features & VIRTIO_F_EVENT_IDX) {
+        word0 |= VIRTIO_F_EVENT_IDX;
+        event_idx_ = true;
+    }
+    // packed rings are only defined for VERSION_1 devices
+    if ((host_features & VIRTIO_F_RING_PACKED) && (word1 & (VIRTIO_F_VERSION_1 >> 32))) {
+        word1 |= VIRTIO_F_RING_PACKED >> 32;
+        packed_ = true;
+    }
+
+    LTRACEF("dev %p, event idx %d, packed %d\n", this, event_idx_, packed_);
+
+    bus_->virtio_set_guest_features(0, word0);
+    bus_->virtio_set_guest_features(1, word1);
+    ring_features_negotiated_ = true;
+}
+
 status_t virtio_device::virtio_alloc_ring(uint index, uint16_t len) {
     LTRACEF("dev %p, index %u, len %u\n", this, index, len);
 
@@ -132,10 +263,14 @@ status_t virtio_device::virtio_alloc_ring(uint index, uint16_t len) {
     if (index >= MAX_VIRTIO_RINGS)
         return ERR_INVALID_ARGS;
 
+    if (!ring_features_negotiated_) {
+        negotiate_ring_features();
+    }
+
     vring &ring = ring_[index];
 
     /* allocate a ring */
-    size_t size = vring_size(len, PAGE_SIZE);
+    size_t size = packed_ ? vring_packed_size(len) : vring_size(len, PAGE_SIZE);
     LTRACEF("need %zu bytes\n", size);
 
 #if WITH_KERNEL_VM
@@ -169,11 +304,40 @@ status_t virtio_device::virtio_alloc_ring(uint index, uint16_t len) {
     paddr_t pa = (paddr_t)vptr;
 #endif
 
-    /* initialize the ring */
-    vring_init(&ring, len, vptr, PAGE_SIZE);
+    if (packed_) {
+        /* the device only sees the packed ring, drivers build their chains in a table of our own */
+        auto *desc = static_cast<vring_desc *>(calloc(len, sizeof(vring_desc)));
+        auto *chain_len = static_cast<uint16_t *>(calloc(len, sizeof(uint16_t)));
+        if (!desc || !chain_len) {
+            free(desc);
+            free(chain_len);
+            return ERR_NO_MEMORY;
+        }
+
+        vring_packed &packed = packed_ring_[index];
+        vring_packed_init(&packed, len, vptr);
+        packed.chain_len = chain_len;
+
+        /* with event idx ask for an interrupt at the first used descriptor, else at every one */
+        if (event_idx_) {
+            vring_packed_event_write_off_wrap(packed.driver, (uint16_t)(1u << VRING_PACKED_EVENT_F_WRAP_CTR));
+            vring_packed_event_write_flags(packed.driver, VRING_PACKED_EVENT_FLAG_DESC);
+        }
+
+        ring.num = len;
+        ring.num_mask = len - 1;
+        ring.last_used = 0;
+        ring.desc = desc;
+        ring.avail = nullptr;
+        ring.used = nullptr;
+    } else {
+        /* initialize the ring */
+        vring_init(&ring, len, vptr, PAGE_SIZE);
+    }
     ring.free_list = 0xffff;
     ring.free_count = 0;
     ring_len_[index] = len;
+    added_since_kick_[index] = 0;
 
     /* add all the descriptors to the free list */
     for (uint i = 0; i < len; i++) {
@@ -181,7 +345,14 @@ status_t virtio_device::virtio_alloc_ring(uint index, uint16_t len) {
     }
 
     /* register the ring with the device */
-    bus()->register_ring(PAGE_SIZE, index, len, PAGE_SIZE, pa / PAGE_SIZE);
+    if (packed_) {
+        vring_packed &packed = packed_ring_[index];
+        bus()->register_packed_ring(index, len, pa,
+                                    pa + ((uintptr_t)packed.driver - (uintptr_t)vptr),
+                                    pa + ((uintptr_t)packed.device - (uintptr_t)vptr));
+    } else {
+        bus()->register_ring(PAGE_SIZE, index, len, PAGE_SIZE, pa / PAGE_SIZE);
+    }
 
     /* mark the ring active */
     active_rings_bitmap_ |= (1 << index);
@@ -195,17 +366,33 @@ handler_return virtio_device::handle_queue_interrupt() {
 
     /* cycle through all the active rings */
     for (uint r = 0; r < MAX_VIRTIO_RINGS; r++) {
-        if ((active_rings_bitmap_ & (1<<r)) == 0)
-            continue;
+        if (handle_ring_interrupt(r) == INT_RESCHEDULE) {
+            ret = INT_RESCHEDULE;
+        }
+    }
 
-        vring &ring = ring_[r];
-        const bool modern = config_is_modern();
+    return ret;
+}
+
+handler_return virtio_device::handle_ring_interrupt(uint r) {
+    DEBUG_ASSERT(r < MAX_VIRTIO_RINGS);
+    handler_return ret = INT_NO_RESCHEDULE;
+
+    if ((active_rings_bitmap_ & (1<<r)) == 0)
+        return ret;
 
-        LTRACEF("desc %p, avail %p, used %p\n", ring.desc, ring.avail, ring.used);
-        LTRACEF("ring %u: used flags 0x%hx idx 0x%hx last_used 0x%hx\n", r,
-            vring_used_read_flags(ring.used, modern), vring_used_read_idx(ring.used, modern), ring.last_used);
+    if (packed_)
+        return handle_packed_ring_interrupt(r);
 
-        uint16_t cur_idx = vring_used_read_idx(ring.used, modern);
+    vring &ring = ring_[r];
+    const bool modern = config_is_modern();
+
+    LTRACEF("desc %p, avail %p, used %p\n", ring.desc, ring.avail, ring.used);
+    LTRACEF("ring %u: used flags 0x%hx idx 0x%hx last_used 0x%hx\n", r,
+        vring_used_read_flags(ring.used, modern), vring_used_read_idx(ring.used, modern), ring.last_used);
+
+    uint16_t cur_idx = vring_used_read_idx(ring.used, modern);
+    for (;;) {
         // Ensure device writes to used elements are visible after observing used->idx.
         rmb();
         for (uint16_t used_idx = ring.last_used; used_idx != cur_idx; ++used_idx) {
@@ -226,6 +413,65 @@ handler_return virtio_device::handle_queue_interrupt() {
 
             ring.last_used++;
         }
+
+        if (!event_idx_)
+            break;
+
+        // Ask for an interrupt at the next used entry, then pick up any that
+        // landed before the device could have seen the request.
+        vring_mem_write16((volatile uint16_t *)&vring_used_event(&ring), ring_swap16(ring.last_used));
+        mb();
+        cur_idx = vring_used_read_idx(ring.used, modern);
+        if (cur_idx == ring.last_used)
+            break;
+    }
+
+    return ret;
+}
+
+handler_return virtio_device::handle_packed_ring_interrupt(uint r) {
+    handler_return ret = INT_NO_RESCHEDULE;
+
+    vring &ring = ring_[r];
+    vring_packed &packed = packed_ring_[r];
+
+    LTRACEF("ring %u: next_used %u used_wrap %d\n", r, packed.next_used, packed.used_wrap);
+
+    for (;;) {
+        while (vring_packed_is_used(&packed)) {
+            // Ensure the device's id and len are read after seeing the flags flip.
+            rmb();
+
+            const vring_packed_desc *desc = &packed.desc[packed.next_used];
+            vring_used_elem used_elem = {
+                .id = vring_packed_desc_read_id(desc),
+                .len = vring_packed_desc_read_len(desc),
+            };
+            LTRACEF("slot %u: id %u, len %u\n", packed.next_used, used_elem.id, used_elem.len);
+            DEBUG_ASSERT(used_elem.id < ring.num);
+
+            /* step over the slots the chain took, before the driver frees it */
+            packed.next_used += packed.chain_len[used_elem.id];
+            if (packed.next_used >= ring.num) {
+                packed.next_used -= ring.num;
+                packed.used_wrap = !packed.used_wrap;
+            }
+
+            DEBUG_ASSERT(irq_driver_callback_);
+            if (irq_driver_callback_(this, r, &used_elem) == INT_RESCHEDULE) {
+                ret = INT_RESCHEDULE;
+            }
+        }
+
+        if (!event_idx_)
+            break;
+
+        // As for split rings: move the event on and catch anything that raced it.
+        vring_packed_event_write_off_wrap(packed.driver,
+            packed.next_used | (uint16_t)(packed.used_wrap << VRING_PACKED_EVENT_F_WRAP_CTR));
+        mb();
+        if (!vring_packed_is_used(&packed))
+            break;
     }
 
     return ret;
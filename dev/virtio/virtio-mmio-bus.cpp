@@ -153,6 +153,7 @@ void virtio_mmio_bus::virtio_status_driver_ok() {
 }
 
 void virtio_mmio_bus::virtio_set_guest_features(uint32_t word, uint32_t features) {
+    save_guest_features(word, features);
     virtio_mmio_write32(&mmio_config_->guest_features_sel, word);
     virtio_mmio_write32(&mmio_config_->guest_features, features);
 }
@@ -199,17 +200,43 @@ void virtio_mmio_bus::register_ring(uint32_t page_size, uint32_t queue_sel, uint
         uint64_t used_pa = (avail_pa + sizeof(uint16_t) * (3 + queue_num) + queue_align - 1) &
                            ~(static_cast<uint64_t>(queue_align) - 1);
 
-        virtio_mmio_write32(&mmio_config_->queue_ready, 0);
-        virtio_mmio_write32(&mmio_config_->queue_desc_low, static_cast<uint32_t>(desc_pa));
-        virtio_mmio_write32(&mmio_config_->queue_desc_high, static_cast<uint32_t>(desc_pa >> 32));
-        virtio_mmio_write32(&mmio_config_->queue_avail_low, static_cast<uint32_t>(avail_pa));
-        virtio_mmio_write32(&mmio_config_->queue_avail_high, static_cast<uint32_t>(avail_pa >> 32));
-        virtio_mmio_write32(&mmio_config_->queue_used_low, static_cast<uint32_t>(used_pa));
-        virtio_mmio_write32(&mmio_config_->queue_used_high, static_cast<uint32_t>(used_pa >> 32));
-        virtio_mmio_write32(&mmio_config_->queue_ready, 1);
+        set_queue_addresses(desc_pa, avail_pa, used_pa);
     }
 }
 
+void virtio_mmio_bus::register_packed_ring(uint32_t queue_sel, uint32_t queue_num, uint64_t desc_pa, uint64_t driver_pa, uint64_t device_pa) {
+    DEBUG_ASSERT(mmio_config_);
+
+    if (mmio_version_ != 2) {
+        printf("virtio-mmio: packed rings need a version 2 device\n");
+        return;
+    }
+
+    virtio_mmio_write32(&mmio_config_->queue_sel, queue_sel);
+
+    uint32_t queue_num_max = virtio_mmio_read32(&mmio_config_->queue_num_max);
+    if (queue_num_max == 0 || queue_num > queue_num_max) {
+        printf("virtio-mmio: invalid queue size %u (max %u) for queue %u\n", queue_num, queue_num_max, queue_sel);
+        return;
+    }
+
+    virtio_mmio_write32(&mmio_config_->queue_num, queue_num);
+
+    // the avail and used registers hold the driver and device areas
+    set_queue_addresses(desc_pa, driver_pa, device_pa);
+}
+
+void virtio_mmio_bus::set_queue_addresses(uint64_t desc_pa, uint64_t driver_pa, uint64_t device_pa) {
+    virtio_mmio_write32(&mmio_config_->queue_ready, 0);
+    virtio_mmio_write32(&mmio_config_->queue_desc_low, static_cast<uint32_t>(desc_pa));
+    virtio_mmio_write32(&mmio_config_->queue_desc_high, static_cast<uint32_t>(desc_pa >> 32));
+    virtio_mmio_write32(&mmio_config_->queue_avail_low, static_cast<uint32_t>(driver_pa));
+    virtio_mmio_write32(&mmio_config_->queue_avail_high, static_cast<uint32_t>(driver_pa >> 32));
+    virtio_mmio_write32(&mmio_config_->queue_used_low, static_cast<uint32_t>(device_pa));
+    virtio_mmio_write32(&mmio_config_->queue_used_high, static_cast<uint32_t>(device_pa >> 32));
+    virtio_mmio_write32(&mmio_config_->queue_ready, 1);
+}
+
 void dump_mmio_config(const volatile virtio_mmio_config *mmio) {
     printf("mmio at %p\n", mmio);
     printf("\tmagic 0x%x\n", virtio_mmio_read32(&mmio->magic));
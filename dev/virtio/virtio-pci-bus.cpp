@@ -139,6 +139,9 @@ struct virtio_pci_common_cfg {
 
 STATIC_ASSERT(sizeof(virtio_pci_common_cfg) == 64);
 
+// read back from a msix vector register when the device couldn't take the vector
+#define VIRTIO_MSI_NO_VECTOR 0xffff
+
 void virtio_pci_bus::virtio_reset_device() {
     common_config()->device_status = 0;
     while (common_config()->device_status != 0)
@@ -150,6 +153,24 @@ void virtio_pci_bus::virtio_status_acknowledge_driver() {
 }
 
 void virtio_pci_bus::virtio_status_driver_ok() {
+    // config changes come in on the first vector
+    if (msix_) {
+        common_config()->config_msix_vector = 0;
+    }
+
+    // VERSION_1 devices need the features settled before they'll go, which also
+    // fixes the ring layout the device expects.
+    constexpr uint32_t version1_bit_word1 = static_cast<uint32_t>(VIRTIO_F_VERSION_1 >> 32);
+    if ((virtio_guest_feature_word(1) & version1_bit_word1) &&
+        !(common_config()->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+        common_config()->device_status |= VIRTIO_STATUS_FEATURES_OK;
+        if (!(common_config()->device_status & VIRTIO_STATUS_FEATURES_OK)) {
+            common_config()->device_status |= VIRTIO_STATUS_FAILED;
+            printf("virtio-pci: device rejected feature negotiation\n");
+            return;
+        }
+    }
+
     common_config()->device_status |= VIRTIO_STATUS_DRIVER_OK;
 }
 
@@ -159,6 +180,7 @@ uint32_t virtio_pci_bus::virtio_read_host_feature_word(uint32_t word) {
 }
 
 void virtio_pci_bus::virtio_set_guest_features(uint32_t word, uint32_t features) {
+    save_guest_features(word, features);
     common_config()->driver_feature_select = word;
     common_config()->driver_feature = features;
 }
@@ -173,6 +195,26 @@ void virtio_pci_bus::virtio_kick(uint16_t ring_index) {
     *notify = ring_index;
 }
 
+// Point the selected queue at its own vector if it has one. The device may not be able to
+// take it, in which case the queue shares the config vector.
+void virtio_pci_bus::set_ring_vector(uint32_t queue_sel) {
+    auto *ccfg = common_config();
+
+    if (queue_sel >= ring_vectors_) {
+        ccfg->queue_msix_vector = 0;
+        return;
+    }
+
+    ccfg->queue_msix_vector = 1 + queue_sel;
+    if (ccfg->queue_msix_vector == VIRTIO_MSI_NO_VECTOR) {
+        LTRACEF("queue %u couldn't take vector %u, sharing the config vector\n", queue_sel, 1 + queue_sel);
+        ccfg->queue_msix_vector = 0;
+        shared_rings_ |= 1u << queue_sel;
+    } else {
+        shared_rings_ &= ~(1u << queue_sel);
+    }
+}
+
 void virtio_pci_bus::register_ring(uint32_t page_size, uint32_t queue_sel, uint32_t queue_num, uint32_t queue_align, uint32_t queue_pfn) {
     auto *ccfg = common_config();
 
@@ -193,10 +235,47 @@ void virtio_pci_bus::register_ring(uint32_t page_size, uint32_t queue_sel, uint3
     ccfg->queue_desc = ring_descriptor_paddr;
     ccfg->queue_driver = ring_available_paddr;
     ccfg->queue_device = ring_used_paddr;
-    ccfg->queue_msix_vector = 0;
+    set_ring_vector(queue_sel);
     ccfg->queue_enable = 1;
 }
 
+void virtio_pci_bus::register_packed_ring(uint32_t queue_sel, uint32_t queue_num, uint64_t desc_pa, uint64_t driver_pa, uint64_t device_pa) {
+    auto *ccfg = common_config();
+
+    LTRACEF("queue %u size %u packed paddr (%#" PRIx64 ", %#" PRIx64 ", %#" PRIx64 ")\n",
+             queue_sel, queue_num, desc_pa, driver_pa, device_pa);
+
+    ccfg->queue_select = queue_sel;
+    ccfg->queue_size = queue_num;
+    ccfg->queue_desc = desc_pa;
+    ccfg->queue_driver = driver_pa;
+    ccfg->queue_device = device_pa;
+    set_ring_vector(queue_sel);
+    ccfg->queue_enable = 1;
+}
+
+status_t virtio_pci_bus::virtio_set_ring_cpu(uint16_t ring_index, uint cpu) {
+    if (ring_index >= ring_vectors_ || (shared_rings_ & (1u << ring_index))) {
+        return ERR_NOT_SUPPORTED;
+    }
+
+    return pci_bus_mgr_set_msix_target(loc_, 1 + ring_index, cpu);
+}
+
+void virtio_pci_bus::mask_interrupt() {
+    virtio_bus::mask_interrupt();
+    for (uint i = 0; i < ring_vectors_; i++) {
+        ::mask_interrupt(irq_base_ + 1 + i);
+    }
+}
+
+void virtio_pci_bus::unmask_interrupt() {
+    virtio_bus::unmask_interrupt();
+    for (uint i = 0; i < ring_vectors_; i++) {
+        ::unmask_interrupt(irq_base_ + 1 + i);
+    }
+}
+
 handler_return virtio_pci_bus::virtio_pci_irq(void *arg) {
     auto *bus = reinterpret_cast<virtio_pci_bus *>(arg);
 
@@ -210,7 +289,9 @@ handler_return virtio_pci_bus::virtio_pci_irq(void *arg) {
     LTRACEF("status %#x\n", irq_status);
 
     enum handler_return ret = INT_NO_RESCHEDULE;
-    if (irq_status & 0x1) { /* used ring update */
+    /* used ring update, unless the rings have their own vectors. any that couldn't get one
+     * come in here too, where the isr status isn't used */
+    if (((irq_status & 0x1) && bus->ring_vectors_ == 0) || bus->shared_rings_ != 0) {
         auto _ret = bus->dev_->handle_queue_interrupt();
         if (_ret == INT_RESCHEDULE) {
             ret = _ret;
@@ -228,6 +309,14 @@ handler_return virtio_pci_bus::virtio_pci_irq(void *arg) {
     return ret;;
 }
 
+handler_return virtio_pci_bus::virtio_pci_ring_irq(void *arg) {
+    auto *ring = reinterpret_cast<ring_irq *>(arg);
+
+    LTRACEF("bus %p, ring %u\n", ring->bus, ring->index);
+
+    return ring->bus->dev_->handle_ring_interrupt(ring->index);
+}
+
 status_t virtio_pci_bus::init(virtio_device *dev, pci_location_t loc, size_t index) {
     LTRACE_ENTRY;
 
@@ -355,9 +444,22 @@ common:
     // Prefer MSI-X, then MSI, then legacy IRQs.
     bool uses_msi = false;
     if (pci_bus_mgr_has_msix(loc_)) {
-        err = pci_bus_mgr_allocate_msix(loc_, 1, &irq_base);
+        // Try for a vector per ring on top of the config one, so each ring can be
+        // serviced on its own cpu, and settle for a single shared one if not.
+        const uint16_t rings = MIN(common_config()->num_queues, virtio_device::MAX_VIRTIO_RINGS);
+        err = ERR_NO_RESOURCES;
+        if (rings > 0) {
+            err = pci_bus_mgr_allocate_msix(loc_, 1 + rings, &irq_base);
+            if (err == NO_ERROR) {
+                ring_vectors_ = rings;
+            }
+        }
+        if (err != NO_ERROR) {
+            err = pci_bus_mgr_allocate_msix(loc_, 1, &irq_base);
+        }
         if (err == NO_ERROR) {
             uses_msi = true;
+            msix_ = true;
         } else {
             printf("virtio: MSI-X allocation failed (%d), falling back to legacy IRQ\n", err);
         }
@@ -385,8 +487,14 @@ common:
     } else {
         register_int_handler(irq_base, virtio_pci_irq, this);
     }
+    for (uint16_t i = 0; i < ring_vectors_; i++) {
+        ring_irqs_[i] = { this, i };
+        ::mask_interrupt(irq_base + 1 + i);
+        register_int_handler_msi(irq_base + 1 + i, virtio_pci_ring_irq, &ring_irqs_[i], true);
+    }
+    irq_base_ = irq_base;
     set_irq(irq_base);
-    LTRACEF("IRQ number %#x\n", irq_base);
+    LTRACEF("IRQ number %#x, %u ring vectors\n", irq_base, ring_vectors_);
 
     return NO_ERROR;
 }
@@ -78,6 +78,7 @@ static int cmd_threadstats(int argc, const console_cmd_args *argv) {
         printf("\treschedules: %lu\n", thread_stats[i].reschedules);
 #if WITH_SMP
         printf("\treschedule_ipis: %lu\n", thread_stats[i].reschedule_ipis);
+        printf("\tsteals: %lu\n", thread_stats[i].steals);
 #endif
         printf("\tcontext_switches: %lu\n", thread_stats[i].context_switches);
         printf("\tpreempts: %lu\n", thread_stats[i].preempts);
@@ -85,6 +86,7 @@ static int cmd_threadstats(int argc, const console_cmd_args *argv) {
         printf("\tinterrupts: %lu\n", thread_stats[i].interrupts);
         printf("\ttimer interrupts: %lu\n", thread_stats[i].timer_ints);
         printf("\ttimers: %lu\n", thread_stats[i].timers);
+        printf("\ttimer interrupts coalesced: %lu\n", thread_stats[i].timers_coalesced);
     }
 
     dump_threads_stats();
@@ -121,7 +123,8 @@ static enum handler_return threadload(struct timer *t, lk_time_t now, void *arg)
 #endif
                "ints %lu, "
                "tmr ints %lu, "
-               "tmrs %lu\n",
+               "tmrs %lu, "
+               "tmrs coalesced %lu\n",
                i,
                busypercent / 100, busypercent % 100,
                thread_stats[i].context_switches - old_stats[i].context_switches,
@@ -131,7 +134,8 @@ static enum handler_return threadload(struct timer *t, lk_time_t now, void *arg)
 #endif
                thread_stats[i].interrupts - old_stats[i].interrupts,
                thread_stats[i].timer_ints - old_stats[i].timer_ints,
-               thread_stats[i].timers - old_stats[i].timers);
+               thread_stats[i].timers - old_stats[i].timers,
+               thread_stats[i].timers_coalesced - old_stats[i].timers_coalesced);
 
         old_stats[i] = thread_stats[i];
         last_idle_time[i] = idle_time;
@@ -54,14 +54,14 @@ void event_init(event_t *e, bool initial, uint flags) {
 void event_destroy(event_t *e) {
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     e->magic = 0;
     e->signaled = false;
     e->flags = 0;
     wait_queue_destroy(&e->wait, true);
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
 }
 
 /**
@@ -84,7 +84,7 @@ status_t event_wait_timeout(event_t *e, lk_time_t timeout) {
 
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     if (e->signaled) {
         /* signaled, we're going to fall through */
@@ -95,9 +95,14 @@ status_t event_wait_timeout(event_t *e, lk_time_t timeout) {
     } else {
         /* unsignaled, block here */
         ret = wait_queue_block(&e->wait, timeout);
+        if (ret == ERR_OBJECT_DESTROYED) {
+            /* the event may be gone already, don't touch it again */
+            arch_interrupt_restore(state);
+            return ret;
+        }
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
 
     return ret;
 }
@@ -125,7 +130,7 @@ int event_signal(event_t *e, bool reschedule) {
     int ret = 0;
     DEBUG_ASSERT(e->magic == EVENT_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&e->wait, state);
 
     if (!e->signaled) {
         if (e->flags & EVENT_FLAG_AUTOUNSIGNAL) {
@@ -146,7 +151,7 @@ int event_signal(event_t *e, bool reschedule) {
         }
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&e->wait, state);
 
     return ret;
 }
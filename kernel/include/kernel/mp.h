@@ -5,6 +5,7 @@
 // https://opensource.org/licenses/MIT
 #pragma once
 
+#include <arch/atomic.h>
 #include <kernel/thread.h>
 #include <lk/compiler.h>
 #include <stdbool.h>
@@ -50,9 +51,10 @@ enum handler_return mp_mbx_reschedule_irq(void);
 struct mp_state {
     volatile mp_cpu_mask_t active_cpus;
 
-    // only safely accessible with thread lock held
-    mp_cpu_mask_t idle_cpus;
-    mp_cpu_mask_t realtime_cpus;
+    // updated atomically by the scheduler on any cpu, no lock needed to read them
+    // but the result is only a hint by the time it's used
+    volatile mp_cpu_mask_t idle_cpus;
+    volatile mp_cpu_mask_t realtime_cpus;
 };
 
 extern struct mp_state mp;
@@ -67,13 +69,12 @@ static inline bool mp_is_cpu_idle(uint cpu) {
     return mp.idle_cpus & (1UL << cpu);
 }
 
-// Must be called with the thread lock held.
 static inline void mp_set_cpu_idle(uint cpu) {
-    mp.idle_cpus |= 1UL << cpu;
+    atomic_or((volatile int *)&mp.idle_cpus, 1U << cpu);
 }
 
 static inline void mp_set_cpu_busy(uint cpu) {
-    mp.idle_cpus &= ~(1UL << cpu);
+    atomic_and((volatile int *)&mp.idle_cpus, ~(1U << cpu));
 }
 
 static inline mp_cpu_mask_t mp_get_idle_mask(void) {
@@ -82,11 +83,11 @@ static inline mp_cpu_mask_t mp_get_idle_mask(void) {
 
 // Realtime cpus are currently running realtime threads.
 static inline void mp_set_cpu_realtime(uint cpu) {
-    mp.realtime_cpus |= 1UL << cpu;
+    atomic_or((volatile int *)&mp.realtime_cpus, 1U << cpu);
 }
 
 static inline void mp_set_cpu_non_realtime(uint cpu) {
-    mp.realtime_cpus &= ~(1UL << cpu);
+    atomic_and((volatile int *)&mp.realtime_cpus, ~(1U << cpu));
 }
 
 static inline mp_cpu_mask_t mp_get_realtime_mask(void) {
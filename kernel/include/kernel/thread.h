@@ -11,6 +11,7 @@
 #include <arch/thread.h>
 #include <arch/arch_ops.h>
 #include <kernel/spinlock.h>
+#include <kernel/timer.h>
 #include <kernel/wait.h>
 #include <lk/compiler.h>
 #include <lk/debug.h>
@@ -62,6 +63,7 @@ enum thread_tls_list {
 #define THREAD_FLAG_REAL_TIME                 (1<<3)
 #define THREAD_FLAG_IDLE                      (1<<4)
 #define THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK  (1<<5)
+#define THREAD_FLAG_DEADLINE                  (1<<6)
 
 #define THREAD_MAGIC (0x74687264) // 'thrd'
 
@@ -70,9 +72,33 @@ struct thread_specific_stats {
     lk_bigtime_t total_run_time;
     lk_bigtime_t last_run_timestamp;
     ulong schedules; // times this thread is scheduled to run.
+    ulong deadline_jobs; // periods started, for deadline threads
+    ulong deadline_misses; // periods whose work finished after the deadline
 };
 #endif
 
+// Deadline scheduling class, see thread_set_deadline(). All times in ms.
+// Protected by the scheduler lock of the cpu the thread is bound to.
+#define THREAD_DEADLINE_UTIL_SCALE 1024
+
+struct thread_deadline {
+    lk_time_t runtime; // cpu time available each period
+    lk_time_t period;
+    lk_time_t deadline; // relative to the start of each period
+    uint cpu; // cpu the thread was admitted on
+    uint util; // runtime / period, scaled by THREAD_DEADLINE_UTIL_SCALE
+
+    // current job
+    lk_time_t abs_deadline;
+    int budget; // runtime left this period
+    bool pending; // released and not yet finished
+    bool throttled; // out of budget until the next period
+    bool parked; // ready but held off the run queue while throttled
+    bool waiting; // finished, sleeping until the next period
+
+    timer_t release_timer; // fires at the start of every period
+};
+
 typedef struct thread {
     uint32_t magic;
     struct list_node thread_list_node;
@@ -81,11 +107,12 @@ typedef struct thread {
     struct list_node queue_node;
     int priority;
     enum thread_state state;
-    int remaining_quantum;
+    int remaining_quantum; // ms left in the current time slice
     unsigned int flags;
 #if WITH_SMP
     int curr_cpu;
     int pinned_cpu; // only run on pinned_cpu if >= 0
+    int last_cpu; // cpu this thread last ran on or is queued to run on
 #endif
 #if WITH_KERNEL_VM
     struct vmm_aspace *aspace;
@@ -95,6 +122,13 @@ typedef struct thread {
     struct wait_queue *blocking_wait_queue;
     status_t wait_queue_block_ret;
 
+    // deadline class parameters, if THREAD_FLAG_DEADLINE is set
+    struct thread_deadline dl;
+
+    // protects the blocking state above and transitions out of the suspended
+    // and blocked states. nests inside the wait queue lock.
+    spin_lock_t lock;
+
     // architecture-specific thread state
     struct arch_thread arch;
 
@@ -151,10 +185,13 @@ thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine
 status_t thread_resume(thread_t *);
 void thread_exit(int retcode) __NO_RETURN;
 void thread_sleep(lk_time_t delay);
+void thread_sleep_slack(lk_time_t delay, lk_time_t slack);
 status_t thread_detach(thread_t *t);
 status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout);
 status_t thread_detach_and_resume(thread_t *t);
 status_t thread_set_real_time(thread_t *t);
+status_t thread_set_deadline(thread_t *t, lk_time_t runtime, lk_time_t period, lk_time_t deadline);
+void thread_deadline_yield(void);
 
 void dump_thread(const thread_t *t);
 void arch_dump_thread(const thread_t *t);
@@ -165,8 +202,7 @@ void dump_threads_stats(void);
 // scheduler routines
 void thread_yield(void); // give up the cpu voluntarily
 void thread_preempt(void); // get preempted (inserted into head of run queue)
-void thread_block(void); // block on something and reschedule
-void thread_unblock(thread_t *t, bool resched); // go back in the run queue
+void thread_block(void); // block on something and reschedule, local scheduler lock held
 
 #ifdef WITH_LIB_UTHREAD
 void uthread_context_switch(thread_t *oldthread, thread_t *newthread);
@@ -188,7 +224,8 @@ static inline void set_current_thread(thread_t *t) {
 // list of all threads, unsafe to traverse without holding thread_lock
 extern struct list_node thread_list;
 
-// scheduler lock
+// thread list lock. Only protects the list above and is never held while
+// acquiring any other lock.
 extern spin_lock_t thread_lock;
 
 #define THREAD_LOCK(state) arch_interrupt_saved_state_t state = spin_lock_irqsave(&thread_lock)
@@ -198,6 +235,31 @@ static inline bool thread_lock_held(void) {
     return spin_lock_held(&thread_lock);
 }
 
+// Per cpu scheduler lock. Protects the cpu's run queue and is held across a context
+// switch, so it is released by the thread being switched to rather than the one that
+// took it. Lock order is wait queue lock, then thread lock, then scheduler lock.
+spin_lock_t *thread_sched_lock(uint cpu);
+
+static inline arch_interrupt_saved_state_t thread_sched_lock_irqsave(void) {
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    spin_lock(thread_sched_lock(arch_curr_cpu_num()));
+    return state;
+}
+
+// the thread may have been migrated while it was switched out, so release the lock
+// of the cpu it is running on now
+static inline void thread_sched_unlock_irqrestore(arch_interrupt_saved_state_t state) {
+    spin_unlock(thread_sched_lock(arch_curr_cpu_num()));
+    arch_interrupt_restore(state);
+}
+
+#define THREAD_SCHED_LOCK(state) arch_interrupt_saved_state_t state = thread_sched_lock_irqsave()
+#define THREAD_SCHED_UNLOCK(state) thread_sched_unlock_irqrestore(state)
+
+static inline bool thread_sched_lock_held(void) {
+    return spin_lock_held(thread_sched_lock(arch_curr_cpu_num()));
+}
+
 // SMP related accessors
 static inline int thread_curr_cpu(const thread_t *t) {
 #if WITH_SMP
@@ -256,9 +318,11 @@ struct thread_stats {
     ulong interrupts; // platform code increment this
     ulong timer_ints; // timer code increment this
     ulong timers; // timer code increment this
+    ulong timers_coalesced; // timer interrupts saved by timer slack
 
 #if WITH_SMP
     ulong reschedule_ipis;
+    ulong steals; // threads pulled from another cpu's run queue
 #endif
 };
 
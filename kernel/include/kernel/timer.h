@@ -32,9 +32,20 @@ typedef struct timer {
 
     lk_time_t scheduled_time;
     lk_time_t periodic_time;
+    lk_time_t slack; // how much later than scheduled_time the timer may fire
 
     timer_callback callback;
     void *arg;
+
+    uint cpu; // cpu whose queue the timer was last set on
+
+    // queue bookkeeping, private to the timer code
+    uint8_t queued; // not queued, in a timer wheel slot or in the long timeout heap
+    uint8_t level;  // timer wheel level if in the wheel
+    uint64_t expires; // scheduled_time extended to 64 bits
+    struct timer *heap_child;
+    struct timer *heap_next;
+    struct timer *heap_prev;
 } timer_t;
 
 // Initializes a timer to the default state. Can statically initialize a timer
@@ -45,8 +56,16 @@ typedef struct timer {
     .node = LIST_INITIAL_CLEARED_VALUE, \
     .scheduled_time = 0, \
     .periodic_time = 0, \
+    .slack = 0, \
     .callback = NULL, \
     .arg = NULL, \
+    .cpu = 0, \
+    .queued = 0, \
+    .level = 0, \
+    .expires = 0, \
+    .heap_child = NULL, \
+    .heap_next = NULL, \
+    .heap_prev = NULL, \
 }
 
 void timer_initialize(timer_t *);
@@ -54,6 +73,11 @@ void timer_initialize(timer_t *);
 // Sets a timer to fire once after a delay.
 void timer_set_oneshot(timer_t *, lk_time_t delay, timer_callback, void *arg);
 
+// Sets a timer to fire once anywhere from delay to delay + slack from now. The
+// expiration is placed where it can share an interrupt with other timers, so
+// timers that don't need to be exact should use this to cut down on wakeups.
+void timer_set_oneshot_slack(timer_t *, lk_time_t delay, lk_time_t slack, timer_callback, void *arg);
+
 // Sets a timer to fire periodically at the specified interval.
 void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 
@@ -63,4 +87,8 @@ void timer_set_periodic(timer_t *, lk_time_t period, timer_callback, void *arg);
 // The callback will not be called again after this.
 void timer_cancel(timer_t *);
 
+// Cancels a timer and, if its callback is running on another cpu, waits for it to return.
+// Must not be called from the timer's own callback or while holding a lock the callback takes.
+void timer_cancel_sync(timer_t *);
+
 __END_CDECLS
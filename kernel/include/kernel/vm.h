@@ -71,10 +71,13 @@ typedef struct vm_page {
     struct list_node node;
 
     uint flags : 8;
-    uint ref : 24;
+    uint order : 8; // size of the free block this page heads, log2 pages
+    uint ref : 16;
 } vm_page_t;
 
 #define VM_PAGE_FLAG_NONFREE  (0x1)
+#define VM_PAGE_FLAG_BUDDY    (0x2) // head of a free block on one of the arena's free lists
+#define VM_PAGE_FLAG_CACHED   (0x4) // held in a per cpu page cache
 
 // Kernel address space
 // Must be declared by the platform or architecture.
@@ -106,6 +109,11 @@ static inline bool is_user_address(vaddr_t va) {
 }
 
 // physical allocator
+// Free pages are kept in naturally aligned power of 2 blocks, up to 2^PMM_MAX_ORDER pages.
+#ifndef PMM_MAX_ORDER
+#define PMM_MAX_ORDER 10
+#endif
+
 typedef struct pmm_arena {
     struct list_node node;
     const char *name;
@@ -119,7 +127,7 @@ typedef struct pmm_arena {
     size_t free_count;
 
     struct vm_page *page_array;
-    struct list_node free_list;
+    struct list_node free_list[PMM_MAX_ORDER + 1]; // free blocks, by order
 } pmm_arena_t;
 
 #define PMM_ARENA_FLAG_KMAP (0x1) // this arena is already mapped and useful for kallocs
@@ -176,6 +184,12 @@ paddr_t vm_page_to_paddr(const vm_page_t *page);
 // paddr to vm_page_t
 vm_page_t *paddr_to_vm_page(paddr_t addr);
 
+// Allocations of at least this size are lined up on it physically and virtually, so the
+// arch mmu code can map them with block/large page entries. 0 if it only maps single pages.
+#ifndef ARCH_MMU_LARGE_PAGE_SHIFT
+#define ARCH_MMU_LARGE_PAGE_SHIFT 0
+#endif
+
 // virtual allocator
 typedef struct vmm_aspace {
     struct list_node node;
@@ -208,6 +222,7 @@ typedef struct vmm_region {
 
 #define VMM_REGION_FLAG_RESERVED 0x1
 #define VMM_REGION_FLAG_PHYSICAL 0x2
+#define VMM_REGION_FLAG_COMMIT_ON_DEMAND 0x4
 
 // grab a handle to the kernel address space
 extern vmm_aspace_t _kernel_aspace;
@@ -240,6 +255,18 @@ status_t vmm_free_region(vmm_aspace_t *aspace, vaddr_t va);
 
 // For the above region creation routines. Allocate virtual space at the passed in pointer.
 #define VMM_FLAG_VALLOC_SPECIFIC 0x1
+// vmm_alloc() only. Reserve the virtual space now and back each page with a zeroed
+// physical page the first time it's touched.
+#define VMM_FLAG_COMMIT_ON_DEMAND 0x2
+
+// called by the arch page fault handlers for faults on unmapped addresses, with interrupts
+// enabled if they were at the time of the fault. Returns NO_ERROR if a page was committed
+// and the access should be retried, or an error if the fault is fatal.
+status_t vmm_page_fault_handler(vaddr_t addr, uint pf_flags);
+
+#define VMM_PF_FLAG_WRITE       0x1
+#define VMM_PF_FLAG_USER        0x2
+#define VMM_PF_FLAG_INSTRUCTION 0x4
 
 // allocate a new address space
 status_t vmm_create_aspace(vmm_aspace_t **aspace, const char *name, uint flags)
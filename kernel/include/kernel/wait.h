@@ -5,6 +5,7 @@
 // https://opensource.org/licenses/MIT
 #pragma once
 
+#include <kernel/spinlock.h>
 #include <lk/compiler.h>
 #include <lk/list.h>
 #include <stdbool.h>
@@ -20,10 +21,17 @@ __BEGIN_CDECLS
 //
 // The wait queue is not a general purpose queue, it is only used for
 // blocking threads.  It is not intended to be used for other purposes.
+//
+// Each wait queue is protected by its own spinlock, which the primitive built on
+// top of it also uses to protect its own state (an event's signaled flag, a mutex's
+// count, etc). Blocking and waking on different wait queues never contend with each
+// other, and only briefly take the per cpu scheduler lock of the cpu the woken
+// thread is queued on.
 #define WAIT_QUEUE_MAGIC (0x77616974) // 'wait'
 
 typedef struct wait_queue {
     uint32_t magic;
+    spin_lock_t lock;
     int count;
     struct list_node list;
 } wait_queue_t;
@@ -33,13 +41,21 @@ typedef struct wait_queue {
 #define WAIT_QUEUE_INITIAL_VALUE(q) \
 { \
     .magic = WAIT_QUEUE_MAGIC, \
+    .lock = SPIN_LOCK_INITIAL_VALUE, \
     .count = 0, \
     .list = LIST_INITIAL_VALUE((q).list) \
 }
 void wait_queue_init(wait_queue_t *wait);
 
-// All of the below apis must be called with interrupts disabled and the main thread
-// lock held (see kernel/thread.h for details).
+// Lock and unlock a wait queue. Unlocking through WAIT_QUEUE_UNLOCK also switches to
+// a thread woken with reschedule set while the lock was held, so callers that wake
+// with reschedule set should always unlock this way.
+#define WAIT_QUEUE_LOCK(q, state) arch_interrupt_saved_state_t state = spin_lock_irqsave(&(q)->lock)
+#define WAIT_QUEUE_UNLOCK(q, state) wait_queue_unlock_irqrestore(q, state)
+void wait_queue_unlock_irqrestore(wait_queue_t *, arch_interrupt_saved_state_t state);
+
+// All of the below apis must be called with interrupts disabled and the wait
+// queue's lock held.
 
 // Release all the threads on this wait queue with a return code of ERR_OBJECT_DESTROYED.
 // the caller must assure that no other threads are operating on the wait queue during or
@@ -50,6 +66,8 @@ void wait_queue_destroy(wait_queue_t *, bool reschedule);
 // Return status is whatever the caller of wait_queue_wake_*() specifies.
 // A timeout other than INFINITE_TIME will set abort after the specified time
 // and return ERR_TIMED_OUT. A timeout of 0 will immediately return.
+// The wait queue lock is dropped while blocked and reacquired before returning, except
+// when the queue was destroyed (ERR_OBJECT_DESTROYED) as it may no longer exist.
 status_t wait_queue_block(wait_queue_t *, lk_time_t timeout);
 
 // Release one or more threads from the wait queue.
@@ -58,11 +76,15 @@ status_t wait_queue_block(wait_queue_t *, lk_time_t timeout);
 // Returns the number of threads released from the wait queue.
 //
 // May be called at interrupt context, but reschedule *must* be false in that case.
+// With reschedule set, the switch to the woken thread happens when the wait queue
+// is unlocked with WAIT_QUEUE_UNLOCK.
 int wait_queue_wake_one(wait_queue_t *, bool reschedule, status_t wait_queue_error);
 int wait_queue_wake_all(wait_queue_t *, bool reschedule, status_t wait_queue_error);
 
 // Remove the thread from whatever wait queue it's in.
 // Return an error if the thread is not currently blocked (or is the current thread).
+// Unlike the above, must be called with interrupts disabled and *without* the lock of
+// the wait queue the thread is blocked on held.
 struct thread;
 status_t thread_unblock_from_wait_queue(struct thread *t, status_t wait_queue_error);
 
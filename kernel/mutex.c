@@ -57,11 +57,11 @@ void mutex_destroy(mutex_t *m) {
               get_current_thread(), get_current_thread()->name, m, m->holder, m->holder->name);
 #endif
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&m->wait, state);
     m->magic = 0;
     m->count = 0;
     wait_queue_destroy(&m->wait, true);
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&m->wait, state);
 }
 
 /**
@@ -84,11 +84,16 @@ status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout) {
 #endif
     DEBUG_ASSERT(!mutex_threading_ready || !timeout || !arch_ints_disabled());
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&m->wait, state);
 
     status_t ret = NO_ERROR;
     if (unlikely(++m->count > 1)) {
         ret = wait_queue_block(&m->wait, timeout);
+        if (unlikely(ret == ERR_OBJECT_DESTROYED)) {
+            /* the mutex may be gone already, don't touch it again */
+            arch_interrupt_restore(state);
+            return ret;
+        }
         if (unlikely(ret < NO_ERROR)) {
             /* if the acquisition timed out, back out the acquire and exit */
             if (likely(ret == ERR_TIMED_OUT)) {
@@ -109,7 +114,7 @@ status_t mutex_acquire_timeout(mutex_t *m, lk_time_t timeout) {
     m->holder = get_current_thread();
 
 err:
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&m->wait, state);
     return ret;
 }
 
@@ -126,7 +131,7 @@ status_t mutex_release(mutex_t *m) {
     }
 #endif
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&m->wait, state);
 
     m->holder = 0;
 
@@ -135,7 +140,7 @@ status_t mutex_release(mutex_t *m) {
         wait_queue_wake_one(&m->wait, true, NO_ERROR);
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&m->wait, state);
     return NO_ERROR;
 }
 
@@ -78,6 +78,41 @@ typedef struct {
 
 static struct list_node write_port_list;
 
+// protects the port lists, the links between ports and the port buffers.
+// nests outside the read port and port group wait queue locks.
+static spin_lock_t port_lock = SPIN_LOCK_INITIAL_VALUE;
+
+#define PORT_LOCK(state) arch_interrupt_saved_state_t state = spin_lock_irqsave(&port_lock)
+#define PORT_UNLOCK(state) spin_unlock_irqrestore(&port_lock, state)
+
+// wake waiters on a read port or port group, port_lock held.
+static int port_wake(wait_queue_t *wait, bool all, status_t error) {
+    spin_lock(&wait->lock);
+    int ret = all ? wait_queue_wake_all(wait, false, error) : wait_queue_wake_one(wait, false, error);
+    spin_unlock(&wait->lock);
+    return ret;
+}
+
+static void port_wait_destroy(wait_queue_t *wait) {
+    spin_lock(&wait->lock);
+    wait_queue_destroy(wait, false);
+    spin_unlock(&wait->lock);
+}
+
+// block on a read port or port group, port_lock held. the wait queue lock is taken
+// before port_lock is dropped so a write in between can't be missed.
+static status_t port_block(wait_queue_t *wait, lk_time_t timeout) {
+    spin_lock(&wait->lock);
+    spin_unlock(&port_lock);
+
+    status_t ret = wait_queue_block(wait, timeout);
+    if (ret != ERR_OBJECT_DESTROYED)
+        spin_unlock(&wait->lock);
+
+    spin_lock(&port_lock);
+    return ret;
+}
+
 
 static port_buf_t *make_buf(bool big) {
     uint pk_count = big ? PORT_BUFF_SIZE_BIG : PORT_BUFF_SIZE;
@@ -143,14 +178,14 @@ status_t port_create(const char *name, port_mode_t mode, port_t *port) {
 
     // lookup for existing port, return that if found.
     write_port_t *wp = NULL;
-    THREAD_LOCK(state1);
+    PORT_LOCK(state1);
     list_for_every_entry(&write_port_list, wp, write_port_t, node) {
         if (strcmp(wp->name, name) == 0) {
             // can't return closed or partial ports.
             if (wp->magic == WRITEPORT_MAGIC_X ||
                 wp->magic == PORTHOLD_MAGIC)
                 wp = NULL;
-            THREAD_UNLOCK(state1);
+            PORT_UNLOCK(state1);
             if (wp) {
                 *port = (void *) wp;
                 return ERR_ALREADY_EXISTS;
@@ -160,14 +195,14 @@ status_t port_create(const char *name, port_mode_t mode, port_t *port) {
         }
     }
     list_add_tail(&write_port_list, &stack_wp.node);
-    THREAD_UNLOCK(state1);
+    PORT_UNLOCK(state1);
 
     // not found, create the write port and the circular buffer.
     wp = calloc(1, sizeof(write_port_t));
     if (!wp) {
-        THREAD_LOCK(state2);
+        PORT_LOCK(state2);
         list_delete(&stack_wp.node);
-        THREAD_UNLOCK(state2);
+        PORT_UNLOCK(state2);
         return ERR_NO_MEMORY;
     }
 
@@ -179,19 +214,19 @@ status_t port_create(const char *name, port_mode_t mode, port_t *port) {
     wp->buf = make_buf(mode & PORT_MODE_BIG_BUFFER);
     if (!wp->buf) {
         free(wp);
-        THREAD_LOCK(state2);
+        PORT_LOCK(state2);
         list_delete(&stack_wp.node);
-        THREAD_UNLOCK(state2);
+        PORT_UNLOCK(state2);
         return ERR_NO_MEMORY;
     }
 
     // Avoid a name collision by swapping the temporary placeholder out of the
     // list for the actual port.
-    THREAD_LOCK(state2);
+    PORT_LOCK(state2);
     // Let's reserve a stack allocated entry then swap it for the allocated one.
     list_add_tail(&write_port_list, &wp->node);
     list_delete(&stack_wp.node);
-    THREAD_UNLOCK(state2);
+    PORT_UNLOCK(state2);
 
     *port = (void *)wp;
     return NO_ERROR;
@@ -222,7 +257,7 @@ status_t port_open(const char *name, void *ctx, port_t *port) {
     // find the named write port and associate it with read port.
     status_t rc = ERR_NOT_FOUND;
 
-    THREAD_LOCK(state);
+    PORT_LOCK(state);
     write_port_t *wp = NULL;
     list_for_every_entry(&write_port_list, wp, write_port_t, node) {
         if (strcmp(wp->name, name) == 0 &&
@@ -254,7 +289,7 @@ status_t port_open(const char *name, void *ctx, port_t *port) {
             break;
         }
     }
-    THREAD_UNLOCK(state);
+    PORT_UNLOCK(state);
 
     if (buf)
         free(buf);
@@ -289,7 +324,7 @@ status_t port_group(port_t *ports, size_t count, port_t *group) {
 
     status_t rc = NO_ERROR;
 
-    THREAD_LOCK(state);
+    PORT_LOCK(state);
     for (size_t ix = 0; ix != count; ix++) {
         read_port_t *rp = (read_port_t *)ports[ix];
         if ((rp->magic != READPORT_MAGIC) || rp->gport) {
@@ -305,7 +340,7 @@ status_t port_group(port_t *ports, size_t count, port_t *group) {
         rp->gport = pg;
         list_add_tail(&pg->rp_list, &rp->g_node);
     }
-    THREAD_UNLOCK(state);
+    PORT_UNLOCK(state);
 
     if (rc == NO_ERROR) {
         *group = (port_t *)pg;
@@ -329,7 +364,7 @@ status_t port_group_add(port_t group, port_t port) {
         return ERR_BAD_HANDLE;
 
     status_t rc = NO_ERROR;
-    THREAD_LOCK(state);
+    PORT_LOCK(state);
 
     if (list_length(&pg->rp_list) == MAX_PORT_GROUP_COUNT) {
         rc = ERR_TOO_BIG;
@@ -340,11 +375,11 @@ status_t port_group_add(port_t group, port_t port) {
         // If the new read port being added has messages available, try to wake
         // any readers that might be present.
         if (!buf_is_empty(rp->buf)) {
-            wait_queue_wake_one(&pg->wait, false, NO_ERROR);
+            port_wake(&pg->wait, false, NO_ERROR);
         }
     }
 
-    THREAD_UNLOCK(state);
+    PORT_UNLOCK(state);
 
     return rc;
 }
@@ -362,7 +397,7 @@ status_t port_group_remove(port_t group, port_t port) {
     if (rp->magic != READPORT_MAGIC || rp->gport != pg)
         return ERR_BAD_HANDLE;
 
-    THREAD_LOCK(state);
+    PORT_LOCK(state);
 
     bool found = false;
     read_port_t *current_rp;
@@ -373,13 +408,13 @@ status_t port_group_remove(port_t group, port_t port) {
     }
 
     if (!found) {
-        THREAD_UNLOCK(state);
+        PORT_UNLOCK(state);
         return ERR_BAD_HANDLE;
     }
 
     list_delete(&rp->g_node);
 
-    THREAD_UNLOCK(state);
+    PORT_UNLOCK(state);
 
     return NO_ERROR;
 }
@@ -389,10 +424,10 @@ status_t port_write(port_t port, const port_packet_t *pk, size_t count) {
         return ERR_INVALID_ARGS;
 
     write_port_t *wp = (write_port_t *)port;
-    THREAD_LOCK(state);
+    PORT_LOCK(state);
     if (wp->magic != WRITEPORT_MAGIC_W) {
         // wrong port type.
-        THREAD_UNLOCK(state);
+        PORT_UNLOCK(state);
         return ERR_BAD_HANDLE;
     }
 
@@ -415,17 +450,17 @@ status_t port_write(port_t port, const port_packet_t *pk, size_t count) {
 
             int awaken = 0;
             if (rp->gport) {
-                awaken = wait_queue_wake_one(&rp->gport->wait, false, NO_ERROR);
+                awaken = port_wake(&rp->gport->wait, false, NO_ERROR);
             }
             if (!awaken) {
-                awaken = wait_queue_wake_one(&rp->wait, false, NO_ERROR);
+                awaken = port_wake(&rp->wait, false, NO_ERROR);
             }
 
             awake_count += awaken;
         }
     }
 
-    THREAD_UNLOCK(state);
+    PORT_UNLOCK(state);
 
 #if RESCHEDULE_POLICY
     if (awake_count)
@@ -446,7 +481,7 @@ static inline status_t read_no_lock(read_port_t *rp, lk_time_t timeout, port_res
     if (!timeout)
         return ERR_TIMED_OUT;
 
-    status_t wr = wait_queue_block(&rp->wait, timeout);
+    status_t wr = port_block(&rp->wait, timeout);
     if (wr != NO_ERROR)
         return wr;
     // recursive tail call is usually optimized away with a goto.
@@ -460,7 +495,7 @@ status_t port_read(port_t port, lk_time_t timeout, port_result_t *result) {
     status_t rc = ERR_GENERIC;
     read_port_t *rp = (read_port_t *)port;
 
-    THREAD_LOCK(state);
+    PORT_LOCK(state);
     if (rp->magic == READPORT_MAGIC) {
         // dealing with a single port.
         rc = read_no_lock(rp, timeout, result);
@@ -476,7 +511,7 @@ status_t port_read(port_t port, lk_time_t timeout, port_result_t *result) {
                     goto read_exit;
             }
             // no data, block on the group waitqueue.
-            rc = wait_queue_block(&pg->wait, timeout);
+            rc = port_block(&pg->wait, timeout);
         } while (rc == NO_ERROR);
     } else {
         // wrong port type.
@@ -484,7 +519,7 @@ status_t port_read(port_t port, lk_time_t timeout, port_result_t *result) {
     }
 
 read_exit:
-    THREAD_UNLOCK(state);
+    PORT_UNLOCK(state);
     return rc;
 }
 
@@ -495,10 +530,10 @@ status_t port_destroy(port_t port) {
     write_port_t *wp = (write_port_t *) port;
     port_buf_t *buf = NULL;
 
-    THREAD_LOCK(state);
+    PORT_LOCK(state);
     if (wp->magic != WRITEPORT_MAGIC_X) {
         // wrong port type.
-        THREAD_UNLOCK(state);
+        PORT_UNLOCK(state);
         return ERR_BAD_HANDLE;
     }
     // remove self from global named ports list.
@@ -512,9 +547,9 @@ status_t port_destroy(port_t port) {
         read_port_t *rp;
         list_for_every_entry(&wp->rp_list, rp, read_port_t, w_node) {
             // wake the read and group ports.
-            wait_queue_wake_all(&rp->wait, false, ERR_CANCELLED);
+            port_wake(&rp->wait, true, ERR_CANCELLED);
             if (rp->gport) {
-                wait_queue_wake_all(&rp->gport->wait, false, ERR_CANCELLED);
+                port_wake(&rp->gport->wait, true, ERR_CANCELLED);
             }
             // remove self from reader ports.
             rp->wport = NULL;
@@ -522,7 +557,7 @@ status_t port_destroy(port_t port) {
     }
 
     wp->magic = 0;
-    THREAD_UNLOCK(state);
+    PORT_UNLOCK(state);
 
     free(buf);
     free(wp);
@@ -536,7 +571,7 @@ status_t port_close(port_t port) {
     read_port_t *rp = (read_port_t *) port;
     port_buf_t *buf = NULL;
 
-    THREAD_LOCK(state);
+    PORT_LOCK(state);
     if (rp->magic == READPORT_MAGIC) {
         // dealing with a read port.
         if (rp->wport) {
@@ -554,14 +589,14 @@ status_t port_close(port_t port) {
             list_delete(&rp->g_node);
         }
         // wake up waiters, the return code is ERR_OBJECT_DESTROYED.
-        wait_queue_destroy(&rp->wait, true);
+        port_wait_destroy(&rp->wait);
         rp->magic = 0;
 
     } else if (rp->magic == PORTGROUP_MAGIC) {
         // dealing with a port group.
         port_group_t *pg = (port_group_t *) port;
         // wake up waiters.
-        wait_queue_destroy(&pg->wait, true);
+        port_wait_destroy(&pg->wait);
         // remove self from reader ports.
         rp = NULL;
         list_for_every_entry(&pg->rp_list, rp, read_port_t, g_node) {
@@ -574,15 +609,15 @@ status_t port_close(port_t port) {
         write_port_t *wp = (write_port_t *) port;
         // mark it as closed. Now it can be read but not written to.
         wp->magic = WRITEPORT_MAGIC_X;
-        THREAD_UNLOCK(state);
+        PORT_UNLOCK(state);
         return NO_ERROR;
 
     } else {
-        THREAD_UNLOCK(state);
+        PORT_UNLOCK(state);
         return ERR_BAD_HANDLE;
     }
 
-    THREAD_UNLOCK(state);
+    PORT_UNLOCK(state);
 
     free(buf);
     free(port);
@@ -25,16 +25,16 @@ void sem_init(semaphore_t *sem, int initial_count) {
 }
 
 void sem_destroy(semaphore_t *sem) {
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
     sem->count = 0;
     wait_queue_destroy(&sem->wait, true);
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
 }
 
 int sem_post(semaphore_t *sem, bool resched) {
     int ret = 0;
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
 
     /*
      * If the count is or was negative then a thread is waiting for a resource, otherwise
@@ -43,29 +43,35 @@ int sem_post(semaphore_t *sem, bool resched) {
     if (unlikely(++sem->count <= 0))
         ret = wait_queue_wake_one(&sem->wait, resched, NO_ERROR);
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
 
     return ret;
 }
 
 status_t sem_wait(semaphore_t *sem) {
     status_t ret = NO_ERROR;
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
 
     /*
      * If there are no resources available then we need to
      * sit in the wait queue until sem_post adds some.
      */
-    if (unlikely(--sem->count < 0))
+    if (unlikely(--sem->count < 0)) {
         ret = wait_queue_block(&sem->wait, INFINITE_TIME);
+        if (ret == ERR_OBJECT_DESTROYED) {
+            /* the semaphore may be gone already, don't touch it again */
+            arch_interrupt_restore(state);
+            return ret;
+        }
+    }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
     return ret;
 }
 
 status_t sem_trywait(semaphore_t *sem) {
     status_t ret = NO_ERROR;
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
 
     if (unlikely(sem->count <= 0)) {
         ret = ERR_NOT_READY;
@@ -73,16 +79,21 @@ status_t sem_trywait(semaphore_t *sem) {
         sem->count--;
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
     return ret;
 }
 
 status_t sem_timedwait(semaphore_t *sem, lk_time_t timeout) {
     status_t ret = NO_ERROR;
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&sem->wait, state);
 
     if (unlikely(--sem->count < 0)) {
         ret = wait_queue_block(&sem->wait, timeout);
+        if (ret == ERR_OBJECT_DESTROYED) {
+            /* the semaphore may be gone already, don't touch it again */
+            arch_interrupt_restore(state);
+            return ret;
+        }
         if (ret < NO_ERROR) {
             if (ret == ERR_TIMED_OUT) {
                 sem->count++;
@@ -90,6 +101,6 @@ status_t sem_timedwait(semaphore_t *sem, lk_time_t timeout) {
         }
     }
 
-    THREAD_UNLOCK(state);
+    WAIT_QUEUE_UNLOCK(&sem->wait, state);
     return ret;
 }
@@ -23,6 +23,7 @@
 #include <kernel/mp.h>
 #include <kernel/timer.h>
 #include <lib/heap.h>
+#include <lib/slab.h>
 #include <lk/debug.h>
 #include <lk/err.h>
 #include <lk/list.h>
@@ -30,6 +31,7 @@
 #include <malloc.h>
 #include <platform.h>
 #include <printf.h>
+#include <stdlib.h>
 #include <string.h>
 #include <target.h>
 #if WITH_KERNEL_VM
@@ -43,20 +45,57 @@ struct thread_stats thread_stats[SMP_MAX_CPUS];
 #define STACK_DEBUG_BYTE (0x99)
 #define STACK_DEBUG_WORD (0x99999999)
 
+#define LOCAL_TRACE 0
+
 #define DEBUG_THREAD_CONTEXT_SWITCH 0
 
 /* global thread list */
 struct list_node thread_list;
 
-/* master thread spinlock */
+/* protects the global thread list */
 spin_lock_t thread_lock = SPIN_LOCK_INITIAL_VALUE;
 
-/* the run queue */
-static struct list_node run_queue[NUM_PRIORITIES];
-static uint32_t run_queue_bitmap;
+/* thread structures allocated by thread_create() */
+static slab_cache_t thread_cache;
+
+/* detached threads that have exited, waiting for their structure to be returned to
+ * the cache. Protected by thread_lock. */
+static struct list_node dead_threads = LIST_INITIAL_VALUE(dead_threads);
+
+/* per cpu run queues */
+struct run_queue {
+    spin_lock_t lock; /* the cpu's scheduler lock, held across context switches */
+    struct list_node queue[NUM_PRIORITIES];
+    uint queue_count[NUM_PRIORITIES];
+    uint32_t bitmap;
+    uint count; /* number of threads in the queue */
+    struct list_node deadline_queue; /* deadline threads, earliest deadline first */
+    uint deadline_util; /* bandwidth reserved by deadline threads bound to this cpu */
+    int curr_priority; /* priority of the thread running on this cpu, -1 if idle */
+    lk_time_t curr_deadline; /* its deadline, if it's a deadline thread */
+    lk_time_t slice_start; /* when the running thread's time slice was last charged */
+    thread_t *handoff; /* thread woken with reschedule set, to run once the waker unlocks */
+} __CPU_ALIGN;
+
+static struct run_queue run_queues[SMP_MAX_CPUS];
 
 /* make sure the bitmap is large enough to cover our number of priorities */
-STATIC_ASSERT(NUM_PRIORITIES <= sizeof(run_queue_bitmap) * 8);
+STATIC_ASSERT(NUM_PRIORITIES <= sizeof(run_queues[0].bitmap) * 8);
+
+/*
+ * Time slices, in ms. Threads at the same priority on a cpu split a target latency
+ * between them, so a thread running alone gets long slices and a crowded priority
+ * level round robins quickly.
+ */
+#define THREAD_QUANTUM_LATENCY 100
+#define THREAD_QUANTUM_MIN 5
+#define THREAD_QUANTUM_MAX 50
+
+/* run queue priority of a deadline thread, above all of the regular ones */
+#define DEADLINE_PRIORITY NUM_PRIORITIES
+
+/* share of each cpu deadline threads may reserve, leaving the rest for everyone else */
+#define THREAD_DEADLINE_MAX_UTIL (THREAD_DEADLINE_UTIL_SCALE * 9 / 10)
 
 /* the idle thread(s) (statically allocated) */
 #if WITH_SMP
@@ -76,44 +115,266 @@ static void idle_thread_routine(void) __NO_RETURN;
 static timer_t preempt_timer[SMP_MAX_CPUS];
 #endif
 
+static inline int thread_last_cpu(const thread_t *t) {
+#if WITH_SMP
+    return t->last_cpu;
+#else
+    return 0;
+#endif
+}
+
+static inline bool thread_is_deadline(const thread_t *t) {
+    return !!(t->flags & THREAD_FLAG_DEADLINE);
+}
+
+/* priority as far as the run queues are concerned */
+static inline int thread_sched_priority(const thread_t *t) {
+    return thread_is_deadline(t) ? DEADLINE_PRIORITY : t->priority;
+}
+
+static inline int run_queue_highest_priority(const struct run_queue *rq) {
+    if (rq->bitmap == 0)
+        return -1;
+    return sizeof(rq->bitmap) * 8 - 1 - __builtin_clz(rq->bitmap);
+}
+
 /* run queue manipulation */
-static void insert_in_run_queue_head(thread_t *t) {
+
+/* deadline threads are kept sorted by deadline. One that is out of budget is
+ * parked instead, and queued when its next period starts. */
+static void insert_in_deadline_queue(uint cpu, thread_t *t) {
+    DEBUG_ASSERT(cpu == t->dl.cpu);
+
+    if (t->dl.throttled) {
+        t->dl.parked = true;
+        return;
+    }
+
+    struct run_queue *rq = &run_queues[cpu];
+    thread_t *entry;
+    list_for_every_entry(&rq->deadline_queue, entry, thread_t, queue_node) {
+        if (TIME_LT(t->dl.abs_deadline, entry->dl.abs_deadline)) {
+            list_add_before(&entry->queue_node, &t->queue_node);
+            goto done;
+        }
+    }
+    list_add_tail(&rq->deadline_queue, &t->queue_node);
+
+done:
+    rq->count++;
+#if WITH_SMP
+    t->last_cpu = cpu;
+#endif
+}
+
+static void insert_in_run_queue_head(uint cpu, thread_t *t) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+    DEBUG_ASSERT(spin_lock_held(&run_queues[cpu].lock));
+
+    if (thread_is_deadline(t)) {
+        insert_in_deadline_queue(cpu, t);
+        return;
+    }
 
-    list_add_head(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    struct run_queue *rq = &run_queues[cpu];
+    list_add_head(&rq->queue[t->priority], &t->queue_node);
+    rq->queue_count[t->priority]++;
+    rq->bitmap |= (1U<<t->priority);
+    rq->count++;
+#if WITH_SMP
+    t->last_cpu = cpu;
+#endif
 }
 
-static void insert_in_run_queue_tail(thread_t *t) {
+static void insert_in_run_queue_tail(uint cpu, thread_t *t) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_READY);
     DEBUG_ASSERT(!list_in_list(&t->queue_node));
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+    DEBUG_ASSERT(spin_lock_held(&run_queues[cpu].lock));
+
+    if (thread_is_deadline(t)) {
+        insert_in_deadline_queue(cpu, t);
+        return;
+    }
+
+    struct run_queue *rq = &run_queues[cpu];
+    list_add_tail(&rq->queue[t->priority], &t->queue_node);
+    rq->queue_count[t->priority]++;
+    rq->bitmap |= (1U<<t->priority);
+    rq->count++;
+#if WITH_SMP
+    t->last_cpu = cpu;
+#endif
+}
+
+static void remove_from_run_queue(uint cpu, thread_t *t) {
+    struct run_queue *rq = &run_queues[cpu];
 
-    list_add_tail(&run_queue[t->priority], &t->queue_node);
-    run_queue_bitmap |= (1<<t->priority);
+    DEBUG_ASSERT(list_in_list(&t->queue_node));
+    DEBUG_ASSERT(spin_lock_held(&rq->lock));
+
+    list_delete(&t->queue_node);
+    rq->count--;
+    if (!thread_is_deadline(t)) {
+        rq->queue_count[t->priority]--;
+        if (list_is_empty(&rq->queue[t->priority]))
+            rq->bitmap &= ~(1U<<t->priority);
+    }
+    if (rq->handoff == t)
+        rq->handoff = NULL;
 }
 
-static void wakeup_cpu_for_thread(thread_t *t)
-{
-    /* Wake up the core to which this thread is pinned
-     * or wake up all if thread is unpinned */
+/*
+ * A thread that just blocked or exited on another cpu may still be in the middle of
+ * switching away there. The switch happens with that cpu's scheduler lock held, so
+ * cycling the lock waits it out before the thread is queued somewhere else or freed.
+ */
+static void wait_for_thread_off_cpu(const thread_t *t) {
+#if WITH_SMP
+    int cpu = thread_last_cpu(t);
+    if (cpu >= 0 && cpu != (int)arch_curr_cpu_num()) {
+        spin_lock(&run_queues[cpu].lock);
+        spin_unlock(&run_queues[cpu].lock);
+    }
+#endif
+}
+
+/* return the structures of detached threads that have exited to the cache */
+static void reap_dead_threads(void) {
+    struct list_node dead = LIST_INITIAL_VALUE(dead);
+    thread_t *t;
+
+    THREAD_LOCK(state);
+    while ((t = list_remove_head_type(&dead_threads, thread_t, thread_list_node)))
+        list_add_tail(&dead, &t->thread_list_node);
+    THREAD_UNLOCK(state);
+
+    while ((t = list_remove_head_type(&dead, thread_t, thread_list_node))) {
+        /* thread_exit() holds its wait queue lock until it has the scheduler lock, and
+         * that until it has switched away, so once we've had both it's gone */
+        arch_interrupt_saved_state_t irq_state = spin_lock_irqsave(&t->retcode_wait_queue.lock);
+        wait_for_thread_off_cpu(t);
+        spin_unlock_irqrestore(&t->retcode_wait_queue.lock, irq_state);
+
+        slab_free(&thread_cache, t);
+    }
+}
+
+/*
+ * Pick the run queue a newly readied thread should go into. In order of
+ * preference: the cpu the thread is pinned to, the idle cpu it last ran on,
+ * any other idle cpu, the cpu running the least important thread if that is
+ * less important than this one, and finally the cpu it last ran on.
+ */
+static uint select_cpu_for_thread(thread_t *t) {
+#if WITH_SMP
+    if (thread_is_deadline(t))
+        return t->dl.cpu;
+
     int pinned_cpu = thread_pinned_cpu(t);
-    if (pinned_cpu < 0)
-        mp_reschedule(MP_CPU_ALL_BUT_LOCAL, 0);
-    else
-        mp_reschedule(1U << pinned_cpu, 0);
+    if (pinned_cpu >= 0)
+        return pinned_cpu;
+
+    uint local_cpu = arch_curr_cpu_num();
+    mp_cpu_mask_t active = mp.active_cpus;
+    int last_cpu = thread_last_cpu(t);
+
+    /* early in boot, before the scheduler is running on any cpu */
+    if ((active & ~(1U << local_cpu)) == 0)
+        return local_cpu;
+
+    mp_cpu_mask_t idle = mp_get_idle_mask() & active;
+    if (idle) {
+        uint cpu;
+        if (last_cpu >= 0 && (idle & (1U << last_cpu)))
+            cpu = last_cpu;
+        else
+            cpu = __builtin_ctz(idle);
+
+        /* claim the cpu so the next wakeup doesn't pile onto it as well. it'll
+         * get marked idle again when it reschedules, even if the thread has been
+         * stolen by then and it goes straight back to idling. */
+        mp_set_cpu_busy(cpu);
+        return cpu;
+    }
+
+    /* look for the cpu running the least important thread */
+    mp_cpu_mask_t candidates = active & ~mp_get_realtime_mask();
+    int lowest_priority = t->priority;
+    int lowest_cpu = -1;
+    while (candidates) {
+        uint cpu = __builtin_ctz(candidates);
+        candidates &= ~(1U << cpu);
+
+        int prio = run_queues[cpu].curr_priority;
+        if (prio < lowest_priority) {
+            lowest_priority = prio;
+            lowest_cpu = cpu;
+        }
+    }
+    if (lowest_cpu >= 0)
+        return lowest_cpu;
+
+    if (last_cpu >= 0 && (active & (1U << last_cpu)))
+        return last_cpu;
+
+    return local_cpu;
+#else
+    return 0;
+#endif
+}
+
+/* would the thread preempt what's running on the run queue's cpu */
+static bool run_queue_should_preempt(const struct run_queue *rq, const thread_t *t) {
+    int prio = thread_sched_priority(t);
+
+    if (prio != rq->curr_priority)
+        return prio > rq->curr_priority;
+
+    /* between deadline threads, the earliest deadline wins */
+    return prio == DEADLINE_PRIORITY && TIME_LT(t->dl.abs_deadline, rq->curr_deadline);
+}
+
+/*
+ * Queue a ready thread on whatever cpu suits it best. Returns the cpu to kick, if
+ * that cpu would pick the thread up when it reschedules. Must not be called with
+ * a scheduler lock held.
+ */
+static mp_cpu_mask_t insert_in_run_queue(thread_t *t) {
+    DEBUG_ASSERT(arch_ints_disabled());
+
+    wait_for_thread_off_cpu(t);
+
+    uint cpu = select_cpu_for_thread(t);
+    struct run_queue *rq = &run_queues[cpu];
+
+    spin_lock(&rq->lock);
+    insert_in_run_queue_head(cpu, t);
+    bool kick = list_in_list(&t->queue_node) && run_queue_should_preempt(rq, t);
+    spin_unlock(&rq->lock);
+
+    return kick ? (1U << cpu) : 0;
+}
+
+static void insert_in_run_queue_and_wakeup(thread_t *t) {
+    /* deadline threads preempt real time ones as well */
+    mp_reschedule(insert_in_run_queue(t), thread_is_deadline(t) ? MP_RESCHEDULE_FLAG_REALTIME : 0);
 }
 
 static void init_thread_struct(thread_t *t, const char *name) {
     memset(t, 0, sizeof(thread_t));
     t->magic = THREAD_MAGIC;
     thread_set_pinned_cpu(t, -1);
+#if WITH_SMP
+    t->last_cpu = -1;
+#endif
+    spin_lock_init(&t->lock);
     strlcpy(t->name, name, sizeof(t->name));
 }
 
@@ -148,7 +409,8 @@ thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine
     unsigned int flags = 0;
 
     if (!t) {
-        t = malloc(sizeof(thread_t));
+        reap_dead_threads();
+        t = slab_alloc(&thread_cache);
         if (!t)
             return NULL;
         flags |= THREAD_FLAG_FREE_STRUCT;
@@ -180,7 +442,7 @@ thread_t *thread_create_etc(thread_t *t, const char *name, thread_start_routine
         t->stack = malloc(stack_size);
         if (!t->stack) {
             if (flags & THREAD_FLAG_FREE_STRUCT)
-                free(t);
+                slab_free(&thread_cache, t);
             return NULL;
         }
         flags |= THREAD_FLAG_FREE_STACK;
@@ -240,7 +502,7 @@ status_t thread_set_real_time(thread_t *t) {
 
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    THREAD_SCHED_LOCK(state);
 #if PLATFORM_HAS_DYNAMIC_TIMER
     if (t == get_current_thread()) {
         /* if we're currently running, cancel the preemption timer. */
@@ -248,7 +510,7 @@ status_t thread_set_real_time(thread_t *t) {
     }
 #endif
     t->flags |= THREAD_FLAG_REAL_TIME;
-    THREAD_UNLOCK(state);
+    THREAD_SCHED_UNLOCK(state);
 
     return NO_ERROR;
 }
@@ -265,6 +527,198 @@ static bool thread_is_real_time_or_idle(thread_t *t) {
     return !!(t->flags & (THREAD_FLAG_REAL_TIME | THREAD_FLAG_IDLE));
 }
 
+/* start of a deadline thread's period: give it a fresh budget and deadline */
+static enum handler_return thread_deadline_release(timer_t *timer, lk_time_t now, void *arg) {
+    thread_t *t = (thread_t *)arg;
+    uint cpu = t->dl.cpu;
+    struct run_queue *rq = &run_queues[cpu];
+
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    spin_lock(&rq->lock);
+
+#if THREAD_STATS
+    /* the last period's work is still not done */
+    if (t->dl.pending)
+        t->stats.deadline_misses++;
+    t->stats.deadline_jobs++;
+#endif
+
+    t->dl.pending = true;
+    t->dl.throttled = false;
+    t->dl.budget = t->dl.runtime;
+    t->dl.abs_deadline = now + t->dl.deadline;
+
+    bool queue = false;
+    if (t->dl.waiting) {
+        t->dl.waiting = false;
+        t->state = THREAD_READY;
+        queue = true;
+    } else if (t->dl.parked) {
+        queue = true;
+    } else if (list_in_list(&t->queue_node)) {
+        /* requeue in order of the new deadline */
+        remove_from_run_queue(cpu, t);
+        queue = true;
+    } else if (t->state == THREAD_RUNNING) {
+        /* start charging the new budget from now */
+        rq->slice_start = now;
+        rq->curr_deadline = t->dl.abs_deadline;
+    }
+    t->dl.parked = false;
+
+    bool kick = false;
+    if (queue) {
+        insert_in_run_queue_head(cpu, t);
+        kick = run_queue_should_preempt(rq, t);
+    }
+
+    spin_unlock(&rq->lock);
+
+    if (!kick)
+        return INT_NO_RESCHEDULE;
+    if (cpu == arch_curr_cpu_num())
+        return INT_RESCHEDULE;
+
+    mp_reschedule(1U << cpu, MP_RESCHEDULE_FLAG_REALTIME);
+    return INT_NO_RESCHEDULE;
+}
+
+/* first period of a deadline thread, as it starts running */
+static void thread_deadline_start(thread_t *t) {
+    t->dl.pending = true;
+    t->dl.budget = t->dl.runtime;
+    t->dl.abs_deadline = current_time() + t->dl.deadline;
+#if THREAD_STATS
+    t->stats.deadline_jobs++;
+#endif
+}
+
+/**
+ * @brief Move a thread into the deadline scheduling class
+ *
+ * The thread is given up to runtime ms of cpu time every period ms, which it
+ * should be done with within deadline ms of the start of each period. Deadline
+ * threads are scheduled earliest deadline first ahead of every regular priority,
+ * and are bound to a cpu with enough spare bandwidth for them. A thread that uses
+ * up its runtime before the period is over doesn't run again until the next one.
+ *
+ * Call thread_deadline_yield() when done with each period's work.
+ *
+ * @param t Thread, either suspended or the current thread
+ * @param runtime Cpu time available each period, in ms
+ * @param period Length of a period, in ms
+ * @param deadline Deadline relative to the start of a period, in ms. 0 means the
+ *        same as the period.
+ *
+ * @return NO_ERROR on success, ERR_NO_RESOURCES if no cpu has the bandwidth
+ */
+status_t thread_set_deadline(thread_t *t, lk_time_t runtime, lk_time_t period, lk_time_t deadline) {
+    if (!t)
+        return ERR_INVALID_ARGS;
+
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+
+    if (deadline == 0)
+        deadline = period;
+    if (runtime == 0 || runtime > deadline || deadline > period)
+        return ERR_INVALID_ARGS;
+
+    bool is_current = (t == get_current_thread());
+    if ((!is_current && t->state != THREAD_SUSPENDED) || thread_is_deadline(t) || thread_is_idle(t))
+        return ERR_BAD_STATE;
+
+    uint util = (uint)((uint64_t)runtime * THREAD_DEADLINE_UTIL_SCALE / period);
+
+    /* the current thread stays where it is, otherwise go with the least loaded cpu */
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    int cpu = thread_pinned_cpu(t);
+    if (is_current) {
+        cpu = arch_curr_cpu_num();
+    } else if (cpu < 0) {
+        cpu = 0;
+        for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+            if (mp_is_cpu_active(i) && run_queues[i].deadline_util < run_queues[cpu].deadline_util)
+                cpu = i;
+        }
+    }
+
+    struct run_queue *rq = &run_queues[cpu];
+    spin_lock(&rq->lock);
+
+    if (rq->deadline_util + util > THREAD_DEADLINE_MAX_UTIL) {
+        spin_unlock(&rq->lock);
+        arch_interrupt_restore(state);
+        return ERR_NO_RESOURCES;
+    }
+    rq->deadline_util += util;
+
+    t->dl.runtime = runtime;
+    t->dl.period = period;
+    t->dl.deadline = deadline;
+    t->dl.cpu = cpu;
+    t->dl.util = util;
+    timer_initialize(&t->dl.release_timer);
+    thread_set_pinned_cpu(t, cpu);
+    t->flags |= THREAD_FLAG_DEADLINE;
+
+    if (is_current) {
+        thread_deadline_start(t);
+        rq->curr_priority = DEADLINE_PRIORITY;
+        rq->curr_deadline = t->dl.abs_deadline;
+        rq->slice_start = current_time();
+    }
+
+    spin_unlock(&rq->lock);
+
+    /* a suspended thread's periods start when it's resumed */
+    if (is_current)
+        timer_set_periodic(&t->dl.release_timer, period, thread_deadline_release, t);
+
+    arch_interrupt_restore(state);
+
+    return NO_ERROR;
+}
+
+/**
+ * @brief Finish the current period's work
+ *
+ * Sleeps the current deadline thread until its next period starts.
+ */
+void thread_deadline_yield(void) {
+    thread_t *current_thread = get_current_thread();
+
+    DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
+    DEBUG_ASSERT(thread_is_deadline(current_thread));
+
+    THREAD_SCHED_LOCK(state);
+
+    DEBUG_ASSERT(current_thread->dl.pending);
+
+#if THREAD_STATS
+    if (TIME_GT(current_time(), current_thread->dl.abs_deadline))
+        current_thread->stats.deadline_misses++;
+#endif
+
+    current_thread->dl.pending = false;
+    current_thread->dl.waiting = true;
+    current_thread->state = THREAD_SLEEPING;
+    thread_resched();
+
+    THREAD_SCHED_UNLOCK(state);
+}
+
+/* stop a deadline thread's periods and give back its bandwidth */
+static void thread_deadline_stop(thread_t *t) {
+    timer_cancel_sync(&t->dl.release_timer);
+
+    THREAD_SCHED_LOCK(state);
+    DEBUG_ASSERT(t->dl.cpu == arch_curr_cpu_num());
+    run_queues[t->dl.cpu].deadline_util -= t->dl.util;
+    THREAD_SCHED_UNLOCK(state);
+}
+
 /**
  * @brief  Make a suspended thread executable.
  *
@@ -281,17 +735,25 @@ status_t thread_resume(thread_t *t) {
 
     bool resched = false;
     bool ints_disabled = arch_ints_disabled();
-    THREAD_LOCK(state);
-    if (t->state == THREAD_SUSPENDED) {
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&t->lock);
+    bool resume = (t->state == THREAD_SUSPENDED);
+    if (resume)
         t->state = THREAD_READY;
-        insert_in_run_queue_head(t);
+    spin_unlock(&t->lock);
+
+    if (resume) {
+        if (thread_is_deadline(t)) {
+            spin_lock(&run_queues[t->dl.cpu].lock);
+            thread_deadline_start(t);
+            spin_unlock(&run_queues[t->dl.cpu].lock);
+            timer_set_periodic(&t->dl.release_timer, t->dl.period, thread_deadline_release, t);
+        }
+        insert_in_run_queue_and_wakeup(t);
         if (!ints_disabled) /* HACK, don't resced into bootstrap thread before idle thread is set up */
             resched = true;
     }
 
-    wakeup_cpu_for_thread(t);
-
-    THREAD_UNLOCK(state);
+    arch_interrupt_restore(state);
 
     if (resched)
         thread_yield();
@@ -310,11 +772,12 @@ status_t thread_detach_and_resume(thread_t *t) {
 status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    /* the retcode wait queue's lock covers the thread's exit and detached state */
+    WAIT_QUEUE_LOCK(&t->retcode_wait_queue, state);
 
     if (t->flags & THREAD_FLAG_DETACHED) {
         /* the thread is detached, go ahead and exit */
-        THREAD_UNLOCK(state);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return ERR_THREAD_DETACHED;
     }
 
@@ -322,7 +785,7 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout) {
     if (t->state != THREAD_DEATH) {
         status_t err = wait_queue_block(&t->retcode_wait_queue, timeout);
         if (err < 0) {
-            THREAD_UNLOCK(state);
+            WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
             return err;
         }
     }
@@ -336,20 +799,27 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout) {
     if (retcode)
         *retcode = t->retcode;
 
+    spin_unlock(&t->retcode_wait_queue.lock);
+
+    /* it may still be switching away on the cpu it exited on */
+    wait_for_thread_off_cpu(t);
+
+    arch_interrupt_restore(state);
+
     /* remove it from the master thread list */
+    THREAD_LOCK(list_state);
     list_delete(&t->thread_list_node);
+    THREAD_UNLOCK(list_state);
 
     /* clear the structure's magic */
     t->magic = 0;
 
-    THREAD_UNLOCK(state);
-
     /* free its stack and the thread structure itself */
     if (t->flags & THREAD_FLAG_FREE_STACK && t->stack)
         free(t->stack);
 
     if (t->flags & THREAD_FLAG_FREE_STRUCT)
-        free(t);
+        slab_free(&thread_cache, t);
 
     return NO_ERROR;
 }
@@ -357,7 +827,7 @@ status_t thread_join(thread_t *t, int *retcode, lk_time_t timeout) {
 status_t thread_detach(thread_t *t) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
 
-    THREAD_LOCK(state);
+    WAIT_QUEUE_LOCK(&t->retcode_wait_queue, state);
 
     /* if another thread is blocked inside thread_join() on this thread,
      * wake them up with a specific return code */
@@ -366,11 +836,11 @@ status_t thread_detach(thread_t *t) {
     /* if it's already dead, then just do what join would have and exit */
     if (t->state == THREAD_DEATH) {
         t->flags &= ~THREAD_FLAG_DETACHED; /* makes sure thread_join continues */
-        THREAD_UNLOCK(state);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return thread_join(t, NULL, 0);
     } else {
         t->flags |= THREAD_FLAG_DETACHED;
-        THREAD_UNLOCK(state);
+        WAIT_QUEUE_UNLOCK(&t->retcode_wait_queue, state);
         return NO_ERROR;
     }
 }
@@ -391,7 +861,10 @@ void thread_exit(int retcode) {
 
 //  dprintf("thread_exit: current %p\n", current_thread);
 
-    THREAD_LOCK(state);
+    if (thread_is_deadline(current_thread))
+        thread_deadline_stop(current_thread);
+
+    WAIT_QUEUE_LOCK(&current_thread->retcode_wait_queue, state);
     (void)state; /* silence unused variable warning */
 
     /* enter the dead state */
@@ -400,8 +873,13 @@ void thread_exit(int retcode) {
 
     /* if we're detached, then do our teardown here */
     if (current_thread->flags & THREAD_FLAG_DETACHED) {
-        /* remove it from the master thread list */
+        /* remove it from the master thread list, and if its structure needs freeing
+         * queue it up for the next thread_create() to do once we've switched away */
+        spin_lock(&thread_lock);
         list_delete(&current_thread->thread_list_node);
+        if (current_thread->flags & THREAD_FLAG_FREE_STRUCT)
+            list_add_tail(&dead_threads, &current_thread->thread_list_node);
+        spin_unlock(&thread_lock);
 
         /* clear the structure's magic */
         current_thread->magic = 0;
@@ -413,14 +891,16 @@ void thread_exit(int retcode) {
             /* make sure its not going to get a bounds check performed on the half-freed stack */
             current_thread->flags &= ~THREAD_FLAG_DEBUG_STACK_BOUNDS_CHECK;
         }
-
-        if (current_thread->flags & THREAD_FLAG_FREE_STRUCT)
-            heap_delayed_free(current_thread);
     } else {
         /* signal if anyone is waiting */
         wait_queue_wake_all(&current_thread->retcode_wait_queue, false, 0);
     }
 
+    /* take the scheduler lock before dropping the wait queue lock, so a joining
+     * thread can't free us until we've switched away */
+    spin_lock(&run_queues[arch_curr_cpu_num()].lock);
+    spin_unlock(&current_thread->retcode_wait_queue.lock);
+
     /* reschedule */
     thread_resched();
 
@@ -432,34 +912,149 @@ static void idle_thread_routine(void) {
         arch_idle();
 }
 
-static thread_t *get_top_thread(int cpu) {
-    thread_t *newthread;
-    uint32_t local_run_queue_bitmap = run_queue_bitmap;
+#if WITH_SMP
+/* most important unpinned thread in a run queue above min_priority, lock held */
+static thread_t *find_stealable_thread(struct run_queue *rq, int min_priority) {
+    uint32_t bitmap = rq->bitmap;
+    while (bitmap) {
+        int prio = sizeof(bitmap) * 8 - 1 - __builtin_clz(bitmap);
+        if (prio <= min_priority)
+            break;
 
-    while (local_run_queue_bitmap) {
-        /* find the first (remaining) queue with a thread in it */
-        uint next_queue = sizeof(run_queue_bitmap) * 8 - 1 - __builtin_clz(local_run_queue_bitmap);
+        thread_t *t;
+        list_for_every_entry(&rq->queue[prio], t, thread_t, queue_node) {
+            if (t->pinned_cpu < 0)
+                return t;
+        }
 
-        list_for_every_entry(&run_queue[next_queue], newthread, thread_t, queue_node) {
-#if WITH_SMP
-            if (newthread->pinned_cpu < 0 || newthread->pinned_cpu == cpu)
-#endif
-            {
-                list_delete(&newthread->queue_node);
+        bitmap &= ~(1U << prio);
+    }
+    return NULL;
+}
+
+/*
+ * Called when the local run queue is empty to pull over the most important
+ * unpinned thread queued on another cpu, if any.
+ *
+ * The local scheduler lock is held, so the other cpus' locks are only ever
+ * tried. A busy cpu is skipped rather than waited for; it's either about to
+ * run its queue itself or queueing more work that it'll kick a cpu for.
+ */
+static thread_t *steal_thread(uint cpu) {
+    uint victim_cpu = 0;
+    int best_priority = -1;
 
-                if (list_is_empty(&run_queue[next_queue]))
-                    run_queue_bitmap &= ~(1<<next_queue);
+    mp_cpu_mask_t candidates = mp.active_cpus & ~(1U << cpu);
+    while (candidates) {
+        uint i = __builtin_ctz(candidates);
+        candidates &= ~(1U << i);
 
-                return newthread;
-            }
+        struct run_queue *rq = &run_queues[i];
+        if (rq->bitmap == 0 || spin_trylock(&rq->lock) != 0)
+            continue;
+
+        thread_t *t = find_stealable_thread(rq, best_priority);
+        if (t) {
+            victim_cpu = i;
+            best_priority = t->priority;
         }
+        spin_unlock(&rq->lock);
+    }
+
+    if (best_priority < 0)
+        return NULL;
+
+    /* the queue may have changed since it was looked at, so look again */
+    struct run_queue *rq = &run_queues[victim_cpu];
+    if (spin_trylock(&rq->lock) != 0)
+        return NULL;
+
+    thread_t *victim = find_stealable_thread(rq, -1);
+    if (victim) {
+        LTRACEF("cpu %u stealing thread %p (%s) pri %d from cpu %u\n", cpu, victim, victim->name,
+                victim->priority, victim_cpu);
+
+        remove_from_run_queue(victim_cpu, victim);
+        THREAD_STATS_INC(steals);
+    }
+    spin_unlock(&rq->lock);
+
+    return victim;
+}
+#endif
+
+static thread_t *get_top_thread(uint cpu) {
+    struct run_queue *rq = &run_queues[cpu];
+
+    /* deadline threads come before everything else */
+    thread_t *dl_thread = list_peek_head_type(&rq->deadline_queue, thread_t, queue_node);
+    if (dl_thread) {
+        remove_from_run_queue(cpu, dl_thread);
+        return dl_thread;
+    }
+
+    int prio = run_queue_highest_priority(rq);
+
+    if (prio >= 0) {
+        thread_t *newthread = list_peek_head_type(&rq->queue[prio], thread_t, queue_node);
+        DEBUG_ASSERT(newthread);
+        DEBUG_ASSERT(thread_pinned_cpu(newthread) < 0 || thread_pinned_cpu(newthread) == (int)cpu);
 
-        local_run_queue_bitmap &= ~(1<<next_queue);
+        remove_from_run_queue(cpu, newthread);
+        return newthread;
     }
+
+#if WITH_SMP
+    /* nothing queued locally, see if another cpu has work to spare */
+    thread_t *stolen = steal_thread(cpu);
+    if (stolen)
+        return stolen;
+#endif
+
     /* no threads to run, select the idle thread for this cpu */
     return idle_thread(cpu);
 }
 
+/* new time slice for a thread, splitting the target latency with the threads queued
+ * behind it at the same priority */
+static int thread_quantum(uint cpu, const thread_t *t) {
+    int quantum = THREAD_QUANTUM_LATENCY / (int)(run_queues[cpu].queue_count[t->priority] + 1);
+
+    return MAX(THREAD_QUANTUM_MIN, MIN(quantum, THREAD_QUANTUM_MAX));
+}
+
+/* ms the running thread has left before it should be preempted */
+static int thread_slice_left(const thread_t *t) {
+    return thread_is_deadline(t) ? t->dl.budget : t->remaining_quantum;
+}
+
+/* charge the time since the last charge to the thread that was running, against its
+ * deadline budget or its time slice */
+static void thread_charge_slice(uint cpu, thread_t *t) {
+    struct run_queue *rq = &run_queues[cpu];
+    lk_time_t now = current_time();
+    int used = now - rq->slice_start;
+
+    rq->slice_start = now;
+    if (thread_is_idle(t))
+        return;
+
+    if (!thread_is_deadline(t)) {
+        t->remaining_quantum -= used;
+        return;
+    }
+
+    t->dl.budget -= used;
+    if (t->dl.budget <= 0 && t->dl.pending && !t->dl.throttled) {
+        /* sit out the rest of the period */
+        t->dl.throttled = true;
+        if (list_in_list(&t->queue_node)) {
+            remove_from_run_queue(cpu, t);
+            t->dl.parked = true;
+        }
+    }
+}
+
 /**
  * @brief  Cause another thread to be executed.
  *
@@ -478,11 +1073,14 @@ void thread_resched(void) {
     uint cpu = arch_curr_cpu_num();
 
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&run_queues[cpu].lock));
     DEBUG_ASSERT(current_thread->state != THREAD_RUNNING);
 
     THREAD_STATS_INC(reschedules);
 
+    /* a deadline thread out of budget comes back off the run queue here */
+    thread_charge_slice(cpu, current_thread);
+
     newthread = get_top_thread(cpu);
 
     DEBUG_ASSERT(newthread);
@@ -491,25 +1089,43 @@ void thread_resched(void) {
 
     oldthread = current_thread;
 
-    if (newthread == oldthread)
-        return;
+    run_queues[cpu].curr_priority = thread_is_idle(newthread) ? -1 : thread_sched_priority(newthread);
+    run_queues[cpu].curr_deadline = newthread->dl.abs_deadline;
 
     /* set up quantum for the new thread if it was consumed */
     if (newthread->remaining_quantum <= 0) {
-        newthread->remaining_quantum = 5; // XXX make this smarter
+        newthread->remaining_quantum = thread_quantum(cpu, newthread);
     }
 
-    /* mark the cpu ownership of the threads */
-    thread_set_curr_cpu(oldthread, -1);
-    thread_set_curr_cpu(newthread, cpu);
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* set the preemption timer for the end of the new thread's time slice */
+    timer_cancel(&preempt_timer[cpu]);
+    if (!thread_is_real_time_or_idle(newthread)) {
+        timer_set_oneshot(&preempt_timer[cpu], thread_slice_left(newthread), thread_timer_tick, NULL);
+    }
+#endif
 
 #if WITH_SMP
+    /* even if the idle thread just keeps running, a waker may have marked this cpu busy
+     * for a thread another cpu stole before it got here */
     if (thread_is_idle(newthread)) {
         mp_set_cpu_idle(cpu);
     } else {
         mp_set_cpu_busy(cpu);
     }
+#endif
+
+    if (newthread == oldthread)
+        return;
+
+    /* mark the cpu ownership of the threads */
+    thread_set_curr_cpu(oldthread, -1);
+    thread_set_curr_cpu(newthread, cpu);
+#if WITH_SMP
+    newthread->last_cpu = cpu;
+#endif
 
+#if WITH_SMP
     if (thread_is_realtime(newthread)) {
         mp_set_cpu_realtime(cpu);
     } else {
@@ -536,28 +1152,6 @@ void thread_resched(void) {
 
     KEVLOG_THREAD_SWITCH(oldthread, newthread);
 
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    if (thread_is_real_time_or_idle(newthread)) {
-        if (!thread_is_real_time_or_idle(oldthread)) {
-            /* if we're switching from a non real time to a real time, cancel
-             * the preemption timer. */
-#if DEBUG_THREAD_CONTEXT_SWITCH
-            dprintf(ALWAYS, "arch_context_switch: stop preempt, cpu %d, old %p (%s), new %p (%s)\n",
-                    cpu, oldthread, oldthread->name, newthread, newthread->name);
-#endif
-            timer_cancel(&preempt_timer[cpu]);
-        }
-    } else if (thread_is_real_time_or_idle(oldthread)) {
-        /* if we're switching from a real time (or idle thread) to a regular one,
-         * set up a periodic timer to run our preemption tick. */
-#if DEBUG_THREAD_CONTEXT_SWITCH
-        dprintf(ALWAYS, "arch_context_switch: start preempt, cpu %d, old %p (%s), new %p (%s)\n",
-                cpu, oldthread, oldthread->name, newthread, newthread->name);
-#endif
-        timer_set_periodic(&preempt_timer[cpu], 10, thread_timer_tick, NULL);
-    }
-#endif
-
     /* set some optional target debug leds */
     target_set_debug_led(0, !thread_is_idle(newthread));
 
@@ -618,7 +1212,7 @@ void thread_yield(void) {
     DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
 
-    THREAD_LOCK(state);
+    THREAD_SCHED_LOCK(state);
 
     THREAD_STATS_INC(yields);
 
@@ -626,11 +1220,11 @@ void thread_yield(void) {
     current_thread->state = THREAD_READY;
     current_thread->remaining_quantum = 0;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
-        insert_in_run_queue_tail(current_thread);
+        insert_in_run_queue_tail(arch_curr_cpu_num(), current_thread);
     }
     thread_resched();
 
-    THREAD_UNLOCK(state);
+    THREAD_SCHED_UNLOCK(state);
 }
 
 /**
@@ -661,19 +1255,19 @@ void thread_preempt(void) {
 
     KEVLOG_THREAD_PREEMPT(current_thread);
 
-    THREAD_LOCK(state);
+    THREAD_SCHED_LOCK(state);
 
     /* we are being preempted, so we get to go back into the front of the run queue if we have quantum left */
     current_thread->state = THREAD_READY;
     if (likely(!thread_is_idle(current_thread))) { /* idle thread doesn't go in the run queue */
         if (current_thread->remaining_quantum > 0)
-            insert_in_run_queue_head(current_thread);
+            insert_in_run_queue_head(arch_curr_cpu_num(), current_thread);
         else
-            insert_in_run_queue_tail(current_thread); /* if we're out of quantum, go to the tail of the queue */
+            insert_in_run_queue_tail(arch_curr_cpu_num(), current_thread); /* if we're out of quantum, go to the tail of the queue */
     }
     thread_resched();
 
-    THREAD_UNLOCK(state);
+    THREAD_SCHED_UNLOCK(state);
 }
 
 /**
@@ -691,39 +1285,30 @@ void thread_block(void) {
 
     DEBUG_ASSERT(current_thread->magic == THREAD_MAGIC);
     DEBUG_ASSERT(current_thread->state == THREAD_BLOCKED);
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(thread_sched_lock_held());
     DEBUG_ASSERT(!thread_is_idle(current_thread));
 
     /* we are blocking on something. the blocking code should have already stuck us on a queue */
     thread_resched();
 }
 
-void thread_unblock(thread_t *t, bool resched) {
-    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
-    DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-    DEBUG_ASSERT(!thread_is_idle(t));
-
-    t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-    wakeup_cpu_for_thread(t);
-
-    if (resched)
-        thread_resched();
-}
-
 enum handler_return thread_timer_tick(struct timer *t, lk_time_t now, void *arg) {
     thread_t *current_thread = get_current_thread();
+    uint cpu = arch_curr_cpu_num();
 
     if (thread_is_real_time_or_idle(current_thread))
         return INT_NO_RESCHEDULE;
 
-    current_thread->remaining_quantum--;
-    if (current_thread->remaining_quantum <= 0) {
+    int left = thread_slice_left(current_thread) - (int)(now - run_queues[cpu].slice_start);
+    if (left <= 0)
         return INT_RESCHEDULE;
-    } else {
-        return INT_NO_RESCHEDULE;
-    }
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* the slice was extended since the timer was set, wait out the rest */
+    timer_set_oneshot(&preempt_timer[cpu], left, thread_timer_tick, NULL);
+#endif
+
+    return INT_NO_RESCHEDULE;
 }
 
 /* timer callback to wake up a sleeping thread */
@@ -733,12 +1318,8 @@ static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, v
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(t->state == THREAD_SLEEPING);
 
-    THREAD_LOCK(state);
-
     t->state = THREAD_READY;
-    insert_in_run_queue_head(t);
-
-    THREAD_UNLOCK(state);
+    insert_in_run_queue_and_wakeup(t);
 
     return INT_RESCHEDULE;
 }
@@ -754,6 +1335,16 @@ static enum handler_return thread_sleep_handler(timer_t *timer, lk_time_t now, v
  * be placed at the head of the run queue.
  */
 void thread_sleep(lk_time_t delay) {
+    thread_sleep_slack(delay, 0);
+}
+
+/**
+ * @brief  Put thread to sleep for somewhere between delay and delay + slack ms
+ *
+ * Like thread_sleep(), but lets the wakeup be combined with other timers
+ * that expire within the slack window. See timer_set_oneshot_slack().
+ */
+void thread_sleep_slack(lk_time_t delay, lk_time_t slack) {
     timer_t timer;
 
     thread_t *current_thread = get_current_thread();
@@ -764,11 +1355,11 @@ void thread_sleep(lk_time_t delay) {
 
     timer_initialize(&timer);
 
-    THREAD_LOCK(state);
-    timer_set_oneshot(&timer, delay, thread_sleep_handler, (void *)current_thread);
+    THREAD_SCHED_LOCK(state);
+    timer_set_oneshot_slack(&timer, delay, slack, thread_sleep_handler, (void *)current_thread);
     current_thread->state = THREAD_SLEEPING;
     thread_resched();
-    THREAD_UNLOCK(state);
+    THREAD_SCHED_UNLOCK(state);
 }
 
 /**
@@ -782,8 +1373,14 @@ void thread_init_early(void) {
     DEBUG_ASSERT(arch_curr_cpu_num() == 0);
 
     /* initialize the run queues */
-    for (i=0; i < NUM_PRIORITIES; i++)
-        list_initialize(&run_queue[i]);
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_lock_init(&run_queues[cpu].lock);
+        for (i=0; i < NUM_PRIORITIES; i++)
+            list_initialize(&run_queues[cpu].queue[i]);
+        list_initialize(&run_queues[cpu].deadline_queue);
+        run_queues[cpu].curr_priority = -1;
+        run_queues[cpu].handoff = NULL;
+    }
 
     /* initialize the thread list */
     list_initialize(&thread_list);
@@ -798,9 +1395,13 @@ void thread_init_early(void) {
     t->flags = THREAD_FLAG_DETACHED;
     thread_set_curr_cpu(t, 0);
     thread_set_pinned_cpu(t, 0);
+#if WITH_SMP
+    t->last_cpu = 0;
+#endif
     wait_queue_init(&t->retcode_wait_queue);
     list_add_head(&thread_list, &t->thread_list_node);
     set_current_thread(t);
+    run_queues[0].curr_priority = t->priority;
 }
 
 /**
@@ -809,6 +1410,9 @@ void thread_init_early(void) {
  * This function is called once at boot time
  */
 void thread_init(void) {
+    slab_cache_init(&thread_cache, "thread", sizeof(thread_t), __alignof(thread_t),
+                    SLAB_FLAG_CACHE_ALIGN, NULL);
+
 #if PLATFORM_HAS_DYNAMIC_TIMER
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
         timer_initialize(&preempt_timer[i]);
@@ -816,6 +1420,11 @@ void thread_init(void) {
 #endif
 }
 
+spin_lock_t *thread_sched_lock(uint cpu) {
+    DEBUG_ASSERT(cpu < SMP_MAX_CPUS);
+    return &run_queues[cpu].lock;
+}
+
 /**
  * @brief Change name of current thread
  */
@@ -832,7 +1441,7 @@ void thread_set_name(const char *name) {
 void thread_set_priority(int priority) {
     thread_t *current_thread = get_current_thread();
 
-    THREAD_LOCK(state);
+    THREAD_SCHED_LOCK(state);
 
     if (priority <= IDLE_PRIORITY)
         priority = IDLE_PRIORITY + 1;
@@ -841,10 +1450,10 @@ void thread_set_priority(int priority) {
     current_thread->priority = priority;
 
     current_thread->state = THREAD_READY;
-    insert_in_run_queue_head(current_thread);
+    insert_in_run_queue_head(arch_curr_cpu_num(), current_thread);
     thread_resched();
 
-    THREAD_UNLOCK(state);
+    THREAD_SCHED_UNLOCK(state);
 }
 
 /**
@@ -908,6 +1517,7 @@ void thread_create_secondary_cpu_idle_thread(uint cpu) {
     t->flags = THREAD_FLAG_DETACHED | THREAD_FLAG_IDLE;
     thread_set_curr_cpu(t, cpu);
     thread_set_pinned_cpu(t, cpu);
+    t->last_cpu = cpu;
     wait_queue_init(&t->retcode_wait_queue);
 
     THREAD_LOCK(state);
@@ -981,8 +1591,8 @@ static size_t thread_stack_used(const thread_t *t) {
 void dump_thread(const thread_t *t) {
     dprintf(INFO, "dump_thread: t %p (%s)\n", t, t->name);
 #if WITH_SMP
-    dprintf(INFO, "\tstate %s, curr_cpu %d, pinned_cpu %d, priority %d, remaining quantum %d\n",
-            thread_state_to_str(t->state), t->curr_cpu, t->pinned_cpu, t->priority, t->remaining_quantum);
+    dprintf(INFO, "\tstate %s, curr_cpu %d, pinned_cpu %d, last_cpu %d, priority %d, remaining quantum %d\n",
+            thread_state_to_str(t->state), t->curr_cpu, t->pinned_cpu, t->last_cpu, t->priority, t->remaining_quantum);
 #else
     dprintf(INFO, "\tstate %s, priority %d, remaining quantum %d\n",
             thread_state_to_str(t->state), t->priority, t->remaining_quantum);
@@ -994,6 +1604,10 @@ void dump_thread(const thread_t *t) {
     dprintf(INFO, "\tstack %p, stack_size %zd\n", t->stack, t->stack_size);
 #endif
     dprintf(INFO, "\tentry %p, arg %p, flags 0x%x\n", t->entry, t->arg, t->flags);
+    if (t->flags & THREAD_FLAG_DEADLINE) {
+        dprintf(INFO, "\tdeadline: runtime %u, period %u, deadline %u, cpu %u, budget %d, next deadline %u\n",
+                t->dl.runtime, t->dl.period, t->dl.deadline, t->dl.cpu, t->dl.budget, t->dl.abs_deadline);
+    }
     dprintf(INFO, "\twait queue %p, wait queue ret %d\n", t->blocking_wait_queue, t->wait_queue_block_ret);
 #if WITH_KERNEL_VM
     dprintf(INFO, "\taspace %p\n", t->aspace);
@@ -1051,6 +1665,10 @@ void dump_threads_stats(void) {
         dprintf(INFO, "\t\tTotal run time: %lld, %u.%02u%%\n", t->stats.total_run_time,
                 percent / 100, percent % 100);
         dprintf(INFO, "\t\tLast time run: %lld\n", t->stats.last_run_timestamp);
+        if (thread_is_deadline(t)) {
+            dprintf(INFO, "\t\tDeadline periods: %lu, missed: %lu\n", t->stats.deadline_jobs,
+                    t->stats.deadline_misses);
+        }
     }
     THREAD_UNLOCK(state);
 }
@@ -1072,18 +1690,96 @@ static enum handler_return wait_queue_timeout_handler(timer_t *timer, lk_time_t
 
     DEBUG_ASSERT(thread->magic == THREAD_MAGIC);
 
-    spin_lock(&thread_lock);
-
     enum handler_return ret = INT_NO_RESCHEDULE;
     if (thread_unblock_from_wait_queue(thread, ERR_TIMED_OUT) >= NO_ERROR) {
         ret = INT_RESCHEDULE;
     }
 
-    spin_unlock(&thread_lock);
-
     return ret;
 }
 
+/* pull a blocked thread off of the wait queue it's blocked on and mark it ready */
+static void wait_queue_remove_thread(wait_queue_t *wait, thread_t *t, status_t wait_queue_error) {
+    DEBUG_ASSERT(t->magic == THREAD_MAGIC);
+    DEBUG_ASSERT(t->state == THREAD_BLOCKED);
+    DEBUG_ASSERT(t->blocking_wait_queue == wait);
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
+
+    list_delete(&t->queue_node);
+    wait->count--;
+
+    spin_lock(&t->lock);
+    t->blocking_wait_queue = NULL;
+    t->wait_queue_block_ret = wait_queue_error;
+    t->state = THREAD_READY;
+    spin_unlock(&t->lock);
+}
+
+/*
+ * Queue a freshly woken thread at the head of the local run queue and mark it to be
+ * switched to once the waker unlocks the wait queue, unless it's pinned elsewhere.
+ */
+static void wait_queue_handoff(thread_t *t) {
+    uint cpu = arch_curr_cpu_num();
+
+    if (thread_pinned_cpu(t) >= 0 && thread_pinned_cpu(t) != (int)cpu) {
+        insert_in_run_queue_and_wakeup(t);
+        return;
+    }
+
+    wait_for_thread_off_cpu(t);
+
+    struct run_queue *rq = &run_queues[cpu];
+    spin_lock(&rq->lock);
+    insert_in_run_queue_head(cpu, t);
+    if (!rq->handoff)
+        rq->handoff = t;
+    spin_unlock(&rq->lock);
+}
+
+/* switch to the thread handed this cpu by wait_queue_handoff(), if it's still queued here */
+static void wait_queue_run_handoff(void) {
+    uint cpu = arch_curr_cpu_num();
+    struct run_queue *rq = &run_queues[cpu];
+
+    /* only this cpu ever sets it, so it's safe to peek without the lock */
+    if (likely(!rq->handoff))
+        return;
+
+    spin_lock(&rq->lock);
+    thread_t *t = rq->handoff;
+    if (t) {
+        thread_t *current_thread = get_current_thread();
+
+        /* stick the current thread on the head of the run queue, so that the newly
+         * awakened thread gets a chance to run before the current one, but the current
+         * one doesn't get unnecessarilly punished.
+         */
+        rq->handoff = NULL;
+        current_thread->state = THREAD_READY;
+        if (likely(!thread_is_idle(current_thread))) {
+            insert_in_run_queue_head(cpu, current_thread);
+            /* deadline threads are ordered by deadline, and a throttled one is parked
+             * rather than queued, so only reorder within a normal priority queue */
+            if (!thread_is_deadline(t) && !thread_is_deadline(current_thread) &&
+                    t->priority == current_thread->priority) {
+                remove_from_run_queue(cpu, t);
+                insert_in_run_queue_head(cpu, t);
+            }
+        }
+        thread_resched();
+    }
+    spin_unlock(&run_queues[arch_curr_cpu_num()].lock);
+}
+
+void wait_queue_unlock_irqrestore(wait_queue_t *wait, arch_interrupt_saved_state_t state) {
+    DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC || wait->magic == 0);
+
+    spin_unlock(&wait->lock);
+    wait_queue_run_handoff();
+    arch_interrupt_restore(state);
+}
+
 /**
  * @brief  Block until a wait queue is notified.
  *
@@ -1099,6 +1795,10 @@ static enum handler_return wait_queue_timeout_handler(timer_t *timer, lk_time_t
  * waits indefinitely.  Otherwise, this function returns with
  * ERR_TIMED_OUT at the end of the timeout period.
  *
+ * The wait queue lock is released while the thread is blocked and
+ * reacquired before returning, unless the queue was destroyed in the
+ * meantime (ERR_OBJECT_DESTROYED), in which case it is left alone.
+ *
  * @return ERR_TIMED_OUT on timeout, else returns the return
  * value specified when the queue was woken by wait_queue_wake_one().
  */
@@ -1110,16 +1810,19 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout) {
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(current_thread->state == THREAD_RUNNING);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
     if (timeout == 0)
         return ERR_TIMED_OUT;
 
     list_add_tail(&wait->list, &current_thread->queue_node);
     wait->count++;
+
+    spin_lock(&current_thread->lock);
     current_thread->state = THREAD_BLOCKED;
     current_thread->blocking_wait_queue = wait;
     current_thread->wait_queue_block_ret = NO_ERROR;
+    spin_unlock(&current_thread->lock);
 
     /* if the timeout is nonzero or noninfinite, set a callback to yank us out of the queue */
     if (timeout != INFINITE_TIME) {
@@ -1127,14 +1830,27 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout) {
         timer_set_oneshot(&timer, timeout, wait_queue_timeout_handler, (void *)current_thread);
     }
 
+    /* grab the scheduler lock before letting go of the wait queue, so whoever
+     * wakes us waits for the switch away from this thread to finish */
+    spin_lock(&run_queues[arch_curr_cpu_num()].lock);
+    spin_unlock(&wait->lock);
+
     thread_resched();
 
-    /* we don't really know if the timer fired or not, so it's better safe to try to cancel it */
+    spin_unlock(&run_queues[arch_curr_cpu_num()].lock);
+
+    /* we don't really know if the timer fired or not, so it's better safe to try to cancel it.
+     * the callback may still be running on another cpu, in which case wait for it */
     if (timeout != INFINITE_TIME) {
-        timer_cancel(&timer);
+        timer_cancel_sync(&timer);
     }
 
-    return current_thread->wait_queue_block_ret;
+    /* a destroyed wait queue may already have been freed by whoever destroyed it */
+    status_t ret = current_thread->wait_queue_block_ret;
+    if (ret != ERR_OBJECT_DESTROYED)
+        spin_lock(&wait->lock);
+
+    return ret;
 }
 
 /**
@@ -1145,7 +1861,8 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout) {
  * run queue.
  *
  * @param wait  The wait queue to wake
- * @param reschedule  If true, the newly-woken thread will run immediately.
+ * @param reschedule  If true, the newly-woken thread will run as soon as the
+ * wait queue is unlocked with WAIT_QUEUE_UNLOCK().
  * @param wait_queue_error  The return value which the new thread will receive
  * from wait_queue_block().
  *
@@ -1153,40 +1870,25 @@ status_t wait_queue_block(wait_queue_t *wait, lk_time_t timeout) {
  */
 int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue_error) {
     thread_t *t;
-    int ret = 0;
-
-    thread_t *current_thread = get_current_thread();
 
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
-    t = list_remove_head_type(&wait->list, thread_t, queue_node);
-    if (t) {
-        wait->count--;
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-        t->state = THREAD_READY;
-        t->wait_queue_block_ret = wait_queue_error;
-        t->blocking_wait_queue = NULL;
+    t = list_peek_head_type(&wait->list, thread_t, queue_node);
+    if (!t)
+        return 0;
 
-        /* if we're instructed to reschedule, stick the current thread on the head
-         * of the run queue first, so that the newly awakened thread gets a chance to run
-         * before the current one, but the current one doesn't get unnecessarilly punished.
-         */
-        if (reschedule) {
-            current_thread->state = THREAD_READY;
-            insert_in_run_queue_head(current_thread);
-        }
-        insert_in_run_queue_head(t);
-        wakeup_cpu_for_thread(t);
-        if (reschedule) {
-            thread_resched();
-        }
-        ret = 1;
+    wait_queue_remove_thread(wait, t, wait_queue_error);
 
+    /* if we're instructed to reschedule, hand the cpu directly to the woken thread */
+    if (reschedule) {
+        wait_queue_handoff(t);
+    } else {
+        insert_in_run_queue_and_wakeup(t);
     }
 
-    return ret;
+    return 1;
 }
 
 
@@ -1198,7 +1900,8 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
  * run queue.
  *
  * @param wait  The wait queue to wake
- * @param reschedule  If true, the newly-woken threads will run immediately.
+ * @param reschedule  If true, the first newly-woken thread will run as soon as
+ * the wait queue is unlocked with WAIT_QUEUE_UNLOCK().
  * @param wait_queue_error  The return value which the new thread will receive
  * from wait_queue_block().
  *
@@ -1207,49 +1910,27 @@ int wait_queue_wake_one(wait_queue_t *wait, bool reschedule, status_t wait_queue
 int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue_error) {
     thread_t *t;
     int ret = 0;
-    uint32_t cpu_mask = 0;
-
-    thread_t *current_thread = get_current_thread();
+    mp_cpu_mask_t cpu_mask = 0;
 
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
-
-    if (reschedule && wait->count > 0) {
-        /* if we're instructed to reschedule, stick the current thread on the head
-         * of the run queue first, so that the newly awakened threads get a chance to run
-         * before the current one, but the current one doesn't get unnecessarilly punished.
-         */
-        current_thread->state = THREAD_READY;
-        insert_in_run_queue_head(current_thread);
-    }
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
-    /* pop all the threads off the wait queue into the run queue */
-    while ((t = list_remove_tail_type(&wait->list, thread_t, queue_node))) {
-        wait->count--;
-        DEBUG_ASSERT(t->state == THREAD_BLOCKED);
-        t->state = THREAD_READY;
-        t->wait_queue_block_ret = wait_queue_error;
-        t->blocking_wait_queue = NULL;
-        int pinned_cpu = thread_pinned_cpu(t);
-        if (pinned_cpu < 0) {
-            /* assumes MP_CPU_ALL_BUT_LOCAL is defined as all bits on */
-            cpu_mask = MP_CPU_ALL_BUT_LOCAL;
+    /* pop all the threads off the wait queue into the run queues */
+    while ((t = list_peek_head_type(&wait->list, thread_t, queue_node))) {
+        wait_queue_remove_thread(wait, t, wait_queue_error);
+        if (reschedule && ret == 0) {
+            wait_queue_handoff(t);
         } else {
-            cpu_mask |= (1U << pinned_cpu);
+            cpu_mask |= insert_in_run_queue(t);
         }
-        insert_in_run_queue_head(t);
         ret++;
     }
 
     DEBUG_ASSERT(wait->count == 0);
 
-    if (ret > 0) {
+    if (cpu_mask)
         mp_reschedule(cpu_mask, 0);
-        if (reschedule) {
-            thread_resched();
-        }
-    }
 
     return ret;
 }
@@ -1262,7 +1943,7 @@ int wait_queue_wake_all(wait_queue_t *wait, bool reschedule, status_t wait_queue
 void wait_queue_destroy(wait_queue_t *wait, bool reschedule) {
     DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
+    DEBUG_ASSERT(spin_lock_held(&wait->lock));
 
     wait_queue_wake_all(wait, reschedule, ERR_OBJECT_DESTROYED);
     wait->magic = 0;
@@ -1274,6 +1955,9 @@ void wait_queue_destroy(wait_queue_t *wait, bool reschedule) {
  * This function extracts a specific thread from a wait queue, wakes it, and
  * puts it at the head of the run queue.
  *
+ * Must be called with interrupts disabled and without the lock of the wait
+ * queue the thread is blocked on held.
+ *
  * @param t  The thread to wake
  * @param wait_queue_error  The return value which the new thread will receive
  *   from wait_queue_block().
@@ -1283,22 +1967,32 @@ void wait_queue_destroy(wait_queue_t *wait, bool reschedule) {
 status_t thread_unblock_from_wait_queue(thread_t *t, status_t wait_queue_error) {
     DEBUG_ASSERT(t->magic == THREAD_MAGIC);
     DEBUG_ASSERT(arch_ints_disabled());
-    DEBUG_ASSERT(spin_lock_held(&thread_lock));
 
-    if (t->state != THREAD_BLOCKED)
-        return ERR_NOT_BLOCKED;
+    /* the thread's lock keeps the wait queue it's blocked on from being woken and
+     * torn down underneath us, but nests inside the wait queue lock, so only try for
+     * the latter and back off in case its holder is trying to wake this thread */
+    for (;;) {
+        spin_lock(&t->lock);
 
-    DEBUG_ASSERT(t->blocking_wait_queue != NULL);
-    DEBUG_ASSERT(t->blocking_wait_queue->magic == WAIT_QUEUE_MAGIC);
-    DEBUG_ASSERT(list_in_list(&t->queue_node));
+        wait_queue_t *wait = t->blocking_wait_queue;
+        if (t->state != THREAD_BLOCKED || !wait) {
+            spin_unlock(&t->lock);
+            return ERR_NOT_BLOCKED;
+        }
 
-    list_delete(&t->queue_node);
-    t->blocking_wait_queue->count--;
-    t->blocking_wait_queue = NULL;
-    t->state = THREAD_READY;
-    t->wait_queue_block_ret = wait_queue_error;
-    insert_in_run_queue_head(t);
-    wakeup_cpu_for_thread(t);
+        if (spin_trylock(&wait->lock) == 0) {
+            spin_unlock(&t->lock);
 
-    return NO_ERROR;
+            DEBUG_ASSERT(wait->magic == WAIT_QUEUE_MAGIC);
+            DEBUG_ASSERT(list_in_list(&t->queue_node));
+
+            wait_queue_remove_thread(wait, t, wait_queue_error);
+            insert_in_run_queue_and_wakeup(t);
+
+            spin_unlock(&wait->lock);
+            return NO_ERROR;
+        }
+
+        spin_unlock(&t->lock);
+    }
 }
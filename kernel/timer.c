@@ -31,13 +31,54 @@
 #include <lk/trace.h>
 #include <platform.h>
 #include <platform/timer.h>
+#include <stdlib.h>
 
 #define LOCAL_TRACE 0
 
-spin_lock_t timer_lock;
+/*
+ * Each cpu keeps its timers in a hierarchical timing wheel. Level 0 has one slot per
+ * millisecond and every level above it covers TIMER_WHEEL_SLOTS times the span of the
+ * one below. A timer is hashed into the lowest level whose range covers its expiration
+ * and is cascaded down a level when the wheel reaches the start of its slot, so setting
+ * and canceling are O(1) and expiration stays exact to the millisecond. Timers further
+ * out than the top level covers wait in a pairing heap until they come into range.
+ *
+ * Wheel time is 64 bits wide so it never wraps. Everything before timer_state.curr has
+ * been processed.
+ */
+#ifndef TIMER_WHEEL_BITS
+#define TIMER_WHEEL_BITS 6
+#endif
+#ifndef TIMER_WHEEL_LEVELS
+#define TIMER_WHEEL_LEVELS 4
+#endif
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_TOP_SHIFT ((TIMER_WHEEL_LEVELS - 1) * TIMER_WHEEL_BITS)
+
+/* slot occupancy is tracked in a 64 bit mask per level, and the delay to the next
+ * event has to fit in a lk_time_t */
+STATIC_ASSERT(TIMER_WHEEL_SLOTS <= 64);
+STATIC_ASSERT(TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS < 31);
+
+/* values of timer_t.queued */
+enum {
+    TIMER_QUEUED_NONE = 0,
+    TIMER_QUEUED_WHEEL,
+    TIMER_QUEUED_HEAP,
+};
 
 struct timer_state {
-    struct list_node timer_queue;
+    spin_lock_t lock;
+    uint64_t curr; /* wheel time of the next millisecond to process */
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    uint64_t deadline; /* wheel time the hardware timer is set for, UINT64_MAX if none */
+#endif
+    uint count; /* timers in the wheel and heap */
+    timer_t *running; /* timer whose callback is currently being called */
+    timer_t *heap; /* timers too far out for the wheel, earliest first */
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    struct list_node wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
 } __CPU_ALIGN;
 
 static struct timer_state timers[SMP_MAX_CPUS];
@@ -51,57 +92,284 @@ void timer_initialize(timer_t *timer) {
     *timer = (timer_t)TIMER_INITIAL_VALUE(*timer);
 }
 
-static void insert_timer_in_queue(uint cpu, timer_t *timer) {
-    timer_t *entry;
+/* pairing heap of timers too far out for the wheel. Each node points at its first
+ * child and next sibling, and back at its previous sibling or, for a first child, its
+ * parent. Both arguments are detached roots.
+ */
+static timer_t *timer_heap_meld(timer_t *a, timer_t *b) {
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+
+    if (b->expires < a->expires) {
+        timer_t *temp = a;
+        a = b;
+        b = temp;
+    }
 
-    DEBUG_ASSERT(arch_ints_disabled());
+    b->heap_prev = a;
+    b->heap_next = a->heap_child;
+    if (a->heap_child)
+        a->heap_child->heap_prev = b;
+    a->heap_child = b;
+
+    return a;
+}
+
+/* meld a list of siblings back into a single heap, pairing them up left to right
+ * then merging the pairs right to left */
+static timer_t *timer_heap_merge_pairs(timer_t *first) {
+    timer_t *pairs = NULL;
 
-    LTRACEF("timer %p, cpu %u, scheduled %u, periodic %u\n", timer, cpu, timer->scheduled_time, timer->periodic_time);
+    while (first) {
+        timer_t *a = first;
+        timer_t *b = a->heap_next;
+        first = b ? b->heap_next : NULL;
 
-    list_for_every_entry(&timers[cpu].timer_queue, entry, timer_t, node) {
-        if (TIME_GT(entry->scheduled_time, timer->scheduled_time)) {
-            list_add_before(&entry->node, &timer->node);
+        a->heap_next = a->heap_prev = NULL;
+        if (b)
+            b->heap_next = b->heap_prev = NULL;
+
+        timer_t *pair = timer_heap_meld(a, b);
+        pair->heap_next = pairs;
+        pairs = pair;
+    }
+
+    timer_t *root = NULL;
+    while (pairs) {
+        timer_t *next = pairs->heap_next;
+        pairs->heap_next = NULL;
+        root = timer_heap_meld(root, pairs);
+        pairs = next;
+    }
+
+    return root;
+}
+
+static void timer_heap_remove(struct timer_state *state, timer_t *timer) {
+    if (timer == state->heap) {
+        state->heap = timer_heap_merge_pairs(timer->heap_child);
+    } else {
+        /* cut it out of its sibling list and meld its children back in */
+        if (timer->heap_prev->heap_child == timer)
+            timer->heap_prev->heap_child = timer->heap_next;
+        else
+            timer->heap_prev->heap_next = timer->heap_next;
+        if (timer->heap_next)
+            timer->heap_next->heap_prev = timer->heap_prev;
+
+        state->heap = timer_heap_meld(state->heap, timer_heap_merge_pairs(timer->heap_child));
+    }
+
+    timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+}
+
+/* convert a time within range of a lk_time_t delta of the wheel's current time to wheel time */
+static uint64_t timer_wheel_time(const struct timer_state *state, lk_time_t t) {
+    return state->curr + (int32_t)(t - (lk_time_t)state->curr);
+}
+
+static void timer_enqueue(struct timer_state *state, timer_t *timer) {
+    /* anything already due goes in the next slot to be processed */
+    if (timer->expires < state->curr)
+        timer->expires = state->curr;
+
+    state->count++;
+
+    /* lowest level whose range from the current time covers the expiration */
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint shift = level * TIMER_WHEEL_BITS;
+        if ((timer->expires >> shift) - (state->curr >> shift) < TIMER_WHEEL_SLOTS) {
+            uint index = (timer->expires >> shift) & TIMER_WHEEL_MASK;
+
+            list_add_tail(&state->wheel[level][index], &timer->node);
+            state->occupied[level] |= 1ULL << index;
+            timer->queued = TIMER_QUEUED_WHEEL;
+            timer->level = level;
             return;
         }
     }
 
-    /* walked off the end of the list */
-    list_add_tail(&timers[cpu].timer_queue, &timer->node);
+    timer->heap_child = timer->heap_next = timer->heap_prev = NULL;
+    state->heap = timer_heap_meld(state->heap, timer);
+    timer->queued = TIMER_QUEUED_HEAP;
 }
 
-static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_callback callback, void *arg) {
+static void timer_dequeue(struct timer_state *state, timer_t *timer) {
+    if (timer->queued == TIMER_QUEUED_WHEEL) {
+        uint index = (timer->expires >> (timer->level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+
+        list_delete(&timer->node);
+        if (list_is_empty(&state->wheel[timer->level][index]))
+            state->occupied[timer->level] &= ~(1ULL << index);
+    } else {
+        DEBUG_ASSERT(timer->queued == TIMER_QUEUED_HEAP);
+        timer_heap_remove(state, timer);
+    }
+
+    timer->queued = TIMER_QUEUED_NONE;
+    state->count--;
+}
+
+/* number of slots from index to the next occupied one, wrapping around the level */
+static inline uint timer_wheel_distance(uint64_t occupied, uint index) {
+    uint64_t rotated = occupied >> index;
+    if (index)
+        rotated |= occupied << (TIMER_WHEEL_SLOTS - index);
+
+    return __builtin_ctzll(rotated);
+}
+
+/* wheel time of the next expiration, cascade or heap timer coming into range,
+ * UINT64_MAX if there are no timers */
+static uint64_t timer_wheel_next_event(const struct timer_state *state) {
+    uint64_t next = UINT64_MAX;
+
+    for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (!state->occupied[level])
+            continue;
+
+        uint shift = level * TIMER_WHEEL_BITS;
+        uint index = (state->curr >> shift) & TIMER_WHEEL_MASK;
+        uint64_t event = ((state->curr >> shift) + timer_wheel_distance(state->occupied[level], index)) << shift;
+
+        /* upper level slots are always ahead of the current one, or exactly at it
+         * when it has yet to be cascaded */
+        DEBUG_ASSERT(event >= state->curr);
+        next = MIN(next, event);
+    }
+
+    if (state->heap) {
+        uint64_t event = ((state->heap->expires >> TIMER_WHEEL_TOP_SHIFT) - TIMER_WHEEL_SLOTS + 1) << TIMER_WHEEL_TOP_SHIFT;
+        next = MIN(next, event);
+    }
+
+    return next;
+}
+
+/* pull in heap timers that have come into range and cascade the slots that start at
+ * the current time, highest level first */
+static void timer_wheel_advance(struct timer_state *state) {
+    timer_t *timer;
+
+    while ((timer = state->heap) &&
+            (timer->expires >> TIMER_WHEEL_TOP_SHIFT) - (state->curr >> TIMER_WHEEL_TOP_SHIFT) < TIMER_WHEEL_SLOTS) {
+        timer_dequeue(state, timer);
+        timer_enqueue(state, timer);
+    }
+
+    for (uint level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        uint shift = level * TIMER_WHEEL_BITS;
+        if (state->curr & ((1ULL << shift) - 1))
+            continue;
+
+        uint index = (state->curr >> shift) & TIMER_WHEEL_MASK;
+        while ((timer = list_peek_head_type(&state->wheel[level][index], timer_t, node))) {
+            /* always lands on a lower level */
+            timer_dequeue(state, timer);
+            timer_enqueue(state, timer);
+        }
+    }
+}
+
+/* move the wheel up to the current time if nothing is due before it, so new timers
+ * are hashed relative to now rather than the last tick */
+static void timer_wheel_catch_up(struct timer_state *state, lk_time_t now) {
+    /* don't move the wheel out from under timer_tick */
+    if (state->running)
+        return;
+
+    if (state->count == 0) {
+        /* may have been idle for longer than a lk_time_t delta covers */
+        state->curr = now;
+        return;
+    }
+
+    uint64_t now64 = timer_wheel_time(state, now);
+    if (now64 > state->curr && timer_wheel_next_event(state) > now64)
+        state->curr = now64;
+}
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+/* set the local hardware timer for the next event in the wheel */
+static void timer_wheel_program(struct timer_state *state, uint64_t now) {
+    uint64_t next = timer_wheel_next_event(state);
+
+    state->deadline = next;
+    if (next == UINT64_MAX)
+        return;
+
+    lk_time_t delay = (next > now) ? next - now : 0;
+
+    LTRACEF("setting new timer for %u msecs\n", (uint)delay);
+    platform_set_oneshot_timer(timer_tick, NULL, delay);
+}
+#endif
+
+/* pick a time in [expires, expires + slack] that other timers are likely to share */
+static uint64_t timer_coalesce(const struct timer_state *state, uint64_t expires, lk_time_t slack) {
+    uint64_t latest = expires + slack;
+
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* ride along with the interrupt that's already coming if it's in the window */
+    if (state->deadline >= expires && state->deadline <= latest)
+        return state->deadline;
+#endif
+
+    /* otherwise take the most aligned time in the window, so timers with
+     * overlapping windows tend to land on the same millisecond */
+    uint64_t diff = (expires - 1) ^ latest;
+    if (diff == 0)
+        return latest;
+
+    uint shift = 63 - __builtin_clzll(diff);
+    return latest & ~((1ULL << shift) - 1);
+}
+
+static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, lk_time_t slack,
+                      timer_callback callback, void *arg) {
     lk_time_t now;
 
-    LTRACEF("timer %p, delay %u, period %u, callback %p, arg %p\n", timer, delay, period, callback, arg);
+    LTRACEF("timer %p, delay %u, period %u, slack %u, callback %p, arg %p\n", timer, delay, period, slack, callback, arg);
 
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
-    if (list_in_list(&timer->node)) {
+    if (timer->queued != TIMER_QUEUED_NONE) {
         panic("timer %p already in list\n", timer);
     }
 
     now = current_time();
     timer->scheduled_time = now + delay;
     timer->periodic_time = period;
+    timer->slack = slack;
     timer->callback = callback;
     timer->arg = arg;
 
     LTRACEF("scheduled time %u\n", timer->scheduled_time);
 
-    arch_interrupt_saved_state_t state = spin_lock_irqsave(&timer_lock);
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
 
     uint cpu = arch_curr_cpu_num();
-    insert_timer_in_queue(cpu, timer);
+    struct timer_state *ts = &timers[cpu];
+    spin_lock(&ts->lock);
+
+    timer_wheel_catch_up(ts, now);
+
+    timer->cpu = cpu;
+    timer->expires = timer_wheel_time(ts, timer->scheduled_time);
+    if (slack > 0)
+        timer->expires = timer_coalesce(ts, MAX(timer->expires, ts->curr), slack);
+    timer_enqueue(ts, timer);
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    if (list_peek_head_type(&timers[cpu].timer_queue, timer_t, node) == timer) {
-        /* we just modified the head of the timer queue */
-        LTRACEF("setting new timer for %u msecs\n", delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
+    if (timer_wheel_next_event(ts) < ts->deadline) {
+        /* the new timer is due before the hardware timer would go off */
+        timer_wheel_program(ts, timer_wheel_time(ts, now));
     }
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock_irqrestore(&ts->lock, state);
 }
 
 /**
@@ -121,7 +389,26 @@ static void timer_set(timer_t *timer, lk_time_t delay, lk_time_t period, timer_c
 void timer_set_oneshot(timer_t *timer, lk_time_t delay, timer_callback callback, void *arg) {
     if (delay == 0)
         delay = 1;
-    timer_set(timer, delay, 0, callback, arg);
+    timer_set(timer, delay, 0, 0, callback, arg);
+}
+
+/**
+ * @brief  Set up a timer that executes once, some time within a window
+ *
+ * Same as timer_set_oneshot(), but the callback may be called anywhere up to
+ * slack ms after the delay. The timer code uses the slack to fire the timer
+ * in the same interrupt as other timers, saving a wakeup.
+ *
+ * @param  timer The timer to use
+ * @param  delay The minimum delay, in ms, before the timer is executed
+ * @param  slack How much longer, in ms, the timer may be delayed
+ * @param  callback  The function to call when the timer expires
+ * @param  arg  The argument to pass to the callback
+ */
+void timer_set_oneshot_slack(timer_t *timer, lk_time_t delay, lk_time_t slack, timer_callback callback, void *arg) {
+    if (delay == 0)
+        delay = 1;
+    timer_set(timer, delay, 0, slack, callback, arg);
 }
 
 /**
@@ -141,7 +428,7 @@ void timer_set_oneshot(timer_t *timer, lk_time_t delay, timer_callback callback,
 void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callback, void *arg) {
     if (period == 0)
         period = 1;
-    timer_set(timer, period, period, callback, arg);
+    timer_set(timer, period, period, 0, callback, arg);
 }
 
 /**
@@ -150,45 +437,61 @@ void timer_set_periodic(timer_t *timer, lk_time_t period, timer_callback callbac
 void timer_cancel(timer_t *timer) {
     DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
 
-    arch_interrupt_saved_state_t state = spin_lock_irqsave(&timer_lock);
+    /* a timer lives in the queue of the cpu it was set on */
+    uint cpu = timer->cpu;
+    struct timer_state *ts = &timers[cpu];
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&ts->lock);
 
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    uint cpu = arch_curr_cpu_num();
-
-    timer_t *oldhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-#endif
-
-    if (list_in_list(&timer->node))
-        list_delete(&timer->node);
+    if (timer->queued != TIMER_QUEUED_NONE)
+        timer_dequeue(ts, timer);
 
     /* to keep it from being reinserted into the queue if called from
      * periodic timer callback.
      */
     timer->periodic_time = 0;
-    timer->callback = NULL;
-    timer->arg = NULL;
+
+    /* the tick handler took its own copy of these before calling a running timer,
+     * leave them alone for it */
+    if (ts->running != timer) {
+        timer->callback = NULL;
+        timer->arg = NULL;
+    }
 
 #if PLATFORM_HAS_DYNAMIC_TIMER
-    /* see if we've just modified the head of the timer queue */
-    timer_t *newhead = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (newhead == NULL) {
+    /* stop the hardware timer if that was the last timer. Otherwise leave it alone and
+     * take a spurious tick rather than searching the wheel, as does another cpu whose
+     * hardware timer can't be reprogrammed from here. */
+    if (cpu == arch_curr_cpu_num() && ts->count == 0 && ts->deadline != UINT64_MAX) {
         LTRACEF("clearing old hw timer, nothing in the queue\n");
         platform_stop_timer();
-    } else if (newhead != oldhead) {
-        lk_time_t delay;
-        lk_time_t now = current_time();
-
-        if (TIME_LT(newhead->scheduled_time, now))
-            delay = 0;
-        else
-            delay = newhead->scheduled_time - now;
-
-        LTRACEF("setting new timer to %u\n", (uint) delay);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
+        ts->deadline = UINT64_MAX;
     }
 #endif
 
-    spin_unlock_irqrestore(&timer_lock, state);
+    spin_unlock_irqrestore(&ts->lock, state);
+}
+
+/**
+ * @brief  Cancel a pending timer and wait for its callback to finish
+ *
+ * Same as timer_cancel(), but if the timer's callback is running on another cpu
+ * at the time, spins until it returns. Must not be called from the timer's own
+ * callback, or with a lock held that the callback acquires.
+ */
+void timer_cancel_sync(timer_t *timer) {
+    /* the cpu the timer was queued on is the only one that can be running it */
+    uint cpu = timer->cpu;
+
+    timer_cancel(timer);
+
+#if WITH_SMP
+    /* the callback can't be running on the local cpu, we'd be inside it */
+    if (cpu == arch_curr_cpu_num())
+        return;
+
+    while (*(timer_t * volatile *)&timers[cpu].running == timer)
+        ;
+#endif
 }
 
 /* called at interrupt time to process any pending timers */
@@ -202,73 +505,91 @@ static enum handler_return timer_tick(void *arg, lk_time_t now) {
 //  KEVLOG_TIMER_TICK(); // enable only if necessary
 
     uint cpu = arch_curr_cpu_num();
+    struct timer_state *ts = &timers[cpu];
 
     LTRACEF("cpu %u now %u, sp %p\n", cpu, now, __GET_FRAME());
 
-    spin_lock(&timer_lock);
-
-    for (;;) {
-        /* see if there's an event to process */
-        timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-        if (likely(timer == 0))
-            break;
-        LTRACEF("next item on timer queue %p at %u now %u (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
-        if (likely(TIME_LT(now, timer->scheduled_time)))
-            break;
-
-        /* process it */
-        LTRACEF("timer %p\n", timer);
-        DEBUG_ASSERT(timer && timer->magic == TIMER_MAGIC);
-        list_delete(&timer->node);
-
-        /* we pulled it off the list, release the list lock to handle it */
-        spin_unlock(&timer_lock);
-
-        LTRACEF("dequeued timer %p, scheduled %u periodic %u\n", timer, timer->scheduled_time, timer->periodic_time);
-
-        THREAD_STATS_INC(timers);
-
-        bool periodic = timer->periodic_time > 0;
-
-        LTRACEF("timer %p firing callback %p, arg %p\n", timer, timer->callback, timer->arg);
-        KEVLOG_TIMER_CALL(timer->callback, timer->arg);
-        if (timer->callback(timer, now, timer->arg) == INT_RESCHEDULE)
-            ret = INT_RESCHEDULE;
-
-        /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
-        spin_lock(&timer_lock);
-
-        /* if it was a periodic timer and it hasn't been requeued
-         * by the callback put it back in the list
-         */
-        if (periodic && !list_in_list(&timer->node) && timer->periodic_time > 0) {
-            LTRACEF("periodic timer, period %u\n", timer->periodic_time);
-            timer->scheduled_time += timer->periodic_time;
-            if (unlikely(TIME_LT(timer->scheduled_time, now))) {
-                timer->scheduled_time = now + timer->periodic_time;
+    spin_lock(&ts->lock);
+
+    uint64_t now64 = timer_wheel_time(ts, now);
+    uint64_t t;
+    uint fired = 0;
+    uint slacked = 0; /* fired late within their slack to share this interrupt */
+    while ((t = timer_wheel_next_event(ts)) <= now64) {
+        ts->curr = t;
+        timer_wheel_advance(ts);
+
+        /* fire everything in the level 0 slot for this millisecond */
+        struct list_node *slot = &ts->wheel[0][t & TIMER_WHEEL_MASK];
+        while ((timer = list_peek_head_type(slot, timer_t, node))) {
+            LTRACEF("next item on timer queue %p at %u now %u (%p, arg %p)\n", timer, timer->scheduled_time, now, timer->callback, timer->arg);
+
+            /* process it */
+            DEBUG_ASSERT(timer->magic == TIMER_MAGIC);
+            DEBUG_ASSERT(timer->expires == t);
+            timer_dequeue(ts, timer);
+            ts->running = timer;
+
+            /* a cancel on another cpu may clear these as soon as the lock is dropped */
+            timer_callback callback = timer->callback;
+            void *callback_arg = timer->arg;
+            bool periodic = timer->periodic_time > 0;
+
+            fired++;
+            if (timer->slack > 0 && (lk_time_t)t != timer->scheduled_time)
+                slacked++;
+
+            /* we pulled it off the list, release the list lock to handle it */
+            spin_unlock(&ts->lock);
+
+            LTRACEF("dequeued timer %p, scheduled %u periodic %u\n", timer, timer->scheduled_time, timer->periodic_time);
+
+            THREAD_STATS_INC(timers);
+
+            LTRACEF("timer %p firing callback %p, arg %p\n", timer, callback, callback_arg);
+            KEVLOG_TIMER_CALL(callback, callback_arg);
+            if (callback(timer, now, callback_arg) == INT_RESCHEDULE)
+                ret = INT_RESCHEDULE;
+
+            /* it may have been requeued or periodic, grab the lock so we can safely inspect it */
+            spin_lock(&ts->lock);
+
+            /* if it was a periodic timer and it hasn't been requeued
+             * by the callback put it back in the list
+             */
+            if (periodic && timer->queued == TIMER_QUEUED_NONE && timer->periodic_time > 0) {
+                LTRACEF("periodic timer, period %u\n", timer->periodic_time);
+                timer->scheduled_time += timer->periodic_time;
+                if (unlikely(TIME_LT(timer->scheduled_time, now))) {
+                    timer->scheduled_time = now + timer->periodic_time;
+                }
+                timer->cpu = cpu;
+                timer->expires = timer_wheel_time(ts, timer->scheduled_time);
+                timer_enqueue(ts, timer);
             }
-            insert_timer_in_queue(cpu, timer);
+            ts->running = NULL;
         }
     }
 
-#if PLATFORM_HAS_DYNAMIC_TIMER
-    /* reset the timer to the next event */
-    timer = list_peek_head_type(&timers[cpu].timer_queue, timer_t, node);
-    if (timer) {
-        /* has to be the case or it would have fired already */
-        DEBUG_ASSERT(TIME_GT(timer->scheduled_time, now));
+#if THREAD_STATS
+    /* every slack timer fired alongside another timer saved an interrupt of its own */
+    if (fired > 1)
+        thread_stats[cpu].timers_coalesced += MIN(slacked, fired - 1);
+#endif
 
-        lk_time_t delay = timer->scheduled_time - now;
+    /* nothing left due, skip the wheel past now */
+    if (now64 >= ts->curr)
+        ts->curr = now64 + 1;
 
-        LTRACEF("setting new timer for %u msecs for event %p\n", (uint)delay, timer);
-        platform_set_oneshot_timer(timer_tick, NULL, delay);
-    }
+#if PLATFORM_HAS_DYNAMIC_TIMER
+    /* reset the timer to the next event */
+    timer_wheel_program(ts, now64);
 
     /* we're done manipulating the timer queue */
-    spin_unlock(&timer_lock);
+    spin_unlock(&ts->lock);
 #else
     /* release the timer lock before calling the tick handler */
-    spin_unlock(&timer_lock);
+    spin_unlock(&ts->lock);
 
     /* let the scheduler have a shot to do quantum expiration, etc */
     /* in case of dynamic timer, the scheduler will set up a periodic timer */
@@ -280,9 +601,17 @@ static enum handler_return timer_tick(void *arg, lk_time_t now) {
 }
 
 void timer_init(void) {
-    timer_lock = SPIN_LOCK_INITIAL_VALUE;
     for (uint i = 0; i < SMP_MAX_CPUS; i++) {
-        list_initialize(&timers[i].timer_queue);
+        struct timer_state *ts = &timers[i];
+
+        spin_lock_init(&ts->lock);
+#if PLATFORM_HAS_DYNAMIC_TIMER
+        ts->deadline = UINT64_MAX;
+#endif
+        for (uint level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            for (uint slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+                list_initialize(&ts->wheel[level][slot]);
+        }
     }
 #if !PLATFORM_HAS_DYNAMIC_TIMER
     /* register for a periodic timer tick */
@@ -7,8 +7,10 @@
  */
 #include <kernel/vm.h>
 
+#include <arch/ops.h>
 #include <assert.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <lk/console_cmd.h>
 #include <lk/err.h>
 #include <lk/list.h>
@@ -36,10 +38,43 @@ static mutex_t lock = MUTEX_INITIAL_VALUE(lock);
 
 struct list_node *get_arena_list(void) { return &arena_list; }
 
+/*
+ * Each arena is a binary buddy allocator. Free pages are kept in naturally aligned
+ * blocks of 2^order pages, aligned by physical address so a block of a given order
+ * satisfies the same alignment, on a free list per order. The first page of a free
+ * block is marked with VM_PAGE_FLAG_BUDDY and records the order.
+ *
+ * In front of that, each cpu keeps a small cache of single pages so the common
+ * pmm_alloc_page()/pmm_free_page() case only touches cpu local state. Cached pages
+ * are not free as far as the arenas are concerned; they are flushed back when an
+ * allocation can't be satisfied without them.
+ */
+#ifndef PMM_PCPU_CACHE_SIZE
+#define PMM_PCPU_CACHE_SIZE 64
+#endif
+#define PMM_PCPU_CACHE_BATCH (PMM_PCPU_CACHE_SIZE / 2)
+
+struct pmm_pcpu_cache {
+    spin_lock_t lock;
+    uint count;
+    vm_page_t *pages[PMM_PCPU_CACHE_SIZE];
+} __CPU_ALIGN;
+
+static struct pmm_pcpu_cache pcpu_cache[SMP_MAX_CPUS];
+
 static inline bool page_is_free(const vm_page_t *page) {
     return !(page->flags & VM_PAGE_FLAG_NONFREE);
 }
 
+static inline size_t arena_page_count(const pmm_arena_t *a) {
+    return a->size / PAGE_SIZE;
+}
+
+/* physical page number of the first page in the arena */
+static inline size_t arena_base_pfn(const pmm_arena_t *a) {
+    return a->base / PAGE_SIZE;
+}
+
 paddr_t vm_page_to_paddr(const vm_page_t *page) {
     pmm_arena_t *a;
     list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
@@ -61,6 +96,224 @@ vm_page_t *paddr_to_vm_page(paddr_t addr) {
     return NULL;
 }
 
+/* the largest block order that starts at index and fits in count pages */
+static uint buddy_block_order(const pmm_arena_t *a, size_t index, size_t count) {
+    size_t pfn = arena_base_pfn(a) + index;
+    uint order = 0;
+
+    while (order < PMM_MAX_ORDER && !(pfn & (1UL << order)) && (2UL << order) <= count)
+        order++;
+
+    return order;
+}
+
+/* put a free block on its free list, merging it with its buddy as far as possible */
+static void buddy_free_block(pmm_arena_t *a, size_t index, uint order) {
+    size_t base_pfn = arena_base_pfn(a);
+
+    while (order < PMM_MAX_ORDER) {
+        /* a buddy before the start of the arena wraps around and fails the bounds check */
+        size_t buddy = ((base_pfn + index) ^ (1UL << order)) - base_pfn;
+        if (buddy >= arena_page_count(a))
+            break;
+
+        vm_page_t *b = &a->page_array[buddy];
+        if (!(b->flags & VM_PAGE_FLAG_BUDDY) || b->order != order)
+            break;
+
+        list_delete(&b->node);
+        b->flags &= ~VM_PAGE_FLAG_BUDDY;
+
+        index = MIN(index, buddy);
+        order++;
+    }
+
+    vm_page_t *p = &a->page_array[index];
+    p->flags |= VM_PAGE_FLAG_BUDDY;
+    p->order = order;
+    list_add_head(&a->free_list[order], &p->node);
+}
+
+/* free a run of allocated pages, as the largest aligned blocks that cover it */
+static void buddy_free_run(pmm_arena_t *a, size_t index, size_t count) {
+    while (count > 0) {
+        uint order = buddy_block_order(a, index, count);
+        size_t block_count = 1UL << order;
+
+        for (size_t i = index; i < index + block_count; i++) {
+            DEBUG_ASSERT(!list_in_list(&a->page_array[i].node));
+            a->page_array[i].flags &= ~VM_PAGE_FLAG_NONFREE;
+        }
+        a->free_count += block_count;
+
+        buddy_free_block(a, index, order);
+
+        index += block_count;
+        count -= block_count;
+    }
+}
+
+/* allocate a block of 2^order pages, splitting a larger one if there's no exact fit */
+static vm_page_t *buddy_alloc_block(pmm_arena_t *a, uint order) {
+    for (uint o = order; o <= PMM_MAX_ORDER; o++) {
+        vm_page_t *p = list_remove_head_type(&a->free_list[o], vm_page_t, node);
+        if (!p)
+            continue;
+
+        DEBUG_ASSERT(p->flags & VM_PAGE_FLAG_BUDDY);
+        DEBUG_ASSERT(p->order == o);
+        p->flags &= ~VM_PAGE_FLAG_BUDDY;
+
+        /* give back the upper half until the block is the size asked for */
+        while (o > order) {
+            o--;
+            vm_page_t *half = p + (1UL << o);
+            half->flags |= VM_PAGE_FLAG_BUDDY;
+            half->order = o;
+            list_add_head(&a->free_list[o], &half->node);
+        }
+
+        for (size_t i = 0; i < (1UL << order); i++) {
+            DEBUG_ASSERT(page_is_free(&p[i]));
+            p[i].flags |= VM_PAGE_FLAG_NONFREE;
+        }
+        a->free_count -= 1UL << order;
+
+        return p;
+    }
+
+    return NULL;
+}
+
+/* allocate a specific free page, splitting the free block it's in around it */
+static void buddy_alloc_page(pmm_arena_t *a, size_t index) {
+    size_t base_pfn = arena_base_pfn(a);
+    size_t pfn = base_pfn + index;
+
+    DEBUG_ASSERT(page_is_free(&a->page_array[index]));
+
+    /* find the head of the block containing the page */
+    for (uint order = 0; order <= PMM_MAX_ORDER; order++) {
+        size_t head = ((pfn >> order) << order) - base_pfn;
+        if (head >= arena_page_count(a))
+            break;
+
+        vm_page_t *p = &a->page_array[head];
+        if (!(p->flags & VM_PAGE_FLAG_BUDDY) || p->order != order)
+            continue;
+
+        list_delete(&p->node);
+        p->flags &= ~VM_PAGE_FLAG_BUDDY;
+
+        /* halve the block, freeing the half the page isn't in */
+        while (order > 0) {
+            order--;
+            if (index >= head + (1UL << order)) {
+                buddy_free_block(a, head, order);
+                head += 1UL << order;
+            } else {
+                buddy_free_block(a, head + (1UL << order), order);
+            }
+        }
+
+        DEBUG_ASSERT(head == index);
+        a->page_array[index].flags |= VM_PAGE_FLAG_NONFREE;
+        a->free_count--;
+        return;
+    }
+
+    panic("pmm: free page %p not in a free block\n", &a->page_array[index]);
+}
+
+static pmm_arena_t *page_to_arena(const vm_page_t *page) {
+    pmm_arena_t *a;
+    list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
+        if (PAGE_BELONGS_TO_ARENA(page, a))
+            return a;
+    }
+    return NULL;
+}
+
+/* return a page to its arena, the lock must be held */
+static bool free_page_locked(vm_page_t *page) {
+    DEBUG_ASSERT(!list_in_list(&page->node));
+    DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_NONFREE);
+
+    pmm_arena_t *a = page_to_arena(page);
+    if (!a)
+        return false;
+
+    buddy_free_run(a, page - a->page_array, 1);
+    return true;
+}
+
+/* return every page in the per cpu caches to the arenas, the lock must be held */
+static size_t pcpu_cache_flush_locked(void) {
+    DEBUG_ASSERT(is_mutex_held(&lock));
+
+    size_t count = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        struct pmm_pcpu_cache *c = &pcpu_cache[i];
+
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&c->lock);
+        while (c->count > 0) {
+            vm_page_t *page = c->pages[--c->count];
+            page->flags &= ~VM_PAGE_FLAG_CACHED;
+            free_page_locked(page);
+            count++;
+        }
+        spin_unlock_irqrestore(&c->lock, state);
+    }
+
+    LTRACEF("flushed %zu pages\n", count);
+    return count;
+}
+
+static vm_page_t *pcpu_cache_get(void) {
+    vm_page_t *page = NULL;
+
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct pmm_pcpu_cache *c = &pcpu_cache[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    if (c->count > 0) {
+        page = c->pages[--c->count];
+        page->flags &= ~VM_PAGE_FLAG_CACHED;
+    }
+    spin_unlock_irqrestore(&c->lock, state);
+
+    return page;
+}
+
+/* stash pages in the current cpu's cache, returns how many fit */
+static uint pcpu_cache_put(vm_page_t **pages, uint count) {
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct pmm_pcpu_cache *c = &pcpu_cache[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    uint put = MIN(count, PMM_PCPU_CACHE_SIZE - c->count);
+    for (uint i = 0; i < put; i++) {
+        pages[i]->flags |= VM_PAGE_FLAG_CACHED;
+        c->pages[c->count++] = pages[i];
+    }
+    spin_unlock_irqrestore(&c->lock, state);
+
+    return put;
+}
+
+/* take up to count pages out of the current cpu's cache */
+static uint pcpu_cache_take(vm_page_t **pages, uint count) {
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct pmm_pcpu_cache *c = &pcpu_cache[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    uint taken = MIN(count, c->count);
+    for (uint i = 0; i < taken; i++) {
+        pages[i] = c->pages[--c->count];
+        pages[i]->flags &= ~VM_PAGE_FLAG_CACHED;
+    }
+    spin_unlock_irqrestore(&c->lock, state);
+
+    return taken;
+}
+
 status_t pmm_add_arena(pmm_arena_t *arena) {
     LTRACEF("arena %p name '%s' base 0x%lx size 0x%zx\n", arena, arena->name, arena->base, arena->size);
 
@@ -84,7 +337,8 @@ done_add:
 
     /* zero out some of the structure */
     arena->free_count = 0;
-    list_initialize(&arena->free_list);
+    for (uint i = 0; i <= PMM_MAX_ORDER; i++)
+        list_initialize(&arena->free_list[i]);
 
     /* allocate an array of pages to back this one */
     size_t page_count = arena->size / PAGE_SIZE;
@@ -93,16 +347,34 @@ done_add:
     /* initialize all of the pages */
     memset(arena->page_array, 0, page_count * sizeof(vm_page_t));
 
-    /* add them to the free list */
-    for (size_t i = 0; i < page_count; i++) {
-        vm_page_t *p = &arena->page_array[i];
+    /* carve the arena into the largest aligned blocks that fit and free them */
+    buddy_free_run(arena, 0, page_count);
+
+    return NO_ERROR;
+}
 
-        list_add_tail(&arena->free_list, &p->node);
+/* allocate single pages straight from the arenas, the lock must be held */
+static uint alloc_pages_locked(uint count, vm_page_t **pages, struct list_node *list) {
+    uint allocated = 0;
 
-        arena->free_count++;
+    /* walk the arenas in order, allocating as many pages as we can from each */
+    pmm_arena_t *a;
+    list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
+        while (allocated < count && a->free_count > 0) {
+            vm_page_t *page = buddy_alloc_block(a, 0);
+            if (!page)
+                break;
+
+            if (pages)
+                pages[allocated] = page;
+            if (list)
+                list_add_tail(list, &page->node);
+
+            allocated++;
+        }
     }
 
-    return NO_ERROR;
+    return allocated;
 }
 
 size_t pmm_alloc_pages(uint count, struct list_node *list) {
@@ -111,45 +383,56 @@ size_t pmm_alloc_pages(uint count, struct list_node *list) {
     /* list must be initialized prior to calling this */
     DEBUG_ASSERT(list);
 
-    uint allocated = 0;
     if (count == 0)
         return 0;
 
-    mutex_acquire(&lock);
-
-    /* walk the arenas in order, allocating as many pages as we can from each */
-    pmm_arena_t *a;
-    list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
-        while (allocated < count && a->free_count > 0) {
-            vm_page_t *page = list_remove_head_type(&a->free_list, vm_page_t, node);
-            if (!page)
-                goto done;
+    if (count == 1) {
+        vm_page_t *page = pmm_alloc_page();
+        if (!page)
+            return 0;
 
-            a->free_count--;
+        list_add_tail(list, &page->node);
+        return 1;
+    }
 
-            page->flags |= VM_PAGE_FLAG_NONFREE;
-            list_add_tail(list, &page->node);
+    mutex_acquire(&lock);
 
-            allocated++;
-        }
-    }
+    uint allocated = alloc_pages_locked(count, NULL, list);
+    if (allocated < count && pcpu_cache_flush_locked() > 0)
+        allocated += alloc_pages_locked(count - allocated, NULL, list);
 
-done:
     mutex_release(&lock);
     return allocated;
 }
 
 vm_page_t *pmm_alloc_page(void) {
-    struct list_node list = LIST_INITIAL_VALUE(list);
+    vm_page_t *page = pcpu_cache_get();
+    if (page)
+        return page;
 
-    size_t ret = pmm_alloc_pages(1, &list);
-    if (ret == 0) {
+    /* the cache is empty, refill half of it from the arenas */
+    vm_page_t *pages[PMM_PCPU_CACHE_BATCH];
+
+    mutex_acquire(&lock);
+    uint count = alloc_pages_locked(countof(pages), pages, NULL);
+    if (count == 0 && pcpu_cache_flush_locked() > 0)
+        count = alloc_pages_locked(countof(pages), pages, NULL);
+    mutex_release(&lock);
+
+    if (count == 0)
         return NULL;
-    }
 
-    DEBUG_ASSERT(ret == 1);
+    page = pages[--count];
+    uint put = pcpu_cache_put(pages, count);
+    if (put < count) {
+        /* we moved to another cpu with a full cache, put the rest back */
+        mutex_acquire(&lock);
+        for (uint i = put; i < count; i++)
+            free_page_locked(pages[i]);
+        mutex_release(&lock);
+    }
 
-    return list_peek_head_type(&list, vm_page_t, node);
+    return page;
 }
 
 size_t pmm_alloc_range(paddr_t address, uint count, struct list_node *list) {
@@ -165,6 +448,8 @@ size_t pmm_alloc_range(paddr_t address, uint count, struct list_node *list) {
 
     mutex_acquire(&lock);
 
+    bool flushed = false;
+
     /* walk through the arenas, looking to see if the physical page belongs to it */
     pmm_arena_t *a;
     list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
@@ -174,18 +459,19 @@ size_t pmm_alloc_range(paddr_t address, uint count, struct list_node *list) {
             DEBUG_ASSERT(index < a->size / PAGE_SIZE);
 
             vm_page_t *page = &a->page_array[index];
+            if (!flushed && (page->flags & VM_PAGE_FLAG_CACHED)) {
+                /* the page is sitting in a cpu's page cache, give them all back */
+                pcpu_cache_flush_locked();
+                flushed = true;
+            }
             if (page->flags & VM_PAGE_FLAG_NONFREE) {
                 /* we hit an allocated page */
                 break;
             }
 
-            DEBUG_ASSERT(list_in_list(&page->node));
-
-            list_delete(&page->node);
-            page->flags |= VM_PAGE_FLAG_NONFREE;
+            buddy_alloc_page(a, index);
             list_add_tail(list, &page->node);
 
-            a->free_count--;
             allocated++;
             address += PAGE_SIZE;
         }
@@ -209,21 +495,9 @@ size_t pmm_free(struct list_node *list) {
     while (!list_is_empty(list)) {
         vm_page_t *page = list_remove_head_type(list, vm_page_t, node);
 
-        DEBUG_ASSERT(!list_in_list(&page->node));
-        DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_NONFREE);
-
         /* see which arena this page belongs to and add it */
-        pmm_arena_t *a;
-        list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
-            if (PAGE_BELONGS_TO_ARENA(page, a)) {
-                page->flags &= ~VM_PAGE_FLAG_NONFREE;
-
-                list_add_head(&a->free_list, &page->node);
-                a->free_count++;
-                count++;
-                break;
-            }
-        }
+        if (free_page_locked(page))
+            count++;
     }
 
     mutex_release(&lock);
@@ -231,12 +505,23 @@ size_t pmm_free(struct list_node *list) {
 }
 
 size_t pmm_free_page(vm_page_t *page) {
-    struct list_node list;
-    list_initialize(&list);
+    DEBUG_ASSERT(!list_in_list(&page->node));
+    DEBUG_ASSERT(page->flags & VM_PAGE_FLAG_NONFREE);
 
-    list_add_head(&list, &page->node);
+    if (pcpu_cache_put(&page, 1) == 1)
+        return 1;
 
-    return pmm_free(&list);
+    /* the cache is full, return half of it to the arenas along with this page */
+    vm_page_t *pages[PMM_PCPU_CACHE_BATCH];
+    uint count = pcpu_cache_take(pages, countof(pages));
+
+    mutex_acquire(&lock);
+    size_t ret = free_page_locked(page) ? 1 : 0;
+    for (uint i = 0; i < count; i++)
+        free_page_locked(pages[i]);
+    mutex_release(&lock);
+
+    return ret;
 }
 
 /* physically allocate a run from arenas marked as KMAP */
@@ -250,6 +535,9 @@ void *pmm_alloc_kpages(uint count, struct list_node *list) {
             return NULL;
         }
 
+        if (list)
+            list_add_tail(list, &p->node);
+
         return paddr_to_kvaddr(vm_page_to_paddr(p));
     }
 
@@ -266,6 +554,11 @@ size_t pmm_free_kpages(void *_ptr, uint count) {
 
     uint8_t *ptr = (uint8_t *)_ptr;
 
+    if (count == 1) {
+        vm_page_t *p = paddr_to_vm_page(vaddr_to_paddr(ptr));
+        return p ? pmm_free_page(p) : 0;
+    }
+
     struct list_node list;
     list_initialize(&list);
 
@@ -282,6 +575,87 @@ size_t pmm_free_kpages(void *_ptr, uint count) {
     return pmm_free(&list);
 }
 
+/*
+ * Find a free run by walking the page array, for runs bigger or more aligned than the
+ * largest buddy block, or when the free space is too fragmented to hold a whole block.
+ * Returns the index of the start of the run or -1.
+ */
+static ssize_t scan_contiguous(const pmm_arena_t *a, uint count, uint8_t alignment_log2) {
+    /* walk the list starting at alignment boundaries.
+     * calculate the starting offset into this arena, based on the
+     * base address of the arena to handle the case where the arena
+     * is not aligned on the same boundary requested.
+     */
+    paddr_t rounded_base = ROUNDUP(a->base, 1UL << alignment_log2);
+    if (rounded_base < a->base || rounded_base > a->base + a->size - 1)
+        return -1;
+
+    uint aligned_offset = (rounded_base - a->base) / PAGE_SIZE;
+    uint start = aligned_offset;
+    LTRACEF("starting search at aligned offset %u\n", start);
+    LTRACEF("arena base 0x%lx size %zu\n", a->base, a->size);
+
+retry:
+    /* search while we're still within the arena and have a chance of finding a slot
+       (start + count < end of arena) */
+    while ((start < a->size / PAGE_SIZE) &&
+            ((start + count) <= a->size / PAGE_SIZE)) {
+        const vm_page_t *p = &a->page_array[start];
+        for (uint i = 0; i < count; i++) {
+            if (p->flags & VM_PAGE_FLAG_NONFREE) {
+                /* this run is broken, break out of the inner loop.
+                 * start over at the next alignment boundary
+                 */
+                start = ROUNDUP(start - aligned_offset + i + 1, 1UL << (alignment_log2 - PAGE_SIZE_SHIFT)) + aligned_offset;
+                goto retry;
+            }
+            p++;
+        }
+
+        return start;
+    }
+
+    return -1;
+}
+
+/* allocate a contiguous run out of one of the KMAP arenas, the lock must be held */
+static ssize_t alloc_contiguous_locked(uint count, uint8_t alignment_log2, pmm_arena_t **arena) {
+    /* the smallest block that holds the run and is aligned enough */
+    uint order = MAX(log2_uint(round_up_pow2_u32(count)), (uint)(alignment_log2 - PAGE_SIZE_SHIFT));
+
+    pmm_arena_t *a;
+    list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
+        // XXX make this a flag to only search kmap?
+        if (!(a->flags & PMM_ARENA_FLAG_KMAP))
+            continue;
+
+        if (order <= PMM_MAX_ORDER) {
+            vm_page_t *p = buddy_alloc_block(a, order);
+            if (p) {
+                /* trim the block down to the size asked for */
+                size_t index = p - a->page_array;
+                buddy_free_run(a, index + count, (1UL << order) - count);
+                *arena = a;
+                return index;
+            }
+
+            /* no single free block is that big, but a run of the size and alignment
+             * actually asked for may still span smaller ones */
+        }
+
+        ssize_t start = scan_contiguous(a, count, alignment_log2);
+        if (start < 0)
+            continue;
+
+        for (size_t i = start; i < (size_t)start + count; i++)
+            buddy_alloc_page(a, i);
+        *arena = a;
+        return start;
+    }
+
+    return -1;
+}
+
 size_t pmm_alloc_contiguous(uint count, uint8_t alignment_log2, paddr_t *pa, struct list_node *list) {
     LTRACEF("count %u, align %u\n", count, alignment_log2);
 
@@ -293,83 +667,48 @@ size_t pmm_alloc_contiguous(uint count, uint8_t alignment_log2, paddr_t *pa, str
     mutex_acquire(&lock);
 
     pmm_arena_t *a;
-    list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
-        // XXX make this a flag to only search kmap?
-        if (a->flags & PMM_ARENA_FLAG_KMAP) {
-            /* walk the list starting at alignment boundaries.
-             * calculate the starting offset into this arena, based on the
-             * base address of the arena to handle the case where the arena
-             * is not aligned on the same boundary requested.
-             */
-            paddr_t rounded_base = ROUNDUP(a->base, 1UL << alignment_log2);
-            if (rounded_base < a->base || rounded_base > a->base + a->size - 1)
-                continue;
-
-            uint aligned_offset = (rounded_base - a->base) / PAGE_SIZE;
-            uint start = aligned_offset;
-            LTRACEF("starting search at aligned offset %u\n", start);
-            LTRACEF("arena base 0x%lx size %zu\n", a->base, a->size);
+    ssize_t start = alloc_contiguous_locked(count, alignment_log2, &a);
+    if (start < 0 && pcpu_cache_flush_locked() > 0)
+        start = alloc_contiguous_locked(count, alignment_log2, &a);
 
-retry:
-            /* search while we're still within the arena and have a chance of finding a slot
-               (start + count < end of arena) */
-            while ((start < a->size / PAGE_SIZE) &&
-                    ((start + count) <= a->size / PAGE_SIZE)) {
-                vm_page_t *p = &a->page_array[start];
-                for (uint i = 0; i < count; i++) {
-                    if (p->flags & VM_PAGE_FLAG_NONFREE) {
-                        /* this run is broken, break out of the inner loop.
-                         * start over at the next alignment boundary
-                         */
-                        start = ROUNDUP(start - aligned_offset + i + 1, 1UL << (alignment_log2 - PAGE_SIZE_SHIFT)) + aligned_offset;
-                        goto retry;
-                    }
-                    p++;
-                }
-
-                /* we found a run */
-                LTRACEF("found run from pn %u to %u\n", start, start + count);
-
-                /* remove the pages from the run out of the free list */
-                for (uint i = start; i < start + count; i++) {
-                    p = &a->page_array[i];
-                    DEBUG_ASSERT(!(p->flags & VM_PAGE_FLAG_NONFREE));
-                    DEBUG_ASSERT(list_in_list(&p->node));
-
-                    list_delete(&p->node);
-                    p->flags |= VM_PAGE_FLAG_NONFREE;
-                    a->free_count--;
-
-                    if (list)
-                        list_add_tail(list, &p->node);
-                }
-
-                if (pa)
-                    *pa = a->base + start * PAGE_SIZE;
-
-                mutex_release(&lock);
-
-                return count;
-            }
-        }
+    mutex_release(&lock);
+
+    if (start < 0) {
+        LTRACEF("couldn't find run\n");
+        return 0;
     }
 
-    mutex_release(&lock);
+    /* we found a run */
+    LTRACEF("found run from pn %zd to %zd\n", start, start + count);
+
+    if (list) {
+        for (size_t i = start; i < (size_t)start + count; i++)
+            list_add_tail(list, &a->page_array[i].node);
+    }
+
+    if (pa)
+        *pa = a->base + start * PAGE_SIZE;
 
-    LTRACEF("couldn't find run\n");
-    return 0;
+    return count;
 }
 
 static void dump_page(const vm_page_t *page) {
     printf("page %p: address 0x%lx flags 0x%x\n", page, vm_page_to_paddr(page), page->flags);
 }
 
-static void dump_arena(const pmm_arena_t *arena, bool dump_pages) {
+static void dump_arena(pmm_arena_t *arena, bool dump_pages) {
     printf("arena %p: name '%s' base 0x%lx size 0x%zx priority %u flags 0x%x\n",
            arena, arena->name, arena->base, arena->size, arena->priority, arena->flags);
     printf("\tpage_array %p, free_count %zu\n",
            arena->page_array, arena->free_count);
 
+    /* dump the number of free blocks of each size */
+    printf("\tfree blocks by order:");
+    for (uint i = 0; i <= PMM_MAX_ORDER; i++) {
+        printf(" %zu", list_length(&arena->free_list[i]));
+    }
+    printf("\n");
+
     /* dump all of the pages */
     if (dump_pages) {
         for (size_t i = 0; i < arena->size / PAGE_SIZE; i++) {
@@ -411,6 +750,7 @@ usage:
         printf("%s alloc_contig <count> <alignment>\n", argv[0].str);
         printf("%s dump_alloced\n", argv[0].str);
         printf("%s free_alloced\n", argv[0].str);
+        printf("%s flush_caches\n", argv[0].str);
         return ERR_GENERIC;
     }
 
@@ -421,6 +761,12 @@ usage:
         list_for_every_entry(&arena_list, a, pmm_arena_t, node) {
             dump_arena(a, false);
         }
+
+        printf("per cpu page caches:");
+        for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+            printf(" %u", pcpu_cache[i].count);
+        }
+        printf("\n");
     } else if (!strcmp(argv[1].str, "alloc")) {
         if (argc < 3) goto notenoughargs;
 
@@ -489,6 +835,11 @@ usage:
     } else if (!strcmp(argv[1].str, "free_alloced")) {
         size_t err = pmm_free(&allocated);
         printf("pmm_free returns %zu\n", err);
+    } else if (!strcmp(argv[1].str, "flush_caches")) {
+        mutex_acquire(&lock);
+        size_t count = pcpu_cache_flush_locked();
+        mutex_release(&lock);
+        printf("flushed %zu pages\n", count);
     } else {
         printf("unknown command\n");
         goto usage;
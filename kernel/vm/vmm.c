@@ -6,10 +6,13 @@
  * https://opensource.org/licenses/MIT
  */
 #include <assert.h>
+#include <kernel/event.h>
 #include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <kernel/vm.h>
 #include <lk/console_cmd.h>
 #include <lk/err.h>
+#include <lk/init.h>
 #include <lk/trace.h>
 #include <string.h>
 #include "kernel/thread.h"
@@ -26,6 +29,30 @@ static void dump_aspace(const vmm_aspace_t *a);
 static void dump_region(const vmm_region_t *r);
 
 static status_t vmm_remove_region_locked(vmm_aspace_t *aspace, vaddr_t vaddr, vmm_region_t **r_out);
+static vmm_region_t *vmm_find_region(const vmm_aspace_t *aspace, vaddr_t vaddr);
+
+/*
+ * Pool of pages zeroed ahead of time by a low priority thread, so commit on demand
+ * faults usually don't have to clear a page themselves. Set VMM_ZERO_POOL_SIZE to 0
+ * to zero every page at fault time instead.
+ */
+#ifndef VMM_ZERO_POOL_SIZE
+#define VMM_ZERO_POOL_SIZE 64
+#endif
+
+static struct {
+    spin_lock_t lock;
+    uint count;
+    struct list_node pages;
+    event_t event;
+
+    /* stats */
+    ulong faults;
+    ulong pool_hits;
+} zero_pool = {
+    .lock = SPIN_LOCK_INITIAL_VALUE,
+    .pages = LIST_INITIAL_VALUE(zero_pool.pages),
+};
 
 void vmm_init_preheap(void) {
     /* initialize the kernel address space */
@@ -290,6 +317,51 @@ static vmm_region_t *alloc_region(vmm_aspace_t *aspace, const char *name, size_t
     return r;
 }
 
+/* raise the alignment of big allocations so the arch can map them with large pages */
+static uint8_t large_page_align(size_t size, uint8_t align_pow2) {
+#if ARCH_MMU_LARGE_PAGE_SHIFT
+    if (size >= (1UL << ARCH_MMU_LARGE_PAGE_SHIFT))
+        return MAX(align_pow2, ARCH_MMU_LARGE_PAGE_SHIFT);
+#endif
+    return align_pow2;
+}
+
+/* map a list of pages at va, one arch_mmu_map call per physically contiguous run */
+static status_t map_page_runs(vmm_aspace_t *aspace, vaddr_t va, struct list_node *page_list,
+                              uint arch_mmu_flags) {
+    vm_page_t *p;
+    paddr_t run_pa = 0;
+    uint run_count = 0;
+
+    list_for_every_entry(page_list, p, vm_page_t, node) {
+        paddr_t pa = vm_page_to_paddr(p);
+        DEBUG_ASSERT(IS_PAGE_ALIGNED(pa));
+
+        if (run_count > 0 && pa == run_pa + run_count * PAGE_SIZE) {
+            run_count++;
+            continue;
+        }
+
+        if (run_count > 0) {
+            status_t err = arch_mmu_map(&aspace->arch_aspace, va, run_pa, run_count, arch_mmu_flags);
+            if (err < NO_ERROR) // TODO: deal with difference between 0 and 1 returns in some arches
+                return err;
+            va += run_count * PAGE_SIZE;
+        }
+
+        run_pa = pa;
+        run_count = 1;
+    }
+
+    if (run_count > 0) {
+        status_t err = arch_mmu_map(&aspace->arch_aspace, va, run_pa, run_count, arch_mmu_flags);
+        if (err < NO_ERROR)
+            return err;
+    }
+
+    return NO_ERROR;
+}
+
 status_t vmm_reserve_space(vmm_aspace_t *aspace, const char *name, size_t size, vaddr_t vaddr) {
     LTRACEF("aspace %p name '%s' size 0x%zx vaddr 0x%lx\n", aspace, name, size, vaddr);
 
@@ -355,6 +427,11 @@ status_t vmm_alloc_physical(vmm_aspace_t *aspace, const char *name, size_t size,
         vaddr = (vaddr_t)*ptr;
     }
 
+    /* if the physical range is lined up for large pages, line the virtual one up to match */
+    uint8_t large_align = large_page_align(size, align_log2);
+    if (IS_ALIGNED(paddr, 1UL << large_align))
+        align_log2 = large_align;
+
     mutex_acquire(&vmm_lock);
 
     /* allocate a region and put it in the aspace list */
@@ -423,13 +500,32 @@ status_t vmm_alloc_contiguous(vmm_aspace_t *aspace, const char *name, size_t siz
         vaddr = (vaddr_t)*ptr;
     }
 
+    /* just reserve the space, the fault handler fills it in a page at a time */
+    if (vmm_flags & VMM_FLAG_COMMIT_ON_DEMAND) {
+        mutex_acquire(&vmm_lock);
+
+        vmm_region_t *r = alloc_region(aspace, name, size, vaddr, align_pow2, vmm_flags,
+                                       VMM_REGION_FLAG_PHYSICAL | VMM_REGION_FLAG_COMMIT_ON_DEMAND,
+                                       arch_mmu_flags);
+        if (r && ptr)
+            *ptr = (void *)r->base;
+
+        mutex_release(&vmm_lock);
+        return r ? NO_ERROR : ERR_NO_MEMORY;
+    }
+
     /* allocate physical memory up front, in case it cant be satisfied */
     struct list_node page_list;
     list_initialize(&page_list);
 
     paddr_t pa = 0;
-    /* allocate a run of physical pages */
-    size_t count = pmm_alloc_contiguous(size / PAGE_SIZE, align_pow2, &pa, &page_list);
+    /* allocate a run of physical pages, lined up for large pages if we can */
+    uint8_t large_align = large_page_align(size, align_pow2);
+    size_t count = pmm_alloc_contiguous(size / PAGE_SIZE, large_align, &pa, &page_list);
+    if (count == 0 && large_align != align_pow2)
+        count = pmm_alloc_contiguous(size / PAGE_SIZE, align_pow2, &pa, &page_list);
+    else
+        align_pow2 = large_align;
     if (count < size / PAGE_SIZE) {
         DEBUG_ASSERT(count == 0); /* check that the pmm didn't allocate a partial run */
         err = ERR_NO_MEMORY;
@@ -511,12 +607,24 @@ status_t vmm_alloc(vmm_aspace_t *aspace, const char *name, size_t size, void **p
     }
 
     /* allocate physical memory up front, in case it cant be satisfied */
-
-    /* allocate a random pile of pages */
     struct list_node page_list;
     list_initialize(&page_list);
 
-    size_t count = pmm_alloc_pages(size / PAGE_SIZE, &page_list);
+    size_t count = 0;
+    align_pow2 = large_page_align(size, align_pow2);
+
+#if ARCH_MMU_LARGE_PAGE_SHIFT
+    /* take as much as we can in large page sized runs so it can be mapped with large pages */
+    const size_t large_count = (1UL << ARCH_MMU_LARGE_PAGE_SHIFT) / PAGE_SIZE;
+    while (size / PAGE_SIZE - count >= large_count) {
+        if (pmm_alloc_contiguous(large_count, ARCH_MMU_LARGE_PAGE_SHIFT, NULL, &page_list) == 0)
+            break;
+        count += large_count;
+    }
+#endif
+
+    /* and a random pile of pages for the rest */
+    count += pmm_alloc_pages(size / PAGE_SIZE - count, &page_list);
     DEBUG_ASSERT(count <= size);
     if (count < size / PAGE_SIZE) {
         LTRACEF("failed to allocate enough pages (asked for %zu, got %zu)\n", size / PAGE_SIZE, count);
@@ -535,27 +643,16 @@ status_t vmm_alloc(vmm_aspace_t *aspace, const char *name, size_t size, void **p
         goto err1;
     }
 
-    /* map all of the pages */
-    /* TODO: use smarter algorithm that tries to build runs */
+    /* map all of the pages, in physically contiguous runs */
+    DEBUG_ASSERT(IS_PAGE_ALIGNED(r->base));
+    err = map_page_runs(aspace, r->base, &page_list, arch_mmu_flags);
+    if (err < NO_ERROR)
+        goto err2;
+
+    /* add all of the pages to this region */
     vm_page_t *p;
-    vaddr_t va = r->base;
-    DEBUG_ASSERT(IS_PAGE_ALIGNED(va));
     while ((p = list_remove_head_type(&page_list, vm_page_t, node))) {
-        DEBUG_ASSERT(va <= r->base + r->size - 1);
-
-        paddr_t pa = vm_page_to_paddr(p);
-        DEBUG_ASSERT(IS_PAGE_ALIGNED(pa));
-
-        err = arch_mmu_map(&aspace->arch_aspace, va, pa, 1, arch_mmu_flags);
-        if (err < NO_ERROR) { // TODO: deal with difference between 0 and 1 returns in some arches
-            // add the page back to the list so it gets freed
-            list_add_tail(&page_list, &p->node);
-            goto err2;
-        }
-
         list_add_tail(&r->page_list, &p->node);
-
-        va += PAGE_SIZE;
     }
 
     /* return the vaddr if requested */
@@ -653,6 +750,133 @@ status_t vmm_free_region(vmm_aspace_t *aspace, vaddr_t vaddr) {
     return NO_ERROR;
 }
 
+/* grab a page from the zero pool, or allocate and clear one */
+static vm_page_t *alloc_zeroed_page(void) {
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&zero_pool.lock);
+    vm_page_t *p = list_remove_head_type(&zero_pool.pages, vm_page_t, node);
+    if (p) {
+        zero_pool.count--;
+        zero_pool.pool_hits++;
+    }
+    bool refill = zero_pool.count < VMM_ZERO_POOL_SIZE / 2;
+    spin_unlock_irqrestore(&zero_pool.lock, state);
+
+    if (refill && VMM_ZERO_POOL_SIZE > 0)
+        event_signal(&zero_pool.event, false);
+
+    if (p)
+        return p;
+
+    p = pmm_alloc_page();
+    if (!p)
+        return NULL;
+
+    void *kva = paddr_to_kvaddr(vm_page_to_paddr(p));
+    if (!kva) {
+        pmm_free_page(p);
+        return NULL;
+    }
+    memset(kva, 0, PAGE_SIZE);
+
+    return p;
+}
+
+static int zero_pool_thread(void *arg) {
+    for (;;) {
+        event_wait(&zero_pool.event);
+
+        while (zero_pool.count < VMM_ZERO_POOL_SIZE) {
+            vm_page_t *p = pmm_alloc_page();
+            if (!p)
+                break;
+
+            void *kva = paddr_to_kvaddr(vm_page_to_paddr(p));
+            if (!kva) {
+                pmm_free_page(p);
+                break;
+            }
+            memset(kva, 0, PAGE_SIZE);
+
+            arch_interrupt_saved_state_t state = spin_lock_irqsave(&zero_pool.lock);
+            list_add_tail(&zero_pool.pages, &p->node);
+            zero_pool.count++;
+            spin_unlock_irqrestore(&zero_pool.lock, state);
+        }
+    }
+
+    return 0;
+}
+
+static void zero_pool_init(uint level) {
+    if (VMM_ZERO_POOL_SIZE == 0)
+        return;
+
+    event_init(&zero_pool.event, true, EVENT_FLAG_AUTOUNSIGNAL);
+
+    thread_detach_and_resume(thread_create("vmm zero", &zero_pool_thread, NULL, LOWEST_PRIORITY + 1,
+                                           DEFAULT_STACK_SIZE));
+}
+
+LK_INIT_HOOK(vmm_zero_pool, &zero_pool_init, LK_INIT_LEVEL_THREADING);
+
+status_t vmm_page_fault_handler(vaddr_t addr, uint pf_flags) {
+    LTRACEF("addr 0x%lx flags 0x%x\n", addr, pf_flags);
+
+    vmm_aspace_t *aspace = vaddr_to_aspace((void *)addr);
+    if (!aspace)
+        return ERR_NOT_FOUND;
+
+    /* can't sleep on the vmm lock with interrupts off, and can't fault on it recursively */
+    if (arch_ints_disabled() || is_mutex_held(&vmm_lock))
+        return ERR_BAD_STATE;
+
+    vaddr_t va = ROUNDDOWN(addr, PAGE_SIZE);
+    status_t err;
+
+    mutex_acquire(&vmm_lock);
+
+    vmm_region_t *r = vmm_find_region(aspace, va);
+    if (!r || !(r->flags & VMM_REGION_FLAG_COMMIT_ON_DEMAND)) {
+        err = ERR_NOT_FOUND;
+        goto out;
+    }
+
+    /* the region has to allow the access, or it's a real fault */
+    if (((pf_flags & VMM_PF_FLAG_WRITE) && (r->arch_mmu_flags & ARCH_MMU_FLAG_PERM_RO)) ||
+            ((pf_flags & VMM_PF_FLAG_USER) && !(r->arch_mmu_flags & ARCH_MMU_FLAG_PERM_USER)) ||
+            ((pf_flags & VMM_PF_FLAG_INSTRUCTION) && (r->arch_mmu_flags & ARCH_MMU_FLAG_PERM_NO_EXECUTE))) {
+        err = ERR_ACCESS_DENIED;
+        goto out;
+    }
+
+    /* another cpu may have gotten here first */
+    paddr_t pa;
+    if (arch_mmu_query(&aspace->arch_aspace, va, &pa, NULL) == NO_ERROR) {
+        err = NO_ERROR;
+        goto out;
+    }
+
+    vm_page_t *p = alloc_zeroed_page();
+    if (!p) {
+        err = ERR_NO_MEMORY;
+        goto out;
+    }
+
+    err = arch_mmu_map(&aspace->arch_aspace, va, vm_page_to_paddr(p), 1, r->arch_mmu_flags);
+    if (err < NO_ERROR) {
+        pmm_free_page(p);
+        goto out;
+    }
+    err = NO_ERROR;
+
+    list_add_tail(&r->page_list, &p->node);
+    zero_pool.faults++;
+
+out:
+    mutex_release(&vmm_lock);
+    return err;
+}
+
 status_t vmm_create_aspace(vmm_aspace_t **_aspace, const char *name, uint flags) {
     status_t err;
 
@@ -729,10 +953,10 @@ status_t vmm_free_aspace(vmm_aspace_t *aspace) {
     /* make sure the current thread does not map the aspace */
     thread_t *current_thread = get_current_thread();
     if (current_thread->aspace == aspace) {
-        THREAD_LOCK(state);
+        THREAD_SCHED_LOCK(state);
         current_thread->aspace = NULL;
         vmm_context_switch(aspace, NULL);
-        THREAD_UNLOCK(state);
+        THREAD_SCHED_UNLOCK(state);
     }
 
     /* destroy the arch portion of the aspace */
@@ -745,7 +969,7 @@ status_t vmm_free_aspace(vmm_aspace_t *aspace) {
 }
 
 void vmm_context_switch(vmm_aspace_t *oldspace, vmm_aspace_t *newaspace) {
-    DEBUG_ASSERT(thread_lock_held());
+    DEBUG_ASSERT(thread_sched_lock_held());
 
     arch_mmu_context_switch(newaspace ? &newaspace->arch_aspace : NULL);
 }
@@ -759,14 +983,14 @@ vmm_aspace_t* vmm_set_active_aspace(vmm_aspace_t *aspace) {
     if (aspace == t->aspace)
         return aspace;
 
-    /* grab the thread lock and switch to the new address space */
-    THREAD_LOCK(state);
+    /* grab the scheduler lock and switch to the new address space */
+    THREAD_SCHED_LOCK(state);
     vmm_aspace_t *old = t->aspace;
     if (old != aspace) {
         t->aspace = aspace;
         vmm_context_switch(old, t->aspace);
     }
-    THREAD_UNLOCK(state);
+    THREAD_SCHED_UNLOCK(state);
     return old;
 }
 
@@ -796,11 +1020,13 @@ usage:
         printf("%s alloc <size> <align_pow2>\n", argv[0].str);
         printf("%s alloc_physical <paddr> <size> <align_pow2>\n", argv[0].str);
         printf("%s alloc_contig <size> <align_pow2>\n", argv[0].str);
+        printf("%s alloc_demand <size> <align_pow2>\n", argv[0].str);
         printf("%s free_region <address>\n", argv[0].str);
         printf("%s create_aspace\n", argv[0].str);
         printf("%s create_test_aspace\n", argv[0].str);
         printf("%s free_aspace <address>\n", argv[0].str);
         printf("%s set_test_aspace <address>\n", argv[0].str);
+        printf("%s demand_stats\n", argv[0].str);
         return ERR_GENERIC;
     }
 
@@ -832,6 +1058,13 @@ usage:
         void *ptr = (void *)0x99;
         status_t err = vmm_alloc_contiguous(test_aspace, "contig test", argv[2].u, &ptr, argv[3].u, 0, 0);
         printf("vmm_alloc_contig returns %d, ptr %p\n", err, ptr);
+    } else if (!strcmp(argv[1].str, "alloc_demand")) {
+        if (argc < 4) goto notenoughargs;
+
+        void *ptr = (void *)0x99;
+        status_t err = vmm_alloc(test_aspace, "demand test", argv[2].u, &ptr, argv[3].u,
+                                 VMM_FLAG_COMMIT_ON_DEMAND, 0);
+        printf("vmm_alloc returns %d, ptr %p\n", err, ptr);
     } else if (!strcmp(argv[1].str, "free_region")) {
         if (argc < 2) goto notenoughargs;
 
@@ -871,6 +1104,9 @@ usage:
         test_aspace = (void *)argv[2].u;
         get_current_thread()->aspace = test_aspace;
         thread_sleep(1); // XXX hack to force it to reschedule and thus load the aspace
+    } else if (!strcmp(argv[1].str, "demand_stats")) {
+        printf("demand faults %lu, %lu from the zero pool, %u pages in the pool\n",
+               zero_pool.faults, zero_pool.pool_hits, zero_pool.count);
     } else {
         printf("unknown command\n");
         goto usage;
@@ -11,67 +11,323 @@
 #include <string.h>
 #include <sys/types.h>
 #include <lk/debug.h>
+#include <lk/pow2.h>
 #include <lk/trace.h>
 #include <lk/err.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
 #include <lib/bcache.h>
 #include <lib/bio.h>
+#include <lib/pool.h>
+#include <lib/slab.h>
+#include <platform.h>
 
 #define LOCAL_TRACE 0
 
+/*
+ * The cache is split into shards by a hash of the block number, each with its own
+ * lock, hash table and eviction lists, so lookups of different blocks on different
+ * cpus rarely contend. Caches too small to split usefully get a single shard.
+ *
+ * Eviction within a shard is 2Q: a block read for the first time goes on the a1in
+ * fifo, and only moves to the am lru if it is read again after falling out of a1in,
+ * which a1out remembers the block numbers of. A single pass over a large file then
+ * only churns a1in, leaving the blocks that are used over and over in am alone.
+ *
+ * Blocks and their buffers are allocated as the cache fills, so a large cache on a
+ * mostly idle filesystem costs little.
+ *
+ * Two misses in a row on consecutive blocks start readahead: a run of blocks is read
+ * with one bio_readv_async() into a set of spare block buffers, which are swapped into
+ * the cache when the reader gets to them, with a second run in flight behind it so the
+ * device is kept busy while the reader works through the first. Runs double in size as
+ * the stream goes on.
+ *
+ * Dirty blocks are written back by a thread per cache once they've been dirty for a
+ * while or enough of them have built up, with runs of adjacent blocks gathered straight
+ * from their buffers into a single bio_writev(). bcache_flush() goes through the same
+ * path.
+ */
+#define BCACHE_MAX_SHARDS 8
+#define BCACHE_MIN_SHARD_BLOCKS 64
+
+/* largest single read or write the cache will issue */
+#define BCACHE_MAX_IO (128 * 1024)
+
+#define BCACHE_RA_SLOTS 3 /* one being installed while two read ahead of the reader */
+#define BCACHE_RA_MIN 4
+#define BCACHE_RA_MAX 64 /* blocks, one bit each in bcache_ra.stale */
+
+#ifndef BCACHE_WRITEBACK_DELAY
+#define BCACHE_WRITEBACK_DELAY 1000 /* msecs */
+#endif
+
+/* dirty blocks gathered up and sorted at a time by the writeback path */
+#define BCACHE_FLUSH_BATCH 256
+
+/* a1in is held to a quarter of the shard, a1out remembers half a shard's worth */
+#define BCACHE_A1IN_SHIFT 2
+#define BCACHE_A1OUT_SHIFT 1
+
+enum bcache_queue {
+    BCACHE_A1IN,
+    BCACHE_AM,
+};
+
 struct bcache_block {
     struct list_node node;
+    struct bcache_block *hash_next;
     bnum_t blocknum;
     int ref_count;
     bool is_dirty;
+    lk_time_t dirty_time;
+    enum bcache_queue queue;
     void *ptr;
 };
 
-struct bcache_stats {
-    uint32_t hits;
-    uint32_t depth;
-    uint32_t misses;
-    uint32_t reads;
-    uint32_t writes;
+/* a block recently evicted from a1in */
+struct bcache_ghost {
+    struct list_node node;
+    struct bcache_ghost *hash_next;
+    bnum_t blocknum;
+};
+
+struct bcache_shard {
+    mutex_t lock;
+    struct bcache_stats stats;
+
+    uint capacity;
+    uint a1in_max;
+    uint a1out_max;
+
+    struct list_node a1in;
+    uint a1in_count;
+    struct list_node am;
+    uint am_count;
+    struct list_node a1out;
+    uint a1out_count;
+
+    uint dirty_count;
+    uint dirty_max; /* wake the flusher early past this many */
+
+    struct bcache_block **hash;
+    struct bcache_ghost **ghost_hash;
+    pool_t ghost_pool;
+    void *ghost_storage;
+};
+
+/* a run of blocks being read ahead */
+struct bcache_ra {
+    bnum_t start;
+    uint count;     /* 0 if the slot is free */
+    bool claimed;   /* a reader is waiting on it to install it, nobody else may */
+    uint64_t stale; /* blocks written to the device since the read was issued */
+    ssize_t status;
+    event_t done;
+
+    /* spare block buffers the run is read into, traded for the cache's own on install */
+    void *bufs[BCACHE_RA_MAX];
+    iovec_t iov[BCACHE_RA_MAX];
 };
 
 struct bcache {
     bdev_t *dev;
     size_t block_size;
     int count;
-    struct bcache_stats stats;
-
-    struct list_node free_list;
-    struct list_node lru_list;
-
-    struct bcache_block *blocks;
     bool read_only;
+    bnum_t dev_blocks;
+
+    uint shard_bits;
+    uint hash_bits;
+
+    slab_cache_t block_cache;
+    slab_cache_t data_cache;
+
+    /* starting readahead and claiming slots is serialized by ra_lock, which is never
+     * held while waiting on a read */
+    mutex_t ra_lock;
+    spin_lock_t ra_stale_lock; /* start, count, claimed, stale and ra_seq_next */
+    uint ra_bufs; /* buffers per slot, 0 if there's no readahead */
+    uint ra_max;
+    uint ra_window;
+    bnum_t ra_seq_next; /* the block a sequential reader will miss on next */
+    bnum_t ra_next;     /* the block after the last one read ahead */
+    struct bcache_ra ra[BCACHE_RA_SLOTS];
+
+    /* write behind, the buffers are protected by flush_lock */
+    mutex_t flush_lock;
+    thread_t *flusher;
+    event_t flush_event;
+    volatile bool flusher_stop;
+    volatile lk_time_t writeback_delay;
+    iovec_t *flush_iov;
+    uint flush_run_max;
+    struct bcache_block **flush_batch;
+
+    struct bcache_shard shards[];
 };
 
+static inline uint32_t block_hash(bnum_t blocknum) {
+    return blocknum * 0x9e3779b1u;
+}
+
+static inline struct bcache_shard *get_shard(struct bcache *cache, bnum_t blocknum) {
+    if (cache->shard_bits == 0)
+        return &cache->shards[0];
+    return &cache->shards[block_hash(blocknum) >> (32 - cache->shard_bits)];
+}
+
+static inline uint hash_bucket(const struct bcache *cache, bnum_t blocknum) {
+    return (block_hash(blocknum) >> (32 - cache->shard_bits - cache->hash_bits)) &
+           ((1u << cache->hash_bits) - 1);
+}
+
+static void destroy_shard(struct bcache *cache, struct bcache_shard *shard);
+static int flusher_thread(void *arg);
+
+static status_t init_shard(struct bcache *cache, struct bcache_shard *shard, uint capacity) {
+    mutex_init(&shard->lock);
+    list_initialize(&shard->a1in);
+    list_initialize(&shard->am);
+    list_initialize(&shard->a1out);
+
+    shard->capacity = capacity;
+    shard->a1in_max = MAX(capacity >> BCACHE_A1IN_SHIFT, 1u);
+    shard->a1out_max = capacity >> BCACHE_A1OUT_SHIFT;
+    shard->dirty_max = MAX(capacity / 4, 1u);
+
+    shard->hash = calloc(1u << cache->hash_bits, sizeof(struct bcache_block *));
+    shard->ghost_hash = calloc(1u << cache->hash_bits, sizeof(struct bcache_ghost *));
+    if (!shard->hash || !shard->ghost_hash)
+        return ERR_NO_MEMORY;
+
+    if (shard->a1out_max > 0) {
+        shard->ghost_storage = malloc(TYPED_POOL_STORAGE_SIZE(struct bcache_ghost, shard->a1out_max));
+        if (!shard->ghost_storage)
+            return ERR_NO_MEMORY;
+        TYPED_POOL_INIT(struct bcache_ghost, &shard->ghost_pool, shard->a1out_max, shard->ghost_storage);
+    }
+
+    return NO_ERROR;
+}
+
+static void free_cache(struct bcache *cache, uint shard_count) {
+    if (cache->flusher) {
+        cache->flusher_stop = true;
+        event_signal(&cache->flush_event, true);
+        thread_join(cache->flusher, NULL, INFINITE_TIME);
+    }
+
+    /* nothing can start new readahead now, wait out any still in flight */
+    for (uint i = 0; i < BCACHE_RA_SLOTS; i++) {
+        struct bcache_ra *ra = &cache->ra[i];
+        if (ra->count > 0)
+            event_wait(&ra->done);
+        event_destroy(&ra->done);
+        for (uint j = 0; j < cache->ra_bufs; j++) {
+            if (ra->bufs[j])
+                slab_free(&cache->data_cache, ra->bufs[j]);
+        }
+    }
+
+    for (uint i = 0; i < shard_count; i++)
+        destroy_shard(cache, &cache->shards[i]);
+
+    free(cache->flush_batch);
+    free(cache->flush_iov);
+    event_destroy(&cache->flush_event);
+    mutex_destroy(&cache->flush_lock);
+    mutex_destroy(&cache->ra_lock);
+    slab_cache_destroy(&cache->data_cache);
+    slab_cache_destroy(&cache->block_cache);
+    free(cache);
+}
+
 bcache_t bcache_create(bdev_t *dev, size_t block_size, int block_count) {
     struct bcache *cache;
 
-    cache = malloc(sizeof(struct bcache));
+    DEBUG_ASSERT(block_count > 0);
+
+    /* split the cache as far as it'll go while keeping each shard a useful size */
+    uint shard_count = 1;
+    while (shard_count < BCACHE_MAX_SHARDS &&
+            (uint)block_count / (shard_count * 2) >= BCACHE_MIN_SHARD_BLOCKS) {
+        shard_count *= 2;
+    }
+
+    cache = calloc(1, sizeof(struct bcache) + shard_count * sizeof(struct bcache_shard));
+    if (!cache)
+        return NULL;
 
     cache->dev = dev;
     cache->block_size = block_size;
     cache->count = block_count;
     cache->read_only = false;
-    memset(&cache->stats, 0, sizeof(cache->stats));
-
-    list_initialize(&cache->free_list);
-    list_initialize(&cache->lru_list);
+    cache->dev_blocks = (bnum_t)(dev->total_size / block_size);
+
+    uint per_shard = ((uint)block_count + shard_count - 1) / shard_count;
+    cache->shard_bits = log2_uint(shard_count);
+    cache->hash_bits = MAX(log2_uint(round_up_pow2_u32(per_shard)), 1u);
+
+    slab_cache_init(&cache->block_cache, "bcache block", sizeof(struct bcache_block),
+                    __alignof(struct bcache_block), 0, NULL);
+    slab_cache_init(&cache->data_cache, "bcache data", block_size, CACHE_LINE, SLAB_FLAG_CACHE_ALIGN, NULL);
+
+    mutex_init(&cache->ra_lock);
+    spin_lock_init(&cache->ra_stale_lock);
+    cache->ra_seq_next = (bnum_t)-1;
+    for (uint i = 0; i < BCACHE_RA_SLOTS; i++)
+        event_init(&cache->ra[i].done, false, 0);
+
+    mutex_init(&cache->flush_lock);
+    event_init(&cache->flush_event, false, EVENT_FLAG_AUTOUNSIGNAL);
+    cache->writeback_delay = BCACHE_WRITEBACK_DELAY;
+
+    for (uint i = 0; i < shard_count; i++) {
+        /* hand the remainder out one block at a time to the first few shards */
+        uint capacity = (uint)block_count / shard_count + (i < (uint)block_count % shard_count ? 1 : 0);
+        if (init_shard(cache, &cache->shards[i], capacity) < 0) {
+            free_cache(cache, i + 1);
+            return NULL;
+        }
+    }
 
-    cache->blocks = malloc(sizeof(struct bcache_block) * block_count);
-    int i;
-    for (i=0; i < block_count; i++) {
-        cache->blocks[i].ref_count = 0;
-        cache->blocks[i].is_dirty = false;
-        cache->blocks[i].ptr = malloc(block_size);
-        // add to the free list
-        list_add_head(&cache->free_list, &cache->blocks[i].node);
+    /* keep both readahead runs small enough to sit in a1in together */
+    uint ra_max = MIN(BCACHE_RA_MAX, MIN(BCACHE_MAX_IO / block_size, (uint)block_count / 8));
+    if (ra_max >= 2) {
+        cache->ra_bufs = ra_max;
+        for (uint i = 0; i < BCACHE_RA_SLOTS; i++) {
+            for (uint j = 0; j < ra_max; j++) {
+                cache->ra[i].bufs[j] = slab_alloc(&cache->data_cache);
+                if (!cache->ra[i].bufs[j])
+                    goto err;
+            }
+        }
+        cache->ra_max = ra_max;
     }
 
+    cache->flush_run_max = MAX(BCACHE_MAX_IO / block_size, 1u);
+    cache->flush_iov = calloc(cache->flush_run_max, sizeof(iovec_t));
+    cache->flush_batch = calloc(BCACHE_FLUSH_BATCH, sizeof(struct bcache_block *));
+    if (!cache->flush_iov || !cache->flush_batch)
+        goto err;
+
+    cache->flusher = thread_create("bcache flusher", &flusher_thread, cache, LOW_PRIORITY,
+                                   DEFAULT_STACK_SIZE);
+    if (!cache->flusher)
+        goto err;
+    thread_resume(cache->flusher);
+
+    LTRACEF("%d blocks of %zu bytes in %u shards, readahead %u\n", block_count, block_size,
+            shard_count, cache->ra_max);
+
     return (bcache_t)cache;
+
+err:
+    free_cache(cache, shard_count);
+    return NULL;
 }
 
 void bcache_set_read_only(bcache_t _cache, bool ro) {
@@ -79,7 +335,55 @@ void bcache_set_read_only(bcache_t _cache, bool ro) {
     cache->read_only = ro;
 }
 
-static int flush_block(struct bcache *cache, struct bcache_block *block) {
+void bcache_set_readahead(bcache_t _cache, uint max_blocks) {
+    struct bcache *cache = _cache;
+
+    mutex_acquire(&cache->ra_lock);
+    cache->ra_max = MIN(max_blocks, cache->ra_bufs);
+    mutex_release(&cache->ra_lock);
+}
+
+void bcache_set_writeback_delay(bcache_t _cache, lk_time_t delay) {
+    struct bcache *cache = _cache;
+
+    /* have the flusher pick up the new interval */
+    cache->writeback_delay = delay;
+    event_signal(&cache->flush_event, false);
+}
+
+/* note that blocks have reached the device, so any readahead of them that was already under way is out of date */
+static void ra_mark_stale(struct bcache *cache, bnum_t start, uint count) {
+    if (cache->ra_bufs == 0)
+        return;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->ra_stale_lock);
+    for (uint i = 0; i < BCACHE_RA_SLOTS; i++) {
+        struct bcache_ra *ra = &cache->ra[i];
+        for (bnum_t b = MAX(start, ra->start); b < start + count && b < ra->start + ra->count; b++)
+            ra->stale |= 1ull << (b - ra->start);
+    }
+    spin_unlock_irqrestore(&cache->ra_stale_lock, state);
+}
+
+static void set_dirty(struct bcache *cache, struct bcache_shard *shard, struct bcache_block *block) {
+    if (block->is_dirty)
+        return;
+
+    block->is_dirty = true;
+    block->dirty_time = current_time();
+    if (++shard->dirty_count == shard->dirty_max)
+        event_signal(&cache->flush_event, false);
+}
+
+static void clear_dirty(struct bcache_shard *shard, struct bcache_block *block) {
+    if (!block->is_dirty)
+        return;
+
+    block->is_dirty = false;
+    shard->dirty_count--;
+}
+
+static int flush_block(struct bcache *cache, struct bcache_shard *shard, struct bcache_block *block) {
     int rc;
 
     if (cache->read_only)
@@ -91,252 +395,717 @@ static int flush_block(struct bcache *cache, struct bcache_block *block) {
     if (rc < 0)
         goto exit;
 
-    block->is_dirty = false;
-    cache->stats.writes++;
+    ra_mark_stale(cache, block->blocknum, 1);
+    clear_dirty(shard, block);
+    shard->stats.writes++;
+    shard->stats.write_ops++;
     rc = 0;
 exit:
     return (rc);
 }
 
+static void free_block(struct bcache *cache, struct bcache_block *block) {
+    slab_free(&cache->data_cache, block->ptr);
+    slab_free(&cache->block_cache, block);
+}
+
+static void destroy_shard(struct bcache *cache, struct bcache_shard *shard) {
+    struct bcache_block *block;
+
+    while ((block = list_remove_head_type(&shard->a1in, struct bcache_block, node)) ||
+            (block = list_remove_head_type(&shard->am, struct bcache_block, node))) {
+        DEBUG_ASSERT(block->ref_count == 0);
+
+        if (block->is_dirty)
+            printf("warning: freeing dirty block %u\n", block->blocknum);
+
+        free_block(cache, block);
+    }
+
+    free(shard->ghost_storage);
+    free(shard->ghost_hash);
+    free(shard->hash);
+    mutex_destroy(&shard->lock);
+}
+
 void bcache_destroy(bcache_t _cache) {
     struct bcache *cache = _cache;
-    int i;
 
-    for (i=0; i < cache->count; i++) {
-        DEBUG_ASSERT(cache->blocks[i].ref_count == 0);
+    free_cache(cache, 1u << cache->shard_bits);
+}
+
+/* find a block if it's already present, without counting it as a use */
+static struct bcache_block *lookup_block(struct bcache *cache, struct bcache_shard *shard, bnum_t blocknum) {
+    struct bcache_block *block = shard->hash[hash_bucket(cache, blocknum)];
+    while (block && block->blocknum != blocknum)
+        block = block->hash_next;
+    return block;
+}
+
+/* find a block if it's already present */
+static struct bcache_block *find_block(struct bcache *cache, struct bcache_shard *shard, bnum_t blocknum) {
+    LTRACEF("num %u\n", blocknum);
 
-        if (cache->blocks[i].is_dirty)
-            printf("warning: freeing dirty block %u\n",
-                   cache->blocks[i].blocknum);
+    struct bcache_block *block = lookup_block(cache, shard, blocknum);
+    if (!block) {
+        shard->stats.misses++;
+        return NULL;
+    }
 
-        free(cache->blocks[i].ptr);
+    /* blocks in a1in stay where they are, am is kept in lru order */
+    if (block->queue == BCACHE_AM) {
+        list_delete(&block->node);
+        list_add_tail(&shard->am, &block->node);
     }
+    shard->stats.hits++;
+    return block;
+}
 
-    free(cache);
+static void unlink_block(struct bcache *cache, struct bcache_shard *shard, struct bcache_block *block) {
+    struct bcache_block **prev = &shard->hash[hash_bucket(cache, block->blocknum)];
+    while (*prev != block)
+        prev = &(*prev)->hash_next;
+    *prev = block->hash_next;
+
+    list_delete(&block->node);
+    if (block->queue == BCACHE_A1IN)
+        shard->a1in_count--;
+    else
+        shard->am_count--;
 }
 
-/* find a block if it's already present */
-static struct bcache_block *find_block(struct bcache *cache, uint blocknum) {
-    uint32_t depth = 0;
-    struct bcache_block *block;
+/* look for a block number in a1out, removing it if it's there */
+static bool take_ghost(struct bcache *cache, struct bcache_shard *shard, bnum_t blocknum) {
+    struct bcache_ghost **prev = &shard->ghost_hash[hash_bucket(cache, blocknum)];
+    while (*prev && (*prev)->blocknum != blocknum)
+        prev = &(*prev)->hash_next;
+
+    struct bcache_ghost *ghost = *prev;
+    if (!ghost)
+        return false;
+
+    *prev = ghost->hash_next;
+    list_delete(&ghost->node);
+    shard->a1out_count--;
+    TYPED_POOL_FREE(struct bcache_ghost, &shard->ghost_pool, ghost);
+    return true;
+}
 
-    LTRACEF("num %u\n", blocknum);
+/* remember a block number evicted from a1in, forgetting the oldest one if a1out is full */
+static void add_ghost(struct bcache *cache, struct bcache_shard *shard, bnum_t blocknum) {
+    if (shard->a1out_max == 0)
+        return;
 
-    block = NULL;
-    list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
-        LTRACEF("looking at entry %p, num %u\n", block, block->blocknum);
-        depth++;
+    if (shard->a1out_count == shard->a1out_max) {
+        struct bcache_ghost *oldest = list_peek_head_type(&shard->a1out, struct bcache_ghost, node);
+        take_ghost(cache, shard, oldest->blocknum);
+    }
+
+    struct bcache_ghost *ghost = TYPED_POOL_ALLOC(struct bcache_ghost, &shard->ghost_pool);
+    DEBUG_ASSERT(ghost);
+
+    uint bucket = hash_bucket(cache, blocknum);
+    ghost->blocknum = blocknum;
+    ghost->hash_next = shard->ghost_hash[bucket];
+    shard->ghost_hash[bucket] = ghost;
+    list_add_tail(&shard->a1out, &ghost->node);
+    shard->a1out_count++;
+}
 
-        if (block->blocknum == blocknum) {
-            list_delete(&block->node);
-            list_add_tail(&cache->lru_list, &block->node);
-            cache->stats.hits++;
-            cache->stats.depth += depth;
+/* the oldest block on a list that nobody holds a reference to */
+static struct bcache_block *find_victim(struct list_node *list) {
+    struct bcache_block *block;
+    list_for_every_entry(list, block, struct bcache_block, node) {
+        if (block->ref_count == 0)
             return block;
+    }
+    return NULL;
+}
+
+/* allocate a new block, evicting one if the shard is full */
+static struct bcache_block *alloc_block(struct bcache *cache, struct bcache_shard *shard) {
+    struct bcache_block *block;
+
+    if (shard->a1in_count + shard->am_count < shard->capacity) {
+        block = slab_alloc(&cache->block_cache);
+        if (block) {
+            block->ptr = slab_alloc(&cache->data_cache);
+            if (block->ptr) {
+                block->ref_count = 0;
+                block->is_dirty = false;
+                LTRACEF("new block %p\n", block);
+                return block;
+            }
+            slab_free(&cache->block_cache, block);
         }
     }
 
-    cache->stats.misses++;
+    /* take from a1in while it's over its share, otherwise from the cold end of am */
+    bool from_a1in = shard->a1in_count > shard->a1in_max || shard->am_count == 0;
+    block = find_victim(from_a1in ? &shard->a1in : &shard->am);
+    if (!block) {
+        from_a1in = !from_a1in;
+        block = find_victim(from_a1in ? &shard->a1in : &shard->am);
+        if (!block)
+            return NULL;
+    }
+
+    LTRACEF("evicting %p, num %u\n", block, block->blocknum);
+
+    if (block->is_dirty) {
+        /* if the block we're evicting is dirty, write it back first */
+        if (flush_block(cache, shard, block) < 0)
+            return NULL;
+    }
+
+    unlink_block(cache, shard, block);
+    if (from_a1in)
+        add_ghost(cache, shard, block->blocknum);
+    shard->stats.evictions++;
+
+    return block;
+}
+
+/* give a newly filled block its number, and put it on whichever queue 2Q says */
+static void insert_block(struct bcache *cache, struct bcache_shard *shard, struct bcache_block *block,
+                         bnum_t blocknum) {
+    block->blocknum = blocknum;
+
+    if (take_ghost(cache, shard, blocknum)) {
+        block->queue = BCACHE_AM;
+        list_add_tail(&shard->am, &block->node);
+        shard->am_count++;
+        shard->stats.ghost_hits++;
+    } else {
+        block->queue = BCACHE_A1IN;
+        list_add_tail(&shard->a1in, &block->node);
+        shard->a1in_count++;
+    }
+
+    uint bucket = hash_bucket(cache, blocknum);
+    block->hash_next = shard->hash[bucket];
+    shard->hash[bucket] = block;
+}
+
+static void ra_callback(void *cookie, bdev_t *dev, ssize_t status) {
+    struct bcache_ra *ra = cookie;
+
+    /* may be called from interrupt context */
+    ra->status = status;
+    event_signal(&ra->done, false);
+}
+
+/* start reading a run of blocks into a free slot */
+static void ra_issue(struct bcache *cache, struct bcache_ra *ra, bnum_t start, uint count) {
+    DEBUG_ASSERT(ra->count == 0);
+    DEBUG_ASSERT(count > 0 && count <= BCACHE_RA_MAX);
+
+    LTRACEF("start %u, count %u\n", start, count);
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->ra_stale_lock);
+    ra->start = start;
+    ra->count = count;
+    ra->stale = 0;
+    spin_unlock_irqrestore(&cache->ra_stale_lock, state);
+
+    event_unsignal(&ra->done);
+
+    for (uint i = 0; i < count; i++) {
+        ra->iov[i].iov_base = ra->bufs[i];
+        ra->iov[i].iov_len = cache->block_size;
+    }
+
+    off_t offset = (off_t)start * cache->block_size;
+    status_t err = bio_readv_async(cache->dev, ra->iov, count, offset, &ra_callback, ra);
+    if (err == ERR_NOT_SUPPORTED) {
+        /* one large synchronous read still beats a lot of small ones */
+        ra_callback(ra, cache->dev, bio_readv(cache->dev, ra->iov, count, offset));
+    } else if (err < 0) {
+        ra_callback(ra, cache->dev, err);
+    }
+}
+
+/* keep every free slot busy reading further along the stream */
+static void ra_fill(struct bcache *cache) {
+    uint window = MIN(cache->ra_window, cache->ra_max);
+
+    for (uint i = 0; i < BCACHE_RA_SLOTS && window > 0; i++) {
+        struct bcache_ra *ra = &cache->ra[i];
+        if (ra->count > 0)
+            continue;
+        if (cache->ra_next >= cache->dev_blocks)
+            break;
+
+        uint count = MIN(window, cache->dev_blocks - cache->ra_next);
+        ra_issue(cache, ra, cache->ra_next, count);
+        cache->ra_next += count;
+    }
+}
+
+/* the unclaimed slot reading blocknum, if any */
+static struct bcache_ra *ra_find(struct bcache *cache, bnum_t blocknum) {
+    for (uint i = 0; i < BCACHE_RA_SLOTS; i++) {
+        struct bcache_ra *ra = &cache->ra[i];
+        if (ra->count > 0 && !ra->claimed && blocknum >= ra->start && blocknum < ra->start + ra->count)
+            return ra;
+    }
     return NULL;
 }
 
-/* allocate a new block */
-static struct bcache_block *alloc_block(struct bcache *cache) {
-    int err;
-    struct bcache_block *block;
+/* take over a slot so it can be waited on and installed without holding ra_lock */
+static void ra_claim(struct bcache *cache, struct bcache_ra *ra) {
+    DEBUG_ASSERT(is_mutex_held(&cache->ra_lock));
+    DEBUG_ASSERT(ra->count > 0 && !ra->claimed);
 
-    /* pop one off the free list if it's present */
-    block = list_remove_head_type(&cache->free_list, struct bcache_block, node);
-    if (block) {
-        block->ref_count = 0;
-        list_add_tail(&cache->lru_list, &block->node);
-        LTRACEF("found block %p on free list\n", block);
-        return block;
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->ra_stale_lock);
+    ra->claimed = true;
+    spin_unlock_irqrestore(&cache->ra_stale_lock, state);
+}
+
+/* wait for a claimed slot's read to finish and copy whatever isn't already cached into
+ * the cache, then free the slot */
+static void ra_install(struct bcache *cache, struct bcache_ra *ra) {
+    DEBUG_ASSERT(ra->claimed);
+    DEBUG_ASSERT(!is_mutex_held(&cache->ra_lock));
+
+    event_wait(&ra->done);
+
+    if (ra->status == (ssize_t)(ra->count * cache->block_size)) {
+        for (uint i = 0; i < ra->count; i++) {
+            bnum_t blocknum = ra->start + i;
+            struct bcache_shard *shard = get_shard(cache, blocknum);
+
+            mutex_acquire(&shard->lock);
+
+            /* a block written since the read was issued would be stale, and one
+             * that's already present may be newer than the device */
+            arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->ra_stale_lock);
+            bool stale = ra->stale & (1ull << i);
+            spin_unlock_irqrestore(&cache->ra_stale_lock, state);
+
+            if (!stale && !lookup_block(cache, shard, blocknum)) {
+                struct bcache_block *block = alloc_block(cache, shard);
+                if (block) {
+                    /* trade buffers rather than copy, the block's old one reads the next run */
+                    void *ptr = block->ptr;
+                    block->ptr = ra->bufs[i];
+                    ra->bufs[i] = ptr;
+                    insert_block(cache, shard, block, blocknum);
+                    shard->stats.readahead++;
+                }
+            }
+            mutex_release(&shard->lock);
+        }
+    } else {
+        LTRACEF("readahead of %u blocks at %u failed: %ld\n", ra->count, ra->start, ra->status);
     }
 
-    /* walk the lru, looking for a free block */
-    list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
-        LTRACEF("looking at %p, num %u\n", block, block->blocknum);
-        if (block->ref_count == 0) {
-            if (block->is_dirty) {
-                /* if the oldest block in the list that's available is dirty, write
-                 * it back first.
-                 */
-                err = flush_block(cache, block);
-                if (err)
-                    return NULL;
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->ra_stale_lock);
+    ra->claimed = false;
+    ra->count = 0;
+    spin_unlock_irqrestore(&cache->ra_stale_lock, state);
+}
+
+/*
+ * Called on a miss without the shard lock held. If blocknum is covered by readahead
+ * already under way, or continues a sequential run of misses, brings it into the cache
+ * with the blocks around it.
+ */
+static void readahead(struct bcache *cache, bnum_t blocknum) {
+    /* most misses aren't part of a stream, turn those away without touching ra_lock */
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->ra_stale_lock);
+    bool sequential = blocknum == cache->ra_seq_next;
+    bool covered = ra_find(cache, blocknum) != NULL;
+    cache->ra_seq_next = blocknum + 1;
+    spin_unlock_irqrestore(&cache->ra_stale_lock, state);
+
+    if (!sequential && !covered)
+        return;
+
+    mutex_acquire(&cache->ra_lock);
+
+    struct bcache_ra *ra = ra_find(cache, blocknum);
+    if (!ra && sequential && cache->ra_max > 0) {
+        /* start a new stream here, after finishing off whatever the last one left behind */
+        struct bcache_ra *leftover[BCACHE_RA_SLOTS];
+        uint leftover_count = 0;
+        for (uint i = 0; i < BCACHE_RA_SLOTS; i++) {
+            if (cache->ra[i].count > 0 && !cache->ra[i].claimed) {
+                ra_claim(cache, &cache->ra[i]);
+                leftover[leftover_count++] = &cache->ra[i];
             }
+        }
 
-            // add it to the tail of the lru
-            list_delete(&block->node);
-            list_add_tail(&cache->lru_list, &block->node);
-            return block;
+        if (leftover_count > 0) {
+            mutex_release(&cache->ra_lock);
+            for (uint i = 0; i < leftover_count; i++)
+                ra_install(cache, leftover[i]);
+            mutex_acquire(&cache->ra_lock);
+        }
+
+        /* another reader may have started a stream covering it in the meantime */
+        ra = ra_find(cache, blocknum);
+        if (!ra) {
+            cache->ra_window = MIN(BCACHE_RA_MIN, cache->ra_max);
+            cache->ra_next = blocknum;
+            ra_fill(cache);
+            ra = ra_find(cache, blocknum);
         }
     }
 
-    return NULL;
-}
+    if (ra) {
+        ra_claim(cache, ra);
+
+        /* the reader has caught up with one run, start the next one twice the size */
+        cache->ra_window = MIN(cache->ra_window * 2, cache->ra_max);
+        ra_fill(cache);
+    }
+
+    mutex_release(&cache->ra_lock);
 
-static struct bcache_block *find_or_fill_block(struct bcache *cache, uint blocknum) {
-    int err;
+    if (ra)
+        ra_install(cache, ra);
+}
 
+static struct bcache_block *find_or_fill_block(struct bcache *cache, struct bcache_shard *shard, uint blocknum) {
     LTRACEF("block %u\n", blocknum);
 
     /* see if it's already in the cache */
-    struct bcache_block *block = find_block(cache, blocknum);
-    if (block == NULL) {
-        LTRACEF("wasn't allocated\n");
+    struct bcache_block *block = find_block(cache, shard, blocknum);
+    if (block)
+        return block;
 
-        /* allocate a new block and fill it */
-        block = alloc_block(cache);
-        DEBUG_ASSERT(block);
+    LTRACEF("wasn't allocated\n");
 
-        LTRACEF("wasn't allocated, new block %p\n", block);
+    if (cache->ra_bufs > 0) {
+        /* the shard lock can't be held while waiting on readahead, which takes other shards' */
+        mutex_release(&shard->lock);
+        readahead(cache, blocknum);
+        mutex_acquire(&shard->lock);
 
-        block->blocknum = blocknum;
-        err = bio_read(cache->dev, block->ptr, (off_t)blocknum * cache->block_size, cache->block_size);
-        if (err < 0) {
-            /* free the block, return an error */
-            list_add_tail(&cache->free_list, &block->node);
-            return NULL;
-        }
+        /* readahead, or another thread, may have filled it in the meantime */
+        block = lookup_block(cache, shard, blocknum);
+        if (block)
+            return block;
+    }
 
-        cache->stats.reads++;
+    /* allocate a new block and fill it */
+    block = alloc_block(cache, shard);
+    if (!block)
+        return NULL;
+
+    LTRACEF("wasn't allocated, new block %p\n", block);
+
+    lk_bigtime_t t = current_time_hires();
+    ssize_t err = bio_read(cache->dev, block->ptr, (off_t)blocknum * cache->block_size, cache->block_size);
+    t = current_time_hires() - t;
+    if (err < 0) {
+        /* free the block, return an error */
+        free_block(cache, block);
+        return NULL;
     }
 
-    DEBUG_ASSERT(block->blocknum == blocknum);
+    shard->stats.reads++;
+    shard->stats.read_time += t;
+    shard->stats.max_read_time = MAX(shard->stats.max_read_time, t);
+
+    insert_block(cache, shard, block, blocknum);
 
     return block;
 }
 
 int bcache_read_block(bcache_t _cache, void *buf, uint blocknum) {
     struct bcache *cache = _cache;
+    struct bcache_shard *shard = get_shard(cache, blocknum);
 
     LTRACEF("buf %p, blocknum %u\n", buf, blocknum);
 
-    struct bcache_block *block = find_or_fill_block(cache, blocknum);
-    if (block == NULL) {
-        /* error */
-        return -1;
-    }
+    mutex_acquire(&shard->lock);
+    struct bcache_block *block = find_or_fill_block(cache, shard, blocknum);
+    if (block)
+        memcpy(buf, block->ptr, cache->block_size);
+    mutex_release(&shard->lock);
 
-    memcpy(buf, block->ptr, cache->block_size);
-    return 0;
+    return block ? 0 : -1;
 }
 
 int bcache_get_block(bcache_t _cache, void **ptr, uint blocknum) {
     struct bcache *cache = _cache;
+    struct bcache_shard *shard = get_shard(cache, blocknum);
 
     LTRACEF("ptr %p, blocknum %u\n", ptr, blocknum);
 
     DEBUG_ASSERT(ptr);
 
-    struct bcache_block *block = find_or_fill_block(cache, blocknum);
-    if (block == NULL) {
-        /* error */
-        return -1;
+    mutex_acquire(&shard->lock);
+    struct bcache_block *block = find_or_fill_block(cache, shard, blocknum);
+    if (block) {
+        /* increment the ref count to keep it from being freed */
+        block->ref_count++;
+        *ptr = block->ptr;
     }
+    mutex_release(&shard->lock);
 
-    /* increment the ref count to keep it from being freed */
-    block->ref_count++;
-    *ptr = block->ptr;
-
-    return 0;
+    return block ? 0 : -1;
 }
 
 int bcache_put_block(bcache_t _cache, uint blocknum) {
     struct bcache *cache = _cache;
+    struct bcache_shard *shard = get_shard(cache, blocknum);
 
     LTRACEF("blocknum %u\n", blocknum);
 
-    struct bcache_block *block = find_block(cache, blocknum);
+    mutex_acquire(&shard->lock);
+    struct bcache_block *block = lookup_block(cache, shard, blocknum);
 
     /* be pretty hard on the caller for now */
     DEBUG_ASSERT(block);
     DEBUG_ASSERT(block->ref_count > 0);
 
     block->ref_count--;
+    mutex_release(&shard->lock);
 
     return 0;
 }
 
 int bcache_mark_block_dirty(bcache_t priv, uint blocknum) {
-    int err;
     struct bcache *cache = priv;
-    struct bcache_block *block;
+    struct bcache_shard *shard = get_shard(cache, blocknum);
 
     if (cache->read_only)
         return ERR_NOT_ALLOWED;
 
-    block = find_block(cache, blocknum);
-    if (!block) {
-        err = -1;
-        goto exit;
-    }
+    mutex_acquire(&shard->lock);
+    struct bcache_block *block = lookup_block(cache, shard, blocknum);
+    if (block)
+        set_dirty(cache, shard, block);
+    mutex_release(&shard->lock);
 
-    block->is_dirty = true;
-    err = 0;
-exit:
-    return (err);
+    return block ? 0 : -1;
 }
 
 int bcache_zero_block(bcache_t priv, uint blocknum) {
-    int err;
     struct bcache *cache = priv;
-    struct bcache_block *block;
+    struct bcache_shard *shard = get_shard(cache, blocknum);
 
     if (cache->read_only)
         return ERR_NOT_ALLOWED;
 
-    block = find_block(cache, blocknum);
+    mutex_acquire(&shard->lock);
+    struct bcache_block *block = lookup_block(cache, shard, blocknum);
     if (!block) {
-        block = alloc_block(cache);
-        if (!block) {
-            err = -1;
-            goto exit;
-        }
+        block = alloc_block(cache, shard);
+        if (block)
+            insert_block(cache, shard, block, blocknum);
+    }
 
-        block->blocknum = blocknum;
+    if (block) {
+        memset(block->ptr, 0, cache->block_size);
+        set_dirty(cache, shard, block);
     }
+    mutex_release(&shard->lock);
 
-    memset(block->ptr, 0, cache->block_size);
-    block->is_dirty = true;
-    err = 0;
-exit:
-    return (err);
+    return block ? 0 : -1;
 }
 
-int bcache_flush(bcache_t priv) {
-    int err;
-    struct bcache *cache = priv;
+/* take a reference to dirty blocks on a list for writeback, returns the new batch size */
+static uint collect_list(struct bcache *cache, struct list_node *list, uint n, lk_time_t cutoff,
+                         bool include_held) {
     struct bcache_block *block;
 
-    list_for_every_entry(&cache->lru_list, block, struct bcache_block, node) {
-        if (block->is_dirty) {
-            err = flush_block(cache, block);
-            if (err)
-                goto exit;
+    list_for_every_entry(list, block, struct bcache_block, node) {
+        if (n == BCACHE_FLUSH_BATCH)
+            break;
+        if (!block->is_dirty || !TIME_LTE(block->dirty_time, cutoff))
+            continue;
+        if (block->ref_count > 0 && !include_held)
+            continue;
+
+        /* hold it so it can't be evicted and read back in before the write lands */
+        block->ref_count++;
+        cache->flush_batch[n++] = block;
+    }
+
+    return n;
+}
+
+static int block_compare(const void *a, const void *b) {
+    bnum_t x = (*(struct bcache_block * const *)a)->blocknum;
+    bnum_t y = (*(struct bcache_block * const *)b)->blocknum;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * Write a run of adjacent blocks from the batch with a single device write, straight
+ * from their buffers. They're held so they stay put; one modified while the write is
+ * under way is dirtied again and goes out with a later write.
+ */
+static int write_run(struct bcache *cache, struct bcache_block **blocks, uint count) {
+    for (uint i = 0; i < count; i++) {
+        struct bcache_shard *shard = get_shard(cache, blocks[i]->blocknum);
+
+        mutex_acquire(&shard->lock);
+        cache->flush_iov[i].iov_base = blocks[i]->ptr;
+        cache->flush_iov[i].iov_len = cache->block_size;
+        clear_dirty(shard, blocks[i]);
+        mutex_release(&shard->lock);
+    }
+
+    size_t len = count * cache->block_size;
+    ssize_t rc = bio_writev(cache->dev, cache->flush_iov, count, (off_t)blocks[0]->blocknum * cache->block_size);
+    if (rc >= 0 && (size_t)rc != len)
+        rc = ERR_IO;
+    if (rc >= 0)
+        ra_mark_stale(cache, blocks[0]->blocknum, count);
+
+    for (uint i = 0; i < count; i++) {
+        struct bcache_shard *shard = get_shard(cache, blocks[i]->blocknum);
+
+        mutex_acquire(&shard->lock);
+        if (rc < 0) {
+            set_dirty(cache, shard, blocks[i]);
+        } else {
+            shard->stats.writes++;
+            if (i == 0)
+                shard->stats.write_ops++;
         }
+        blocks[i]->ref_count--;
+        mutex_release(&shard->lock);
     }
 
-    err = 0;
-exit:
-    return (err);
+    return rc < 0 ? (int)rc : 0;
+}
+
+/*
+ * Write back the blocks dirtied at or before cutoff, sorted so runs of adjacent blocks
+ * go out as one write. Blocks someone holds are left alone unless include_held is set.
+ */
+static int write_dirty(struct bcache *cache, lk_time_t cutoff, bool include_held) {
+    int err = 0;
+
+    if (cache->read_only)
+        return ERR_NOT_ALLOWED;
+
+    mutex_acquire(&cache->flush_lock);
+    for (;;) {
+        uint n = 0;
+        for (uint i = 0; i < (1u << cache->shard_bits); i++) {
+            struct bcache_shard *shard = &cache->shards[i];
+
+            mutex_acquire(&shard->lock);
+            n = collect_list(cache, &shard->a1in, n, cutoff, include_held);
+            n = collect_list(cache, &shard->am, n, cutoff, include_held);
+            mutex_release(&shard->lock);
+        }
+        if (n == 0)
+            break;
+
+        qsort(cache->flush_batch, n, sizeof(struct bcache_block *), &block_compare);
+
+        for (uint i = 0; i < n;) {
+            uint run = 1;
+            while (i + run < n && run < cache->flush_run_max &&
+                    cache->flush_batch[i + run]->blocknum == cache->flush_batch[i]->blocknum + run) {
+                run++;
+            }
+
+            int rc = write_run(cache, &cache->flush_batch[i], run);
+            if (rc < 0 && err == 0)
+                err = rc;
+            i += run;
+        }
+
+        /* a full batch means there may be more */
+        if (err < 0 || n < BCACHE_FLUSH_BATCH)
+            break;
+    }
+    mutex_release(&cache->flush_lock);
+
+    return err;
+}
+
+static int flusher_thread(void *arg) {
+    struct bcache *cache = arg;
+
+    for (;;) {
+        lk_time_t delay = cache->writeback_delay;
+        event_wait_timeout(&cache->flush_event, (delay == INFINITE_TIME) ? INFINITE_TIME : MAX(delay / 2, 1u));
+        if (cache->flusher_stop)
+            break;
+
+        delay = cache->writeback_delay;
+        if (delay == INFINITE_TIME)
+            continue;
+
+        /* write everything if dirty blocks are piling up, otherwise just the old ones */
+        bool pressure = false;
+        for (uint i = 0; i < (1u << cache->shard_bits); i++)
+            pressure |= cache->shards[i].dirty_count >= cache->shards[i].dirty_max;
+
+        lk_time_t now = current_time();
+        write_dirty(cache, pressure ? now : now - delay, false);
+    }
+
+    return 0;
+}
+
+int bcache_flush(bcache_t priv) {
+    struct bcache *cache = priv;
+
+    return write_dirty(cache, current_time(), true);
+}
+
+void bcache_get_stats(bcache_t priv, struct bcache_stats *stats) {
+    struct bcache *cache = priv;
+
+    memset(stats, 0, sizeof(*stats));
+    for (uint i = 0; i < (1u << cache->shard_bits); i++) {
+        struct bcache_shard *shard = &cache->shards[i];
+
+        mutex_acquire(&shard->lock);
+        stats->hits += shard->stats.hits;
+        stats->misses += shard->stats.misses;
+        stats->ghost_hits += shard->stats.ghost_hits;
+        stats->reads += shard->stats.reads;
+        stats->readahead += shard->stats.readahead;
+        stats->writes += shard->stats.writes;
+        stats->write_ops += shard->stats.write_ops;
+        stats->evictions += shard->stats.evictions;
+        stats->read_time += shard->stats.read_time;
+        stats->max_read_time = MAX(stats->max_read_time, shard->stats.max_read_time);
+        stats->blocks += shard->a1in_count + shard->am_count;
+        mutex_release(&shard->lock);
+    }
 }
 
 void bcache_dump(bcache_t priv, const char *name) {
-    uint32_t finds;
     struct bcache *cache = priv;
+    struct bcache_stats stats;
+    uint32_t finds;
 
-    finds = cache->stats.hits + cache->stats.misses;
+    bcache_get_stats(priv, &stats);
+    finds = stats.hits + stats.misses;
 
-    printf("%s: hits=%u(%u%%) depth=%u misses=%u(%u%%) reads=%u writes=%u\n",
+    printf("%s: hits=%u(%u%%) misses=%u(%u%%) ghost hits=%u reads=%u readahead=%u writes=%u write ops=%u "
+           "evictions=%u\n",
+           name,
+           stats.hits,
+           finds ? (uint32_t)(((uint64_t)stats.hits * 100) / finds) : 0,
+           stats.misses,
+           finds ? (uint32_t)(((uint64_t)stats.misses * 100) / finds) : 0,
+           stats.ghost_hits,
+           stats.reads,
+           stats.readahead,
+           stats.writes,
+           stats.write_ops,
+           stats.evictions);
+    printf("%s: read latency avg=%lluus max=%lluus, %u of %d blocks of %zu bytes in %u shards\n",
            name,
-           cache->stats.hits,
-           finds ? (cache->stats.hits * 100) / finds : 0,
-           cache->stats.hits ? cache->stats.depth / cache->stats.hits : 0,
-           cache->stats.misses,
-           finds ? (cache->stats.misses * 100) / finds : 0,
-           cache->stats.reads,
-           cache->stats.writes);
+           stats.reads ? stats.read_time / stats.reads : 0,
+           stats.max_read_time,
+           stats.blocks,
+           cache->count,
+           cache->block_size,
+           1u << cache->shard_bits);
 }
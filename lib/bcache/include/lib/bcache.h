@@ -14,8 +14,31 @@ __BEGIN_CDECLS
 
 typedef void *bcache_t;
 
+struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t ghost_hits;    // misses on blocks evicted recently enough to be remembered
+    uint32_t reads;
+    uint32_t readahead;     // blocks brought in by readahead rather than on demand
+    uint32_t writes;
+    uint32_t write_ops;     // device writes, each covering one or more adjacent blocks
+    uint32_t evictions;
+    uint32_t blocks;        // blocks currently cached
+    lk_bigtime_t read_time; // usecs spent reading blocks in, in total
+    lk_bigtime_t max_read_time;
+};
+
 bcache_t bcache_create(bdev_t *dev, size_t block_size, int block_count);
 void bcache_set_read_only(bcache_t priv, bool ro);
+
+// limit readahead on sequential misses to max_blocks at a time, 0 turns it off.
+// can only lower the limit the cache was created with.
+void bcache_set_readahead(bcache_t priv, uint max_blocks);
+
+// dirty blocks are written back in the background once they've been dirty for
+// delay msecs, or sooner if too many pile up. INFINITE_TIME leaves them until
+// they're evicted or flushed.
+void bcache_set_writeback_delay(bcache_t priv, lk_time_t delay);
 void bcache_destroy(bcache_t);
 
 int bcache_read_block(bcache_t, void *, uint block);
@@ -26,6 +49,7 @@ int bcache_put_block(bcache_t, uint block);
 int bcache_mark_block_dirty(bcache_t priv, uint blocknum);
 int bcache_zero_block(bcache_t priv, uint blocknum);
 int bcache_flush(bcache_t priv);
+void bcache_get_stats(bcache_t priv, struct bcache_stats *stats);
 void bcache_dump(bcache_t priv, const char *name);
 
 __END_CDECLS
@@ -2,9 +2,13 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
 
-MODULE_DEPS += lib/bio
+MODULE_DEPS += \
+	lib/bio \
+	lib/pool
 
 MODULE_SRCS += \
 	$(LOCAL_DIR)/bcache.c
 
+MODULE_OPTIONS := test
+
 include make/module.mk
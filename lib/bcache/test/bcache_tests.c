@@ -0,0 +1,347 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <lib/bcache.h>
+#include <lib/bio.h>
+#include <lib/heap.h>
+#include <lib/unittest.h>
+#include <kernel/thread.h>
+#include <lk/err.h>
+#include <platform.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_SIZE ((size_t)512)
+#define TEST_DEVICE_BLOCKS 512
+
+/* put a memory block device under the cache with block n filled with n */
+static bdev_t *create_test_bdev(const char *name, void **mem, uint blocks) {
+    *mem = memalign(CACHE_LINE, blocks * BLOCK_SIZE);
+    if (!*mem)
+        return NULL;
+
+    for (uint i = 0; i < blocks; i++)
+        memset((uint8_t *)*mem + i * BLOCK_SIZE, (uint8_t)i, BLOCK_SIZE);
+
+    if (create_membdev(name, *mem, blocks * BLOCK_SIZE) < 0) {
+        free(*mem);
+        return NULL;
+    }
+
+    return bio_open(name);
+}
+
+static void destroy_test_bdev(bdev_t *dev, void *mem) {
+    bio_close(dev);
+    bio_unregister_device(dev);
+    free(mem);
+}
+
+static bool read_through_evictions(void) {
+    BEGIN_TEST;
+
+    void *mem;
+    bdev_t *dev = create_test_bdev("bcache_test0", &mem, TEST_DEVICE_BLOCKS);
+    ASSERT_NONNULL(dev, "failed to create test device");
+
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, 32);
+    ASSERT_NONNULL(cache, "");
+    bcache_set_readahead(cache, 0);
+    bcache_set_writeback_delay(cache, INFINITE_TIME);
+
+    /* twice over a device much larger than the cache */
+    uint8_t buf[BLOCK_SIZE];
+    for (uint pass = 0; pass < 2; pass++) {
+        for (uint i = 0; i < TEST_DEVICE_BLOCKS; i++) {
+            EXPECT_EQ(0, bcache_read_block(cache, buf, i), "");
+            EXPECT_EQ((uint8_t)i, buf[0], "");
+            EXPECT_EQ((uint8_t)i, buf[BLOCK_SIZE - 1], "");
+        }
+    }
+
+    struct bcache_stats stats;
+    bcache_get_stats(cache, &stats);
+    EXPECT_EQ(32u, stats.blocks, "cache should be full but no larger");
+    EXPECT_EQ(2u * TEST_DEVICE_BLOCKS, stats.reads, "");
+    EXPECT_EQ(2u * TEST_DEVICE_BLOCKS - 32, stats.evictions, "");
+
+    /* a block just read should be a hit */
+    EXPECT_EQ(0, bcache_read_block(cache, buf, TEST_DEVICE_BLOCKS - 1), "");
+    bcache_get_stats(cache, &stats);
+    EXPECT_EQ(1u, stats.hits, "");
+
+    bcache_destroy(cache);
+    destroy_test_bdev(dev, mem);
+
+    END_TEST;
+}
+
+static bool dirty_blocks_written_back(void) {
+    BEGIN_TEST;
+
+    void *mem;
+    bdev_t *dev = create_test_bdev("bcache_test1", &mem, TEST_DEVICE_BLOCKS);
+    ASSERT_NONNULL(dev, "failed to create test device");
+
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, 16);
+    ASSERT_NONNULL(cache, "");
+    bcache_set_writeback_delay(cache, INFINITE_TIME);
+
+    /* dirty a block and push it out by reading plenty of others */
+    void *ptr;
+    ASSERT_EQ(0, bcache_get_block(cache, &ptr, 3), "");
+    memset(ptr, 0x5a, BLOCK_SIZE);
+    EXPECT_EQ(0, bcache_mark_block_dirty(cache, 3), "");
+    EXPECT_EQ(0, bcache_put_block(cache, 3), "");
+
+    uint8_t buf[BLOCK_SIZE];
+    for (uint i = 100; i < 200; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, i), "");
+
+    EXPECT_EQ(0x5a, ((uint8_t *)mem)[3 * BLOCK_SIZE], "evicted dirty block wasn't written");
+
+    /* a held block can't be evicted out from under its holder */
+    ASSERT_EQ(0, bcache_get_block(cache, &ptr, 7), "");
+    for (uint i = 200; i < 300; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, i), "");
+    EXPECT_EQ(7, ((uint8_t *)ptr)[0], "");
+    EXPECT_EQ(0, bcache_put_block(cache, 7), "");
+
+    /* zeroed blocks only reach the device on flush */
+    EXPECT_EQ(0, bcache_zero_block(cache, 9), "");
+    EXPECT_EQ(9, ((uint8_t *)mem)[9 * BLOCK_SIZE], "");
+    EXPECT_EQ(0, bcache_flush(cache), "");
+    EXPECT_EQ(0, ((uint8_t *)mem)[9 * BLOCK_SIZE], "");
+
+    struct bcache_stats stats;
+    bcache_get_stats(cache, &stats);
+    EXPECT_EQ(2u, stats.writes, "");
+
+    bcache_destroy(cache);
+    destroy_test_bdev(dev, mem);
+
+    END_TEST;
+}
+
+static bool hot_blocks_survive_scan(void) {
+    BEGIN_TEST;
+
+    /* small enough to be a single shard, so the numbers below are exact:
+     * 64 blocks, a1in held to 16 and a1out remembering 32 */
+    const uint capacity = 64;
+    const uint hot = 8;
+    const uint filler = 76;
+    const uint scan = 4 * capacity;
+
+    void *mem;
+    bdev_t *dev = create_test_bdev("bcache_test2", &mem, TEST_DEVICE_BLOCKS);
+    ASSERT_NONNULL(dev, "failed to create test device");
+
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, capacity);
+    ASSERT_NONNULL(cache, "");
+    bcache_set_readahead(cache, 0);
+    bcache_set_writeback_delay(cache, INFINITE_TIME);
+
+    uint8_t buf[BLOCK_SIZE];
+    uint next = hot;
+
+    /* read the hot set, then enough to push it out of a1in but not out of a1out */
+    for (uint i = 0; i < hot; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, i), "");
+    for (uint i = 0; i < filler; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, next++), "");
+
+    /* reading it again should find it in a1out and promote it */
+    for (uint i = 0; i < hot; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, i), "");
+
+    struct bcache_stats stats;
+    bcache_get_stats(cache, &stats);
+    EXPECT_EQ(hot, stats.ghost_hits, "");
+
+    /* one pass over a run of blocks several times the size of the cache */
+    for (uint i = 0; i < scan; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, next++), "");
+
+    /* the hot set should all still be there */
+    struct bcache_stats before;
+    bcache_get_stats(cache, &before);
+    for (uint i = 0; i < hot; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, i), "");
+    bcache_get_stats(cache, &stats);
+    EXPECT_EQ(before.hits + hot, stats.hits, "hot blocks were evicted by the scan");
+    EXPECT_EQ(before.misses, stats.misses, "");
+
+    bcache_destroy(cache);
+    destroy_test_bdev(dev, mem);
+
+    END_TEST;
+}
+
+static bool lookup_bench(void) {
+    BEGIN_TEST;
+
+    const uint blocks = 2048;
+    const uint iters = 100000;
+
+    void *mem;
+    bdev_t *dev = create_test_bdev("bcache_test3", &mem, blocks);
+    ASSERT_NONNULL(dev, "failed to create test device");
+
+    /* room to spare, so no shard overflows however the blocks hash */
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, blocks * 2);
+    ASSERT_NONNULL(cache, "");
+
+    uint8_t buf[BLOCK_SIZE];
+    for (uint i = 0; i < blocks; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, i), "");
+
+    struct bcache_stats before;
+    bcache_get_stats(cache, &before);
+
+    /* every lookup is a hit, stride around so consecutive ones land apart */
+    lk_bigtime_t t = current_time_hires();
+    uint b = 0;
+    for (uint i = 0; i < iters; i++) {
+        void *ptr;
+        bcache_get_block(cache, &ptr, b);
+        bcache_put_block(cache, b);
+        b = (b + 97) % blocks;
+    }
+    t = current_time_hires() - t;
+
+    struct bcache_stats stats;
+    bcache_get_stats(cache, &stats);
+    EXPECT_EQ(before.hits + iters, stats.hits, "");
+
+    unittest_printf("\n\t%u cached blocks: %llu nsecs per lookup\n", blocks, t * 1000 / iters);
+
+    bcache_destroy(cache);
+    destroy_test_bdev(dev, mem);
+
+    END_TEST;
+}
+
+static bool sequential_readahead(void) {
+    BEGIN_TEST;
+
+    void *mem;
+    bdev_t *dev = create_test_bdev("bcache_test4", &mem, TEST_DEVICE_BLOCKS);
+    ASSERT_NONNULL(dev, "failed to create test device");
+
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, 256);
+    ASSERT_NONNULL(cache, "");
+
+    uint8_t buf[BLOCK_SIZE];
+    for (uint i = 0; i < TEST_DEVICE_BLOCKS; i++) {
+        EXPECT_EQ(0, bcache_read_block(cache, buf, i), "");
+        EXPECT_EQ((uint8_t)i, buf[0], "");
+        EXPECT_EQ((uint8_t)i, buf[BLOCK_SIZE - 1], "");
+    }
+
+    /* only the first block should have been read on its own, the second starts the stream */
+    struct bcache_stats stats;
+    bcache_get_stats(cache, &stats);
+    EXPECT_EQ(1u, stats.reads, "");
+    EXPECT_EQ(TEST_DEVICE_BLOCKS - 1u, stats.readahead, "");
+    EXPECT_GT(32u, stats.misses, "readahead runs aren't growing");
+
+    bcache_destroy(cache);
+    destroy_test_bdev(dev, mem);
+
+    END_TEST;
+}
+
+static bool readahead_not_stale(void) {
+    BEGIN_TEST;
+
+    void *mem;
+    bdev_t *dev = create_test_bdev("bcache_test5", &mem, TEST_DEVICE_BLOCKS);
+    ASSERT_NONNULL(dev, "failed to create test device");
+
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, 32);
+    ASSERT_NONNULL(cache, "");
+    bcache_set_writeback_delay(cache, INFINITE_TIME);
+
+    /* start a stream, which leaves blocks 5 through 8 read ahead but not yet installed */
+    uint8_t buf[BLOCK_SIZE];
+    EXPECT_EQ(0, bcache_read_block(cache, buf, 0), "");
+    EXPECT_EQ(0, bcache_read_block(cache, buf, 1), "");
+
+    /* rewrite block 6 on the device behind the readahead, then push it out of the cache */
+    EXPECT_EQ(0, bcache_zero_block(cache, 6), "");
+    EXPECT_EQ(0, bcache_flush(cache), "");
+    for (uint i = 0; i < 32; i++)
+        EXPECT_EQ(0, bcache_read_block(cache, buf, 200 + i * 2), "");
+
+    /* picking the stream back up must not bring back the old contents */
+    EXPECT_EQ(0, bcache_read_block(cache, buf, 5), "");
+    EXPECT_EQ(5, buf[0], "");
+    EXPECT_EQ(0, bcache_read_block(cache, buf, 6), "");
+    EXPECT_EQ(0, buf[0], "stale readahead data");
+    EXPECT_EQ(0, bcache_read_block(cache, buf, 7), "");
+    EXPECT_EQ(7, buf[0], "");
+
+    bcache_destroy(cache);
+    destroy_test_bdev(dev, mem);
+
+    END_TEST;
+}
+
+static bool write_behind(void) {
+    BEGIN_TEST;
+
+    void *mem;
+    bdev_t *dev = create_test_bdev("bcache_test6", &mem, TEST_DEVICE_BLOCKS);
+    ASSERT_NONNULL(dev, "failed to create test device");
+
+    bcache_t cache = bcache_create(dev, BLOCK_SIZE, 128);
+    ASSERT_NONNULL(cache, "");
+    bcache_set_writeback_delay(cache, INFINITE_TIME);
+
+    /* dirty a run of blocks in no particular order, they should go out as one write */
+    for (uint i = 0; i < 32; i++) {
+        uint b = 64 + (i * 7) % 32;
+        void *ptr;
+        ASSERT_EQ(0, bcache_get_block(cache, &ptr, b), "");
+        memset(ptr, 0xa5, BLOCK_SIZE);
+        EXPECT_EQ(0, bcache_mark_block_dirty(cache, b), "");
+        EXPECT_EQ(0, bcache_put_block(cache, b), "");
+    }
+    EXPECT_EQ(0, bcache_flush(cache), "");
+
+    struct bcache_stats stats;
+    bcache_get_stats(cache, &stats);
+    EXPECT_EQ(32u, stats.writes, "");
+    EXPECT_EQ(1u, stats.write_ops, "adjacent blocks weren't merged");
+    for (uint i = 64; i < 96; i++)
+        EXPECT_EQ(0xa5, ((uint8_t *)mem)[i * BLOCK_SIZE], "");
+
+    /* now let the flusher find a couple of dirty blocks on its own */
+    bcache_set_writeback_delay(cache, 10);
+    EXPECT_EQ(0, bcache_zero_block(cache, 300), "");
+    EXPECT_EQ(0, bcache_zero_block(cache, 301), "");
+    for (uint i = 0; i < 100 && ((uint8_t *)mem)[301 * BLOCK_SIZE] != 0; i++)
+        thread_sleep(10);
+    EXPECT_EQ(0, ((uint8_t *)mem)[300 * BLOCK_SIZE], "");
+    EXPECT_EQ(0, ((uint8_t *)mem)[301 * BLOCK_SIZE], "flusher didn't write block back");
+
+    bcache_destroy(cache);
+    destroy_test_bdev(dev, mem);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(bcache_tests)
+RUN_TEST(read_through_evictions)
+RUN_TEST(dirty_blocks_written_back)
+RUN_TEST(hot_blocks_survive_scan)
+RUN_TEST(lookup_bench)
+RUN_TEST(sequential_readahead)
+RUN_TEST(readahead_not_stale)
+RUN_TEST(write_behind)
+END_TEST_CASE(bcache_tests)
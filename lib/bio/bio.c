@@ -7,8 +7,11 @@
  */
 #include <lib/bio.h>
 
+#include "bio_priv.h"
+
 #include <arch/atomic.h>
 #include <assert.h>
+#include <kernel/event.h>
 #include <kernel/mutex.h>
 #include <lk/debug.h>
 #include <lk/err.h>
@@ -297,6 +300,8 @@ static void bdev_dec_ref(bdev_t *dev) {
 
         LTRACEF("last ref, removing (%s)\n", dev->name);
 
+        bio_queue_destroy(dev);
+
         // call the close hook if it exists
         if (dev->close) {
             dev->close(dev);
@@ -391,7 +396,7 @@ status_t bio_read_async(bdev_t *dev, void *buf, off_t offset, size_t len,
 
     DEBUG_ASSERT(dev && dev->ref > 0);
     DEBUG_ASSERT(buf);
-    if (dev->read_async == NULL) {
+    if (dev->queue_depth == 0 && dev->read_async == NULL) {
         return ERR_NOT_SUPPORTED;
     }
 
@@ -401,7 +406,8 @@ status_t bio_read_async(bdev_t *dev, void *buf, off_t offset, size_t len,
         return 0;
     }
 
-    return dev->read_async(dev, buf, offset, len, callback, callback_context);
+    iovec_t iov = { buf, len };
+    return bio_submit_iov(dev, false, &iov, 1, offset, len, callback, callback_context);
 }
 
 status_t bio_write_async(bdev_t *dev, const void *buf, off_t offset, size_t len,
@@ -411,7 +417,7 @@ status_t bio_write_async(bdev_t *dev, const void *buf, off_t offset, size_t len,
 
     DEBUG_ASSERT(dev && dev->ref > 0);
     DEBUG_ASSERT(buf);
-    if (dev->write_async == NULL) {
+    if (dev->queue_depth == 0 && dev->write_async == NULL) {
         return ERR_NOT_SUPPORTED;
     }
 
@@ -421,7 +427,179 @@ status_t bio_write_async(bdev_t *dev, const void *buf, off_t offset, size_t len,
         return 0;
     }
 
-    return dev->write_async(dev, buf, offset, len, callback, callback_context);
+    iovec_t iov = { (void *)buf, len };
+    return bio_submit_iov(dev, true, &iov, 1, offset, len, callback, callback_context);
+}
+
+bool bio_iov_aligned(const bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                     size_t len) {
+    if (!IS_ALIGNED(offset, dev->block_size)) {
+        return false;
+    }
+
+    bool cache_aligned = dev->flags & (write ? BIO_FLAG_CACHE_ALIGNED_WRITES : BIO_FLAG_CACHE_ALIGNED_READS);
+    for (uint i = 0; i < iov_cnt && len > 0; i++) {
+        size_t seg = MIN(iov[i].iov_len, len);
+        if (!IS_ALIGNED(seg, dev->block_size)) {
+            return false;
+        }
+        if (cache_aligned && !IS_ALIGNED(iov[i].iov_base, CACHE_LINE)) {
+            return false;
+        }
+        len -= seg;
+    }
+
+    return true;
+}
+
+ssize_t bio_iov_sync(bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                     size_t len) {
+    ssize_t total = 0;
+
+    for (uint i = 0; i < iov_cnt && len > 0; i++) {
+        size_t seg = MIN(iov[i].iov_len, len);
+        if (seg == 0) {
+            continue;
+        }
+
+        ssize_t err = write ? dev->write(dev, iov[i].iov_base, offset, seg)
+                            : dev->read(dev, iov[i].iov_base, offset, seg);
+        if (err < 0) {
+            return err;
+        }
+
+        total += err;
+        offset += err;
+        len -= err;
+        if ((size_t)err < seg) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+status_t bio_submit_iov(bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                        size_t len, bio_async_callback_t callback, void *cookie) {
+    if (dev->queue_depth > 0) {
+        return bio_queue_submit(dev, write, iov, iov_cnt, offset, len, callback, cookie);
+    }
+
+    /* straight through to the driver */
+    if (iov_cnt == 1) {
+        if (write && dev->write_async) {
+            return dev->write_async(dev, iov[0].iov_base, offset, len, callback, cookie);
+        }
+        if (!write && dev->read_async) {
+            return dev->read_async(dev, iov[0].iov_base, offset, len, callback, cookie);
+        }
+    }
+
+    if (bio_iov_aligned(dev, write, iov, iov_cnt, offset, len)) {
+        if (write && dev->writev_async) {
+            return dev->writev_async(dev, iov, iov_cnt, offset, len, callback, cookie);
+        }
+        if (!write && dev->readv_async) {
+            return dev->readv_async(dev, iov, iov_cnt, offset, len, callback, cookie);
+        }
+    }
+
+    /* unqueued devices with async hooks complete inline anyway, do the same */
+    if (write ? dev->write_async != NULL : dev->read_async != NULL) {
+        callback(cookie, dev, bio_iov_sync(dev, write, iov, iov_cnt, offset, len));
+        return NO_ERROR;
+    }
+
+    return ERR_NOT_SUPPORTED;
+}
+
+struct bio_iov_wait {
+    event_t event;
+    ssize_t result;
+};
+
+static void bio_iov_wait_callback(void *cookie, bdev_t *dev, ssize_t status) {
+    struct bio_iov_wait *wait = cookie;
+
+    wait->result = status;
+    event_signal(&wait->event, false);
+}
+
+static ssize_t bio_rwv(bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset) {
+    LTRACEF("dev '%s', %s iov %p, iov_cnt %u, offset %lld\n", dev->name, write ? "write" : "read",
+            iov, iov_cnt, offset);
+
+    DEBUG_ASSERT(dev && dev->ref > 0);
+    DEBUG_ASSERT(iov || iov_cnt == 0);
+
+    /* range check */
+    ssize_t size = iovec_size(iov, iov_cnt);
+    if (size < 0) {
+        return size;
+    }
+    size_t len = bio_trim_range(dev, offset, size);
+    if (len == 0) {
+        return 0;
+    }
+
+    /* a scattered transfer the driver can take in one go, otherwise a buffer at a time */
+    bool vectored = iov_cnt > 1 && (write ? dev->writev_async != NULL : dev->readv_async != NULL) &&
+                    bio_iov_aligned(dev, write, iov, iov_cnt, offset, len);
+    if (!vectored) {
+        return bio_iov_sync(dev, write, iov, iov_cnt, offset, len);
+    }
+
+    struct bio_iov_wait wait;
+    event_init(&wait.event, false, 0);
+
+    ssize_t err = bio_submit_iov(dev, write, iov, iov_cnt, offset, len, &bio_iov_wait_callback, &wait);
+    if (err >= 0) {
+        event_wait(&wait.event);
+        err = wait.result;
+    }
+
+    event_destroy(&wait.event);
+
+    return err;
+}
+
+ssize_t bio_readv(bdev_t *dev, const iovec_t *iov, uint iov_cnt, off_t offset) {
+    return bio_rwv(dev, false, iov, iov_cnt, offset);
+}
+
+ssize_t bio_writev(bdev_t *dev, const iovec_t *iov, uint iov_cnt, off_t offset) {
+    return bio_rwv(dev, true, iov, iov_cnt, offset);
+}
+
+static status_t bio_rwv_async(bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                              bio_async_callback_t callback, void *callback_context) {
+    LTRACEF("dev '%s', %s iov %p, iov_cnt %u, offset %lld\n", dev->name, write ? "write" : "read",
+            iov, iov_cnt, offset);
+
+    DEBUG_ASSERT(dev && dev->ref > 0);
+    DEBUG_ASSERT(iov || iov_cnt == 0);
+
+    /* range check */
+    ssize_t size = iovec_size(iov, iov_cnt);
+    if (size < 0) {
+        return (status_t)size;
+    }
+    size_t len = bio_trim_range(dev, offset, size);
+    if (len == 0) {
+        return 0;
+    }
+
+    return bio_submit_iov(dev, write, iov, iov_cnt, offset, len, callback, callback_context);
+}
+
+status_t bio_readv_async(bdev_t *dev, const iovec_t *iov, uint iov_cnt, off_t offset,
+                         bio_async_callback_t callback, void *callback_context) {
+    return bio_rwv_async(dev, false, iov, iov_cnt, offset, callback, callback_context);
+}
+
+status_t bio_writev_async(bdev_t *dev, const iovec_t *iov, uint iov_cnt, off_t offset,
+                          bio_async_callback_t callback, void *callback_context) {
+    return bio_rwv_async(dev, true, iov, iov_cnt, offset, callback, callback_context);
 }
 
 ssize_t bio_read_block(bdev_t *dev, void *buf, bnum_t block, uint count) {
@@ -519,6 +697,8 @@ void bio_initialize_bdev(bdev_t *dev,
     dev->erase_byte = 0;
     dev->ref = 0;
     dev->flags = flags;
+    dev->queue_depth = 0;
+    dev->queue = NULL;
 
 #if DEBUG
     // If we have been supplied information about our erase geometry, sanity
@@ -568,6 +748,8 @@ void bio_initialize_bdev(bdev_t *dev,
     dev->write = bio_default_write;
     dev->write_async = NULL;
     dev->write_block = bio_default_write_block;
+    dev->readv_async = NULL;
+    dev->writev_async = NULL;
     dev->erase = bio_default_erase;
     dev->ioctl = NULL;
     dev->close = NULL;
@@ -624,6 +806,13 @@ void bio_dump_devices(void) {
         printf("\t%s, size %lld, bsize %zd, ref %d",
                entry->name, entry->total_size, entry->block_size, entry->ref);
 
+        struct bio_queue_stats qstats;
+        if (bio_get_queue_stats(entry, &qstats) == NO_ERROR) {
+            printf(", queue depth %u: %u requests %u merged %u dispatches %u expired max inflight %u",
+                   entry->queue_depth, qstats.requests, qstats.merged, qstats.dispatches,
+                   qstats.expired, qstats.max_inflight);
+        }
+
         if (!entry->geometry_count || !entry->geometry) {
             printf(" (no erase geometry)");
         } else {
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#pragma once
+
+#include <lib/bio.h>
+#include <lk/compiler.h>
+
+__BEGIN_CDECLS
+
+// start an async transfer of len bytes, already trimmed to the device, to or from
+// the buffers in iov. A single entry iov is copied, a longer one must stay valid
+// until the callback.
+status_t bio_submit_iov(bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                        size_t len, bio_async_callback_t callback, void *cookie);
+
+// whether a vectored transfer is laid out so the driver's vector hooks can take it
+bool bio_iov_aligned(const bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                     size_t len);
+
+// transfer the buffers in iov one at a time through the synchronous hooks
+ssize_t bio_iov_sync(bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                     size_t len);
+
+// queue an async request, the range has already been trimmed to the device
+status_t bio_queue_submit(bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                          size_t len, bio_async_callback_t callback, void *cookie);
+
+// finish off and free a device's queue, once the last reference to it is gone
+void bio_queue_destroy(bdev_t *dev);
+
+__END_CDECLS
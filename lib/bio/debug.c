@@ -50,6 +50,7 @@ usage:
         printf("%s write <device> <address> <offset> <len>\n", argv[0].str);
         printf("%s dump <device> <offset> <len>\n", argv[0].str);
         printf("%s erase <device> <offset> <len>\n", argv[0].str);
+        printf("%s discard <device> <offset> <len>\n", argv[0].str);
         printf("%s ioctl <device> <request> <arg>\n", argv[0].str);
         printf("%s remove <device>\n", argv[0].str);
         printf("%s create_memdev <device> <blocks>\n", argv[0].str);
@@ -174,6 +175,28 @@ usage:
 
         bio_close(dev);
 
+        rc = err;
+    } else if (!strcmp(argv[1].str, "discard")) {
+        if (argc < 5) {
+            goto notenoughargs;
+        }
+
+        bio_ioctl_range_t range = {
+            .offset = argv[3].ull,
+            .len = argv[4].u,
+        };
+
+        bdev_t *dev = bio_open(argv[2].str);
+        if (!dev) {
+            printf("error opening block device\n");
+            return -1;
+        }
+
+        int err = bio_ioctl(dev, BIO_IOCTL_DISCARD, &range);
+        dprintf(INFO, "discard returns %d\n", err);
+
+        bio_close(dev);
+
         rc = err;
     } else if (!strcmp(argv[1].str, "ioctl")) {
         if (argc < 4) {
@@ -28,6 +28,7 @@
 //   inside bio_iter_devices() callbacks (internal lock held).
 
 #include <assert.h>
+#include <iovec.h>
 #include <lk/list.h>
 #include <sys/types.h>
 
@@ -43,6 +44,10 @@ __BEGIN_CDECLS
 #define BIO_FLAG_CACHE_ALIGNED_READS  (1 << 0)
 #define BIO_FLAG_CACHE_ALIGNED_WRITES (1 << 1)
 
+// BIO_FLAG_SCHED_FIFO: dispatch queued async requests in the order they were
+// submitted rather than sorted by offset, for devices where seeking is free.
+#define BIO_FLAG_SCHED_FIFO           (1 << 2)
+
 // Block number type.
 // NOTE: 32-bit for historical reasons; may be extended to 64-bit on 64-bit
 // architectures in the future.
@@ -81,6 +86,13 @@ typedef struct bdev {
     uint8_t erase_byte; // byte pattern used after erase (e.g., 0xFF for NOR)
     uint32_t flags;     // BIO_FLAG_* values indicating device properties
 
+    // Number of async requests the driver can have outstanding at once. Drivers
+    // opt in to request queueing by setting it, async requests are then queued and
+    // handed to the driver up to this many at a time. Defaults to 0, which passes
+    // async calls straight through to the driver hooks unqueued.
+    uint queue_depth;
+    struct bio_queue *queue; // internal, created on the first queued request
+
     // Driver-provided operations.
     // Synchronous ops return number of bytes/blocks processed (>= 0) or
     // negative LK error code on failure.
@@ -97,6 +109,18 @@ typedef struct bdev {
                             void *callback_context);
     ssize_t (*write_block)(struct bdev *, const void *buf, bnum_t block, uint count);
 
+    // Vectored async ops (optional). Transfer len bytes starting at offset
+    // to/from the iov_cnt buffers in iov, in order; the buffers may describe
+    // more than len. Only called with offset and every buffer length a multiple
+    // of block_size. The iovec array need only stay valid for the call, the
+    // buffers until the callback.
+    status_t (*readv_async)(struct bdev *, const iovec_t *iov, uint iov_cnt, off_t offset,
+                            size_t len, void (*callback)(void *cookie, struct bdev *, ssize_t),
+                            void *callback_context);
+    status_t (*writev_async)(struct bdev *, const iovec_t *iov, uint iov_cnt, off_t offset,
+                             size_t len, void (*callback)(void *cookie, struct bdev *, ssize_t),
+                             void *callback_context);
+
     // Erase len bytes starting at offset, adhering to erase geometry if present.
     // Optional; return ERR_NOT_SUPPORTED if not implemented.
     ssize_t (*erase)(struct bdev *, off_t offset, size_t len);
@@ -126,9 +150,46 @@ ssize_t bio_read(bdev_t *dev, void *buf, off_t offset, size_t len);
 
 // Asynchronous read. Returns status immediately; on completion the callback is
 // invoked with the final byte count or negative error.
+// Unless the device has a queue_depth of 0 the request goes on the device's
+// queue, where it may be merged with adjacent requests and reordered with
+// respect to others that don't overlap it. The callback is then called from
+// the queue's thread rather than the driver's completion context. Devices
+// without async hooks are handled by the queue calling their sync hooks.
 status_t bio_read_async(bdev_t *dev, void *buf, off_t offset, size_t len,
                         bio_async_callback_t callback, void *callback_context);
 
+// Vectored read into the iov_cnt buffers in iov, filled in order. Returns the
+// number of bytes read or a negative error.
+// When offset and every buffer's length are multiples of the block size (and
+// the buffers are cache line aligned, for BIO_FLAG_CACHE_ALIGNED_READS devices)
+// a driver with vector hooks transfers straight to and from the buffers with a
+// single request. Otherwise each buffer is read in turn as bio_read() would.
+ssize_t bio_readv(bdev_t *dev, const iovec_t *iov, uint iov_cnt, off_t offset);
+
+// Asynchronous vectored read. As bio_read_async(), except the iovec array, not
+// just the buffers, must stay valid until the callback.
+status_t bio_readv_async(bdev_t *dev, const iovec_t *iov, uint iov_cnt, off_t offset,
+                         bio_async_callback_t callback, void *callback_context);
+
+// Hold queued async requests back from the driver until the matching
+// bio_unplug(), so a batch of them can be merged and sorted as a whole.
+// Plugs nest.
+void bio_plug(bdev_t *dev);
+void bio_unplug(bdev_t *dev);
+
+// Counters for a device's async request queue.
+struct bio_queue_stats {
+    uint32_t requests;   // requests submitted
+    uint32_t merged;     // requests merged into an adjacent one's dispatch
+    uint32_t dispatches; // requests handed to the driver
+    uint32_t expired;    // dispatched early because they'd waited too long
+    uint32_t max_inflight;
+};
+
+// Fetch a device's queue counters. Returns ERR_NOT_FOUND if nothing has been
+// queued to it yet.
+status_t bio_get_queue_stats(bdev_t *dev, struct bio_queue_stats *stats);
+
 // Read count blocks starting at block index into buf. count is in blocks.
 // Returns blocks read (in bytes via ssize_t, i.e. count*block_size) or error.
 ssize_t bio_read_block(bdev_t *dev, void *buf, bnum_t block, uint count);
@@ -142,6 +203,13 @@ ssize_t bio_write(bdev_t *dev, const void *buf, off_t offset, size_t len);
 status_t bio_write_async(bdev_t *dev, const void *buf, off_t offset, size_t len,
                          bio_async_callback_t callback, void *callback_context);
 
+// Vectored write, gathering from the buffers in iov. See bio_readv().
+ssize_t bio_writev(bdev_t *dev, const iovec_t *iov, uint iov_cnt, off_t offset);
+
+// Asynchronous vectored write. See bio_readv_async().
+status_t bio_writev_async(bdev_t *dev, const iovec_t *iov, uint iov_cnt, off_t offset,
+                          bio_async_callback_t callback, void *callback_context);
+
 // Write count blocks starting at block index from buf. Returns bytes written
 // (count*block_size) or negative error.
 ssize_t bio_write_block(bdev_t *dev, const void *buf, bnum_t block, uint count);
@@ -226,14 +294,23 @@ static inline bool bio_contains_range(uint64_t container_start, uint64_t contain
 // - BIO_IOCTL_GET_MAP_ADDR: argp -> void **out; fetch map address without
 //   forcing linear mode if supported by the driver.
 // - BIO_IOCTL_IS_MAPPED: argp -> bool *out; returns whether device is mapped.
+// - BIO_IOCTL_DISCARD: argp -> const bio_ioctl_range_t *; tells the device the
+//   block aligned range is no longer in use. Its contents are undefined after.
 enum bio_ioctl_num {
     BIO_IOCTL_NULL = 0,
     BIO_IOCTL_GET_MEM_MAP,  // if supported, request a pointer to the memory map of the device
     BIO_IOCTL_PUT_MEM_MAP,  // if needed, return the pointer (to 'close' the map)
     BIO_IOCTL_GET_MAP_ADDR, // if supported, request a pointer to the memory map without putting the device into linear mode
     BIO_IOCTL_IS_MAPPED,    // if supported, returns whether or not the device is memory mapped.
+    BIO_IOCTL_DISCARD,      // if supported, drop the backing storage of a range of the device
 };
 
+// Byte range argument for BIO_IOCTL_DISCARD.
+typedef struct bio_ioctl_range {
+    off_t offset;
+    size_t len;
+} bio_ioctl_range_t;
+
 // The callback will be called once for every block device, with the cookie and pointer
 // to the bdev structure. Note callback would be called with internal mutex held, which
 // prevents other process/threads from using APIs such as bio_open, so kindly ask callers
@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include "bio_priv.h"
+
+#include <arch/ops.h>
+#include <assert.h>
+#include <kernel/event.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <kernel/thread.h>
+#include <lib/bio.h>
+#include <lib/slab.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <lk/init.h>
+#include <lk/list.h>
+#include <lk/trace.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOCAL_TRACE 0
+
+/*
+ * Per device queue of async requests.
+ *
+ * bio_read_async() and bio_write_async() put the request on the device's queue, and a
+ * thread per device hands requests to the driver, keeping up to queue_depth of them in
+ * flight. Requests waiting their turn are kept sorted by offset and dispatched in one
+ * sweep up the device before starting again from the bottom (C-LOOK), except that a
+ * read waiting more than BIO_READ_DEADLINE msecs or a write more than BIO_WRITE_DEADLINE
+ * goes next regardless. Devices with BIO_FLAG_SCHED_FIFO are dispatched in submission
+ * order instead. Either way a request never overtakes an earlier one it overlaps if
+ * either of them writes.
+ *
+ * A run of requests adjacent on the device goes to the driver as one, if they're also
+ * adjacent in memory or the driver has vector hooks to take the scattered buffers.
+ *
+ * Drivers complete requests in whatever context they like, often an interrupt handler,
+ * which only puts them on a list. The queue thread calls the callbacks a batch at a
+ * time and then refills the device. Drivers without async hooks are handled by the
+ * thread calling their synchronous ones.
+ */
+
+#define BIO_READ_DEADLINE 50   /* msecs */
+#define BIO_WRITE_DEADLINE 500 /* msecs */
+
+/* largest request built by merging, and the most buffers one can gather up */
+#define BIO_MAX_MERGE (128 * 1024)
+#define BIO_MAX_SEGS 64
+
+struct bio_request {
+    struct list_node node;      /* sorted list while pending, in flight or completed list after */
+    struct list_node fifo_node; /* fifo list while pending */
+    struct bio_queue *queue;
+    uint64_t seq;
+    lk_time_t deadline;
+
+    bool write;
+    bool vec_ok; /* laid out for the driver's vector hooks */
+    off_t offset;
+    size_t len;
+    const iovec_t *iov;
+    uint iov_cnt;
+    iovec_t single; /* iov points here for a single buffer */
+    bio_async_callback_t callback;
+    void *cookie;
+
+    /* set in the first request of a dispatch */
+    struct bio_request *merged; /* the rest of the dispatch, in offset order */
+    size_t io_len;
+    uint io_segs;
+    ssize_t status;
+};
+
+struct bio_queue {
+    bdev_t *dev;
+    spin_lock_t lock;
+
+    struct list_node sorted;    /* pending, by offset */
+    struct list_node fifo;      /* pending, by submission */
+    struct list_node inflight;  /* handed to the driver */
+    struct list_node completed; /* waiting for their callbacks */
+    uint inflight_count;
+
+    uint64_t next_seq;
+    off_t head;    /* where the last dispatch ended */
+    uint plugged;
+    bool stalled;  /* the driver ran out of room, wait for something to complete */
+    bool stopping;
+
+    event_t event;
+    thread_t *thread;
+
+    /* scratch space for gathering a merged dispatch's buffers, used by the queue thread */
+    iovec_t iov[BIO_MAX_SEGS];
+
+    struct bio_queue_stats stats;
+};
+
+static slab_cache_t request_cache;
+static mutex_t queue_create_lock = MUTEX_INITIAL_VALUE(queue_create_lock);
+
+static void bio_queue_init(uint level) {
+    slab_cache_init(&request_cache, "bio request", sizeof(struct bio_request),
+                    __alignof(struct bio_request), 0, NULL);
+}
+
+LK_INIT_HOOK(bio_queue, &bio_queue_init, LK_INIT_LEVEL_KERNEL);
+
+static bool conflicts(const struct bio_request *a, const struct bio_request *b) {
+    return (a->write || b->write) && bio_does_overlap(a->offset, a->len, b->offset, b->len);
+}
+
+/* can req go to the driver now, without overtaking anything it overlaps */
+static bool can_dispatch(struct bio_queue *q, const struct bio_request *req) {
+    struct bio_request *r;
+
+    list_for_every_entry(&q->fifo, r, struct bio_request, fifo_node) {
+        if (r->seq >= req->seq)
+            break;
+        if (conflicts(r, req))
+            return false;
+    }
+
+    list_for_every_entry(&q->inflight, r, struct bio_request, node) {
+        for (struct bio_request *m = r; m; m = m->merged) {
+            if (conflicts(m, req))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+static void insert_pending(struct bio_queue *q, struct bio_request *req) {
+    struct bio_request *r;
+
+    /* after any others at the same offset, so they keep their order */
+    r = list_peek_tail_type(&q->sorted, struct bio_request, node);
+    while (r && r->offset > req->offset)
+        r = list_prev_type(&q->sorted, &r->node, struct bio_request, node);
+    if (r)
+        list_add_after(&r->node, &req->node);
+    else
+        list_add_head(&q->sorted, &req->node);
+
+    /* almost always the newest, unless it's being put back */
+    r = list_peek_tail_type(&q->fifo, struct bio_request, fifo_node);
+    while (r && r->seq > req->seq)
+        r = list_prev_type(&q->fifo, &r->fifo_node, struct bio_request, fifo_node);
+    if (r)
+        list_add_after(&r->fifo_node, &req->fifo_node);
+    else
+        list_add_head(&q->fifo, &req->fifo_node);
+}
+
+static void remove_pending(struct bio_request *req) {
+    list_delete(&req->node);
+    list_delete(&req->fifo_node);
+}
+
+/* choose the next request to dispatch, NULL if nothing can go yet */
+static struct bio_request *pick_request(struct bio_queue *q) {
+    struct bio_request *oldest = list_peek_head_type(&q->fifo, struct bio_request, fifo_node);
+    struct bio_request *req = NULL;
+
+    if (!oldest)
+        return NULL;
+
+    if (q->dev->flags & BIO_FLAG_SCHED_FIFO) {
+        req = oldest;
+    } else if (TIME_GTE(current_time(), oldest->deadline)) {
+        req = oldest;
+        q->stats.expired++;
+    } else {
+        /* the next one up from the last dispatch, wrapping around to the start */
+        struct bio_request *r;
+        list_for_every_entry(&q->sorted, r, struct bio_request, node) {
+            if (r->offset >= q->head) {
+                req = r;
+                break;
+            }
+        }
+        if (!req)
+            req = list_peek_head_type(&q->sorted, struct bio_request, node);
+    }
+
+    /* if it would overtake something it overlaps, go with the oldest of those instead */
+    for (;;) {
+        struct bio_request *r, *conflict = NULL;
+        list_for_every_entry(&q->fifo, r, struct bio_request, fifo_node) {
+            if (r->seq >= req->seq)
+                break;
+            if (conflicts(r, req)) {
+                conflict = r;
+                break;
+            }
+        }
+        if (!conflict)
+            break;
+        req = conflict;
+    }
+
+    return can_dispatch(q, req) ? req : NULL;
+}
+
+static bool has_vector_hook(const bdev_t *dev, bool write) {
+    return write ? dev->writev_async != NULL : dev->readv_async != NULL;
+}
+
+/* can b follow straight on from a in one dispatch */
+static bool mergeable(const bdev_t *dev, const struct bio_request *a, const struct bio_request *b) {
+    if (a->write != b->write || a->offset + (off_t)a->len != b->offset)
+        return false;
+
+    /* the driver can gather the buffers up wherever they are */
+    if (a->vec_ok && b->vec_ok && has_vector_hook(dev, a->write))
+        return true;
+
+    return a->iov_cnt == 1 && b->iov_cnt == 1 &&
+           (uint8_t *)a->iov[0].iov_base + a->len == b->iov[0].iov_base;
+}
+
+static bool fits(size_t len, uint segs, const struct bio_request *r) {
+    return len + r->len <= BIO_MAX_MERGE && segs + r->iov_cnt <= BIO_MAX_SEGS;
+}
+
+/* take req off the pending lists, along with any run of requests it can be merged with */
+static struct bio_request *take_request(struct bio_queue *q, struct bio_request *req) {
+    size_t len = req->len;
+    uint segs = req->iov_cnt;
+
+    /* back up to the start of the run */
+    for (;;) {
+        struct bio_request *prev = list_prev_type(&q->sorted, &req->node, struct bio_request, node);
+        if (!prev || !mergeable(q->dev, prev, req) || !fits(len, segs, prev) || !can_dispatch(q, prev))
+            break;
+        len += prev->len;
+        segs += prev->iov_cnt;
+        req = prev;
+    }
+
+    struct bio_request *tail = req;
+    struct bio_request *next = list_next_type(&q->sorted, &req->node, struct bio_request, node);
+    remove_pending(req);
+    req->merged = NULL;
+    req->io_len = req->len;
+    req->io_segs = req->iov_cnt;
+
+    while (next && mergeable(q->dev, tail, next) && fits(req->io_len, req->io_segs, next) &&
+            can_dispatch(q, next)) {
+        struct bio_request *r = next;
+        next = list_next_type(&q->sorted, &r->node, struct bio_request, node);
+        remove_pending(r);
+        r->merged = NULL;
+        tail->merged = r;
+        tail = r;
+        req->io_len += r->len;
+        req->io_segs += r->iov_cnt;
+        q->stats.merged++;
+    }
+
+    return req;
+}
+
+/*
+ * Gather the buffers of a merged dispatch into the queue's scratch iovec, joining up
+ * any that are adjacent in memory. Returns the number used.
+ */
+static uint gather_iov(struct bio_queue *q, const struct bio_request *req) {
+    uint n = 0;
+
+    for (const struct bio_request *r = req; r; r = r->merged) {
+        size_t len = r->len;
+        for (uint i = 0; i < r->iov_cnt && len > 0; i++) {
+            size_t seg = MIN(r->iov[i].iov_len, len);
+            len -= seg;
+            if (seg == 0)
+                continue;
+
+            if (n > 0 && (uint8_t *)q->iov[n - 1].iov_base + q->iov[n - 1].iov_len == r->iov[i].iov_base) {
+                q->iov[n - 1].iov_len += seg;
+            } else {
+                DEBUG_ASSERT(n < BIO_MAX_SEGS);
+                q->iov[n].iov_base = r->iov[i].iov_base;
+                q->iov[n].iov_len = seg;
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
+
+/* called by the driver when a dispatch finishes, possibly in interrupt context */
+static void bio_queue_complete(void *cookie, bdev_t *dev, ssize_t status) {
+    struct bio_request *req = cookie;
+    struct bio_queue *q = req->queue;
+
+    req->status = status;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+    list_delete(&req->node);
+    q->inflight_count--;
+    q->stalled = false;
+    list_add_tail(&q->completed, &req->node);
+    spin_unlock_irqrestore(&q->lock, state);
+
+    event_signal(&q->event, false);
+}
+
+static void issue(struct bio_queue *q, struct bio_request *req) {
+    bdev_t *dev = q->dev;
+    status_t err;
+
+    const iovec_t *iov = req->iov;
+    uint iov_cnt = req->iov_cnt;
+    bool vec_ok = req->vec_ok;
+    if (req->merged) {
+        iov_cnt = gather_iov(q, req);
+        iov = q->iov;
+        for (const struct bio_request *r = req->merged; r; r = r->merged)
+            vec_ok = vec_ok && r->vec_ok;
+    }
+
+    LTRACEF("dev '%s', %s offset %lld len %zu segs %u\n", dev->name, req->write ? "write" : "read",
+            req->offset, req->io_len, iov_cnt);
+
+    if (iov_cnt == 1 && (req->write ? dev->write_async != NULL : dev->read_async != NULL)) {
+        if (req->write) {
+            err = dev->write_async(dev, iov[0].iov_base, req->offset, req->io_len, &bio_queue_complete, req);
+        } else {
+            err = dev->read_async(dev, iov[0].iov_base, req->offset, req->io_len, &bio_queue_complete, req);
+        }
+    } else if (vec_ok && has_vector_hook(dev, req->write)) {
+        if (req->write) {
+            err = dev->writev_async(dev, iov, iov_cnt, req->offset, req->io_len, &bio_queue_complete, req);
+        } else {
+            err = dev->readv_async(dev, iov, iov_cnt, req->offset, req->io_len, &bio_queue_complete, req);
+        }
+    } else {
+        /* nothing the driver can take asynchronously, do it here a buffer at a time */
+        bio_queue_complete(req, dev, bio_iov_sync(dev, req->write, iov, iov_cnt, req->offset, req->io_len));
+        return;
+    }
+
+    if (err == ERR_NO_RESOURCES) {
+        /* the driver is full, put it back and try again once something completes */
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+        if (q->inflight_count > 1) {
+            list_delete(&req->node);
+            q->inflight_count--;
+            q->stats.dispatches--;
+            q->stalled = true;
+            for (struct bio_request *r = req, *next; r; r = next) {
+                next = r->merged;
+                insert_pending(q, r);
+            }
+            spin_unlock_irqrestore(&q->lock, state);
+            return;
+        }
+        spin_unlock_irqrestore(&q->lock, state);
+    }
+
+    if (err < 0)
+        bio_queue_complete(req, dev, err);
+}
+
+/* hand requests to the driver until it's full or there are no more */
+static void dispatch(struct bio_queue *q) {
+    for (;;) {
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+
+        struct bio_request *req = NULL;
+        if (!q->plugged && !q->stalled && q->inflight_count < MAX(q->dev->queue_depth, 1u))
+            req = pick_request(q);
+        if (!req) {
+            spin_unlock_irqrestore(&q->lock, state);
+            return;
+        }
+
+        req = take_request(q, req);
+        list_add_tail(&q->inflight, &req->node);
+        q->inflight_count++;
+        q->head = req->offset + (off_t)req->io_len;
+        q->stats.dispatches++;
+        q->stats.max_inflight = MAX(q->stats.max_inflight, q->inflight_count);
+
+        spin_unlock_irqrestore(&q->lock, state);
+
+        issue(q, req);
+    }
+}
+
+/* call back everything in a finished dispatch, splitting up the result between them */
+static void finish_request(struct bio_queue *q, struct bio_request *req) {
+    ssize_t status = req->status;
+    size_t pos = 0;
+
+    for (struct bio_request *r = req, *next; r; r = next) {
+        next = r->merged;
+
+        ssize_t result;
+        if (status < 0)
+            result = status;
+        else if ((size_t)status <= pos)
+            result = 0;
+        else
+            result = (ssize_t)MIN(r->len, (size_t)status - pos);
+        pos += r->len;
+
+        if (r->callback)
+            r->callback(r->cookie, q->dev, result);
+        slab_free(&request_cache, r);
+    }
+}
+
+static int bio_queue_thread(void *arg) {
+    struct bio_queue *q = arg;
+
+    for (;;) {
+        event_wait(&q->event);
+
+        struct list_node done = LIST_INITIAL_VALUE(done);
+        struct bio_request *req;
+
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+        while ((req = list_remove_head_type(&q->completed, struct bio_request, node)))
+            list_add_tail(&done, &req->node);
+        spin_unlock_irqrestore(&q->lock, state);
+
+        while ((req = list_remove_head_type(&done, struct bio_request, node)))
+            finish_request(q, req);
+
+        dispatch(q);
+
+        state = spin_lock_irqsave(&q->lock);
+        bool idle = list_is_empty(&q->fifo) && list_is_empty(&q->inflight) && list_is_empty(&q->completed);
+        bool exit = q->stopping && idle;
+        spin_unlock_irqrestore(&q->lock, state);
+
+        if (exit)
+            break;
+    }
+
+    return 0;
+}
+
+static struct bio_queue *get_queue(bdev_t *dev) {
+    if (dev->queue)
+        return dev->queue;
+
+    mutex_acquire(&queue_create_lock);
+    if (!dev->queue) {
+        struct bio_queue *q = calloc(1, sizeof(struct bio_queue));
+        if (!q)
+            goto out;
+
+        q->dev = dev;
+        spin_lock_init(&q->lock);
+        list_initialize(&q->sorted);
+        list_initialize(&q->fifo);
+        list_initialize(&q->inflight);
+        list_initialize(&q->completed);
+        event_init(&q->event, false, EVENT_FLAG_AUTOUNSIGNAL);
+
+        char name[32];
+        snprintf(name, sizeof(name), "bio %s", dev->name);
+        q->thread = thread_create(name, &bio_queue_thread, q, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+        if (!q->thread) {
+            event_destroy(&q->event);
+            free(q);
+            goto out;
+        }
+        thread_resume(q->thread);
+
+        /* others look at dev->queue without the lock */
+        smp_wmb();
+        dev->queue = q;
+    }
+out:
+    mutex_release(&queue_create_lock);
+
+    return dev->queue;
+}
+
+status_t bio_queue_submit(bdev_t *dev, bool write, const iovec_t *iov, uint iov_cnt, off_t offset,
+                          size_t len, bio_async_callback_t callback, void *cookie) {
+    struct bio_queue *q = get_queue(dev);
+    if (!q)
+        return ERR_NO_MEMORY;
+
+    struct bio_request *req = slab_alloc(&request_cache);
+    if (!req)
+        return ERR_NO_MEMORY;
+
+    req->queue = q;
+    req->write = write;
+    req->offset = offset;
+    req->len = len;
+    if (iov_cnt == 1) {
+        req->single = iov[0];
+        req->iov = &req->single;
+    } else {
+        req->iov = iov;
+    }
+    req->iov_cnt = iov_cnt;
+    req->vec_ok = bio_iov_aligned(dev, write, iov, iov_cnt, offset, len);
+    req->callback = callback;
+    req->cookie = cookie;
+    req->deadline = current_time() + (write ? BIO_WRITE_DEADLINE : BIO_READ_DEADLINE);
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+    req->seq = q->next_seq++;
+    insert_pending(q, req);
+    q->stats.requests++;
+    bool kick = !q->plugged;
+    spin_unlock_irqrestore(&q->lock, state);
+
+    /* don't reschedule, so a caller submitting several in a row gets them merged */
+    if (kick)
+        event_signal(&q->event, false);
+
+    return NO_ERROR;
+}
+
+void bio_plug(bdev_t *dev) {
+    DEBUG_ASSERT(dev && dev->ref > 0);
+
+    struct bio_queue *q = (dev->queue_depth > 0) ? get_queue(dev) : NULL;
+    if (!q)
+        return;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+    q->plugged++;
+    spin_unlock_irqrestore(&q->lock, state);
+}
+
+void bio_unplug(bdev_t *dev) {
+    DEBUG_ASSERT(dev && dev->ref > 0);
+
+    struct bio_queue *q = dev->queue;
+    if (!q)
+        return;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+    DEBUG_ASSERT(q->plugged > 0);
+    bool kick = --q->plugged == 0;
+    spin_unlock_irqrestore(&q->lock, state);
+
+    if (kick)
+        event_signal(&q->event, true);
+}
+
+status_t bio_get_queue_stats(bdev_t *dev, struct bio_queue_stats *stats) {
+    struct bio_queue *q = dev->queue;
+    if (!q)
+        return ERR_NOT_FOUND;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+    *stats = q->stats;
+    spin_unlock_irqrestore(&q->lock, state);
+
+    return NO_ERROR;
+}
+
+void bio_queue_destroy(bdev_t *dev) {
+    struct bio_queue *q = dev->queue;
+    if (!q)
+        return;
+
+    /* let whatever is still queued finish first */
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&q->lock);
+    q->stopping = true;
+    q->plugged = 0;
+    spin_unlock_irqrestore(&q->lock, state);
+    event_signal(&q->event, true);
+
+    thread_join(q->thread, NULL, INFINITE_TIME);
+    event_destroy(&q->event);
+    dev->queue = NULL;
+    free(q);
+}
@@ -11,6 +11,8 @@
 #include <lk/trace.h>
 #include <stdlib.h>
 
+#include "bio_priv.h"
+
 #define LOCAL_TRACE 0
 
 typedef struct {
@@ -58,6 +60,28 @@ static ssize_t subdev_erase(struct bdev *_dev, off_t offset, size_t len) {
     return bio_erase(subdev->parent, offset + subdev->offset * subdev->dev.block_size, len);
 }
 
+static int subdev_ioctl(struct bdev *_dev, int request, void *argp) {
+    subdev_t *subdev = (subdev_t *)_dev;
+
+    /* only pass on requests we know how to translate into the parent's range */
+    if (request == BIO_IOCTL_DISCARD) {
+        const bio_ioctl_range_t *range = (const bio_ioctl_range_t *)argp;
+        if (!range) {
+            return ERR_INVALID_ARGS;
+        }
+        bio_ioctl_range_t parent_range = {
+            .offset = range->offset + subdev->offset * subdev->dev.block_size,
+            .len = bio_trim_range(_dev, range->offset, range->len),
+        };
+        if (parent_range.len == 0) {
+            return NO_ERROR;
+        }
+        return bio_ioctl(subdev->parent, request, &parent_range);
+    }
+
+    return ERR_NOT_SUPPORTED;
+}
+
 static status_t subdev_read_async(struct bdev *_dev, void *buf, off_t offset, size_t len,
                                    bio_async_callback_t callback, void *callback_context) {
     subdev_t *subdev = (subdev_t *)_dev;
@@ -74,6 +98,22 @@ static status_t subdev_write_async(struct bdev *_dev, const void *buf, off_t off
                            callback, callback_context);
 }
 
+static status_t subdev_readv_async(struct bdev *_dev, const iovec_t *iov, uint iov_cnt, off_t offset,
+                                   size_t len, bio_async_callback_t callback, void *callback_context) {
+    subdev_t *subdev = (subdev_t *)_dev;
+
+    return bio_submit_iov(subdev->parent, false, iov, iov_cnt, offset + subdev->offset * subdev->dev.block_size,
+                          len, callback, callback_context);
+}
+
+static status_t subdev_writev_async(struct bdev *_dev, const iovec_t *iov, uint iov_cnt, off_t offset,
+                                    size_t len, bio_async_callback_t callback, void *callback_context) {
+    subdev_t *subdev = (subdev_t *)_dev;
+
+    return bio_submit_iov(subdev->parent, true, iov, iov_cnt, offset + subdev->offset * subdev->dev.block_size,
+                          len, callback, callback_context);
+}
+
 static void subdev_close(struct bdev *_dev) {
     subdev_t *subdev = (subdev_t *)_dev;
 
@@ -183,10 +223,16 @@ status_t bio_publish_subdevice(const char *parent_dev,
     sub->dev.write = &subdev_write;
     sub->dev.write_block = &subdev_write_block;
     sub->dev.erase = &subdev_erase;
+    sub->dev.ioctl = &subdev_ioctl;
     sub->dev.read_async = &subdev_read_async;
     sub->dev.write_async = &subdev_write_async;
+    sub->dev.readv_async = &subdev_readv_async;
+    sub->dev.writev_async = &subdev_writev_async;
     sub->dev.close = &subdev_close;
 
+    /* async requests are queued by the parent */
+    sub->dev.queue_depth = 0;
+
     bio_register_device(&sub->dev);
 
 bailout:
@@ -12,6 +12,7 @@
 #include <lk/debug.h>
 #include <lk/err.h>
 #include <kernel/event.h>
+#include <kernel/thread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -643,6 +644,62 @@ static bool subdev_nested(void) {
     END_TEST;
 }
 
+static bool memdev_readv_writev(void) {
+    BEGIN_TEST;
+
+    uint8_t *mem = memalign(CACHE_LINE, TEST_DEVICE_SIZE);
+    ASSERT_NONNULL(mem, "failed to allocate memory");
+    memset(mem, 0, TEST_DEVICE_SIZE);
+
+    EXPECT_EQ(0, create_membdev("test_bdev_iov", mem, TEST_DEVICE_SIZE), "");
+    bdev_t *dev = bio_open("test_bdev_iov");
+    ASSERT_NONNULL(dev, "failed to open bio device");
+
+    // gather from uneven pieces, starting part way into a block
+    uint8_t a[100], b[BLOCK_SIZE], c[700];
+    memset(a, 0x11, sizeof(a));
+    memset(b, 0x22, sizeof(b));
+    memset(c, 0x33, sizeof(c));
+    iovec_t wiov[] = { { a, sizeof(a) }, { b, sizeof(b) }, { c, sizeof(c) } };
+    const size_t total = sizeof(a) + sizeof(b) + sizeof(c);
+
+    EXPECT_EQ((ssize_t)total, bio_writev(dev, wiov, countof(wiov), 300), "");
+    EXPECT_EQ(0, mem[299], "");
+    EXPECT_EQ(0x11, mem[300], "");
+    EXPECT_EQ(0x22, mem[400], "");
+    EXPECT_EQ(0x33, mem[400 + BLOCK_SIZE], "");
+    EXPECT_EQ(0x33, mem[300 + total - 1], "");
+    EXPECT_EQ(0, mem[300 + total], "");
+
+    // scatter back out split up differently
+    uint8_t *rbuf = malloc(total);
+    ASSERT_NONNULL(rbuf, "");
+    memset(rbuf, 0, total);
+    iovec_t riov[] = { { rbuf, 1 }, { rbuf + 1, BLOCK_SIZE * 2 }, { rbuf + 1 + BLOCK_SIZE * 2, total - 1 - BLOCK_SIZE * 2 } };
+    EXPECT_EQ((ssize_t)total, bio_readv(dev, riov, countof(riov), 300), "");
+    EXPECT_BYTES_EQ(mem + 300, rbuf, total, "");
+
+    // trimmed at the end of the device
+    EXPECT_EQ(200, bio_readv(dev, riov, countof(riov), TEST_DEVICE_SIZE - 200), "");
+    EXPECT_EQ(0, bio_readv(dev, riov, countof(riov), TEST_DEVICE_SIZE), "");
+
+    // async goes through the same way on a device without vector hooks
+    async_cookie_t cookie;
+    event_init(&cookie.event, false, 0);
+    cookie.result = 0;
+    EXPECT_EQ(NO_ERROR, bio_readv_async(dev, riov, countof(riov), 300, async_callback, &cookie), "");
+    event_wait(&cookie.event);
+    EXPECT_EQ((ssize_t)total, cookie.result, "");
+    event_destroy(&cookie.event);
+
+    free(rbuf);
+    bio_close(dev);
+    bio_unregister_device(dev);
+    free(mem);
+
+    END_TEST;
+}
+
 static bool memdev_direct_ops_clamp(void) {
     BEGIN_TEST;
 
@@ -787,6 +844,457 @@ static bool memdev_ioctl_memory_map(void) {
     END_TEST;
 }
 
+// A device for exercising the request queue: backed by memory like the mem
+// device, but logging every request the queue hands it, and optionally holding
+// on to completions until the test releases them.
+#define QTEST_BLOCKS 64
+#define QTEST_MAX_LOG 16
+
+typedef struct {
+    bdev_t dev;
+    uint8_t *mem;
+    bool hold;
+
+    volatile uint log_count;
+    struct {
+        off_t offset;
+        size_t len;
+        uint segs;
+        bool write;
+        bio_async_callback_t callback;
+        void *cookie;
+    } log[QTEST_MAX_LOG];
+} qtest_bdev_t;
+
+static void qtest_log(qtest_bdev_t *qd, off_t offset, size_t len, uint segs, bool write,
+                      bio_async_callback_t callback, void *cookie) {
+    if (qd->log_count < QTEST_MAX_LOG) {
+        qd->log[qd->log_count].offset = offset;
+        qd->log[qd->log_count].len = len;
+        qd->log[qd->log_count].segs = segs;
+        qd->log[qd->log_count].write = write;
+        qd->log[qd->log_count].callback = callback;
+        qd->log[qd->log_count].cookie = cookie;
+        qd->log_count++;
+    }
+    if (!qd->hold) {
+        callback(cookie, &qd->dev, (ssize_t)len);
+    }
+}
+
+static status_t qtest_read_async(struct bdev *dev, void *buf, off_t offset, size_t len,
+                                 bio_async_callback_t callback, void *cookie) {
+    qtest_bdev_t *qd = (qtest_bdev_t *)dev;
+    memcpy(buf, qd->mem + offset, len);
+    qtest_log(qd, offset, len, 1, false, callback, cookie);
+    return NO_ERROR;
+}
+
+static status_t qtest_write_async(struct bdev *dev, const void *buf, off_t offset, size_t len,
+                                  bio_async_callback_t callback, void *cookie) {
+    qtest_bdev_t *qd = (qtest_bdev_t *)dev;
+    memcpy(qd->mem + offset, buf, len);
+    qtest_log(qd, offset, len, 1, true, callback, cookie);
+    return NO_ERROR;
+}
+
+static status_t qtest_rwv_async(qtest_bdev_t *qd, const iovec_t *iov, uint iov_cnt, off_t offset, size_t len,
+                                bool write, bio_async_callback_t callback, void *cookie) {
+    size_t pos = 0;
+    for (uint i = 0; i < iov_cnt && pos < len; i++) {
+        size_t seg = MIN(iov[i].iov_len, len - pos);
+        if (write) {
+            memcpy(qd->mem + offset + pos, iov[i].iov_base, seg);
+        } else {
+            memcpy(iov[i].iov_base, qd->mem + offset + pos, seg);
+        }
+        pos += seg;
+    }
+    qtest_log(qd, offset, len, iov_cnt, write, callback, cookie);
+    return NO_ERROR;
+}
+
+static status_t qtest_readv_async(struct bdev *dev, const iovec_t *iov, uint iov_cnt, off_t offset, size_t len,
+                                  bio_async_callback_t callback, void *cookie) {
+    return qtest_rwv_async((qtest_bdev_t *)dev, iov, iov_cnt, offset, len, false, callback, cookie);
+}
+
+static status_t qtest_writev_async(struct bdev *dev, const iovec_t *iov, uint iov_cnt, off_t offset, size_t len,
+                                   bio_async_callback_t callback, void *cookie) {
+    return qtest_rwv_async((qtest_bdev_t *)dev, iov, iov_cnt, offset, len, true, callback, cookie);
+}
+
+static ssize_t qtest_read_block(struct bdev *dev, void *buf, bnum_t block, uint count) {
+    qtest_bdev_t *qd = (qtest_bdev_t *)dev;
+    memcpy(buf, qd->mem + block * BLOCK_SIZE, count * BLOCK_SIZE);
+    return (ssize_t)(count * BLOCK_SIZE);
+}
+
+static ssize_t qtest_write_block(struct bdev *dev, const void *buf, bnum_t block, uint count) {
+    qtest_bdev_t *qd = (qtest_bdev_t *)dev;
+    memcpy(qd->mem + block * BLOCK_SIZE, buf, count * BLOCK_SIZE);
+    return (ssize_t)(count * BLOCK_SIZE);
+}
+
+static qtest_bdev_t *qtest_create(const char *name, uint depth, bool async) {
+    qtest_bdev_t *qd = calloc(1, sizeof(qtest_bdev_t));
+    if (!qd) {
+        return NULL;
+    }
+    qd->mem = memalign(CACHE_LINE, QTEST_BLOCKS * BLOCK_SIZE);
+    if (!qd->mem) {
+        free(qd);
+        return NULL;
+    }
+    for (size_t i = 0; i < QTEST_BLOCKS * BLOCK_SIZE; i++) {
+        qd->mem[i] = (uint8_t)(i / BLOCK_SIZE);
+    }
+
+    bio_initialize_bdev(&qd->dev, name, BLOCK_SIZE, QTEST_BLOCKS, 0, NULL, BIO_FLAGS_NONE);
+    qd->dev.read_block = qtest_read_block;
+    qd->dev.write_block = qtest_write_block;
+    if (async) {
+        qd->dev.read_async = qtest_read_async;
+        qd->dev.write_async = qtest_write_async;
+    }
+    qd->dev.queue_depth = depth;
+    bio_register_device(&qd->dev);
+
+    return qd;
+}
+
+static void qtest_destroy(qtest_bdev_t *qd) {
+    bio_unregister_device(&qd->dev);
+    free(qd->mem);
+    free(qd);
+}
+
+// counts completions, signaling once the expected number are in
+typedef struct {
+    event_t event;
+    volatile uint count;
+    uint expected;
+    volatile bool failed;
+} qtest_waiter_t;
+
+static void qtest_waiter_init(qtest_waiter_t *w, uint expected) {
+    event_init(&w->event, false, 0);
+    w->count = 0;
+    w->expected = expected;
+    w->failed = false;
+}
+
+static void qtest_callback(void *cookie, bdev_t *dev, ssize_t status) {
+    qtest_waiter_t *w = (qtest_waiter_t *)cookie;
+    if (status != (ssize_t)BLOCK_SIZE) {
+        w->failed = true;
+    }
+    if (++w->count == w->expected) {
+        event_signal(&w->event, false);
+    }
+}
+
+static bool queue_sorts_and_merges(void) {
+    BEGIN_TEST;
+
+    qtest_bdev_t *qd = qtest_create("qtest0", 1, true);
+    ASSERT_NONNULL(qd, "");
+    bdev_t *dev = bio_open("qtest0");
+    ASSERT_NONNULL(dev, "");
+
+    uint8_t *buf = memalign(CACHE_LINE, QTEST_BLOCKS * BLOCK_SIZE);
+    ASSERT_NONNULL(buf, "");
+    memset(buf, 0xff, QTEST_BLOCKS * BLOCK_SIZE);
+
+    // each block read into its own place in one buffer, so neighbours can merge
+    const uint blocks[] = { 40, 10, 12, 11, 3, 41 };
+    qtest_waiter_t w;
+    qtest_waiter_init(&w, countof(blocks));
+
+    bio_plug(dev);
+    for (size_t i = 0; i < countof(blocks); i++) {
+        off_t offset = (off_t)blocks[i] * BLOCK_SIZE;
+        EXPECT_EQ(NO_ERROR, bio_read_async(dev, buf + offset, offset, BLOCK_SIZE, qtest_callback, &w), "");
+    }
+    EXPECT_EQ(0u, qd->log_count, "requests reached the driver while plugged");
+    bio_unplug(dev);
+
+    event_wait(&w.event);
+    EXPECT_FALSE(w.failed, "");
+
+    // one sweep up the device, with the adjacent requests merged
+    ASSERT_EQ(3u, qd->log_count, "");
+    EXPECT_EQ(3 * BLOCK_SIZE, (size_t)qd->log[0].offset, "");
+    EXPECT_EQ(BLOCK_SIZE, qd->log[0].len, "");
+    EXPECT_EQ(10 * BLOCK_SIZE, (size_t)qd->log[1].offset, "");
+    EXPECT_EQ(3 * BLOCK_SIZE, qd->log[1].len, "");
+    EXPECT_EQ(40 * BLOCK_SIZE, (size_t)qd->log[2].offset, "");
+    EXPECT_EQ(2 * BLOCK_SIZE, qd->log[2].len, "");
+
+    for (size_t i = 0; i < countof(blocks); i++) {
+        EXPECT_EQ(blocks[i], buf[blocks[i] * BLOCK_SIZE], "");
+        EXPECT_EQ(blocks[i], buf[(blocks[i] + 1) * BLOCK_SIZE - 1], "");
+    }
+
+    struct bio_queue_stats stats;
+    EXPECT_EQ(NO_ERROR, bio_get_queue_stats(dev, &stats), "");
+    EXPECT_EQ(6u, stats.requests, "");
+    EXPECT_EQ(3u, stats.merged, "");
+    EXPECT_EQ(3u, stats.dispatches, "");
+
+    event_destroy(&w.event);
+    free(buf);
+    bio_close(dev);
+    qtest_destroy(qd);
+
+    END_TEST;
+}
+
+static bool queue_keeps_overlapping_order(void) {
+    BEGIN_TEST;
+
+    qtest_bdev_t *qd = qtest_create("qtest1", 1, true);
+    ASSERT_NONNULL(qd, "");
+    bdev_t *dev = bio_open("qtest1");
+    ASSERT_NONNULL(dev, "");
+
+    uint8_t wbuf[BLOCK_SIZE];
+    memset(wbuf, 0x77, sizeof(wbuf));
+    uint8_t *rbuf = memalign(CACHE_LINE, 8 * BLOCK_SIZE);
+    ASSERT_NONNULL(rbuf, "");
+
+    // the read sorts first, but mustn't get ahead of the write it overlaps
+    qtest_waiter_t ww, rw;
+    qtest_waiter_init(&ww, 1);
+    qtest_waiter_init(&rw, 8);
+
+    bio_plug(dev);
+    EXPECT_EQ(NO_ERROR, bio_write_async(dev, wbuf, 8 * BLOCK_SIZE, BLOCK_SIZE, qtest_callback, &ww), "");
+    for (uint i = 0; i < 8; i++) {
+        EXPECT_EQ(NO_ERROR, bio_read_async(dev, rbuf + i * BLOCK_SIZE, (2 + i) * BLOCK_SIZE, BLOCK_SIZE,
+                                           qtest_callback, &rw), "");
+    }
+    bio_unplug(dev);
+
+    event_wait(&ww.event);
+    event_wait(&rw.event);
+    EXPECT_FALSE(ww.failed || rw.failed, "");
+
+    ASSERT_LE(2u, qd->log_count, "");
+    EXPECT_TRUE(qd->log[0].write, "read overtook an overlapping write");
+    EXPECT_EQ(0x77, rbuf[6 * BLOCK_SIZE], "");
+    EXPECT_EQ(2, rbuf[0], "");
+
+    event_destroy(&ww.event);
+    event_destroy(&rw.event);
+    free(rbuf);
+    bio_close(dev);
+    qtest_destroy(qd);
+
+    END_TEST;
+}
+
+static bool queue_fills_depth(void) {
+    BEGIN_TEST;
+
+    const uint depth = 4;
+    const uint count = 8;
+
+    qtest_bdev_t *qd = qtest_create("qtest2", depth, true);
+    ASSERT_NONNULL(qd, "");
+    qd->hold = true;
+    bdev_t *dev = bio_open("qtest2");
+    ASSERT_NONNULL(dev, "");
+
+    uint8_t *buf = memalign(CACHE_LINE, QTEST_BLOCKS * BLOCK_SIZE);
+    ASSERT_NONNULL(buf, "");
+
+    // spaced out so none of them merge
+    qtest_waiter_t w;
+    qtest_waiter_init(&w, count);
+    for (uint i = 0; i < count; i++) {
+        off_t offset = (off_t)i * 2 * BLOCK_SIZE;
+        EXPECT_EQ(NO_ERROR, bio_read_async(dev, buf + offset, offset, BLOCK_SIZE, qtest_callback, &w), "");
+    }
+
+    // the driver should get exactly as many as it can take
+    for (uint i = 0; i < 1000 && qd->log_count < depth; i++) {
+        thread_sleep(1);
+    }
+    thread_sleep(10);
+    EXPECT_EQ(depth, qd->log_count, "");
+
+    // completing them lets the rest through, completing those finishes it
+    for (uint done = 0; done < count;) {
+        while (done < qd->log_count) {
+            qd->log[done].callback(qd->log[done].cookie, dev, (ssize_t)qd->log[done].len);
+            done++;
+        }
+        thread_sleep(1);
+    }
+    event_wait(&w.event);
+    EXPECT_FALSE(w.failed, "");
+    EXPECT_EQ(count, qd->log_count, "");
+
+    struct bio_queue_stats stats;
+    EXPECT_EQ(NO_ERROR, bio_get_queue_stats(dev, &stats), "");
+    EXPECT_EQ(depth, stats.max_inflight, "");
+
+    event_destroy(&w.event);
+    free(buf);
+    bio_close(dev);
+    qtest_destroy(qd);
+
+    END_TEST;
+}
+
+static bool queue_sync_driver(void) {
+    BEGIN_TEST;
+
+    // no async hooks at all, the queue should call the sync ones
+    qtest_bdev_t *qd = qtest_create("qtest3", 1, false);
+    ASSERT_NONNULL(qd, "");
+    bdev_t *dev = bio_open("qtest3");
+    ASSERT_NONNULL(dev, "");
+
+    uint8_t buf[BLOCK_SIZE];
+    memset(buf, 0x3c, sizeof(buf));
+
+    qtest_waiter_t w;
+    qtest_waiter_init(&w, 1);
+    EXPECT_EQ(NO_ERROR, bio_write_async(dev, buf, 5 * BLOCK_SIZE, BLOCK_SIZE, qtest_callback, &w), "");
+    event_wait(&w.event);
+    EXPECT_FALSE(w.failed, "");
+    EXPECT_EQ(0x3c, qd->mem[5 * BLOCK_SIZE], "");
+    event_destroy(&w.event);
+
+    memset(buf, 0, sizeof(buf));
+    qtest_waiter_init(&w, 1);
+    EXPECT_EQ(NO_ERROR, bio_read_async(dev, buf, 6 * BLOCK_SIZE, BLOCK_SIZE, qtest_callback, &w), "");
+    event_wait(&w.event);
+    EXPECT_FALSE(w.failed, "");
+    EXPECT_EQ(6, buf[0], "");
+    event_destroy(&w.event);
+
+    bio_close(dev);
+    qtest_destroy(qd);
+
+    END_TEST;
+}
+
+static bool queue_gathers_scattered_buffers(void) {
+    BEGIN_TEST;
+
+    qtest_bdev_t *qd = qtest_create("qtest4", 1, true);
+    ASSERT_NONNULL(qd, "");
+    qd->dev.readv_async = qtest_readv_async;
+    qd->dev.writev_async = qtest_writev_async;
+    bdev_t *dev = bio_open("qtest4");
+    ASSERT_NONNULL(dev, "");
+
+    // adjacent on the device, scattered in memory, backwards even
+    uint8_t *buf = memalign(CACHE_LINE, 8 * BLOCK_SIZE);
+    ASSERT_NONNULL(buf, "");
+    qtest_waiter_t w;
+    qtest_waiter_init(&w, 3);
+
+    bio_plug(dev);
+    for (uint i = 0; i < 3; i++) {
+        EXPECT_EQ(NO_ERROR, bio_read_async(dev, buf + (6 - i * 3) * BLOCK_SIZE, (20 + i) * BLOCK_SIZE,
+                                           BLOCK_SIZE, qtest_callback, &w), "");
+    }
+    bio_unplug(dev);
+    event_wait(&w.event);
+    event_destroy(&w.event);
+    EXPECT_FALSE(w.failed, "");
+
+    ASSERT_EQ(1u, qd->log_count, "");
+    EXPECT_EQ(20 * BLOCK_SIZE, (size_t)qd->log[0].offset, "");
+    EXPECT_EQ(3 * BLOCK_SIZE, qd->log[0].len, "");
+    EXPECT_EQ(3u, qd->log[0].segs, "");
+    EXPECT_EQ(20, buf[6 * BLOCK_SIZE], "");
+    EXPECT_EQ(21, buf[3 * BLOCK_SIZE], "");
+    EXPECT_EQ(22, buf[0], "");
+
+    // a vectored write goes out as one request too
+    memset(buf, 0x5a, BLOCK_SIZE);
+    memset(buf + 4 * BLOCK_SIZE, 0xa5, 2 * BLOCK_SIZE);
+    iovec_t iov[] = { { buf + 4 * BLOCK_SIZE, 2 * BLOCK_SIZE }, { buf, BLOCK_SIZE } };
+    EXPECT_EQ((ssize_t)(3 * BLOCK_SIZE), bio_writev(dev, iov, countof(iov), 30 * BLOCK_SIZE), "");
+    ASSERT_EQ(2u, qd->log_count, "");
+    EXPECT_TRUE(qd->log[1].write, "");
+    EXPECT_EQ(2u, qd->log[1].segs, "");
+    EXPECT_EQ(0xa5, qd->mem[31 * BLOCK_SIZE], "");
+    EXPECT_EQ(0x5a, qd->mem[32 * BLOCK_SIZE], "");
+
+    // and through a subdevice, which hands it on to the parent's queue
+    EXPECT_EQ(NO_ERROR, bio_publish_subdevice("qtest4", "qtest4.sub", 16, 32), "");
+    bdev_t *sub = bio_open("qtest4.sub");
+    ASSERT_NONNULL(sub, "");
+    memset(buf, 0, 8 * BLOCK_SIZE);
+    EXPECT_EQ((ssize_t)(3 * BLOCK_SIZE), bio_readv(sub, iov, countof(iov), 14 * BLOCK_SIZE), "");
+    ASSERT_EQ(3u, qd->log_count, "");
+    EXPECT_EQ(30 * BLOCK_SIZE, (size_t)qd->log[2].offset, "");
+    EXPECT_EQ(0xa5, buf[4 * BLOCK_SIZE], "");
+    EXPECT_EQ(0x5a, buf[0], "");
+    bio_close(sub);
+    bio_unregister_device(sub);
+
+    free(buf);
+    bio_close(dev);
+    qtest_destroy(qd);
+
+    END_TEST;
+}
+
+// logs discards like requests, to check the range a subdevice passes on
+static int qtest_ioctl(struct bdev *dev, int request, void *argp) {
+    qtest_bdev_t *qd = (qtest_bdev_t *)dev;
+    if (request != BIO_IOCTL_DISCARD || qd->log_count >= QTEST_MAX_LOG) {
+        return ERR_NOT_SUPPORTED;
+    }
+    const bio_ioctl_range_t *range = (const bio_ioctl_range_t *)argp;
+    qd->log[qd->log_count].offset = range->offset;
+    qd->log[qd->log_count].len = range->len;
+    qd->log_count++;
+    return NO_ERROR;
+}
+
+static bool subdev_passes_discard(void) {
+    BEGIN_TEST;
+
+    qtest_bdev_t *qd = qtest_create("qtest5", 1, true);
+    ASSERT_NONNULL(qd, "");
+    qd->dev.ioctl = qtest_ioctl;
+
+    EXPECT_EQ(NO_ERROR, bio_publish_subdevice("qtest5", "qtest5.sub", 16, 32), "");
+    bdev_t *sub = bio_open("qtest5.sub");
+    ASSERT_NONNULL(sub, "");
+
+    // moved up to where the subdevice starts
+    bio_ioctl_range_t range = { 2 * BLOCK_SIZE, 4 * BLOCK_SIZE };
+    EXPECT_EQ(NO_ERROR, bio_ioctl(sub, BIO_IOCTL_DISCARD, &range), "");
+    ASSERT_EQ(1u, qd->log_count, "");
+    EXPECT_EQ(18 * BLOCK_SIZE, (size_t)qd->log[0].offset, "");
+    EXPECT_EQ(4 * BLOCK_SIZE, qd->log[0].len, "");
+
+    // and cut off at its end
+    range.offset = 30 * BLOCK_SIZE;
+    EXPECT_EQ(NO_ERROR, bio_ioctl(sub, BIO_IOCTL_DISCARD, &range), "");
+    ASSERT_EQ(2u, qd->log_count, "");
+    EXPECT_EQ(46 * BLOCK_SIZE, (size_t)qd->log[1].offset, "");
+    EXPECT_EQ(2 * BLOCK_SIZE, qd->log[1].len, "");
+
+    // anything else isn't the subdevice's to pass on
+    EXPECT_EQ(ERR_NOT_SUPPORTED, bio_ioctl(sub, BIO_IOCTL_GET_MEM_MAP, NULL), "");
+
+    bio_close(sub);
+    bio_unregister_device(sub);
+    qtest_destroy(qd);
+
+    END_TEST;
+}
+
 BEGIN_TEST_CASE(bio_tests)
 RUN_TEST(basic_read_write)
 RUN_TEST(block_read_write)
@@ -799,7 +1307,14 @@ RUN_TEST(subdev_write_propagates)
 RUN_TEST(subdev_block_ops)
 RUN_TEST(subdev_async)
 RUN_TEST(subdev_nested)
+RUN_TEST(memdev_readv_writev)
 RUN_TEST(memdev_direct_ops_clamp)
 RUN_TEST(memdev_create_rejects_null_args)
 RUN_TEST(memdev_ioctl_memory_map)
+RUN_TEST(queue_sorts_and_merges)
+RUN_TEST(queue_keeps_overlapping_order)
+RUN_TEST(queue_fills_depth)
+RUN_TEST(queue_sync_driver)
+RUN_TEST(queue_gathers_scattered_buffers)
+RUN_TEST(subdev_passes_discard)
 END_TEST_CASE(bio_tests)
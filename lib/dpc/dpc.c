@@ -8,11 +8,12 @@
 #include <lk/debug.h>
 #include <stddef.h>
 #include <lk/list.h>
-#include <malloc.h>
 #include <lk/err.h>
 #include <lib/dpc.h>
+#include <lib/slab.h>
 #include <kernel/thread.h>
 #include <kernel/event.h>
+#include <kernel/spinlock.h>
 #include <lk/init.h>
 
 struct dpc {
@@ -23,24 +24,26 @@ struct dpc {
 };
 
 static struct list_node dpc_list = LIST_INITIAL_VALUE(dpc_list);
+static spin_lock_t dpc_lock = SPIN_LOCK_INITIAL_VALUE;
 static event_t dpc_event;
+static slab_cache_t dpc_cache;
 
 static int dpc_thread_routine(void *arg);
 
 status_t dpc_queue(dpc_callback cb, void *arg, uint flags) {
     struct dpc *dpc;
 
-    dpc = malloc(sizeof(struct dpc));
+    dpc = slab_alloc(&dpc_cache);
 
     if (dpc == NULL)
         return ERR_NO_MEMORY;
 
     dpc->cb = cb;
     dpc->arg = arg;
-    enter_critical_section();
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&dpc_lock);
     list_add_tail(&dpc_list, &dpc->node);
+    spin_unlock_irqrestore(&dpc_lock, state);
     event_signal(&dpc_event, (flags & DPC_FLAG_NORESCHED) ? false : true);
-    exit_critical_section();
 
     return NO_ERROR;
 }
@@ -49,17 +52,17 @@ static int dpc_thread_routine(void *arg) {
     for (;;) {
         event_wait(&dpc_event);
 
-        enter_critical_section();
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&dpc_lock);
         struct dpc *dpc = list_remove_head_type(&dpc_list, struct dpc, node);
         if (!dpc)
             event_unsignal(&dpc_event);
-        exit_critical_section();
+        spin_unlock_irqrestore(&dpc_lock, state);
 
         if (dpc) {
 //          dprintf("dpc calling %p, arg %p\n", dpc->cb, dpc->arg);
             dpc->cb(dpc->arg);
 
-            free(dpc);
+            slab_free(&dpc_cache, dpc);
         }
     }
 
@@ -67,6 +70,7 @@ static int dpc_thread_routine(void *arg) {
 }
 
 static void dpc_init(uint level) {
+    slab_cache_init(&dpc_cache, "dpc", sizeof(struct dpc), __alignof(struct dpc), 0, NULL);
     event_init(&dpc_event, false, 0);
 
     thread_detach_and_resume(thread_create("dpc", &dpc_thread_routine, NULL, DPC_PRIORITY, DEFAULT_STACK_SIZE));
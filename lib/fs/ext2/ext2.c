@@ -17,6 +17,11 @@
 
 #define LOCAL_TRACE 0
 
+/* bytes of block cache per mount, blocks are only allocated as they're used */
+#ifndef EXT2_BCACHE_SIZE
+#define EXT2_BCACHE_SIZE (16 * 1024 * 1024)
+#endif
+
 static void endian_swap_superblock(struct ext2_super_block *sb) {
     LE32SWAP(sb->s_inodes_count);
     LE32SWAP(sb->s_blocks_count);
@@ -55,6 +60,7 @@ static void endian_swap_superblock(struct ext2_super_block *sb) {
     LE32SWAP(sb->s_journal_inum);
     LE32SWAP(sb->s_journal_dev);
     LE32SWAP(sb->s_last_orphan);
+    LE16SWAP(sb->s_desc_size);
     LE32SWAP(sb->s_default_mount_opts);
     LE32SWAP(sb->s_first_meta_bg);
 }
@@ -141,22 +147,55 @@ status_t ext2_mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options option
         return err;
     }
 
-    /* make sure it doesn't have any ro features we don't support */
-    if (ext2->sb.s_feature_ro_compat & ~(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE)) {
+    /* make sure it doesn't have any ro features we don't support. The ext4 ones only
+     * matter to writers, or add checksums we don't verify. */
+    if (ext2->sb.s_feature_ro_compat & ~(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER | EXT2_FEATURE_RO_COMPAT_LARGE_FILE |
+                                         EXT4_FEATURE_RO_COMPAT_HUGE_FILE | EXT4_FEATURE_RO_COMPAT_GDT_CSUM |
+                                         EXT4_FEATURE_RO_COMPAT_DIR_NLINK | EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE |
+                                         EXT4_FEATURE_RO_COMPAT_METADATA_CSUM |
+                                         EXT4_FEATURE_RO_COMPAT_ORPHAN_PRESENT)) {
+        err = -3;
+        return err;
+    }
+
+    /* or any incompat features we can't read. META_BG moves the group descriptors out
+     * of the blocks we read them from, and RECOVER means the metadata is stale until
+     * the journal is replayed. */
+    if (ext2->sb.s_feature_incompat & EXT3_FEATURE_INCOMPAT_RECOVER) {
+        printf("ext2: journal needs recovery, not mounting\n");
+        err = -3;
+        return err;
+    }
+    if (ext2->sb.s_feature_incompat & ~(EXT2_FEATURE_INCOMPAT_FILETYPE | EXT4_FEATURE_INCOMPAT_EXTENTS |
+                                        EXT4_FEATURE_INCOMPAT_64BIT | EXT4_FEATURE_INCOMPAT_FLEX_BG |
+                                        EXT4_FEATURE_INCOMPAT_CSUM_SEED)) {
         err = -3;
         return err;
     }
 
+    /* with 64bit the on disk group descriptors grow, but start with the same fields */
+    size_t desc_size = sizeof(struct ext2_group_desc);
+    if (ext2->sb.s_feature_incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+        desc_size = MAX(ext2->sb.s_desc_size, sizeof(struct ext2_group_desc));
+    }
+
     /* read in all the group descriptors */
-    ext2->gd = malloc(sizeof(struct ext2_group_desc) * ext2->s_group_count);
+    ext2->gd = malloc(desc_size * ext2->s_group_count);
     err = bio_read(ext2->dev, (void *)ext2->gd,
                    (EXT2_BLOCK_SIZE(ext2->sb) == 4096) ? 4096 : 2048,
-                   sizeof(struct ext2_group_desc) * ext2->s_group_count);
+                   desc_size * ext2->s_group_count);
     if (err < 0) {
         err = -4;
         return err;
     }
 
+    /* pack them down to the part we use */
+    if (desc_size != sizeof(struct ext2_group_desc)) {
+        for (int i = 1; i < ext2->s_group_count; i++) {
+            memmove(&ext2->gd[i], (uint8_t *)ext2->gd + desc_size * i, sizeof(struct ext2_group_desc));
+        }
+    }
+
     int i;
     for (i = 0; i < ext2->s_group_count; i++) {
         endian_swap_group_desc(&ext2->gd[i]);
@@ -170,7 +209,12 @@ status_t ext2_mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options option
     }
 
     /* initialize the block cache */
-    ext2->cache = bcache_create(ext2->dev, EXT2_BLOCK_SIZE(ext2->sb), 4);
+    ext2->cache = bcache_create(ext2->dev, EXT2_BLOCK_SIZE(ext2->sb),
+                                MAX(EXT2_BCACHE_SIZE / EXT2_BLOCK_SIZE(ext2->sb), 4));
+    if (!ext2->cache) {
+        err = ERR_NO_MEMORY;
+        goto err;
+    }
 
     /* load the first inode */
     err = ext2_load_inode(ext2, EXT2_ROOT_INO, &ext2->root_inode);
@@ -161,6 +161,42 @@ struct ext2_inode {
 #define i_gid_high  osd2.linux2.l_i_gid_high
 #define i_reserved2 osd2.linux2.l_i_reserved2
 
+/*
+ * Inode flags
+ */
+#define EXT4_EXTENTS_FL 0x00080000 /* Inode uses extents */
+
+/*
+ * ext4 extent tree, rooted in i_block of inodes with EXT4_EXTENTS_FL set.
+ * Each node starts with a header, followed by index entries in interior
+ * nodes or extents in leaves.
+ */
+#define EXT4_EXT_MAGIC        0xf30a
+#define EXT4_EXT_INIT_MAX_LEN (1U << 15) /* longer ee_len marks an uninitialized extent */
+#define EXT4_EXT_MAX_DEPTH    5         /* deepest tree the kernel will build */
+
+struct ext4_extent_header {
+    uint16_t eh_magic;      /* EXT4_EXT_MAGIC */
+    uint16_t eh_entries;    /* number of valid entries */
+    uint16_t eh_max;        /* capacity of store in entries */
+    uint16_t eh_depth;      /* 0 for a leaf */
+    uint32_t eh_generation; /* generation of the tree */
+};
+
+struct ext4_extent_idx {
+    uint32_t ei_block;   /* index covers logical blocks from 'block' */
+    uint32_t ei_leaf_lo; /* low 32 bits of the next level's physical block */
+    uint16_t ei_leaf_hi; /* high 16 bits of physical block */
+    uint16_t ei_unused;
+};
+
+struct ext4_extent {
+    uint32_t ee_block;    /* first logical block extent covers */
+    uint16_t ee_len;      /* number of blocks covered by extent */
+    uint16_t ee_start_hi; /* high 16 bits of physical block */
+    uint32_t ee_start_lo; /* low 32 bits of physical block */
+};
+
 /*
  * File system states
  */
@@ -277,7 +313,7 @@ struct ext2_super_block {
     uint32_t s_hash_seed[4];    /* HTREE hash seed */
     uint8_t s_def_hash_version; /* Default hash version to use */
     uint8_t s_reserved_char_pad;
-    uint16_t s_reserved_word_pad;
+    uint16_t s_desc_size;       /* Group descriptor size, with 64bit */
     uint32_t s_default_mount_opts;
     uint32_t s_first_meta_bg; /* First metablock block group */
     uint32_t s_reserved[190]; /* Padding to the end of the block */
@@ -334,16 +370,26 @@ struct ext2_super_block {
 #define EXT2_FEATURE_COMPAT_DIR_INDEX     0x0020
 #define EXT2_FEATURE_COMPAT_ANY           0xffffffff
 
-#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER 0x0001
-#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE   0x0002
-#define EXT2_FEATURE_RO_COMPAT_BTREE_DIR    0x0004
-#define EXT2_FEATURE_RO_COMPAT_ANY          0xffffffff
+#define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER   0x0001
+#define EXT2_FEATURE_RO_COMPAT_LARGE_FILE     0x0002
+#define EXT2_FEATURE_RO_COMPAT_BTREE_DIR      0x0004
+#define EXT4_FEATURE_RO_COMPAT_HUGE_FILE      0x0008
+#define EXT4_FEATURE_RO_COMPAT_GDT_CSUM       0x0010
+#define EXT4_FEATURE_RO_COMPAT_DIR_NLINK      0x0020
+#define EXT4_FEATURE_RO_COMPAT_EXTRA_ISIZE    0x0040
+#define EXT4_FEATURE_RO_COMPAT_METADATA_CSUM  0x0400
+#define EXT4_FEATURE_RO_COMPAT_ORPHAN_PRESENT 0x10000
+#define EXT2_FEATURE_RO_COMPAT_ANY            0xffffffff
 
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION 0x0001
 #define EXT2_FEATURE_INCOMPAT_FILETYPE    0x0002
 #define EXT3_FEATURE_INCOMPAT_RECOVER     0x0004
 #define EXT3_FEATURE_INCOMPAT_JOURNAL_DEV 0x0008
 #define EXT2_FEATURE_INCOMPAT_META_BG     0x0010
+#define EXT4_FEATURE_INCOMPAT_EXTENTS     0x0040
+#define EXT4_FEATURE_INCOMPAT_64BIT       0x0080
+#define EXT4_FEATURE_INCOMPAT_FLEX_BG     0x0200
+#define EXT4_FEATURE_INCOMPAT_CSUM_SEED   0x2000
 #define EXT2_FEATURE_INCOMPAT_ANY         0xffffffff
 
 #define EXT2_FEATURE_COMPAT_SUPP   EXT2_FEATURE_COMPAT_EXT_ATTR
@@ -26,16 +26,26 @@ typedef struct {
     struct ext2_inode root_inode;
 } ext2_t;
 
-struct cache_block {
-    blocknum_t num;
-    void *ptr;
+/* a run of file blocks that are physically contiguous on disk, or a hole if phys_block is 0 */
+struct ext2_extent {
+    uint32_t file_block;
+    uint32_t len;
+    blocknum_t phys_block;
+};
+
+/* recently used runs of a file, so sequential reads only walk the block map once per run */
+#define EXT2_EXTENT_CACHE_ENTRIES 8
+
+struct ext2_extent_cache {
+    struct ext2_extent entry[EXT2_EXTENT_CACHE_ENTRIES];
+    uint next; // round robin replacement
 };
 
 /* open file handle */
 typedef struct {
     ext2_t *ext2;
 
-    struct cache_block ind_cache[3]; // cache of indirect blocks as they're scanned
+    struct ext2_extent_cache extents;
     struct ext2_inode inode;
 } ext2_file_t;
 
@@ -49,7 +59,9 @@ int ext2_get_block(ext2_t *ext2, void **ptr, blocknum_t bnum);
 int ext2_put_block(ext2_t *ext2, blocknum_t bnum);
 
 off_t ext2_file_len(ext2_t *ext2, struct ext2_inode *inode);
-ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, void *buf, off_t offset, size_t len);
+// cache is optional, and remembers block runs across calls for the same inode
+ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, struct ext2_extent_cache *cache,
+                        void *buf, off_t offset, size_t len);
 int ext2_read_link(ext2_t *ext2, struct ext2_inode *inode, char *str, size_t len);
 
 /* fs api */
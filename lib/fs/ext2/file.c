@@ -54,7 +54,7 @@ ssize_t ext2_read_file(filecookie *fcookie, void *buf, off_t offset, size_t len)
     }
 
     // read from the inode
-    err = ext2_read_inode(file->ext2, &file->inode, buf, offset, len);
+    err = ext2_read_inode(file->ext2, &file->inode, &file->extents, buf, offset, len);
 
     return err;
 }
@@ -62,14 +62,6 @@ ssize_t ext2_read_file(filecookie *fcookie, void *buf, off_t offset, size_t len)
 int ext2_close_file(filecookie *fcookie) {
     ext2_file_t *file = (ext2_file_t *)fcookie;
 
-    // see if we need to free any of the cache blocks
-    int i;
-    for (i = 0; i < 3; i++) {
-        if (file->ind_cache[i].num != 0) {
-            free(file->ind_cache[i].ptr);
-        }
-    }
-
     free(file);
 
     return 0;
@@ -110,7 +102,7 @@ int ext2_read_link(ext2_t *ext2, struct ext2_inode *inode, char *str, size_t len
     }
 
     if (linklen > 60) {
-        int err = ext2_read_inode(ext2, inode, str, 0, linklen);
+        int err = ext2_read_inode(ext2, inode, NULL, str, 0, linklen);
         if (err < 0) {
             return err;
         }
@@ -8,6 +8,7 @@
 
 #include "ext2_priv.h"
 #include <lk/debug.h>
+#include <lk/err.h>
 #include <lk/trace.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,8 +30,6 @@ int ext2_put_block(ext2_t *ext2, blocknum_t bnum) {
 static int ext2_calculate_block_pointer_pos(ext2_t *ext2, blocknum_t block_to_find, uint32_t *level, uint32_t pos[]) {
     uint32_t block_ptr_per_block, block_ptr_per_2nd_block;
 
-    // XXX optimize this
-
     // See if it's in the direct blocks
     if (block_to_find < EXT2_NDIR_BLOCKS) {
         *level = 0;
@@ -123,48 +122,209 @@ error:
     return err;
 }
 
-/* translate a file block to a physical block */
-static blocknum_t file_block_to_fs_block(ext2_t *ext2, struct ext2_inode *inode, uint fileblock) {
-    int err;
-    blocknum_t block;
-
-    LTRACEF("inode %p, fileblock %u\n", inode, fileblock);
-
+/* find the run of contiguous blocks starting at fileblock in the direct/indirect block map */
+static int ext2_map_indirect(ext2_t *ext2, struct ext2_inode *inode, uint32_t fileblock,
+                             blocknum_t *phys_block, uint32_t *run_len) {
     uint32_t pos[4];
     uint32_t level = 0;
-    ext2_calculate_block_pointer_pos(ext2, fileblock, &level, pos);
+    if (ext2_calculate_block_pointer_pos(ext2, fileblock, &level, pos) < 0) {
+        return ERR_OUT_OF_RANGE;
+    }
 
     LTRACEF("level %d, pos 0x%x 0x%x 0x%x 0x%x\n", level, pos[0], pos[1], pos[2], pos[3]);
 
+    const uint32_t *table;
+    uint32_t table_len;
+    blocknum_t ind_block = 0;
     if (level == 0) {
-        /* direct block, just return it directly */
-        block = LE32(inode->i_block[fileblock]);
+        /* direct block */
+        table = inode->i_block;
+        table_len = EXT2_NDIR_BLOCKS;
     } else {
-        /* at least one level of indirection, get a pointer to the final indirect block table and dereference it */
+        /* at least one level of indirection, get a pointer to the final indirect block table */
         blocknum_t *ind_table;
-        blocknum_t phys_block;
-        err = ext2_get_indirect_block_pointer_cache_block(ext2, inode, &ind_table, level, pos, &phys_block);
+        int err = ext2_get_indirect_block_pointer_cache_block(ext2, inode, &ind_table, level, pos, &ind_block);
         if (err < 0) {
+            /* missing indirect block, treat it as a hole */
+            *phys_block = 0;
+            *run_len = 1;
             return 0;
         }
+        table = ind_table;
+        table_len = EXT2_ADDR_PER_BLOCK(ext2->sb);
+    }
 
-        /* dereference the final entry in the final table */
-        block = LE32(ind_table[pos[level]]);
-        LTRACEF("block %u, indirect_block %u\n", block, phys_block);
+    /* extend the run for as long as the table stays contiguous (or stays a hole) */
+    const uint32_t i = pos[level];
+    const blocknum_t first = LE32(table[i]);
+    uint32_t len = 1;
+    while (i + len < table_len) {
+        blocknum_t next = LE32(table[i + len]);
+        if (first == 0 ? next != 0 : next != first + len) {
+            break;
+        }
+        len++;
+    }
 
+    if (ind_block != 0) {
         /* release the ref on the cache block */
-        ext2_put_block(ext2, phys_block);
+        ext2_put_block(ext2, ind_block);
+    }
+
+    *phys_block = first;
+    *run_len = len;
+    return 0;
+}
+
+/* find the run of contiguous blocks starting at fileblock in an ext4 extent tree */
+static int ext4_map_extent(ext2_t *ext2, struct ext2_inode *inode, uint32_t fileblock,
+                           blocknum_t *phys_block, uint32_t *run_len) {
+    const struct ext4_extent_header *eh = (const struct ext4_extent_header *)inode->i_block;
+    blocknum_t node_block = 0; /* cache block holding eh, 0 while still in the inode */
+    uint32_t hole_end = UINT32_MAX; /* start of the next mapped range after fileblock */
+    /* entries that fit after the header, in i_block for the root and in a whole block below it */
+    uint32_t node_max = (sizeof(inode->i_block) - sizeof(*eh)) / sizeof(struct ext4_extent);
+    uint32_t max_depth = EXT4_EXT_MAX_DEPTH;
+    int err = 0;
+
+    for (;;) {
+        /* don't trust anything on disk: a corrupt node could index past its block or loop */
+        const uint32_t depth = LE16(eh->eh_depth);
+        if (LE16(eh->eh_magic) != EXT4_EXT_MAGIC ||
+            LE16(eh->eh_entries) > LE16(eh->eh_max) ||
+            LE16(eh->eh_max) > node_max ||
+            depth > max_depth) {
+            err = ERR_BAD_STATE;
+            break;
+        }
+
+        const int entries = LE16(eh->eh_entries);
+
+        if (LE16(eh->eh_depth) == 0) {
+            /* leaf, find the last extent starting at or before fileblock */
+            const struct ext4_extent *ex = (const struct ext4_extent *)(eh + 1);
+            int i = entries - 1;
+            while (i >= 0 && LE32(ex[i].ee_block) > fileblock) {
+                i--;
+            }
+            if (i + 1 < entries) {
+                hole_end = MIN(hole_end, LE32(ex[i + 1].ee_block));
+            }
+
+            *phys_block = 0;
+            *run_len = hole_end - fileblock;
+            if (i >= 0) {
+                const uint32_t start = LE32(ex[i].ee_block);
+                uint32_t len = LE16(ex[i].ee_len);
+                const bool uninit = len > EXT4_EXT_INIT_MAX_LEN;
+                if (uninit) {
+                    len -= EXT4_EXT_INIT_MAX_LEN;
+                }
+                if (fileblock - start < len) {
+                    if (LE16(ex[i].ee_start_hi) != 0) {
+                        /* beyond the 32 bit block numbers we use */
+                        err = ERR_NOT_SUPPORTED;
+                        break;
+                    }
+                    /* uninitialized extents read back as zeros, same as a hole */
+                    *phys_block = uninit ? 0 : LE32(ex[i].ee_start_lo) + (fileblock - start);
+                    *run_len = start + len - fileblock;
+                }
+            }
+            break;
+        }
+
+        /* interior node, find the last index starting at or before fileblock */
+        const struct ext4_extent_idx *ix = (const struct ext4_extent_idx *)(eh + 1);
+        int i = entries - 1;
+        while (i >= 0 && LE32(ix[i].ei_block) > fileblock) {
+            i--;
+        }
+        if (i + 1 < entries) {
+            hole_end = MIN(hole_end, LE32(ix[i + 1].ei_block));
+        }
+        if (i < 0) {
+            /* before the first mapped block */
+            *phys_block = 0;
+            *run_len = hole_end - fileblock;
+            break;
+        }
+        if (LE16(ix[i].ei_leaf_hi) != 0) {
+            err = ERR_NOT_SUPPORTED;
+            break;
+        }
+
+        /* descend a level */
+        blocknum_t child = LE32(ix[i].ei_leaf_lo);
+        void *ptr;
+        err = ext2_get_block(ext2, &ptr, child);
+        if (err < 0) {
+            break;
+        }
+        if (node_block != 0) {
+            ext2_put_block(ext2, node_block);
+        }
+        node_block = child;
+        eh = ptr;
+
+        /* each level down has to be shallower than its parent */
+        max_depth = depth - 1;
+        node_max = (EXT2_BLOCK_SIZE(ext2->sb) - sizeof(*eh)) / sizeof(struct ext4_extent);
+    }
+
+    if (node_block != 0) {
+        ext2_put_block(ext2, node_block);
+    }
+
+    return err;
+}
+
+/* translate a file block to the run of physical blocks that starts with it */
+static int file_block_to_fs_run(ext2_t *ext2, struct ext2_inode *inode, struct ext2_extent_cache *cache,
+                                uint32_t fileblock, blocknum_t *phys_block, uint32_t *run_len) {
+    LTRACEF("inode %p, fileblock %u\n", inode, fileblock);
+
+    if (cache) {
+        for (uint i = 0; i < EXT2_EXTENT_CACHE_ENTRIES; i++) {
+            const struct ext2_extent *e = &cache->entry[i];
+            const uint32_t off = fileblock - e->file_block;
+            if (off < e->len) {
+                *phys_block = e->phys_block ? e->phys_block + off : 0;
+                *run_len = e->len - off;
+                return 0;
+            }
+        }
     }
 
-    LTRACEF("returning %u\n", block);
+    int err;
+    if (inode->i_flags & EXT4_EXTENTS_FL) {
+        err = ext4_map_extent(ext2, inode, fileblock, phys_block, run_len);
+    } else {
+        err = ext2_map_indirect(ext2, inode, fileblock, phys_block, run_len);
+    }
+    if (err < 0) {
+        return err;
+    }
+
+    LTRACEF("returning block %u, run %u\n", *phys_block, *run_len);
+
+    if (cache) {
+        struct ext2_extent *e = &cache->entry[cache->next];
+        e->file_block = fileblock;
+        e->len = *run_len;
+        e->phys_block = *phys_block;
+        cache->next = (cache->next + 1) % EXT2_EXTENT_CACHE_ENTRIES;
+    }
 
-    return block;
+    return 0;
 }
 
-ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, void *_buf, off_t offset, size_t len) {
+ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, struct ext2_extent_cache *cache,
+                        void *_buf, off_t offset, size_t len) {
     int err = 0;
     size_t bytes_read = 0;
     uint8_t *buf = _buf;
+    const size_t block_size = EXT2_BLOCK_SIZE(ext2->sb);
 
     /* calculate the file size */
     off_t file_size = ext2_file_len(ext2, inode);
@@ -183,68 +343,61 @@ ssize_t ext2_read_inode(ext2_t *ext2, struct ext2_inode *inode, void *_buf, off_
     }
 
     /* calculate the starting file block */
-    uint file_block = offset / EXT2_BLOCK_SIZE(ext2->sb);
+    uint32_t file_block = offset / block_size;
+    size_t block_offset = offset % block_size;
 
-    /* handle partial first block */
-    if ((offset % EXT2_BLOCK_SIZE(ext2->sb)) != 0) {
-        uint8_t temp[EXT2_BLOCK_SIZE(ext2->sb)];
+    while (len > 0) {
+        blocknum_t phys_block;
+        uint32_t run_len;
+        err = file_block_to_fs_run(ext2, inode, cache, file_block, &phys_block, &run_len);
+        if (err < 0) {
+            break;
+        }
 
-        /* calculate the block and read it */
-        blocknum_t phys_block = file_block_to_fs_block(ext2, inode, file_block);
-        if (phys_block == 0) {
-            memset(temp, 0, EXT2_BLOCK_SIZE(ext2->sb));
+        size_t tocopy;
+        if (block_offset != 0 || len < block_size) {
+            /* partial block, copy what we need out of the block cache */
+            tocopy = MIN(len, block_size - block_offset);
+            if (phys_block == 0) {
+                memset(buf, 0, tocopy);
+            } else {
+                void *ptr;
+                err = ext2_get_block(ext2, &ptr, phys_block);
+                if (err < 0) {
+                    break;
+                }
+                memcpy(buf, (uint8_t *)ptr + block_offset, tocopy);
+                ext2_put_block(ext2, phys_block);
+            }
         } else {
-            ext2_read_block(ext2, temp, phys_block);
+            /* whole blocks, take as much of the run as fits in the request */
+            const uint32_t blocks = MIN(run_len, len / block_size);
+            tocopy = blocks * block_size;
+            if (phys_block == 0) {
+                memset(buf, 0, tocopy);
+            } else if (blocks == 1) {
+                /* single blocks go through the cache, which also catches readahead */
+                err = ext2_read_block(ext2, buf, phys_block);
+            } else {
+                /* read the run straight into the caller's buffer in one request */
+                ssize_t ret = bio_read(ext2->dev, buf, (off_t)phys_block * block_size, tocopy);
+                if (ret != (ssize_t)tocopy) {
+                    err = (ret < 0) ? (int)ret : ERR_IO;
+                }
+            }
+            if (err < 0) {
+                break;
+            }
         }
 
-        /* copy out what we need */
-        size_t block_offset = offset % EXT2_BLOCK_SIZE(ext2->sb);
-        size_t tocopy = MIN(len, EXT2_BLOCK_SIZE(ext2->sb) - block_offset);
-        memcpy(buf, temp + block_offset, tocopy);
-
         /* increment our stuff */
-        file_block++;
+        file_block += (block_offset + tocopy) / block_size;
+        block_offset = 0;
         len -= tocopy;
         bytes_read += tocopy;
         buf += tocopy;
     }
 
-    /* handle middle blocks */
-    while (len >= EXT2_BLOCK_SIZE(ext2->sb)) {
-        /* calculate the block and read it */
-        blocknum_t phys_block = file_block_to_fs_block(ext2, inode, file_block);
-        if (phys_block == 0) {
-            memset(buf, 0, EXT2_BLOCK_SIZE(ext2->sb));
-        } else {
-            ext2_read_block(ext2, buf, phys_block);
-        }
-
-        /* increment our stuff */
-        file_block++;
-        len -= EXT2_BLOCK_SIZE(ext2->sb);
-        bytes_read += EXT2_BLOCK_SIZE(ext2->sb);
-        buf += EXT2_BLOCK_SIZE(ext2->sb);
-    }
-
-    /* handle partial last block */
-    if (len > 0) {
-        uint8_t temp[EXT2_BLOCK_SIZE(ext2->sb)];
-
-        /* calculate the block and read it */
-        blocknum_t phys_block = file_block_to_fs_block(ext2, inode, file_block);
-        if (phys_block == 0) {
-            memset(temp, 0, EXT2_BLOCK_SIZE(ext2->sb));
-        } else {
-            ext2_read_block(ext2, temp, phys_block);
-        }
-
-        /* copy out what we need */
-        memcpy(buf, temp, len);
-
-        /* increment our stuff */
-        bytes_read += len;
-    }
-
     LTRACEF("err %d, bytes_read %zu\n", err, bytes_read);
 
     return (err < 0) ? err : (ssize_t)bytes_read;
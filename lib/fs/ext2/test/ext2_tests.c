@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <endian.h>
+#include <lib/bcache.h>
+#include <lib/bio.h>
+#include <lib/unittest.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../ext2_priv.h"
+
+// Extent trees built by hand on a memory block device, read back through ext2_read_inode().
+
+#define BLOCK_SIZE ((size_t)1024)
+#define BLOCK_COUNT 64
+
+// where the test puts its tree nodes
+#define GOOD_LEAF 10
+#define LOOP_NODE 11 // claims to be as deep as its parent and points at itself
+#define BAD_MAGIC_LEAF 12
+#define OVERFULL_LEAF 13
+
+// file blocks 0-3 map to 20-23, 4-5 are a hole, 6-7 are uninitialized at 30-31, 8-9 map to 40-41
+#define FILE_BLOCKS 10
+
+static void set_header(struct ext4_extent_header *eh, uint16_t magic, uint16_t entries, uint16_t max, uint16_t depth) {
+    eh->eh_magic = LE16(magic);
+    eh->eh_entries = LE16(entries);
+    eh->eh_max = LE16(max);
+    eh->eh_depth = LE16(depth);
+    eh->eh_generation = 0;
+}
+
+static void set_extent(struct ext4_extent *ex, uint32_t block, uint16_t len, uint32_t start) {
+    ex->ee_block = LE32(block);
+    ex->ee_len = LE16(len);
+    ex->ee_start_hi = 0;
+    ex->ee_start_lo = LE32(start);
+}
+
+static void set_index(struct ext4_extent_idx *ix, uint32_t block, uint32_t leaf) {
+    ix->ei_block = LE32(block);
+    ix->ei_leaf_lo = LE32(leaf);
+    ix->ei_leaf_hi = 0;
+    ix->ei_unused = 0;
+}
+
+// the root of the tree in the inode, a single index pointing at leaf
+static void set_root(struct ext2_inode *inode, uint32_t leaf) {
+    memset(inode, 0, sizeof(*inode));
+    inode->i_mode = S_IFREG;
+    inode->i_flags = EXT4_EXTENTS_FL;
+    inode->i_size = FILE_BLOCKS * BLOCK_SIZE;
+
+    struct ext4_extent_header *eh = (struct ext4_extent_header *)inode->i_block;
+    set_header(eh, EXT4_EXT_MAGIC, 1, 4, 1);
+    set_index((struct ext4_extent_idx *)(eh + 1), 0, leaf);
+}
+
+static void fill_leaf(uint8_t *mem, uint32_t block, uint16_t magic, uint16_t entries, uint16_t max) {
+    struct ext4_extent_header *eh = (struct ext4_extent_header *)(mem + block * BLOCK_SIZE);
+    set_header(eh, magic, entries, max, 0);
+
+    struct ext4_extent *ex = (struct ext4_extent *)(eh + 1);
+    set_extent(&ex[0], 0, 4, 20);
+    set_extent(&ex[1], 6, 2 + EXT4_EXT_INIT_MAX_LEN, 30);
+    set_extent(&ex[2], 8, 2, 40);
+}
+
+// Set up a memory device holding the test trees, with every data block filled with its
+// block number, and an ext2_t with just enough filled in to read inodes off it.
+static bool setup(ext2_t *ext2, uint8_t **mem_out) {
+    BEGIN_TEST;
+
+    uint8_t *mem = memalign(CACHE_LINE, BLOCK_SIZE * BLOCK_COUNT);
+    ASSERT_NONNULL(mem, "");
+    for (size_t i = 0; i < BLOCK_COUNT; i++) {
+        memset(mem + i * BLOCK_SIZE, (int)i, BLOCK_SIZE);
+    }
+
+    const uint16_t leaf_max = (BLOCK_SIZE - sizeof(struct ext4_extent_header)) / sizeof(struct ext4_extent);
+    fill_leaf(mem, GOOD_LEAF, EXT4_EXT_MAGIC, 3, leaf_max);
+    fill_leaf(mem, BAD_MAGIC_LEAF, 0x1234, 3, leaf_max);
+    fill_leaf(mem, OVERFULL_LEAF, EXT4_EXT_MAGIC, 3, 2);
+
+    struct ext4_extent_header *eh = (struct ext4_extent_header *)(mem + LOOP_NODE * BLOCK_SIZE);
+    set_header(eh, EXT4_EXT_MAGIC, 1, leaf_max, 1);
+    set_index((struct ext4_extent_idx *)(eh + 1), 0, LOOP_NODE);
+
+    ASSERT_EQ(0, create_membdev("ext2_test", mem, BLOCK_SIZE * BLOCK_COUNT), "");
+
+    memset(ext2, 0, sizeof(*ext2));
+    ext2->dev = bio_open("ext2_test");
+    ASSERT_NONNULL(ext2->dev, "");
+    ext2->cache = bcache_create(ext2->dev, BLOCK_SIZE, 4);
+    ASSERT_NONNULL(ext2->cache, "");
+    ext2->sb.s_log_block_size = 0; // 1K blocks
+
+    *mem_out = mem;
+
+    END_TEST;
+}
+
+static void teardown(ext2_t *ext2, uint8_t *mem) {
+    bcache_destroy(ext2->cache);
+    bio_close(ext2->dev);
+    bio_unregister_device(ext2->dev);
+    free(mem);
+}
+
+static bool extent_map(void) {
+    BEGIN_TEST;
+
+    ext2_t ext2;
+    uint8_t *mem;
+    ASSERT_TRUE(setup(&ext2, &mem), "");
+
+    struct ext2_inode inode;
+    set_root(&inode, GOOD_LEAF);
+
+    uint8_t *buf = malloc(FILE_BLOCKS * BLOCK_SIZE);
+    ASSERT_NONNULL(buf, "");
+
+    // the whole file in one go, then one block at a time through the extent cache
+    for (int pass = 0; pass < 2; pass++) {
+        struct ext2_extent_cache cache = {};
+        memset(buf, 0xff, FILE_BLOCKS * BLOCK_SIZE);
+        if (pass == 0) {
+            EXPECT_EQ((ssize_t)(FILE_BLOCKS * BLOCK_SIZE),
+                      ext2_read_inode(&ext2, &inode, NULL, buf, 0, FILE_BLOCKS * BLOCK_SIZE), "");
+        } else {
+            for (size_t i = 0; i < FILE_BLOCKS; i++) {
+                EXPECT_EQ((ssize_t)BLOCK_SIZE,
+                          ext2_read_inode(&ext2, &inode, &cache, buf + i * BLOCK_SIZE, i * BLOCK_SIZE, BLOCK_SIZE), "");
+            }
+        }
+
+        static const uint8_t expected[FILE_BLOCKS] = { 20, 21, 22, 23, 0, 0, 0, 0, 40, 41 };
+        for (size_t i = 0; i < FILE_BLOCKS; i++) {
+            for (size_t j = 0; j < BLOCK_SIZE; j++) {
+                if (buf[i * BLOCK_SIZE + j] != expected[i]) {
+                    unittest_printf("file block %zu offset %zu: %#x, expected %#x\n",
+                                    i, j, buf[i * BLOCK_SIZE + j], expected[i]);
+                    EXPECT_EQ(expected[i], buf[i * BLOCK_SIZE + j], "");
+                    break;
+                }
+            }
+        }
+    }
+
+    // a read that starts and ends partway through blocks
+    memset(buf, 0xff, BLOCK_SIZE);
+    EXPECT_EQ((ssize_t)BLOCK_SIZE, ext2_read_inode(&ext2, &inode, NULL, buf, 3 * BLOCK_SIZE + 512, BLOCK_SIZE), "");
+    EXPECT_EQ(23, buf[0], "");
+    EXPECT_EQ(23, buf[511], "");
+    EXPECT_EQ(0, buf[512], "");
+
+    free(buf);
+    teardown(&ext2, mem);
+
+    END_TEST;
+}
+
+static bool extent_map_rejects_corrupt_trees(void) {
+    BEGIN_TEST;
+
+    ext2_t ext2;
+    uint8_t *mem;
+    ASSERT_TRUE(setup(&ext2, &mem), "");
+
+    struct ext2_inode inode;
+    uint8_t buf[BLOCK_SIZE];
+    struct ext4_extent_header *root = (struct ext4_extent_header *)inode.i_block;
+
+    set_root(&inode, BAD_MAGIC_LEAF);
+    EXPECT_EQ(ERR_BAD_STATE, ext2_read_inode(&ext2, &inode, NULL, buf, 0, sizeof(buf)), "bad magic");
+
+    set_root(&inode, OVERFULL_LEAF);
+    EXPECT_EQ(ERR_BAD_STATE, ext2_read_inode(&ext2, &inode, NULL, buf, 0, sizeof(buf)), "entries > max");
+
+    set_root(&inode, LOOP_NODE);
+    EXPECT_EQ(ERR_BAD_STATE, ext2_read_inode(&ext2, &inode, NULL, buf, 0, sizeof(buf)), "depth not decreasing");
+
+    // more entries than fit in i_block
+    set_root(&inode, GOOD_LEAF);
+    root->eh_max = LE16(5);
+    EXPECT_EQ(ERR_BAD_STATE, ext2_read_inode(&ext2, &inode, NULL, buf, 0, sizeof(buf)), "root max too big");
+
+    // deeper than any tree ext4 builds
+    set_root(&inode, GOOD_LEAF);
+    root->eh_depth = LE16(EXT4_EXT_MAX_DEPTH + 1);
+    EXPECT_EQ(ERR_BAD_STATE, ext2_read_inode(&ext2, &inode, NULL, buf, 0, sizeof(buf)), "root too deep");
+
+    // and the same tree still reads fine once it's put back
+    set_root(&inode, GOOD_LEAF);
+    EXPECT_EQ((ssize_t)sizeof(buf), ext2_read_inode(&ext2, &inode, NULL, buf, 0, sizeof(buf)), "");
+    EXPECT_EQ(20, buf[0], "");
+
+    teardown(&ext2, mem);
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(ext2_tests)
+RUN_TEST(extent_map)
+RUN_TEST(extent_map_rejects_corrupt_trees)
+END_TEST_CASE(ext2_tests)
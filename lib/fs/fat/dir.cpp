@@ -1137,9 +1137,7 @@ status_t fat_dir::mkdir(fscookie *cookie, const char *path) {
                       parent_cluster_for_dotdot, 0);
     bref.mark_dirty();
 
-    bcache_flush(fat->bcache());
-
-    return NO_ERROR;
+    return fat->flush_locked();
 }
 
 // static
@@ -1205,10 +1203,10 @@ status_t fat_dir::remove(fscookie *cookie, const char *path) {
     }
 
     LTRACEF("Flushing bcache...\n");
-    bcache_flush(fat->bcache());
-    LTRACEF("Remove complete\n");
+    err = fat->flush_locked();
+    LTRACEF("Remove complete, err %d\n", err);
 
-    return NO_ERROR;
+    return err;
 }
 
 // static
@@ -1275,9 +1273,7 @@ status_t fat_dir::rmdir(fscookie *cookie, const char *path) {
         return err;
     }
 
-    bcache_flush(fat->bcache());
-
-    return NO_ERROR;
+    return fat->flush_locked();
 }
 
 status_t fat_dir_allocate(fat_fs *fat, const char *path, const fat_attribute attr, const uint32_t starting_cluster, const uint32_t size, dir_entry_location *loc) {
@@ -1482,8 +1478,8 @@ status_t fat_dir_allocate(fat_fs *fat, const char *path, const fat_attribute att
         bref.mark_dirty();
     }
 
-    bcache_flush(fat->bcache());
-
+    // the caller flushes once it's done with the entry, so a failed flush can't leave
+    // it holding on to clusters the caller has already given back
     if (loc) {
         loc->starting_dir_cluster = starting_dir_cluster;
         loc->dir_offset = run_start_offset + static_cast<uint32_t>(lfn_entry_count * DIR_ENTRY_LENGTH);
@@ -9,10 +9,14 @@
 
 #include <endian.h>
 #include <lib/bcache/bcache_block_ref.h>
+#include <lk/cpp.h>
 #include <lk/err.h>
 #include <lk/trace.h>
+#include <malloc.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "fat_fs.h"
 #include "fat_priv.h"
@@ -244,6 +248,145 @@ static status_t fat_mark_entry(fat_fs *fat, uint32_t cluster, uint32_t val) {
     return NO_ERROR;
 }
 
+// size of the reads used to pull in a FAT16/32 table when building the free map
+constexpr size_t kFreeMapReadChunk = 64 * 1024;
+
+// scan the FAT once and record which clusters are in use in the fs's free map.
+// no-op if the map has already been built.
+static status_t fat_build_free_map(fat_fs *fat) {
+    DEBUG_ASSERT(fat->lock.is_held());
+
+    auto &map = fat->free_map();
+    if (map.is_built()) {
+        return NO_ERROR;
+    }
+
+    const auto &info = fat->info();
+    const uint32_t total_clusters = info.total_clusters;
+    const size_t words = (total_clusters + 31) / 32;
+
+    // start with everything marked in use so the reserved clusters and the tail of
+    // the last word are never handed out
+    auto *bits = static_cast<uint32_t *>(malloc(words * sizeof(uint32_t)));
+    if (!bits) {
+        return ERR_NO_MEMORY;
+    }
+    auto free_bits = lk::make_auto_call([&]() { free(bits); });
+    memset(bits, 0xff, words * sizeof(uint32_t));
+
+    uint32_t free_count = 0;
+    auto mark_free = [&](uint32_t cluster) {
+        bits[cluster / 32] &= ~(1U << (cluster % 32));
+        free_count++;
+    };
+
+    if (info.fat_bits == 12) {
+        // FAT12 tables are only a few sectors, walk them through the block cache
+        for (uint32_t cluster = 2; cluster < total_clusters; cluster++) {
+            if (fat_next_cluster_in_chain(fat, cluster) == 0) {
+                mark_free(cluster);
+            }
+        }
+    } else {
+        // read larger tables straight off the device in big chunks rather than cycling
+        // every FAT sector through the block cache. Flush first so the device has any
+        // FAT updates still sitting in the cache.
+        status_t err = bcache_flush(fat->bcache());
+        if (err < 0) {
+            return err;
+        }
+
+        auto *buf = static_cast<uint8_t *>(malloc(kFreeMapReadChunk));
+        if (!buf) {
+            return ERR_NO_MEMORY;
+        }
+        auto free_buf = lk::make_auto_call([&]() { free(buf); });
+
+        const uint32_t entry_size = info.fat_bits / 8;
+        const off_t fat_start = static_cast<off_t>(info.reserved_sectors +
+                                                   info.active_fat * info.sectors_per_fat) *
+                                info.bytes_per_sector;
+        const off_t fat_len = static_cast<off_t>(total_clusters) * entry_size;
+
+        uint32_t cluster = 0;
+        for (off_t pos = 0; pos < fat_len; pos += kFreeMapReadChunk) {
+            const size_t len = MIN(kFreeMapReadChunk, static_cast<size_t>(fat_len - pos));
+            ssize_t read = bio_read(fat->dev(), buf, fat_start + pos, len);
+            if (read < 0) {
+                return static_cast<status_t>(read);
+            } else if (static_cast<size_t>(read) != len) {
+                return ERR_IO;
+            }
+
+            for (size_t off = 0; off < len; off += entry_size, cluster++) {
+                uint32_t entry = (entry_size == 4) ? (fat_read32(buf, off) & 0x0fffffff)
+                                                   : fat_read16(buf, off);
+                if (cluster >= 2 && entry == 0) {
+                    mark_free(cluster);
+                }
+            }
+        }
+    }
+
+    free_bits.cancel();
+    map.bits = bits;
+    map.free_count = free_count;
+    map.hint = (info.fsinfo_next_free != UINT32_MAX) ? info.fsinfo_next_free : 2;
+
+    LTRACEF("%u of %u clusters free\n", free_count, total_clusters - 2);
+
+    // the FSInfo free count is only a hint, replace it with the real thing
+    fat->set_fsinfo_free_clusters(free_count);
+
+    return NO_ERROR;
+}
+
+// find the start of the first run of at least want free clusters, searching from the
+// allocation hint to the end of the volume and then wrapping around. If no run is long
+// enough return the start of the longest one seen, or 0 if there are no free clusters.
+static uint32_t fat_find_free_run(fat_fs *fat, uint32_t want) {
+    const auto &map = fat->free_map();
+    const uint32_t total_clusters = fat->info().total_clusters;
+    const uint32_t hint = (map.hint >= 2 && map.hint < total_clusters) ? map.hint : 2;
+
+    uint32_t best_start = 0;
+    uint32_t best_len = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t cluster = (pass == 0) ? hint : 2;
+        const uint32_t end = (pass == 0) ? total_clusters : hint;
+
+        uint32_t run_start = 0;
+        uint32_t run_len = 0;
+        while (cluster < end) {
+            // skip over words with every cluster in use
+            if ((cluster % 32) == 0 && map.bits[cluster / 32] == UINT32_MAX) {
+                run_len = 0;
+                cluster += 32;
+                continue;
+            }
+
+            if (map.in_use(cluster)) {
+                run_len = 0;
+            } else {
+                if (run_len == 0) {
+                    run_start = cluster;
+                }
+                run_len++;
+                if (run_len >= want) {
+                    return run_start;
+                }
+                if (run_len > best_len) {
+                    best_start = run_start;
+                    best_len = run_len;
+                }
+            }
+            cluster++;
+        }
+    }
+
+    return best_start;
+}
+
 // allocate a cluster chain
 // start_cluster is an existing cluster that it should link to (or 0 if its the first in the chain)
 // count is number of clusters to allocate
@@ -256,132 +399,76 @@ status_t fat_allocate_cluster_chain(fat_fs *fat, uint32_t start_cluster, uint32_
     DEBUG_ASSERT(fat->lock.is_held());
 
     *first_cluster = *last_cluster = 0;
-    uint32_t prev_cluster = start_cluster;
-
-    // TODO: start search at start_cluster instead of the beginning
-    uint32_t search_cluster = 2; // first 2 clusters are reserved
+    if (count == 0) {
+        return NO_ERROR;
+    }
 
-    // compute the starting address
-    uint32_t sector;
-    uint32_t fat_offset_in_sector;
-    compute_fat_entry_address(fat, search_cluster, &sector, &fat_offset_in_sector);
+    if (fat->is_read_only()) {
+        return ERR_NOT_ALLOWED;
+    }
 
-    // grab a pointer to the sector holding the fat entry
-    bcache_block_ref bref(fat->bcache());
-    int err = bref.get_block(sector);
+    status_t err = fat_build_free_map(fat);
     if (err < 0) {
-        printf("bcache_get_block returned: %i\n", err);
-        return EOF_CLUSTER;
+        return err;
     }
 
-    // start walking forward until we have found up to count clusters or we run out of clusters
-    const auto total_clusters = fat->info().total_clusters;
-    while (count > 0) {
-        if (fat->info().fat_bits == 12) {
-            // FAT12 entries do not advance linearly by whole bytes, so recompute from
-            // the current cluster each iteration.
-            compute_fat_entry_address(fat, search_cluster, &sector, &fat_offset_in_sector);
-        }
-
-        uint32_t entry;
-        if (fat->info().fat_bits == 32) {
-            const auto *table = (const uint32_t *)bref.ptr();
-            const auto index = fat_offset_in_sector / 4;
-            entry = table[index];
-            LE32SWAP(entry);
+    auto &map = fat->free_map();
+    if (count > map.free_count) {
+        return ERR_NO_RESOURCES;
+    }
 
-            // mask out the top nibble
-            entry &= 0x0fffffff;
-        } else if (fat->info().fat_bits == 16) {
-            const auto *table = (const uint16_t *)bref.ptr();
-            const auto index = fat_offset_in_sector / 2;
-            entry = LE16(table[index]);
-        } else { // fat12
-            entry = fat_next_cluster_in_chain(fat, search_cluster);
+    const auto total_clusters = fat->info().total_clusters;
+    uint32_t prev_cluster = start_cluster;
+    for (uint32_t remaining = count; remaining > 0; remaining--) {
+        // keep growing in place right behind the previous cluster if we can, otherwise
+        // start over at a free run with room for everything that's left
+        uint32_t cluster;
+        if (prev_cluster >= 2 && prev_cluster + 1 < total_clusters && !map.in_use(prev_cluster + 1)) {
+            cluster = prev_cluster + 1;
+        } else {
+            cluster = fat_find_free_run(fat, remaining);
         }
+        DEBUG_ASSERT(cluster >= 2 && cluster < total_clusters);
 
-        LTRACEF_LEVEL(2, "search_cluster %u, sector %u, offset %u: entry %#x\n", search_cluster, sector, fat_offset_in_sector, entry);
-        if (entry == 0) {
-            // its a free entry, allocate it and move on
-            LTRACEF("found free cluster %u, sector %u, offset %u\n", search_cluster, sector, fat_offset_in_sector);
-
-            // zero the cluster first
-            if (zero_new_blocks) {
-                fat_zero_cluster(fat, search_cluster);
-            }
-
-            // add it to the chain
-            if (prev_cluster > 0) {
-                // link the last cluster we had found before to this one.
-                // NOTE: may be start_cluster if this is the first iteration
-                fat_mark_entry(fat, prev_cluster, search_cluster);
-            }
-            if (*first_cluster == 0) {
-                // this is the first one in the chain
-                *first_cluster = search_cluster;
-            }
-            *last_cluster = search_cluster;
-            prev_cluster = search_cluster;
-
-            // Keep FAT32 FSInfo metadata up to date for allocated clusters.
-            fat->adjust_fsinfo_free_clusters(-1);
-            fat->set_fsinfo_next_free(search_cluster + 1);
+        LTRACEF("allocating cluster %u\n", cluster);
 
-            count--;
-            if (count == 0) {
-                // we're at the end of this chain, mark it as EOF
-                fat_mark_entry(fat, search_cluster, EOF_CLUSTER);
+        map.set_in_use(cluster);
+        map.free_count--;
+        fat->adjust_fsinfo_free_clusters(-1);
 
-                // early terminate here, since there's no point pushing
-                // to the next sector
-                break;
-            }
+        // zero the cluster first
+        if (zero_new_blocks) {
+            fat_zero_cluster(fat, cluster);
         }
 
-        // helper to move to the next sector, dropping old block cache and
-        // loading the next one.
-        auto inc_sector = [&bref, &sector]() -> status_t {
-            status_t localerr = bref.get_block(++sector);
-            if (localerr < 0) {
-                printf("bcache_get_block returned: %i\n", localerr);
-                return EOF_CLUSTER;
+        // add it to the chain
+        if (prev_cluster > 0) {
+            // link the last cluster we had found before to this one.
+            // NOTE: may be start_cluster if this is the first iteration
+            err = fat_mark_entry(fat, prev_cluster, cluster);
+            if (err < 0) {
+                return err;
             }
-
-            return NO_ERROR;
-        };
-
-        // next entry
-        search_cluster++;
-        if (search_cluster >= total_clusters) {
-            // no more clusters, abort
-            break;
         }
-        if (fat->info().fat_bits == 32) {
-            fat_offset_in_sector += 4;
-            if (fat_offset_in_sector == fat->info().bytes_per_sector) {
-                fat_offset_in_sector = 0;
-                if ((err = inc_sector()) != NO_ERROR) {
-                    return err;
-                }
-            }
-        } else if (fat->info().fat_bits == 16) {
-            fat_offset_in_sector += 2;
-            if (fat_offset_in_sector == fat->info().bytes_per_sector) {
-                fat_offset_in_sector = 0;
-                if ((err = inc_sector()) != NO_ERROR) {
-                    return err;
-                }
-            }
-        } else { // fat12
-            // address is recomputed from the cluster number at top of loop
+        if (*first_cluster == 0) {
+            // this is the first one in the chain
+            *first_cluster = cluster;
         }
+        *last_cluster = cluster;
+        prev_cluster = cluster;
     }
 
-    if (count == 0) {
-        return NO_ERROR;
-    } else {
-        return ERR_NO_RESOURCES;
+    // we're at the end of this chain, mark it as EOF
+    err = fat_mark_entry(fat, *last_cluster, EOF_CLUSTER);
+    if (err < 0) {
+        return err;
     }
+
+    // pick up the next search right after what was just handed out
+    map.hint = (*last_cluster + 1 < total_clusters) ? *last_cluster + 1 : 2;
+    fat->set_fsinfo_next_free(map.hint);
+
+    return NO_ERROR;
 }
 
 status_t fat_free_cluster_chain(fat_fs *fat, uint32_t start_cluster) {
@@ -403,6 +490,10 @@ status_t fat_free_cluster_chain(fat_fs *fat, uint32_t start_cluster) {
         }
 
         fat->adjust_fsinfo_free_clusters(1);
+        if (fat->free_map().is_built()) {
+            fat->free_map().set_free(cluster);
+            fat->free_map().free_count++;
+        }
 
         if (is_eof_cluster(next) || next < 2 || next >= fat->info().total_clusters) {
             break;
@@ -38,6 +38,19 @@ struct fat_info {
     uint32_t fsinfo_next_free = UINT32_MAX;
 };
 
+// in memory record of which clusters are in use, built from the FAT on the first
+// allocation after mount so that allocating doesn't have to scan the FAT itself
+struct fat_free_map {
+    uint32_t *bits = nullptr; // one bit per cluster, set if the cluster is in use
+    uint32_t free_count = 0;
+    uint32_t hint = 2; // cluster to start the next search for a free run at
+
+    bool is_built() const { return bits != nullptr; }
+    bool in_use(uint32_t cluster) const { return bits[cluster / 32] & (1U << (cluster % 32)); }
+    void set_in_use(uint32_t cluster) { bits[cluster / 32] |= (1U << (cluster % 32)); }
+    void set_free(uint32_t cluster) { bits[cluster / 32] &= ~(1U << (cluster % 32)); }
+};
+
 class fat_file;
 struct dir_entry_location;
 
@@ -54,10 +67,18 @@ class fat_fs {
     bool is_read_only() const { return read_only_; }
 
     // FAT32 FSInfo helpers (no-op on FAT12/16 or invalid FSInfo)
+    // the counters are only updated in memory, flush_locked() writes them back
     status_t adjust_fsinfo_free_clusters(int32_t delta);
+    status_t set_fsinfo_free_clusters(uint32_t free_clusters);
     status_t set_fsinfo_next_free(uint32_t next_free);
     status_t write_fsinfo_locked();
 
+    // write back the FSInfo counters if they changed and flush the block cache
+    status_t flush_locked();
+
+    // must be called with lock held
+    fat_free_map &free_map() { return free_map_; }
+
     // FAT16/32 volume dirty/clean bit in FAT entry 1 (no-op on FAT12)
     status_t mark_volume_dirty_locked();
     status_t mark_volume_clean_locked();
@@ -86,6 +107,9 @@ class fat_fs {
     // shared implementation for mark_volume_dirty/clean_locked
     status_t set_volume_clean_bit_locked(bool clean);
 
+    fat_free_map free_map_{};
+    bool fsinfo_dirty_ = false;
+
     bool read_only_ = false;
 };
 
@@ -57,7 +57,7 @@ inline bool operator==(const dir_entry_location &a, const dir_entry_location &b)
 status_t fat_dir_walk(fat_fs *fat, const char *path, dir_entry *out_entry, dir_entry_location *loc);
 
 // walk a path, allocating a new entry with the path name.
-// returns the dir entry location
+// returns the dir entry location. the entry is left dirty in the block cache for the caller to flush
 status_t fat_dir_allocate(fat_fs *fat, const char *path, fat_attribute attr, uint32_t starting_cluster, uint32_t size, dir_entry_location *loc);
 
 status_t fat_dir_update_entry(fat_fs *fat, const dir_entry_location &loc, uint32_t starting_cluster, uint32_t size);
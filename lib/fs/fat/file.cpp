@@ -8,6 +8,7 @@
  */
 #include "file.h"
 
+#include <lib/bcache/bcache_block_ref.h>
 #include <lib/bio.h>
 #include <lib/fs.h>
 #include <lk/debug.h>
@@ -26,7 +27,85 @@
 
 fat_file::fat_file(fat_fs *f)
     : fs_(f) {}
-fat_file::~fat_file() = default;
+fat_file::~fat_file() {
+    free(runs_);
+}
+
+void fat_file::invalidate_runs_locked() {
+    run_count_ = 0;
+    runs_end_ = 0;
+    runs_next_ = 0;
+}
+
+status_t fat_file::map_cluster_locked(uint32_t logical_cluster, uint32_t want, uint32_t *cluster, uint32_t *run_len) {
+    DEBUG_ASSERT(fs_->lock.is_held());
+
+    const uint32_t total_clusters = fs_->info().total_clusters;
+
+    // extend the run map until it covers what's wanted or the chain ends
+    uint32_t next = run_count_ ? runs_next_ : start_cluster_;
+    while (runs_end_ < logical_cluster + MAX(want, 1u)) {
+        if (next < 2 || next >= total_clusters) {
+            break;
+        }
+
+        cluster_run *last = run_count_ ? &runs_[run_count_ - 1] : nullptr;
+        if (last && last->cluster + last->count == next) {
+            last->count++;
+        } else {
+            if (run_count_ == MAX_CLUSTER_RUNS) {
+                break;
+            }
+            if (run_count_ == run_capacity_) {
+                const uint32_t capacity = run_capacity_ ? run_capacity_ * 2 : 8;
+                auto *runs = (cluster_run *)realloc(runs_, capacity * sizeof(cluster_run));
+                if (!runs) {
+                    break;
+                }
+                runs_ = runs;
+                run_capacity_ = capacity;
+            }
+            runs_[run_count_++] = { runs_end_, next, 1 };
+        }
+        runs_end_++;
+        next = fat_next_cluster_in_chain(fs_, next);
+    }
+    runs_next_ = next;
+
+    if (logical_cluster < runs_end_) {
+        // binary search for the run holding it
+        uint32_t lo = 0;
+        uint32_t hi = run_count_;
+        while (hi - lo > 1) {
+            const uint32_t mid = lo + (hi - lo) / 2;
+            if (runs_[mid].logical <= logical_cluster) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        const cluster_run &run = runs_[lo];
+        DEBUG_ASSERT(logical_cluster - run.logical < run.count);
+        *cluster = run.cluster + (logical_cluster - run.logical);
+        *run_len = run.count - (logical_cluster - run.logical);
+        return NO_ERROR;
+    }
+
+    // past what the map holds, walk the rest of the way one cluster at a time
+    for (uint32_t i = runs_end_; i < logical_cluster; i++) {
+        if (next < 2 || next >= total_clusters) {
+            return ERR_IO;
+        }
+        next = fat_next_cluster_in_chain(fs_, next);
+    }
+    if (next < 2 || next >= total_clusters) {
+        return ERR_IO;
+    }
+
+    *cluster = next;
+    *run_len = 1;
+    return NO_ERROR;
+}
 
 status_t fat_file::zero_range_locked(uint32_t offset, uint32_t len) {
     DEBUG_ASSERT(fs_->lock.is_held());
@@ -44,9 +123,14 @@ status_t fat_file::zero_range_locked(uint32_t offset, uint32_t len) {
         (offset % fs_->info().bytes_per_cluster) / fs_->info().bytes_per_sector;
     uint32_t offset_within_sector = offset % fs_->info().bytes_per_sector;
 
-    file_block_iterator fbi(fs_, start_cluster_);
-    status_t err = fbi.next_sectors(logical_cluster * fs_->info().sectors_per_cluster +
-                                    sector_within_cluster);
+    uint32_t cluster, run_len;
+    status_t err = map_cluster_locked(logical_cluster, 1, &cluster, &run_len);
+    if (err < 0) {
+        return err;
+    }
+
+    file_block_iterator fbi(fs_, cluster);
+    err = fbi.next_sectors(sector_within_cluster);
     if (err < 0) {
         return err;
     }
@@ -108,6 +192,11 @@ status_t fat_file::open_file_priv(const dir_entry &entry, const dir_entry_locati
 
     LTRACEF("found file at location %u:%u\n", loc.starting_dir_cluster, loc.dir_offset);
 
+    // an existing object reopened at a different chain can't keep its run map
+    if (start_cluster_ != entry.start_cluster) {
+        invalidate_runs_locked();
+    }
+
     // move this out to the wrapper function so we can properly deal with dirs
     //
     // did we get a file?
@@ -198,67 +287,68 @@ ssize_t fat_file::read_file_priv(void *_buf, const off_t offset, size_t len) {
 
     LTRACEF("trimmed offset %lld len %zu\n", offset, len);
 
-    // create a file block iterator and push it forward to the starting point
-    uint32_t logical_cluster = offset / fs_->info().bytes_per_cluster;
-    uint32_t sector_within_cluster = (offset % fs_->info().bytes_per_cluster) / fs_->info().bytes_per_sector;
-    uint32_t offset_within_sector = offset % fs_->info().bytes_per_sector;
-
-    LTRACEF("starting off logical cluster %u, sector within %u, offset within %u\n",
-            logical_cluster, sector_within_cluster, offset_within_sector);
+    const uint32_t bytes_per_sector = fs_->info().bytes_per_sector;
+    const uint32_t bytes_per_cluster = fs_->info().bytes_per_cluster;
 
-    file_block_iterator fbi(fs_, start_cluster_);
-
-    // move it forward to our index point
-    // also loads the buffer
-    status_t err = fbi.next_sectors(logical_cluster * fs_->info().sectors_per_cluster + sector_within_cluster);
-    if (err < 0) {
-        LTRACEF("error moving up to starting point!\n");
-        return err;
-    }
-
-    ssize_t amount_read = 0;
+    uint32_t pos = offset;
     size_t buf_offset = 0; // offset into the output buffer
     while (buf_offset < len) {
-        size_t to_read = MIN(fs_->info().bytes_per_sector - offset_within_sector, len - buf_offset);
-
-        LTRACEF("top of loop: sector offset %u, buf offset %zu, remaining len %zu, to_read %zu\n",
-                offset_within_sector, buf_offset, len, to_read);
+        const uint32_t logical_cluster = pos / bytes_per_cluster;
+        const uint32_t offset_within_cluster = pos % bytes_per_cluster;
+        const uint32_t offset_within_sector = pos % bytes_per_sector;
+        const uint32_t clusters_wanted = (offset_within_cluster + (len - buf_offset) + bytes_per_cluster - 1) / bytes_per_cluster;
+
+        // find the run of contiguous clusters we're in
+        uint32_t cluster, run_len;
+        status_t err = map_cluster_locked(logical_cluster, clusters_wanted, &cluster, &run_len);
+        if (err < 0) {
+            LTRACEF("error mapping logical cluster %u\n", logical_cluster);
+            return err;
+        }
 
-        // grab a pointer directly to the block cache
-        const uint8_t *ptr;
-        ptr = fbi.get_bcache_ptr(offset_within_sector);
-        if (!ptr) {
-            LTRACEF("error getting pointer to file in cache\n");
+        uint32_t sector = fat_sector_for_cluster(fs_, cluster);
+        if (sector == 0xffffffff) {
             return ERR_IO;
         }
+        sector += offset_within_cluster / bytes_per_sector;
 
-        // make sure we dont do something silly
-        DEBUG_ASSERT(buf_offset + to_read <= len);
-        DEBUG_ASSERT(offset_within_sector + to_read <= fs_->info().bytes_per_sector);
+        // how much of the read the run covers
+        const size_t run_bytes = MIN((size_t)run_len * bytes_per_cluster - offset_within_cluster, len - buf_offset);
 
-        // copy out to the buffer
-        memcpy(buf + buf_offset, ptr, to_read);
+        LTRACEF("pos %u: cluster %u run %u sector %u, run bytes %zu\n", pos, cluster, run_len, sector, run_bytes);
 
-        // next iteration of the loop
-        amount_read += to_read;
-        buf_offset += to_read;
+        size_t to_read;
+        if (offset_within_sector == 0 && run_bytes >= 2 * bytes_per_sector) {
+            // read whole sectors of the run straight into the buffer in one request.
+            // writes flush the block cache before returning, so the device is current.
+            to_read = ROUNDDOWN(run_bytes, bytes_per_sector);
+            ssize_t ret = bio_read(fs_->dev(), buf + buf_offset, (off_t)sector * bytes_per_sector, to_read);
+            if (ret < 0) {
+                return ret;
+            }
+            if ((size_t)ret != to_read) {
+                return ERR_IO;
+            }
+        } else {
+            // partial or single sector, copy out of the block cache
+            to_read = MIN(bytes_per_sector - offset_within_sector, run_bytes);
 
-        // go to the next sector
-        offset_within_sector += to_read;
-        DEBUG_ASSERT(offset_within_sector <= fs_->info().bytes_per_sector);
-        if (offset_within_sector == fs_->info().bytes_per_sector) {
-            offset_within_sector = 0;
-            // push the iterator forward to next sector
-            if (buf_offset < len) {
-                err = fbi.next_sector();
-                if (err < 0) {
-                    return err;
-                }
+            bcache_block_ref bref(fs_->bcache());
+            err = bref.get_block(sector);
+            if (err < 0) {
+                return err;
             }
+            memcpy(buf + buf_offset, (const uint8_t *)bref.ptr() + offset_within_sector, to_read);
         }
+
+        // make sure we dont do something silly
+        DEBUG_ASSERT(buf_offset + to_read <= len);
+
+        buf_offset += to_read;
+        pos += to_read;
     }
 
-    return amount_read;
+    return buf_offset;
 }
 
 // static
@@ -340,6 +430,10 @@ status_t fat_file::create_file(fscookie *cookie, const char *path, filecookie **
         if (err < 0) {
             return err;
         }
+        err = fs->flush_locked();
+        if (err < 0) {
+            return err;
+        }
 
         // we have found and allocated a spot
         fat_file *file = new fat_file(fs);
@@ -401,6 +495,9 @@ status_t fat_file::truncate_file_priv(uint64_t _len) {
 
             // TODO: compartmentalize this cluster extension/shrinking so DIR code can reuse it
 
+            // the chain is about to change under the run map
+            invalidate_runs_locked();
+
             // walk to the end of the existing cluster chain
             const uint32_t existing_chain_end = fat_find_last_cluster_in_chain(fs_, start_cluster_);
 
@@ -444,6 +541,9 @@ status_t fat_file::truncate_file_priv(uint64_t _len) {
             // shrinking the file
             uint32_t new_start_cluster = start_cluster_;
 
+            // the chain is about to change under the run map
+            invalidate_runs_locked();
+
             if (new_cluster_count == 0) {
                 // File shrunk to zero length: free the entire chain and clear start cluster.
                 status_t err = fat_free_cluster_chain(fs_, start_cluster_);
@@ -485,9 +585,7 @@ status_t fat_file::truncate_file_priv(uint64_t _len) {
         }
     }
 
-    bcache_flush(fs_->bcache());
-
-    return NO_ERROR;
+    return fs_->flush_locked();
 }
 
 ssize_t fat_file::write_file_priv(const void *_buf, const off_t offset, size_t len) {
@@ -530,9 +628,14 @@ ssize_t fat_file::write_file_priv(const void *_buf, const off_t offset, size_t l
         (offset % fs_->info().bytes_per_cluster) / fs_->info().bytes_per_sector;
     uint32_t offset_within_sector = offset % fs_->info().bytes_per_sector;
 
-    file_block_iterator fbi(fs_, start_cluster_);
-    status_t err = fbi.next_sectors(logical_cluster * fs_->info().sectors_per_cluster +
-                                    sector_within_cluster);
+    uint32_t cluster, run_len;
+    status_t err = map_cluster_locked(logical_cluster, 1, &cluster, &run_len);
+    if (err < 0) {
+        return err;
+    }
+
+    file_block_iterator fbi(fs_, cluster);
+    err = fbi.next_sectors(sector_within_cluster);
     if (err < 0) {
         return err;
     }
@@ -563,7 +666,10 @@ ssize_t fat_file::write_file_priv(const void *_buf, const off_t offset, size_t l
         }
     }
 
-    bcache_flush(fs_->bcache());
+    err = fs_->flush_locked();
+    if (err < 0) {
+        return err;
+    }
 
     return written;
 }
@@ -44,6 +44,12 @@ class fat_file {
     status_t truncate_file_priv(uint64_t len);
     status_t zero_range_locked(uint32_t offset, uint32_t len);
 
+    // find the physical cluster backing a cluster of the file, and how many clusters
+    // are contiguous with it. want is how many clusters the caller is interested in,
+    // to size how far ahead the chain is walked.
+    status_t map_cluster_locked(uint32_t logical_cluster, uint32_t want, uint32_t *cluster, uint32_t *run_len);
+    void invalidate_runs_locked();
+
   protected:
     // increment the ref and add/remove the file from the fs list
     void inc_ref();
@@ -63,4 +69,20 @@ class fat_file {
 
     // saved attributes from our dir entry
     fat_attribute attributes_ = fat_attribute(0);
+
+    // runs of physically contiguous clusters making up the file, filled in from the
+    // start of the cluster chain as accesses reach further into the file
+    struct cluster_run {
+        uint32_t logical; // first cluster of the run, counted from the start of the file
+        uint32_t cluster; // first physical cluster of the run
+        uint32_t count;
+    };
+    // bounds the memory spent on badly fragmented files, past this the chain is walked
+    static const uint32_t MAX_CLUSTER_RUNS = 1024;
+
+    cluster_run *runs_ = nullptr;
+    uint32_t run_count_ = 0;
+    uint32_t run_capacity_ = 0;
+    uint32_t runs_end_ = 0;  // number of clusters of the file covered by runs_
+    uint32_t runs_next_ = 0; // physical cluster following the covered part
 };
@@ -26,6 +26,11 @@
 
 #define LOCAL_TRACE FAT_GLOBAL_TRACE(0)
 
+// bytes of block cache per mount, blocks are only allocated as they're used
+#ifndef FAT_BCACHE_SIZE
+#define FAT_BCACHE_SIZE (16 * 1024 * 1024)
+#endif
+
 namespace {
 
 constexpr uint32_t kFsInfoLeadSig = 0x41615252;
@@ -59,7 +64,9 @@ __NO_INLINE static void fat_dump(fat_fs *fat) {
 }
 
 fat_fs::fat_fs() = default;
-fat_fs::~fat_fs() = default;
+fat_fs::~fat_fs() {
+    free(free_map_.bits);
+}
 
 void fat_fs::add_to_file_list(fat_file *file) {
     DEBUG_ASSERT(lock.is_held());
@@ -103,10 +110,24 @@ status_t fat_fs::write_fsinfo_locked() {
     fat_write32(buf, 0x1ec, info_.fsinfo_next_free);
     fat_write32(buf, 0x1fc, kFsInfoTrailSig);
     bref.mark_dirty();
+    fsinfo_dirty_ = false;
 
     return NO_ERROR;
 }
 
+status_t fat_fs::flush_locked() {
+    DEBUG_ASSERT(lock.is_held());
+
+    if (fsinfo_dirty_) {
+        status_t err = write_fsinfo_locked();
+        if (err < 0) {
+            return err;
+        }
+    }
+
+    return bcache_flush(bcache_);
+}
+
 status_t fat_fs::adjust_fsinfo_free_clusters(int32_t delta) {
     DEBUG_ASSERT(lock.is_held());
 
@@ -127,8 +148,22 @@ status_t fat_fs::adjust_fsinfo_free_clusters(int32_t delta) {
         // The count of data clusters is total_clusters - 2.
         info_.fsinfo_free_clusters = MIN(new_count, info_.total_clusters - 2);
     }
+    fsinfo_dirty_ = true;
+
+    return NO_ERROR;
+}
+
+status_t fat_fs::set_fsinfo_free_clusters(uint32_t free_clusters) {
+    DEBUG_ASSERT(lock.is_held());
+
+    if (info_.fat_bits != 32 || !info_.fsinfo_valid) {
+        return NO_ERROR;
+    }
+
+    info_.fsinfo_free_clusters = MIN(free_clusters, info_.total_clusters - 2);
+    fsinfo_dirty_ = true;
 
-    return write_fsinfo_locked();
+    return NO_ERROR;
 }
 
 status_t fat_fs::set_fsinfo_next_free(uint32_t next_free) {
@@ -143,8 +178,9 @@ status_t fat_fs::set_fsinfo_next_free(uint32_t next_free) {
     } else {
         info_.fsinfo_next_free = next_free;
     }
+    fsinfo_dirty_ = true;
 
-    return write_fsinfo_locked();
+    return NO_ERROR;
 }
 
 // Update FAT entry 1 across all FAT copies: clear ClnShutBit (mark dirty) or set it (mark clean).
@@ -390,11 +426,14 @@ status_t fat_fs::mount(bdev_t *dev, fscookie **cookie, enum fs_mount_options opt
 
     info->bytes_per_cluster = info->sectors_per_cluster * info->bytes_per_sector;
 
-    int bcache_size = MIN(16, 64 * info->sectors_per_cluster);
+    int bcache_size = MAX(FAT_BCACHE_SIZE / info->bytes_per_sector, 16u);
 
     dprintf(INFO, "FAT: creating bcache of %d entries of %u bytes\n", bcache_size, info->bytes_per_sector);
 
     fat->bcache_ = bcache_create(fat->dev(), info->bytes_per_sector, bcache_size);
+    if (!fat->bcache_) {
+        return ERR_NO_MEMORY;
+    }
 
     if (fat->read_only_) {
         bcache_set_read_only(fat->bcache_, true);
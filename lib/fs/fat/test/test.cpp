@@ -16,6 +16,8 @@
 #include <lk/err.h>
 #include <lk/trace.h>
 #include <malloc.h>
+#include <platform.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "../dir.h"
@@ -58,6 +60,26 @@ const char *get_test_device() {
 
 #define test_path "/fat"
 
+// Returns the cluster size of the filesystem on the test device, read out of the
+// BPB in its boot sector, or 0 if it can't be read.
+size_t get_test_cluster_size() {
+    bdev_t *bio = bio_open(get_test_device());
+    if (!bio) {
+        return 0;
+    }
+
+    uint8_t bpb[16];
+    ssize_t err = bio_read(bio, bpb, 0, sizeof(bpb));
+    bio_close(bio);
+    if (err != (ssize_t)sizeof(bpb)) {
+        return 0;
+    }
+
+    const uint16_t bytes_per_sector = bpb[11] | (bpb[12] << 8);
+    const uint8_t sectors_per_cluster = bpb[13];
+    return (size_t)bytes_per_sector * sectors_per_cluster;
+}
+
 #define SKIP_TEST_IF_NO_DEVICE()                                                          \
     do {                                                                                  \
         if (!get_test_device()) {                                                         \
@@ -398,6 +420,104 @@ bool test_fat_read_file() {
     });
 }
 
+// read a file back in pieces at odd offsets and sizes, so reads start and end
+// mid sector and mix cached sector copies with direct multi sector reads
+bool test_fat_read_offsets() {
+    return test_mount_wrapper([]() {
+        BEGIN_TEST;
+
+        filehandle *handle = nullptr;
+        ASSERT_EQ(NO_ERROR, fs_open_file(test_path "/test_8kb.bin", &handle));
+        auto closefile_cleanup = lk::make_auto_call([&]() { fs_close_file(handle); });
+
+        const size_t sizes[] = { 1, 100, 511, 512, 513, 1024, 1500, 4096, 5000 };
+        const size_t max_size = 5000;
+
+        // the last read of each pass asks for more than is left in the file, leave room
+        // past the end so a read that isn't trimmed at EOF fails the compare below instead
+        // of running off the buffer
+        char *buf = new char[test_file_8kb_size + max_size];
+        auto delete_buffer = lk::make_auto_call([&]() { delete[] buf; });
+
+        for (size_t size : sizes) {
+            memset(buf, 0xaa, test_file_8kb_size + max_size);
+            for (size_t offset = 0; offset < test_file_8kb_size; offset += size) {
+                const size_t expected = MIN(size, test_file_8kb_size - offset);
+                ASSERT_EQ((ssize_t)expected, fs_read_file(handle, buf + offset, offset, size));
+            }
+            EXPECT_EQ(0, memcmp(buf, test_file_8kb, test_file_8kb_size));
+            EXPECT_EQ((char)0xaa, buf[test_file_8kb_size]);
+        }
+
+        // a read straddling the middle of the file
+        ASSERT_EQ(3000, fs_read_file(handle, buf, 2777, 3000));
+        EXPECT_EQ(0, memcmp(buf, test_file_8kb + 2777, 3000));
+
+        closefile_cleanup.cancel();
+        ASSERT_EQ(NO_ERROR, fs_close_file(handle));
+
+        END_TEST;
+    });
+}
+
+// time sequential and random reads of the largest file on the image
+bool test_fat_read_bench() {
+    return test_mount_wrapper([]() {
+        BEGIN_TEST;
+
+        filehandle *handle = nullptr;
+        ASSERT_EQ(NO_ERROR, fs_open_file(test_path "/largefile", &handle));
+        auto closefile_cleanup = lk::make_auto_call([&]() { fs_close_file(handle); });
+
+        struct file_stat stat;
+        ASSERT_EQ(NO_ERROR, fs_stat_file(handle, &stat));
+        const size_t file_size = stat.size;
+        ASSERT_LT(64u * 1024, file_size);
+
+        const size_t chunk = 64 * 1024;
+        uint8_t *buf = new uint8_t[chunk];
+        auto delete_buffer = lk::make_auto_call([&]() { delete[] buf; });
+
+        // sequential, in large chunks
+        const uint passes = 8;
+        lk_bigtime_t t = current_time_hires();
+        for (uint pass = 0; pass < passes; pass++) {
+            for (size_t offset = 0; offset < file_size; offset += chunk) {
+                const size_t expected = MIN(chunk, file_size - offset);
+                ASSERT_EQ((ssize_t)expected, fs_read_file(handle, buf, offset, chunk));
+            }
+        }
+        t = current_time_hires() - t;
+
+        // the file is all zeros
+        for (size_t i = 0; i < chunk; i++) {
+            ASSERT_EQ(0, buf[i]);
+        }
+
+        unittest_printf("\n\tsequential %zuKB reads: %llu KB/sec\n", chunk / 1024,
+                        (unsigned long long)file_size * passes * 1000000 / 1024 / MAX(t, (lk_bigtime_t)1));
+
+        // random 4KB reads at unaligned offsets
+        const uint iters = 1000;
+        const size_t rsize = 4096;
+        uint32_t seed = 1;
+        t = current_time_hires();
+        for (uint i = 0; i < iters; i++) {
+            seed = seed * 1103515245 + 12345;
+            const off_t offset = (seed >> 8) % (file_size - rsize);
+            ASSERT_EQ((ssize_t)rsize, fs_read_file(handle, buf, offset, rsize));
+        }
+        t = current_time_hires() - t;
+
+        unittest_printf("\trandom %zuKB reads: %llu usecs per read\n", rsize / 1024, t / iters);
+
+        closefile_cleanup.cancel();
+        ASSERT_EQ(NO_ERROR, fs_close_file(handle));
+
+        END_TEST;
+    });
+}
+
 bool test_fat_multi_open() {
     return test_mount_wrapper([]() {
         BEGIN_TEST;
@@ -568,6 +688,86 @@ bool test_fat_write_file() {
     });
 }
 
+// interleave growing files so their clusters are mixed, then free one and make sure a
+// bigger file allocated into the hole doesn't stomp on its neighbour
+bool test_fat_cluster_reuse() {
+    return test_mount_wrapper([]() {
+        BEGIN_TEST;
+
+        // write a cluster at a time so the allocations interleave
+        const size_t chunk = get_test_cluster_size();
+        ASSERT_NE(0u, chunk);
+        uint8_t *buf = new uint8_t[chunk];
+        uint8_t *expected = new uint8_t[chunk];
+        auto delete_buffers = lk::make_auto_call([&]() {
+            delete[] buf;
+            delete[] expected;
+        });
+
+        auto fill = [&](uint8_t seed, size_t offset) {
+            for (size_t i = 0; i < chunk; i++) {
+                buf[i] = (uint8_t)(seed + (offset + i) / 7);
+            }
+        };
+
+        filehandle *a = nullptr;
+        filehandle *b = nullptr;
+        ASSERT_EQ(NO_ERROR, fs_create_file(test_path "/reuse_a", &a, 0));
+        auto removea_cleanup = lk::make_auto_call([&]() {
+            fs_close_file(a);
+            fs_remove_file(test_path "/reuse_a");
+        });
+        ASSERT_EQ(NO_ERROR, fs_create_file(test_path "/reuse_b", &b, 0));
+        auto removeb_cleanup = lk::make_auto_call([&]() {
+            fs_close_file(b);
+            fs_remove_file(test_path "/reuse_b");
+        });
+        for (size_t off = 0; off < 16 * chunk; off += chunk) {
+            fill('a', off);
+            ASSERT_EQ((ssize_t)chunk, fs_write_file(a, buf, off, chunk));
+            fill('b', off);
+            ASSERT_EQ((ssize_t)chunk, fs_write_file(b, buf, off, chunk));
+        }
+        removea_cleanup.cancel();
+        ASSERT_EQ(NO_ERROR, fs_close_file(a));
+        ASSERT_EQ(NO_ERROR, fs_remove_file(test_path "/reuse_a"));
+
+        filehandle *c = nullptr;
+        ASSERT_EQ(NO_ERROR, fs_create_file(test_path "/reuse_c", &c, 0));
+        auto removec_cleanup = lk::make_auto_call([&]() {
+            fs_close_file(c);
+            fs_remove_file(test_path "/reuse_c");
+        });
+        for (size_t off = 0; off < 48 * chunk; off += chunk) {
+            fill('c', off);
+            ASSERT_EQ((ssize_t)chunk, fs_write_file(c, buf, off, chunk));
+        }
+
+        for (size_t off = 0; off < 48 * chunk; off += chunk) {
+            fill('c', off);
+            memcpy(expected, buf, chunk);
+            ASSERT_EQ((ssize_t)chunk, fs_read_file(c, buf, off, chunk));
+            EXPECT_EQ(0, memcmp(expected, buf, chunk));
+        }
+        for (size_t off = 0; off < 16 * chunk; off += chunk) {
+            fill('b', off);
+            memcpy(expected, buf, chunk);
+            ASSERT_EQ((ssize_t)chunk, fs_read_file(b, buf, off, chunk));
+            EXPECT_EQ(0, memcmp(expected, buf, chunk));
+        }
+
+        // leave the image the way we found it
+        removeb_cleanup.cancel();
+        removec_cleanup.cancel();
+        ASSERT_EQ(NO_ERROR, fs_close_file(b));
+        ASSERT_EQ(NO_ERROR, fs_remove_file(test_path "/reuse_b"));
+        ASSERT_EQ(NO_ERROR, fs_close_file(c));
+        ASSERT_EQ(NO_ERROR, fs_remove_file(test_path "/reuse_c"));
+
+        END_TEST;
+    });
+}
+
 bool test_fat_mkdir() {
     return test_mount_wrapper([]() {
         BEGIN_TEST;
@@ -821,10 +1021,13 @@ RUN_TEST(test_fat_split_path)
 RUN_TEST(test_fat_name_to_short_file_name)
 RUN_TEST(test_fat_dir_root)
 RUN_TEST(test_fat_read_file)
+RUN_TEST(test_fat_read_offsets)
+RUN_TEST(test_fat_read_bench)
 RUN_TEST(test_fat_multi_open)
 RUN_TEST(test_fat_create_file)
 RUN_TEST(test_fat_resize_file)
 RUN_TEST(test_fat_write_file)
+RUN_TEST(test_fat_cluster_reuse)
 RUN_TEST(test_fat_mkdir)
 RUN_TEST(test_fat_remove_file)
 RUN_TEST(test_fat_remove_dir)
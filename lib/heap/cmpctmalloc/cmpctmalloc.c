@@ -7,6 +7,7 @@
  */
 #include <lk/debug.h>
 #include <lk/trace.h>
+#include <arch/ops.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,6 +24,12 @@
 // Allocation strategy takes place with a global mutex.  Freelist entries are
 // kept in linked lists with 8 different sizes per binary order of magnitude
 // and the header size is two words with eager coalescing on free.
+//
+// In front of that each cpu keeps a cache of freed small allocations, one
+// list per bucket, so most small mallocs and frees only touch a per cpu
+// spinlock.  The caches are refilled from and spilled back to the heap a
+// batch at a time under the mutex.  Cached allocations still look allocated
+// to the heap, so they don't coalesce until they're flushed back.
 
 #ifdef DEBUG
 #define CMPCT_DEBUG
@@ -51,6 +58,15 @@ STATIC_ASSERT(IS_PAGE_ALIGNED(HEAP_GROW_SIZE));
 // buckets.
 STATIC_ASSERT(HEAP_GROW_SIZE <= (1u << HEAP_ALLOC_VIRTUAL_BITS));
 
+// Allocations up to this size (not including the header) go through the per
+// cpu caches.  That's the first 24 buckets.
+#define CACHE_MAX_SIZE 256
+#define CACHE_BUCKETS 24
+// Most allocations a cpu keeps per bucket, and how many move between the
+// cache and the heap at a time.
+#define CACHE_DEPTH 32
+#define CACHE_BATCH 16
+
 // Buckets for allocations.  The smallest 15 buckets are 8, 16, 24, etc. up to
 // 120 bytes.  After that we round up to the nearest size that can be written
 // /^0*1...0*$/, giving 8 buckets per order of binary magnitude.  The freelist
@@ -85,7 +101,22 @@ struct heap {
 // Heap static vars.
 static struct heap theheap;
 
+// Cached allocations are linked through their first word.
+typedef struct cached_struct {
+    struct cached_struct *next;
+} cached_t;
+
+static struct cpu_cache {
+    spin_lock_t lock;
+    uint count[CACHE_BUCKETS];
+    cached_t *lists[CACHE_BUCKETS];
+} __CPU_ALIGN cpu_cache[SMP_MAX_CPUS];
+
+// Turned off while the self tests run, since they check exact free space.
+static bool cache_disabled;
+
 static ssize_t heap_grow(size_t len, free_t **bucket);
+static size_t cache_flush_locked(void);
 
 static void lock(void) {
     mutex_acquire(&theheap.lock);
@@ -119,6 +150,20 @@ void cmpct_dump(void) {
             dump_free(&free_area->header);
         }
     }
+
+    dprintf(INFO, "\tper cpu caches:\n");
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct cpu_cache *c = &cpu_cache[cpu];
+        size_t count = 0;
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&c->lock);
+        for (int i = 0; i < CACHE_BUCKETS; i++) {
+            count += c->count[i];
+        }
+        spin_unlock_irqrestore(&c->lock, state);
+        if (count > 0) {
+            dprintf(INFO, "\t\tcpu %u: %zu allocations\n", cpu, count);
+        }
+    }
     unlock();
 }
 
@@ -525,6 +570,13 @@ static void cmpct_test_return_to_os(void) {
 }
 
 void cmpct_test(void) {
+    // The tests below check exact amounts of free space, so keep
+    // everything on the free lists while they run.
+    lock();
+    cache_flush_locked();
+    cache_disabled = true;
+    unlock();
+
     cmpct_test_buckets();
     cmpct_test_get_back_newly_freed();
     cmpct_test_return_to_os();
@@ -580,6 +632,8 @@ void cmpct_test(void) {
             cmpct_free(ptr[i]);
     }
 
+    cache_disabled = false;
+
     cmpct_dump();
 }
 
@@ -591,6 +645,7 @@ static void *large_alloc(size_t size) {
     free_t *free_area = NULL;
     lock();
     if (heap_grow(size, &free_area) < 0) {
+        unlock();
         return 0;
     }
     void *result =
@@ -615,6 +670,7 @@ void cmpct_trim(void) {
     // header. They might be at the start or the end of a block, so we can trim
     // them and free the page(s).
     lock();
+    cache_flush_locked();
     for (int bucket = size_to_index_freeing(PAGE_SIZE);
             bucket < NUMBER_OF_BUCKETS;
             bucket++) {
@@ -657,7 +713,9 @@ void cmpct_trim(void) {
                 if (freed_up == 0) continue;
                 unlink_free(free_area, bucket);
                 size_t sentinel_size = sizeof(header_t);
-                size_t new_free_size = free_area->header.size - freed_up;
+                // Measure from the right neighbour, the old left sentinel may
+                // have been bigger than a header after an earlier trim.
+                size_t new_free_size = (char *)right - new_os_allocation_start - sentinel_size;
                 if (new_free_size < sizeof(free_t)) {
                     sentinel_size += new_free_size;
                     new_free_size = 0;
@@ -681,26 +739,23 @@ void cmpct_trim(void) {
     unlock();
 }
 
-void *cmpct_alloc(size_t size) {
-    if (size == 0u) return NULL;
-
-    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
-
+// Allocate from the free lists, growing the heap if needed.  Called with the lock.
+static void *alloc_locked(size_t size) {
     size_t rounded_up;
     int start_bucket = size_to_index_allocating(size, &rounded_up);
 
     rounded_up += sizeof(header_t);
 
-    lock();
     int bucket = find_nonempty_bucket(start_bucket);
     if (bucket == -1) {
-        // Grow heap by at least 12% if we can.
+        // Grow heap by at least 12% if we can.  Leave room for the sentinels
+        // and rounding up to a page, or the new free area won't fit in the
+        // last bucket once the heap is big.
         size_t growby = MIN(1u << HEAP_ALLOC_VIRTUAL_BITS,
-                            MAX(theheap.size >> 3,
+                            MAX(MIN(theheap.size >> 3, (1u << HEAP_ALLOC_VIRTUAL_BITS) - PAGE_SIZE),
                                 MAX(HEAP_GROW_SIZE, rounded_up)));
         while (heap_grow(growby, NULL) < 0) {
             if (growby <= rounded_up) {
-                unlock();
                 return NULL;
             }
             growby = MAX(growby >> 1, rounded_up);
@@ -730,44 +785,15 @@ void *cmpct_alloc(size_t size) {
     memset(result, ALLOC_FILL, size);
     memset(((char *)result) + size, PADDING_FILL, rounded_up - size - sizeof(header_t));
 #endif
-    unlock();
     return result;
 }
 
-void *cmpct_memalign(size_t size, size_t alignment) {
-    if (alignment < 8) return cmpct_alloc(size);
-    size_t padded_size =
-        size + alignment + sizeof(free_t) + sizeof(header_t);
-    char *unaligned = (char *)cmpct_alloc(padded_size);
-    lock();
-    size_t mask = alignment - 1;
-    uintptr_t payload_int = (uintptr_t)unaligned + sizeof(free_t) +
-                            sizeof(header_t) + mask;
-    char *payload = (char *)(payload_int & ~mask);
-    if (unaligned != payload) {
-        header_t *unaligned_header = (header_t *)unaligned - 1;
-        header_t *header = (header_t *)payload - 1;
-        size_t left_over = payload - unaligned;
-        create_allocation_header(
-            header, 0, unaligned_header->size - left_over, unaligned_header);
-        header_t *right = right_header(unaligned_header);
-        unaligned_header->size = left_over;
-        FixLeftPointer(right, header);
-        unlock();
-        cmpct_free(unaligned);
-    } else {
-        unlock();
-    }
-    // TODO: Free the part after the aligned allocation.
-    return payload;
-}
-
-void cmpct_free(void *payload) {
-    if (payload == NULL) return;
+// Return an allocation to the free lists, coalescing with its neighbours.
+// Called with the lock.
+static void free_locked(void *payload) {
     header_t *header = (header_t *)payload - 1;
     DEBUG_ASSERT(!is_tagged_as_free(header));  // Double free!
     size_t size = header->size;
-    lock();
     header_t *left = header->left;
     if (left != NULL && is_tagged_as_free(left)) {
         // Coalesce with left free object.
@@ -796,6 +822,183 @@ void cmpct_free(void *payload) {
             free_memory(header, left, size);
         }
     }
+}
+
+// Empty every cpu's cache back into the free lists.  Called with the lock.
+static size_t cache_flush_locked(void) {
+    size_t count = 0;
+    for (uint cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct cpu_cache *c = &cpu_cache[cpu];
+
+        // Unhook the lists first, freeing can give pages back to the OS
+        // which can't be done under a spinlock.
+        cached_t *chain = NULL;
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&c->lock);
+        for (int i = 0; i < CACHE_BUCKETS; i++) {
+            while (c->lists[i]) {
+                cached_t *obj = c->lists[i];
+                c->lists[i] = obj->next;
+                obj->next = chain;
+                chain = obj;
+            }
+            c->count[i] = 0;
+        }
+        spin_unlock_irqrestore(&c->lock, state);
+
+        while (chain) {
+            cached_t *next = chain->next;
+            free_locked(chain);
+            chain = next;
+            count++;
+        }
+    }
+    LTRACEF("flushed %zu allocations\n", count);
+    return count;
+}
+
+static void *cache_get(int bucket) {
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct cpu_cache *c = &cpu_cache[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    cached_t *obj = c->lists[bucket];
+    if (obj) {
+        c->lists[bucket] = obj->next;
+        c->count[bucket]--;
+    }
+    spin_unlock_irqrestore(&c->lock, state);
+    return obj;
+}
+
+// Put an allocation in the current cpu's cache.  If that overflows the
+// bucket, half of it is handed back in spill to be freed to the heap.
+static uint cache_put(int bucket, void *payload, void **spill) {
+    uint spilled = 0;
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct cpu_cache *c = &cpu_cache[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    cached_t *obj = payload;
+    obj->next = c->lists[bucket];
+    c->lists[bucket] = obj;
+    if (++c->count[bucket] > CACHE_DEPTH) {
+        for (; spilled < CACHE_BATCH; spilled++) {
+            obj = c->lists[bucket];
+            c->lists[bucket] = obj->next;
+            spill[spilled] = obj;
+        }
+        c->count[bucket] -= spilled;
+    }
+    spin_unlock_irqrestore(&c->lock, state);
+    return spilled;
+}
+
+// Take a batch of allocations of this size from the heap, return one and
+// cache the rest.
+static void *cache_refill(size_t size, int bucket) {
+    void *objs[CACHE_BATCH];
+    uint count = 0;
+
+    lock();
+    for (; count < CACHE_BATCH; count++) {
+        objs[count] = alloc_locked(size);
+        if (!objs[count]) break;
+    }
+    if (count == 0 && cache_flush_locked() > 0) {
+        objs[0] = alloc_locked(size);
+        if (objs[0]) count = 1;
+    }
+    unlock();
+
+    if (count == 0) return NULL;
+
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct cpu_cache *c = &cpu_cache[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    for (uint i = 1; i < count; i++) {
+        cached_t *obj = objs[i];
+        obj->next = c->lists[bucket];
+        c->lists[bucket] = obj;
+    }
+    c->count[bucket] += count - 1;
+    spin_unlock_irqrestore(&c->lock, state);
+
+    return objs[0];
+}
+
+void *cmpct_alloc(size_t size) {
+    if (size == 0u) return NULL;
+
+    if (size + sizeof(header_t) > (1u << HEAP_ALLOC_VIRTUAL_BITS)) return large_alloc(size);
+
+    size_t rounded_up;
+    size_to_index_allocating(size, &rounded_up);
+    if (rounded_up <= CACHE_MAX_SIZE && !cache_disabled) {
+        // Cached allocations are filed by the bucket their size rounds down
+        // to, so look in the one the rounded up request size lands in.
+        int bucket = size_to_index_freeing(rounded_up);
+        void *result = cache_get(bucket);
+        if (!result) result = cache_refill(size, bucket);
+#ifdef CMPCT_DEBUG
+        if (result) memset(result, ALLOC_FILL, size);
+#endif
+        return result;
+    }
+
+    lock();
+    void *result = alloc_locked(size);
+    if (!result && cache_flush_locked() > 0) {
+        result = alloc_locked(size);
+    }
+    unlock();
+    return result;
+}
+
+void *cmpct_memalign(size_t size, size_t alignment) {
+    if (alignment < 8) return cmpct_alloc(size);
+    size_t padded_size =
+        size + alignment + sizeof(free_t) + sizeof(header_t);
+    char *unaligned = (char *)cmpct_alloc(padded_size);
+    if (unaligned == NULL) return NULL;
+    lock();
+    size_t mask = alignment - 1;
+    uintptr_t payload_int = (uintptr_t)unaligned + sizeof(free_t) +
+                            sizeof(header_t) + mask;
+    char *payload = (char *)(payload_int & ~mask);
+    if (unaligned != payload) {
+        header_t *unaligned_header = (header_t *)unaligned - 1;
+        header_t *header = (header_t *)payload - 1;
+        size_t left_over = payload - unaligned;
+        create_allocation_header(
+            header, 0, unaligned_header->size - left_over, unaligned_header);
+        header_t *right = right_header(unaligned_header);
+        unaligned_header->size = left_over;
+        FixLeftPointer(right, header);
+        // Straight back to the free lists rather than the cache, so it can
+        // coalesce with whatever is to its left.
+        free_locked(unaligned);
+    }
+    unlock();
+    // TODO: Free the part after the aligned allocation.
+    return payload;
+}
+
+void cmpct_free(void *payload) {
+    if (payload == NULL) return;
+    header_t *header = (header_t *)payload - 1;
+    DEBUG_ASSERT(!is_tagged_as_free(header));  // Double free!
+    size_t size = header->size - sizeof(header_t);
+    if (size <= CACHE_MAX_SIZE && !cache_disabled) {
+        void *spill[CACHE_BATCH];
+        uint count = cache_put(size_to_index_freeing(size), payload, spill);
+        if (count == 0) return;
+        lock();
+        for (uint i = 0; i < count; i++) {
+            free_locked(spill[i]);
+        }
+        unlock();
+        return;
+    }
+    lock();
+    free_locked(payload);
     unlock();
 }
 
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <lib/unittest.h>
+#include <lib/heap.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Multi-threaded heap stress and benchmark. Several threads hammer malloc and free
+ * with a mostly small, occasionally larger mix of sizes, each tagging its allocations
+ * so any block handed out twice or scribbled on by another thread is caught. Run once
+ * with one thread and once with several to show how allocation scales.
+ */
+
+#if !defined(MEMSIZE) || MEMSIZE >= (128 * 1024)
+#define HEAP_MT_THREADS 4
+#define HEAP_MT_SLOTS 256
+#define HEAP_MT_ITERS 50000
+#define HEAP_MT_LARGE_BYTES 4096
+#else
+#define HEAP_MT_THREADS 2
+#define HEAP_MT_SLOTS 16
+#define HEAP_MT_ITERS 2000
+#define HEAP_MT_LARGE_BYTES 512
+#endif
+
+struct heap_mt_thread {
+    uint32_t seed;
+    uint8_t tag;
+    bool failed;
+    uint8_t *slots[HEAP_MT_SLOTS];
+    size_t sizes[HEAP_MT_SLOTS];
+};
+
+static uint32_t heap_mt_rand(uint32_t *seed) {
+    /* xorshift32, so the threads don't share the libc rand state */
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+static size_t heap_mt_size(uint32_t *seed) {
+    uint32_t r = heap_mt_rand(seed);
+    if ((r & 0xf) == 0)
+        return 257 + (r >> 4) % (HEAP_MT_LARGE_BYTES - 256);
+    return 1 + (r >> 4) % 256;
+}
+
+static bool heap_mt_check(const uint8_t *p, size_t size, uint8_t tag) {
+    return p[0] == tag && p[size / 2] == tag && p[size - 1] == tag;
+}
+
+static int heap_mt_thread_routine(void *arg) {
+    struct heap_mt_thread *t = arg;
+
+    for (uint i = 0; i < HEAP_MT_ITERS; i++) {
+        uint slot = heap_mt_rand(&t->seed) % HEAP_MT_SLOTS;
+
+        if (t->slots[slot]) {
+            if (!heap_mt_check(t->slots[slot], t->sizes[slot], t->tag))
+                t->failed = true;
+            free(t->slots[slot]);
+        }
+
+        size_t size = heap_mt_size(&t->seed);
+        uint8_t *p = malloc(size);
+        t->slots[slot] = p;
+        t->sizes[slot] = size;
+        if (!p) {
+            t->failed = true;
+            continue;
+        }
+        memset(p, t->tag, size);
+    }
+
+    for (uint slot = 0; slot < HEAP_MT_SLOTS; slot++) {
+        if (t->slots[slot]) {
+            if (!heap_mt_check(t->slots[slot], t->sizes[slot], t->tag))
+                t->failed = true;
+            free(t->slots[slot]);
+        }
+    }
+
+    return 0;
+}
+
+/* run count threads to completion, timing them */
+static bool heap_mt_run(uint count, lk_bigtime_t *time) {
+    BEGIN_TEST;
+
+    struct heap_mt_thread *state = calloc(count, sizeof(*state));
+    ASSERT_NONNULL(state, "");
+
+    for (uint i = 0; i < count; i++) {
+        state[i].seed = 0x9e3779b9u * (i + 1);
+        state[i].tag = (uint8_t)(0xa0 + i);
+    }
+
+    *time = unittest_run_threads("heap stress", count, &heap_mt_thread_routine, state, sizeof(*state));
+    EXPECT_NE(0ull, *time, "couldn't start the threads");
+    for (uint i = 0; i < count; i++) {
+        EXPECT_FALSE(state[i].failed, "corruption or allocation failure");
+    }
+
+    free(state);
+
+    END_TEST;
+}
+
+static bool test_malloc_threads(void) {
+    BEGIN_TEST;
+
+    lk_bigtime_t one, many;
+    ASSERT_TRUE(heap_mt_run(1, &one), "one thread");
+    ASSERT_TRUE(heap_mt_run(HEAP_MT_THREADS, &many), "several threads");
+
+    unittest_printf("\n\t1 thread: %llu nsecs per op, %d threads: %llu nsecs per op\n",
+                    one * 1000 / HEAP_MT_ITERS, HEAP_MT_THREADS,
+                    many * 1000 / ((lk_bigtime_t)HEAP_MT_ITERS * HEAP_MT_THREADS));
+
+    END_TEST;
+}
+
+BEGIN_TEST_CASE(heap_mt_tests)
+    RUN_TEST(test_malloc_threads)
+END_TEST_CASE(heap_mt_tests)
@@ -2,7 +2,9 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 
 MODULE := $(LOCAL_DIR)
 
-MODULE_SRCS += $(LOCAL_DIR)/heap_tests.c
+MODULE_SRCS += \
+    $(LOCAL_DIR)/heap_mt_tests.c \
+    $(LOCAL_DIR)/heap_tests.c
 
 MODULE_DEPS += \
     lib/heap \
@@ -37,9 +37,23 @@ void minip_start_static(uint32_t ip, uint32_t netmask, uint32_t gateway);
  */
 void minip_start_dhcp(void);
 
-/* ethernet driver install hook */
+/* ethernet driver install hook. the tx handler takes ownership of the packets it's handed,
+ * which may be made of multiple parts linked through pktbuf->next. drivers that can't
+ * gather a packet out of several buffers can pktbuf_linearize() it first.
+ */
 void minip_set_eth(tx_func_t tx_handler, void *tx_arg, const uint8_t *macaddr);
 
+/* transmit offloads the ethernet driver can do, for minip_set_eth_caps() */
+#define MINIP_ETH_CAP_TX_CSUM_TCP (1<<0) // finishes the tcp checksum of PKTBUF_FLAG_CSUM_PARTIAL packets
+#define MINIP_ETH_CAP_TX_CSUM_UDP (1<<1) // same for udp
+#define MINIP_ETH_CAP_TSO4        (1<<2) // splits PKTBUF_FLAG_TSO tcp segments, needs TX_CSUM_TCP
+
+/* tell minip which offloads the driver installed with minip_set_eth() can do. tso_max_size is
+ * the most tcp payload it takes in a single PKTBUF_FLAG_TSO packet. without this call
+ * minip does everything in software.
+ */
+void minip_set_eth_caps(uint32_t caps, uint32_t tso_max_size);
+
 /* check or wait for minip to be configured */
 bool minip_is_configured(void);
 status_t minip_wait_for_configured(lk_time_t timeout);
@@ -81,6 +95,24 @@ status_t tcp_close(tcp_socket_t *socket);
 ssize_t tcp_read(tcp_socket_t *socket, void *buf, size_t len);
 ssize_t tcp_write(tcp_socket_t *socket, const void *buf, size_t len);
 
+/* read without copying: returns the number of bytes in *p, which points straight into the
+ * socket's receive buffer. the window doesn't reopen over that data until it's freed with
+ * pktbuf_free_chain(), which is fine from interrupt context. only one can be outstanding per
+ * socket, reads block until it's freed and taken back.
+ */
+ssize_t tcp_read_pktbuf(tcp_socket_t *socket, pktbuf_t **p);
+
+/* per socket options for tcp_setsockopt() */
+typedef enum {
+    TCP_SOCKOPT_RCVBUF, // receive buffer size, bounds the window advertised to the other end
+    TCP_SOCKOPT_SNDBUF, // transmit buffer size, bounds how much data can be in flight
+} tcp_sockopt_t;
+
+/* buffer sizes set on a listening socket are passed on to the sockets it accepts.
+ * the buffers of a connected socket can only grow.
+ */
+status_t tcp_setsockopt(tcp_socket_t *socket, tcp_sockopt_t opt, uint32_t value);
+
 static inline status_t tcp_accept(tcp_socket_t *listen_socket, tcp_socket_t **accept_socket) {
     return tcp_accept_timeout(listen_socket, accept_socket, INFINITE_TIME);
 }
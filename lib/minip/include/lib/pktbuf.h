@@ -38,6 +38,12 @@ typedef struct pktbuf {
     pktbuf_free_callback cb;
     void *cb_args;
     u8 *buffer;
+    struct pktbuf *next; // next part of a multi part packet, the last part has PKTBUF_FLAG_EOF set
+
+    /* transmit offload requests, in the first part of a packet */
+    u16 csum_start;  // offset from data of where the nic starts summing, kept up by _prepend
+    u16 csum_offset; // offset from csum_start of the checksum field to store the sum in
+    u16 gso_size;    // bytes of tcp payload per segment for PKTBUF_FLAG_TSO
 } pktbuf_t;
 
 typedef struct pktbuf_pool_object {
@@ -52,6 +58,8 @@ typedef struct pktbuf_pool_object {
 #define PKTBUF_FLAG_CKSUM_UDP_GOOD (1<<2)
 #define PKTBUF_FLAG_EOF            (1<<3)
 #define PKTBUF_FLAG_CACHED         (1<<4)
+#define PKTBUF_FLAG_CSUM_PARTIAL   (1<<5) // tx: checksum field holds the pseudo header sum, nic finishes it
+#define PKTBUF_FLAG_TSO            (1<<6) // tx: nic splits the tcp segment into gso_size pieces
 
 /* Return the physical address offset of data in the packet */
 static inline u32 pktbuf_data_phys(pktbuf_t *p) {
@@ -80,6 +88,24 @@ void pktbuf_add_buffer(pktbuf_t *p, u8 *buf, u32 len, uint32_t header_sz,
 // returns number of threads woken up
 int pktbuf_free(pktbuf_t *p, bool reschedule);
 
+// return every part of a multi part packet to the buffer pool
+int pktbuf_free_chain(pktbuf_t *p, bool reschedule);
+
+// append next (and any parts following it) to the end of the packet p
+void pktbuf_chain(pktbuf_t *p, pktbuf_t *next);
+
+// total number of data bytes in all the parts of a packet
+u32 pktbuf_chain_len(const pktbuf_t *p);
+
+// allocate a packet pointing at len bytes of memory owned by the caller instead of copying
+// it, made of as many parts as it takes to keep each one physically contiguous.
+// cb is called with cb_args as each part is freed, which may be from interrupt context.
+pktbuf_t *pktbuf_alloc_ref(const void *buf, u32 len, pktbuf_free_callback cb, void *cb_args);
+
+// copy all the parts of a multi part packet into the first one and free the rest,
+// for drivers that can't gather a packet from multiple buffers
+status_t pktbuf_linearize(pktbuf_t *p);
+
 // extend buffer by sz bytes, copied from data
 void pktbuf_append_data(pktbuf_t *p, const void *data, size_t sz);
 
@@ -81,6 +81,10 @@ minip_usage:
                 printf("netmask: %u.%u.%u.%u\n", IPV4_SPLIT(minip_get_netmask()));
                 printf("broadcast: %u.%u.%u.%u\n", IPV4_SPLIT(minip_get_broadcast()));
                 printf("gateway: %u.%u.%u.%u\n", IPV4_SPLIT(minip_get_gateway()));
+                printf("offloads:%s%s%s\n",
+                       (minip_eth_caps & MINIP_ETH_CAP_TX_CSUM_TCP) ? " tx-tcp-csum" : "",
+                       (minip_eth_caps & MINIP_ETH_CAP_TX_CSUM_UDP) ? " tx-udp-csum" : "",
+                       (minip_eth_caps & MINIP_ETH_CAP_TSO4) ? " tso4" : "");
             }
             break;
             case 't': {
@@ -88,6 +88,8 @@ enum {
 
 extern tx_func_t minip_tx_handler;
 extern void *minip_tx_arg;
+extern uint32_t minip_eth_caps;
+extern uint32_t minip_eth_tso_max_size;
 
 typedef struct udp_hdr udp_hdr_t;
 static const uint8_t bcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
@@ -115,6 +117,7 @@ void minip_build_ipv4_hdr(struct ipv4_hdr *ipv4, uint32_t dst, uint8_t proto, ui
 
 status_t minip_ipv4_send(pktbuf_t *p, uint32_t dest_addr, uint8_t proto);
 
+void tcp_init(void);
 void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip);
 void udp_input(pktbuf_t *p, uint32_t src_ip);
 
@@ -132,7 +135,8 @@ typedef struct net_timer {
     void *arg;
 } net_timer_t;
 
-/* set a net timer. returns true if the timer was not set before and is now */
+/* set a net timer, from thread or interrupt context. the callback runs on the net timer
+ * thread. returns true if the timer was not set before and is now */
 bool net_timer_set(net_timer_t *, net_timer_callback_t, void *callback_args, lk_time_t delay) __NONNULL((1));
 
 /* cancels a net timer. returns true if it was previously set and is not now */
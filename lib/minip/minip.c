@@ -46,6 +46,10 @@ static event_t minip_configured_event = EVENT_INITIAL_VALUE(minip_configured_eve
 tx_func_t minip_tx_handler;
 void *minip_tx_arg;
 
+/* offloads the driver can do for us, MINIP_ETH_CAP_* */
+uint32_t minip_eth_caps;
+uint32_t minip_eth_tso_max_size;
+
 static void dump_mac_address(const uint8_t *mac);
 static void dump_ipv4_addr(uint32_t addr);
 
@@ -160,6 +164,18 @@ void minip_set_eth(tx_func_t tx_handler, void *tx_arg, const uint8_t *macaddr) {
     mac_addr_copy(minip_mac, macaddr);
 }
 
+void minip_set_eth_caps(uint32_t caps, uint32_t tso_max_size) {
+    LTRACEF("caps %#x, tso max %u\n", caps, tso_max_size);
+
+    /* segments are only split up by a nic that fills in their checksums */
+    if (!(caps & MINIP_ETH_CAP_TX_CSUM_TCP) || tso_max_size == 0) {
+        caps &= ~MINIP_ETH_CAP_TSO4;
+    }
+
+    minip_eth_tso_max_size = (caps & MINIP_ETH_CAP_TSO4) ? tso_max_size : 0;
+    minip_eth_caps = caps;
+}
+
 static uint16_t ipv4_payload_len(struct ipv4_hdr *pkt) {
     return (pkt->len - ((pkt->ver_ihl >> 4) * 5));
 }
@@ -245,7 +261,7 @@ const uint8_t *get_dest_mac(uint32_t host) {
 
 status_t minip_ipv4_send(pktbuf_t *p, uint32_t dest_addr, uint8_t proto) {
     status_t ret = 0;
-    size_t data_len = p->dlen;
+    size_t data_len = pktbuf_chain_len(p);
     const uint8_t *dst_mac;
 
     struct ipv4_hdr *ip = pktbuf_prepend(p, sizeof(struct ipv4_hdr));
@@ -270,7 +286,7 @@ status_t minip_ipv4_send(pktbuf_t *p, uint32_t dest_addr, uint8_t proto) {
 
     dst_mac = arp_get_dest_mac(target_addr);
     if (!dst_mac) {
-        pktbuf_free(p, true);
+        pktbuf_free_chain(p, true);
         ret = -EHOSTUNREACH;
         goto err;
     }
@@ -364,8 +380,8 @@ __NO_INLINE static void handle_ipv4_packet(pktbuf_t *p, const uint8_t *src_mac)
         return;
     }
 
-    /* compute checksum */
-    if (rfc1701_chksum((void *)ip, header_len) != 0) {
+    /* compute checksum, unless the nic already has */
+    if (!(p->flags & PKTBUF_FLAG_CKSUM_IP_GOOD) && rfc1701_chksum((void *)ip, header_len) != 0) {
         /* bad checksum */
         LTRACEF("REJECT: bad checksum\n");
         return;
@@ -557,6 +573,7 @@ void printip_named(const char *s, uint32_t x) {
 static void minip_init(uint level) {
     arp_cache_init();
     net_timer_init();
+    tcp_init();
 }
 
 
@@ -17,14 +17,15 @@
 #include <sys/types.h>
 #include <kernel/thread.h>
 #include <kernel/event.h>
-#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
 #include <platform.h>
 
 #define LOCAL_TRACE 0
 
 static struct list_node net_timer_list = LIST_INITIAL_VALUE(net_timer_list);
 static event_t net_timer_event = EVENT_INITIAL_VALUE(net_timer_event, false, 0);
-static mutex_t net_timer_lock = MUTEX_INITIAL_VALUE(net_timer_lock);
+/* a spinlock so timers can be set from interrupt context */
+static spin_lock_t net_timer_lock = SPIN_LOCK_INITIAL_VALUE;
 
 static void add_to_queue(net_timer_t *t) {
     net_timer_t *e;
@@ -43,7 +44,7 @@ bool net_timer_set(net_timer_t *t, net_timer_callback_t cb, void *callback_args,
 
     lk_time_t now = current_time();
 
-    mutex_acquire(&net_timer_lock);
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&net_timer_lock);
 
     if (list_in_list(&t->node)) {
         list_delete(&t->node);
@@ -56,9 +57,10 @@ bool net_timer_set(net_timer_t *t, net_timer_callback_t cb, void *callback_args,
 
     add_to_queue(t);
 
-    mutex_release(&net_timer_lock);
+    spin_unlock_irqrestore(&net_timer_lock, state);
 
-    event_signal(&net_timer_event, true);
+    /* can't reschedule from an interrupt handler */
+    event_signal(&net_timer_event, !arch_ints_disabled());
 
     return newly_queued;
 }
@@ -66,14 +68,14 @@ bool net_timer_set(net_timer_t *t, net_timer_callback_t cb, void *callback_args,
 bool net_timer_cancel(net_timer_t *t) {
     bool was_queued = false;
 
-    mutex_acquire(&net_timer_lock);
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&net_timer_lock);
 
     if (list_in_list(&t->node)) {
         list_delete(&t->node);
         was_queued = true;
     }
 
-    mutex_release(&net_timer_lock);
+    spin_unlock_irqrestore(&net_timer_lock, state);
 
     return was_queued;
 }
@@ -83,7 +85,7 @@ static lk_time_t net_timer_work_routine(void) {
     lk_time_t now = current_time();
     lk_time_t delay = INFINITE_TIME;
 
-    mutex_acquire(&net_timer_lock);
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&net_timer_lock);
 
     for (;;) {
         net_timer_t *e;
@@ -100,19 +102,19 @@ static lk_time_t net_timer_work_routine(void) {
 
         list_delete(&e->node);
 
-        mutex_release(&net_timer_lock);
+        spin_unlock_irqrestore(&net_timer_lock, state);
 
         LTRACEF("firing timer %p, cb %p, arg %p\n", e, e->cb, e->arg);
         e->cb(e->arg);
 
-        mutex_acquire(&net_timer_lock);
+        state = spin_lock_irqsave(&net_timer_lock);
     }
 
 done:
     if (delay == INFINITE_TIME)
         event_unsignal(&net_timer_event);
 
-    mutex_release(&net_timer_lock);
+    spin_unlock_irqrestore(&net_timer_lock, state);
 
     return delay;
 }
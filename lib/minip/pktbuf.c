@@ -9,6 +9,7 @@
 
 #include <assert.h>
 #include <lk/debug.h>
+#include <lk/err.h>
 #include <lk/trace.h>
 #include <malloc.h>
 #include <printf.h>
@@ -122,7 +123,11 @@ void pktbuf_reset(pktbuf_t *p, uint32_t header_sz) {
 
 pktbuf_t *pktbuf_alloc_empty(void) {
     pktbuf_t *p = (pktbuf_t *)get_pool_object();
+    if (!p) {
+        return NULL;
+    }
 
+    memset(p, 0, sizeof(pktbuf_t));
     p->flags = PKTBUF_FLAG_EOF;
     return p;
 }
@@ -138,6 +143,113 @@ int pktbuf_free(pktbuf_t *p, bool reschedule) {
     return 1;
 }
 
+int pktbuf_free_chain(pktbuf_t *p, bool reschedule) {
+    int ret = 0;
+
+    while (p) {
+        pktbuf_t *next = p->next;
+        ret += pktbuf_free(p, reschedule);
+        p = next;
+    }
+
+    return ret;
+}
+
+void pktbuf_chain(pktbuf_t *p, pktbuf_t *next) {
+    DEBUG_ASSERT(p);
+    DEBUG_ASSERT(next);
+
+    while (p->next) {
+        p = p->next;
+    }
+
+    p->flags &= ~PKTBUF_FLAG_EOF;
+    p->next = next;
+}
+
+u32 pktbuf_chain_len(const pktbuf_t *p) {
+    u32 len = 0;
+
+    for (; p; p = p->next) {
+        len += p->dlen;
+    }
+
+    return len;
+}
+
+pktbuf_t *pktbuf_alloc_ref(const void *buf, u32 len, pktbuf_free_callback cb, void *cb_args) {
+    DEBUG_ASSERT(buf);
+    DEBUG_ASSERT(len > 0);
+
+    pktbuf_t *head = NULL;
+    const u8 *ptr = buf;
+    while (len > 0) {
+        u32 part_len = len;
+#if WITH_KERNEL_VM
+        /* the memory is only known to be physically contiguous within a page */
+        part_len = MIN(part_len, PAGE_SIZE - ((uintptr_t)ptr % PAGE_SIZE));
+#endif
+
+        pktbuf_t *part = pktbuf_alloc_empty();
+        if (!part) {
+            /* back out what we built, without calling back for it */
+            for (pktbuf_t *built = head; built; built = built->next) {
+                built->cb = NULL;
+            }
+            pktbuf_free_chain(head, false);
+            return NULL;
+        }
+
+        /* the buffer is all data, nothing can be prepended to it */
+        pktbuf_add_buffer(part, (u8 *)ptr, part_len, 0, 0, cb, cb_args);
+        part->dlen = part_len;
+
+        if (head) {
+            pktbuf_chain(head, part);
+        } else {
+            head = part;
+        }
+
+        ptr += part_len;
+        len -= part_len;
+    }
+
+    return head;
+}
+
+status_t pktbuf_linearize(pktbuf_t *p) {
+    DEBUG_ASSERT(p);
+
+    if (!p->next) {
+        return NO_ERROR;
+    }
+
+    u32 len = pktbuf_chain_len(p->next);
+    if (pktbuf_avail_tail(p) < len) {
+        /* slide the data down over the unused header space to make room */
+        if (pktbuf_avail_head(p) + pktbuf_avail_tail(p) < len) {
+            return ERR_TOO_BIG;
+        }
+
+        u32 shift = len - pktbuf_avail_tail(p);
+        memmove(p->data - shift, p->data, p->dlen);
+        p->data -= shift;
+    }
+
+    pktbuf_t *part = p->next;
+    while (part) {
+        pktbuf_t *next = part->next;
+        pktbuf_append_data(p, part->data, part->dlen);
+        pktbuf_free(part, false);
+        part = next;
+    }
+
+    p->next = NULL;
+    p->flags |= PKTBUF_FLAG_EOF;
+
+    return NO_ERROR;
+}
+
 void pktbuf_append_data(pktbuf_t *p, const void *data, size_t sz) {
     if (pktbuf_avail_tail(p) < sz) {
         panic("pktbuf_append_data: overflow");
@@ -165,6 +277,9 @@ void *pktbuf_prepend(pktbuf_t *p, size_t sz) {
 
     p->dlen += sz;
     p->data -= sz;
+    if (p->flags & PKTBUF_FLAG_CSUM_PARTIAL) {
+        p->csum_start += sz;
+    }
 
     return p->data;
 }
@@ -11,17 +11,20 @@
 #include <lk/trace.h>
 #include <assert.h>
 #include <lk/compiler.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <lk/err.h>
 #include <string.h>
 #include <sys/types.h>
 #include <lk/console_cmd.h>
 #include <lib/cbuf.h>
+#include <lib/slab.h>
 #include <kernel/mutex.h>
 #include <kernel/semaphore.h>
 #include <arch/ops.h>
 #include <platform.h>
 #include <arch/atomic.h>
+#include <lk/pow2.h>
 
 #define LOCAL_TRACE 0
 
@@ -44,11 +47,44 @@ typedef struct tcp_pseudo_header {
     uint16_t tcp_length;
 } __PACKED tcp_pseudo_header_t;
 
-typedef struct tcp_mss_option {
-    uint8_t kind; /* 0x2 */
-    uint8_t len;  /* 0x4 */
-    uint16_t mss;
-} __PACKED tcp_mss_option_t;
+/* option kinds */
+#define TCP_OPTION_EOL (0)
+#define TCP_OPTION_NOP (1)
+#define TCP_OPTION_MSS (2)
+#define TCP_OPTION_WINDOW_SCALE (3)
+#define TCP_OPTION_SACK_PERMITTED (4)
+#define TCP_OPTION_SACK (5)
+#define TCP_OPTION_TIMESTAMP (8)
+
+#define TCP_MAX_OPTIONS_LENGTH (40)
+#define TCP_TIMESTAMP_OPTIONS_LENGTH (12) // NOP, NOP, timestamp
+#define TCP_MAX_SACK_BLOCKS (4)
+
+/* a range of sequence space, [start, end) */
+typedef struct tcp_sack_block {
+    uint32_t start;
+    uint32_t end;
+} tcp_sack_block_t;
+
+/* the options we understand out of an incoming segment */
+typedef struct tcp_options {
+    uint16_t mss;       // 0 if not present
+    int      wscale;    // -1 if not present
+    bool     sack_permitted;
+    bool     has_timestamp;
+    uint32_t ts_val;
+    uint32_t ts_ecr;
+    uint32_t sack_count;
+    tcp_sack_block_t sack[TCP_MAX_SACK_BLOCKS];
+} tcp_options_t;
+
+/* a segment received past a hole in the sequence space, held until the hole is filled */
+typedef struct tcp_ooo_segment {
+    struct list_node node;
+    uint32_t sequence;
+    uint32_t len;
+    uint8_t data[];
+} tcp_ooo_segment_t;
 
 typedef enum tcp_state {
     STATE_CLOSED,
@@ -73,8 +109,11 @@ typedef enum tcp_flags {
     PKT_URG = 32
 } tcp_flags_t;
 
+struct tcp_hash_bucket;
+
 typedef struct tcp_socket {
     struct list_node node;
+    struct tcp_hash_bucket *bucket; // hash bucket the socket is linked into, if any
 
     mutex_t lock;
     volatile int ref;
@@ -85,7 +124,15 @@ typedef struct tcp_socket {
     uint16_t local_port;
     uint16_t remote_port;
 
-    uint32_t mss;
+    uint32_t mss; // largest segment they will take, not counting options
+
+    /* options negotiated on the SYN */
+    bool     wscale_ok;
+    uint8_t  snd_wscale; // shift applied to the windows they advertise
+    uint8_t  rcv_wscale; // shift applied to the windows we advertise
+    bool     sack_ok;
+    bool     ts_ok;
+    uint32_t ts_recent; // most recent timestamp they sent us, echoed back in ours
 
     /* rx */
     uint32_t rx_win_size;
@@ -96,17 +143,56 @@ typedef struct tcp_socket {
     event_t  rx_event;
     int      rx_full_mss_count; // number of packets we have received in a row with a full mss
     net_timer_t ack_delay_timer;
+    struct list_node rx_ooo_list; // segments received past a hole, sorted by sequence
+    uint32_t rx_ooo_count;
+    uint32_t rx_ooo_last; // sequence of the most recent out of order segment, reported first in SACKs
+    volatile int rx_lent_parts; // parts of the pktbuf handed out by tcp_read_pktbuf() not yet freed
+    uint32_t rx_lent_len;       // bytes at the start of rx_buffer that pktbuf points at, until it's taken back
+    net_timer_t rx_lend_timer;  // takes the lent data back out of thread context once it's all freed
+    event_t  rx_lend_event;     // signaled while nothing is lent out
 
     /* tx */
     uint32_t tx_win_low;  // low side of the acked window
     uint32_t tx_win_high; // tx_win_low + their advertised window size
     uint32_t tx_highest_seq; // highest sequence we have txed them
-    uint8_t  *tx_buffer;  // our outgoing buffer
+    uint8_t  *tx_buffer;  // our outgoing buffer, used as a ring
     uint32_t tx_buffer_size; // size of tx_buffer
-    uint32_t tx_buffer_offset; // offset into the buffer to append new data to
+    uint32_t tx_buffer_head; // index into the buffer of the byte at tx_win_low
+    uint32_t tx_buffer_offset; // number of bytes in the buffer, new data is appended past this
+    bool     tx_fin_queued; // tcp_close() was called, send a FIN once the buffer is sent
+    bool     tx_fin_sent; // the FIN went out, it's at tx_highest_seq - 1
+    volatile int tx_refs; // pktbuf parts pointing into tx_buffer that the nic hasn't freed yet
+    event_t  tx_refs_event; // signaled while tx_refs is 0
     event_t  tx_event;
     net_timer_t retransmit_timer;
 
+    /* loss recovery */
+    tcp_sack_block_t tx_sacked[TCP_MAX_SACK_BLOCKS * 2]; // ranges past tx_win_low they have told us they hold
+    uint32_t tx_sacked_count;
+    uint32_t tx_dup_acks;
+    bool     tx_in_recovery;
+    uint32_t tx_recover; // tx_highest_seq when recovery started, recovery ends once it's acked
+    uint32_t tx_rexmit_next; // next sequence to consider for retransmission during recovery
+    bool     tx_rto_recovery; // recovery was started by the retransmit timer rather than duplicate acks
+
+    /* congestion control, NewReno (RFC 5681, RFC 6582) */
+    uint32_t tx_cwnd;
+    uint32_t tx_ssthresh;
+    uint32_t tx_cwnd_acked; // bytes acked toward the next congestion avoidance increase
+
+    /* round trip time estimation (RFC 6298), in msecs */
+    uint32_t rtt_srtt; // smoothed rtt, scaled by 8. 0 until the first sample
+    uint32_t rtt_var;  // rtt variation, scaled by 4
+    uint32_t rto;      // current retransmit timeout, including any backoff
+    bool     rtt_timing; // a segment is being timed, only used without timestamps
+    uint32_t rtt_seq;    // the timed segment is acked once the ack reaches this
+    lk_time_t rtt_start;
+
+    /* counters */
+    uint32_t stat_retransmits;      // segments sent again
+    uint32_t stat_fast_retransmits; // recoveries started by duplicate acks
+    uint32_t stat_timeouts;         // retransmit timer expirations
+
     /* listen accept */
     semaphore_t accept_sem;
     struct tcp_socket *accepted;
@@ -120,8 +206,28 @@ typedef struct tcp_socket {
 #define DEFAULT_MSS (1460)
 #define DEFAULT_RX_WINDOW_SIZE (8192)
 #define DEFAULT_TX_BUFFER_SIZE (8192)
+#define MIN_SOCKET_BUFFER_SIZE (4096)
+#define MAX_SOCKET_BUFFER_SIZE (4 * 1024 * 1024)
+
+/* the window scale we offer is fixed so that a receive buffer grown after the connection
+ * is set up can still be advertised in full */
+#define RX_WINDOW_SCALE (7)
+STATIC_ASSERT((0xffffU << RX_WINDOW_SCALE) >= MAX_SOCKET_BUFFER_SIZE);
+
+#define MAX_OOO_SEGMENTS (64)
+#define MAX_RX_LEND (64 * 1024) // most tcp_read_pktbuf() hands out at once
+#define DUP_ACK_THRESHOLD (3)
+
+/* retransmit timer bounds, in msecs. the minimum is below the 1 second RFC 6298 asks for,
+ * which is far too long on the local networks we usually talk to */
+#define INITIAL_RTO (1000)
+#define MIN_RTO (200)
+#define MAX_RTO (60000)
+#define RTT_CLOCK_GRANULARITY (1)
+
+#define INITIAL_CWND_SEGMENTS (10) // RFC 6928
+#define MAX_CWND (MAX_SOCKET_BUFFER_SIZE)
 
-#define RETRANSMIT_TIMEOUT (50)
 #define DELAYED_ACK_TIMEOUT (50)
 #define TIME_WAIT_TIMEOUT (60000) // 1 minute
 
@@ -132,25 +238,44 @@ typedef struct tcp_socket {
 #define SEQUENCE_GT(a, b) ((int32_t)((a) - (b)) > 0)
 #define SEQUENCE_LT(a, b) ((int32_t)((a) - (b)) < 0)
 
-static mutex_t tcp_socket_list_lock = MUTEX_INITIAL_VALUE(tcp_socket_list_lock);
-static struct list_node tcp_socket_list = LIST_INITIAL_VALUE(tcp_socket_list);
+/* sockets are hashed by their 4-tuple once connected, or by local port while listening.
+ * each bucket has its own lock so lookups for unrelated connections don't contend.
+ */
+#define TCP_CONN_HASH_SIZE (256)
+#define TCP_LISTEN_HASH_SIZE (32)
+
+struct tcp_hash_bucket {
+    mutex_t lock;
+    struct list_node list;
+};
+
+static struct tcp_hash_bucket tcp_conn_hash[TCP_CONN_HASH_SIZE];
+static struct tcp_hash_bucket tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+static slab_cache_t tcp_socket_cache;
 
 static bool tcp_debug = false;
 
 /* local routines */
 static tcp_socket_t *lookup_socket(ipv4_addr remote_ip, ipv4_addr local_ip, uint16_t remote_port, uint16_t local_port);
-static void add_socket_to_list(tcp_socket_t *s);
-static void remove_socket_from_list(tcp_socket_t *s);
-static tcp_socket_t *create_tcp_socket(bool alloc_buffers);
-static status_t tcp_send(ipv4_addr dest_ip, uint16_t dest_port, ipv4_addr src_ip, uint16_t src_port, const void *buf,
-                         size_t len, tcp_flags_t flags, const void *options, size_t options_length, uint32_t ack, uint32_t sequence, uint16_t window_size);
-static status_t tcp_socket_send(tcp_socket_t *s, const void *data, size_t len, tcp_flags_t flags, const void *options, size_t options_length, uint32_t sequence);
+static void add_socket_to_hash(tcp_socket_t *s);
+static void remove_socket_from_hash(tcp_socket_t *s);
+static tcp_socket_t *create_tcp_socket(bool alloc_buffers, uint32_t rx_buffer_size, uint32_t tx_buffer_size);
+static status_t tcp_send(ipv4_addr dest_ip, uint16_t dest_port, ipv4_addr src_ip, uint16_t src_port, pktbuf_t *data,
+                         tcp_flags_t flags, const void *options, size_t options_length, uint32_t ack, uint32_t sequence, uint16_t window_size,
+                         uint16_t gso_size);
+static status_t tcp_socket_send(tcp_socket_t *s, pktbuf_t *data, tcp_flags_t flags, uint32_t sequence);
+static status_t tcp_send_tx_data(tcp_socket_t *s, uint32_t sequence, uint32_t len);
 static void handle_data(tcp_socket_t *s, const void *data, size_t len, uint32_t sequence);
 static void send_ack(tcp_socket_t *s);
-static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size);
+static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size, const tcp_options_t *options, bool has_data);
+static ssize_t tcp_write_pending_data(tcp_socket_t *s);
+static uint32_t tcp_sack_retransmit(tcp_socket_t *s, uint32_t max_segments);
+static void free_ooo_segments(tcp_socket_t *s);
+static void wait_for_tx_refs(tcp_socket_t *s);
 static void handle_retransmit_timeout(void *_s);
 static void handle_time_wait_timeout(void *_s);
 static void handle_delayed_ack_timeout(void *_s);
+static void handle_rx_lend_returned(void *_s);
 static void tcp_remote_close(tcp_socket_t *s);
 static void tcp_wakeup_waiters(tcp_socket_t *s);
 static void inc_socket_ref(tcp_socket_t *s);
@@ -161,6 +286,26 @@ static uint16_t cksum_pheader(const tcp_pseudo_header_t *pheader, const void *bu
     return ~ones_sum16(checksum, buf, len);
 }
 
+/* same as above, over all the parts of a multi part packet */
+static uint16_t cksum_pheader_chain(const tcp_pseudo_header_t *pheader, const pktbuf_t *p) {
+    uint32_t sum = ones_sum16(0, pheader, sizeof(*pheader));
+    bool odd = false;
+
+    for (; p; p = p->next) {
+        uint32_t part = ones_sum16(0, p->data, p->dlen);
+        /* a part starting on an odd byte of the packet sums with its bytes swapped */
+        if (odd)
+            part = ((part & 0xff) << 8) | (part >> 8);
+        sum += part;
+        odd ^= (p->dlen & 1);
+    }
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum;
+}
+
 __NO_INLINE static void dump_tcp_header(const tcp_header_t *header) {
     printf("TCP: src_port %u, dest_port %u, seq %u, ack %u, win %u, flags %c%c%c%c%c%c\n",
            ntohs(header->source_port), ntohs(header->dest_port), ntohl(header->seq_num), ntohl(header->ack_num),
@@ -213,74 +358,356 @@ static void dump_socket(tcp_socket_t *s) {
                s->tx_win_low, s->tx_win_high, s->tx_win_high - s->tx_win_low,
                s->tx_highest_seq, s->tx_highest_seq - s->tx_win_low,
                s->tx_buffer_size, s->tx_buffer_offset);
+        printf("\toptions: wscale %s (snd %u rcv %u) sack %s timestamps %s, mss %u, ooo segments %u, sacked ranges %u\n",
+               s->wscale_ok ? "on" : "off", s->snd_wscale, s->rcv_wscale,
+               s->sack_ok ? "on" : "off", s->ts_ok ? "on" : "off", s->mss,
+               s->rx_ooo_count, s->tx_sacked_count);
+        printf("\tcc: cwnd %u ssthresh %u%s, srtt %u rttvar %u rto %u msecs, retransmits %u (fast %u timeouts %u)\n",
+               s->tx_cwnd, s->tx_ssthresh, s->tx_in_recovery ? (s->tx_rto_recovery ? " (rto recovery)" : " (recovery)") : "",
+               s->rtt_srtt >> 3, s->rtt_var >> 2, s->rto,
+               s->stat_retransmits, s->stat_fast_retransmits, s->stat_timeouts);
     }
 }
 
-static tcp_socket_t *lookup_socket(ipv4_addr remote_ip, ipv4_addr local_ip, uint16_t remote_port, uint16_t local_port) {
-    LTRACEF_LEVEL(2, "remote ip 0x%x local ip 0x%x remote port %u local port %u\n", remote_ip, local_ip, remote_port, local_port);
+static uint32_t get_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint8_t *put_be32(uint8_t *p, uint32_t val) {
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+    return p + 4;
+}
 
-    mutex_acquire(&tcp_socket_list_lock);
+static void tcp_parse_options(const uint8_t *opt, size_t len, tcp_options_t *options) {
+    memset(options, 0, sizeof(*options));
+    options->wscale = -1;
 
-    /* XXX replace with something faster, like a hash table */
-    tcp_socket_t *s = NULL;
-    list_for_every_entry(&tcp_socket_list, s, tcp_socket_t, node) {
-        if (s->state == STATE_CLOSED || s->state == STATE_LISTEN) {
+    size_t i = 0;
+    while (i < len) {
+        uint8_t kind = opt[i];
+        if (kind == TCP_OPTION_EOL) {
+            break;
+        } else if (kind == TCP_OPTION_NOP) {
+            i++;
             continue;
+        }
+
+        if (i + 1 >= len) {
+            break;
+        }
+        uint8_t opt_len = opt[i + 1];
+        if (opt_len < 2 || i + opt_len > len) {
+            break;
+        }
+        const uint8_t *data = &opt[i + 2];
+
+        switch (kind) {
+            case TCP_OPTION_MSS:
+                if (opt_len == 4) {
+                    options->mss = (data[0] << 8) | data[1];
+                }
+                break;
+            case TCP_OPTION_WINDOW_SCALE:
+                if (opt_len == 3) {
+                    options->wscale = MIN(data[0], 14);
+                }
+                break;
+            case TCP_OPTION_SACK_PERMITTED:
+                if (opt_len == 2) {
+                    options->sack_permitted = true;
+                }
+                break;
+            case TCP_OPTION_SACK:
+                for (size_t off = 0; off + 8 <= opt_len - 2U && options->sack_count < TCP_MAX_SACK_BLOCKS; off += 8) {
+                    options->sack[options->sack_count].start = get_be32(data + off);
+                    options->sack[options->sack_count].end = get_be32(data + off + 4);
+                    options->sack_count++;
+                }
+                break;
+            case TCP_OPTION_TIMESTAMP:
+                if (opt_len == 10) {
+                    options->has_timestamp = true;
+                    options->ts_val = get_be32(data);
+                    options->ts_ecr = get_be32(data + 4);
+                }
+                break;
+        }
+
+        i += opt_len;
+    }
+}
+
+/* collect the out of order data we're holding as SACK blocks, with the block holding
+ * the most recently received segment first as RFC 2018 asks */
+static uint32_t tcp_build_sack_blocks(tcp_socket_t *s, tcp_sack_block_t *blocks, uint32_t max_blocks) {
+    tcp_sack_block_t ranges[MAX_OOO_SEGMENTS];
+    uint32_t range_count = 0;
+
+    /* merge the queued segments into contiguous ranges */
+    tcp_ooo_segment_t *seg;
+    list_for_every_entry(&s->rx_ooo_list, seg, tcp_ooo_segment_t, node) {
+        uint32_t end = seg->sequence + seg->len;
+        if (range_count > 0 && SEQUENCE_LTE(seg->sequence, ranges[range_count - 1].end)) {
+            if (SEQUENCE_GT(end, ranges[range_count - 1].end)) {
+                ranges[range_count - 1].end = end;
+            }
         } else {
-            /* full check */
-            if (s->remote_ip == remote_ip &&
-                    s->local_ip == local_ip &&
-                    s->remote_port == remote_port &&
-                    s->local_port == local_port) {
-                goto out;
+            ranges[range_count].start = seg->sequence;
+            ranges[range_count].end = end;
+            range_count++;
+        }
+    }
+
+    uint32_t count = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < range_count && count < max_blocks; i++) {
+            bool recent = SEQUENCE_GTE(s->rx_ooo_last, ranges[i].start) && SEQUENCE_LT(s->rx_ooo_last, ranges[i].end);
+            if (recent == (pass == 0)) {
+                blocks[count++] = ranges[i];
             }
         }
     }
 
-    /* walk the list again, looking only for listen matches */
-    list_for_every_entry(&tcp_socket_list, s, tcp_socket_t, node) {
-        if (s->state == STATE_LISTEN) {
-            /* sockets in listen state only care about local port */
-            if (s->local_port == local_port) {
-                goto out;
+    return count;
+}
+
+/* build the options for an outgoing segment, returning their length */
+static size_t tcp_build_options(tcp_socket_t *s, uint8_t *buf, tcp_flags_t flags, size_t data_len) {
+    uint8_t *p = buf;
+
+    if (flags & PKT_SYN) {
+        /* offer everything on an active open, echo what they offered on a passive one */
+        *p++ = TCP_OPTION_MSS;
+        *p++ = 4;
+        *p++ = DEFAULT_MSS >> 8;
+        *p++ = DEFAULT_MSS & 0xff;
+
+        if (s->sack_ok) {
+            if (!s->ts_ok) {
+                *p++ = TCP_OPTION_NOP;
+                *p++ = TCP_OPTION_NOP;
+            }
+            *p++ = TCP_OPTION_SACK_PERMITTED;
+            *p++ = 2;
+        }
+        if (s->ts_ok) {
+            if (!s->sack_ok) {
+                *p++ = TCP_OPTION_NOP;
+                *p++ = TCP_OPTION_NOP;
+            }
+            *p++ = TCP_OPTION_TIMESTAMP;
+            *p++ = 10;
+            p = put_be32(p, (uint32_t)current_time());
+            p = put_be32(p, s->ts_recent);
+        }
+        if (s->wscale_ok) {
+            *p++ = TCP_OPTION_NOP;
+            *p++ = TCP_OPTION_WINDOW_SCALE;
+            *p++ = 3;
+            *p++ = s->rcv_wscale;
+        }
+    } else {
+        if (s->ts_ok) {
+            *p++ = TCP_OPTION_NOP;
+            *p++ = TCP_OPTION_NOP;
+            *p++ = TCP_OPTION_TIMESTAMP;
+            *p++ = 10;
+            p = put_be32(p, (uint32_t)current_time());
+            p = put_be32(p, s->ts_recent);
+        }
+
+        /* only report holes on pure acks so data segments keep a fixed size */
+        if (s->sack_ok && (flags & PKT_ACK) && data_len == 0 && s->rx_ooo_count > 0) {
+            tcp_sack_block_t blocks[TCP_MAX_SACK_BLOCKS];
+            uint32_t count = tcp_build_sack_blocks(s, blocks, s->ts_ok ? 3 : 4);
+            if (count > 0) {
+                *p++ = TCP_OPTION_NOP;
+                *p++ = TCP_OPTION_NOP;
+                *p++ = TCP_OPTION_SACK;
+                *p++ = 2 + count * 8;
+                for (uint32_t i = 0; i < count; i++) {
+                    p = put_be32(p, blocks[i].start);
+                    p = put_be32(p, blocks[i].end);
+                }
             }
         }
     }
 
-    /* fall through case returns null */
-    s = NULL;
+    size_t len = p - buf;
+    DEBUG_ASSERT(len <= TCP_MAX_OPTIONS_LENGTH);
+    DEBUG_ASSERT((len % 4) == 0);
 
-out:
-    /* bump the ref before returning it */
-    if (s)
-        inc_socket_ref(s);
+    return len;
+}
 
-    mutex_release(&tcp_socket_list_lock);
+/* largest payload we can put in a segment once the per segment options are accounted for */
+static uint32_t tcp_tx_mss(const tcp_socket_t *s) {
+    return s->mss - (s->ts_ok ? TCP_TIMESTAMP_OPTIONS_LENGTH : 0);
+}
 
-    return s;
+/* largest payload to hand the nic at once, whole segments of it if the nic splits them up */
+static uint32_t tcp_tx_tso_max(const tcp_socket_t *s) {
+    const uint32_t mss = tcp_tx_mss(s);
+
+    if (!(minip_eth_caps & MINIP_ETH_CAP_TSO4) || minip_eth_tso_max_size < 2 * mss)
+        return mss;
+
+    return minip_eth_tso_max_size - minip_eth_tso_max_size % mss;
+}
+
+/* sequence just past the data we have sent, not counting a FIN */
+static uint32_t tx_sent_data_end(const tcp_socket_t *s) {
+    return s->tx_fin_sent ? s->tx_highest_seq - 1 : s->tx_highest_seq;
+}
+
+static bool fin_acked(const tcp_socket_t *s) {
+    return s->tx_fin_sent && s->tx_win_low == s->tx_highest_seq;
+}
+
+/* fold a round trip time measurement into the estimate and recompute the retransmit
+ * timeout from it, RFC 6298 section 2 */
+static void tcp_rtt_sample(tcp_socket_t *s, uint32_t rtt) {
+    rtt = MAX(rtt, 1u);
+
+    if (s->rtt_srtt == 0) {
+        s->rtt_srtt = rtt << 3;
+        s->rtt_var = rtt << 1;
+    } else {
+        /* srtt = 7/8 srtt + 1/8 rtt, rttvar = 3/4 rttvar + 1/4 |srtt - rtt| */
+        int32_t delta = (int32_t)rtt - (int32_t)(s->rtt_srtt >> 3);
+        s->rtt_srtt += delta;
+        if (delta < 0)
+            delta = -delta;
+        delta -= (int32_t)(s->rtt_var >> 2);
+        s->rtt_var += delta;
+    }
+
+    uint32_t rto = (s->rtt_srtt >> 3) + MAX((uint32_t)RTT_CLOCK_GRANULARITY, s->rtt_var);
+    s->rto = MIN(MAX(rto, (uint32_t)MIN_RTO), (uint32_t)MAX_RTO);
+}
+
+/* where the slow start threshold goes after a loss, RFC 5681 equation 4 */
+static uint32_t tcp_loss_ssthresh(const tcp_socket_t *s) {
+    uint32_t flight = s->tx_highest_seq - s->tx_win_low;
+    return MAX(flight / 2, 2 * tcp_tx_mss(s));
+}
+
+/* open the congestion window for newly acked data outside of fast recovery */
+static void tcp_cwnd_open(tcp_socket_t *s, uint32_t acked) {
+    const uint32_t mss = tcp_tx_mss(s);
+
+    if (s->tx_cwnd < s->tx_ssthresh) {
+        /* slow start */
+        s->tx_cwnd += MIN(acked, mss);
+    } else {
+        /* congestion avoidance, a segment per window's worth of acks */
+        s->tx_cwnd_acked += acked;
+        if (s->tx_cwnd_acked >= s->tx_cwnd) {
+            s->tx_cwnd_acked -= s->tx_cwnd;
+            s->tx_cwnd += mss;
+        }
+    }
+    s->tx_cwnd = MIN(s->tx_cwnd, (uint32_t)MAX_CWND);
+}
+
+/* start congestion control once the mss is settled on the SYN exchange */
+static void tcp_cc_init(tcp_socket_t *s) {
+    s->tx_cwnd = INITIAL_CWND_SEGMENTS * tcp_tx_mss(s);
+    s->tx_ssthresh = UINT32_MAX;
+    s->tx_cwnd_acked = 0;
+    s->tx_recover = s->tx_win_low;
+}
+
+static struct tcp_hash_bucket *conn_hash_bucket(ipv4_addr remote_ip, ipv4_addr local_ip, uint16_t remote_port, uint16_t local_port) {
+    uint32_t hash = remote_ip ^ (local_ip * 0x9e3779b1) ^ (((uint32_t)remote_port << 16) | local_port);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+
+    return &tcp_conn_hash[hash % TCP_CONN_HASH_SIZE];
+}
+
+static struct tcp_hash_bucket *listen_hash_bucket(uint16_t local_port) {
+    return &tcp_listen_hash[local_port % TCP_LISTEN_HASH_SIZE];
+}
+
+static tcp_socket_t *lookup_socket(ipv4_addr remote_ip, ipv4_addr local_ip, uint16_t remote_port, uint16_t local_port) {
+    LTRACEF_LEVEL(2, "remote ip 0x%x local ip 0x%x remote port %u local port %u\n", remote_ip, local_ip, remote_port, local_port);
+
+    /* look for an exact match on a connected socket first */
+    struct tcp_hash_bucket *b = conn_hash_bucket(remote_ip, local_ip, remote_port, local_port);
+    tcp_socket_t *s;
+
+    mutex_acquire(&b->lock);
+    list_for_every_entry(&b->list, s, tcp_socket_t, node) {
+        if (s->state == STATE_CLOSED) {
+            continue;
+        }
+        if (s->remote_ip == remote_ip &&
+                s->local_ip == local_ip &&
+                s->remote_port == remote_port &&
+                s->local_port == local_port) {
+            /* bump the ref before returning it */
+            inc_socket_ref(s);
+            mutex_release(&b->lock);
+            return s;
+        }
+    }
+    mutex_release(&b->lock);
+
+    /* sockets in listen state only care about local port */
+    b = listen_hash_bucket(local_port);
+
+    mutex_acquire(&b->lock);
+    list_for_every_entry(&b->list, s, tcp_socket_t, node) {
+        if (s->state == STATE_LISTEN && s->local_port == local_port) {
+            inc_socket_ref(s);
+            mutex_release(&b->lock);
+            return s;
+        }
+    }
+    mutex_release(&b->lock);
+
+    return NULL;
 }
 
-static void add_socket_to_list(tcp_socket_t *s) {
+static void add_socket_to_hash(tcp_socket_t *s) {
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(s->ref > 0); // we should have implicitly bumped the ref when creating the socket
+    DEBUG_ASSERT(!s->bucket);
 
-    mutex_acquire(&tcp_socket_list_lock);
+    struct tcp_hash_bucket *b;
+    if (s->state == STATE_LISTEN) {
+        b = listen_hash_bucket(s->local_port);
+    } else {
+        b = conn_hash_bucket(s->remote_ip, s->local_ip, s->remote_port, s->local_port);
+    }
 
-    list_add_head(&tcp_socket_list, &s->node);
+    mutex_acquire(&b->lock);
 
-    mutex_release(&tcp_socket_list_lock);
+    list_add_head(&b->list, &s->node);
+    s->bucket = b;
+
+    mutex_release(&b->lock);
 }
 
-static void remove_socket_from_list(tcp_socket_t *s) {
+static void remove_socket_from_hash(tcp_socket_t *s) {
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(s->ref > 0);
 
-    mutex_acquire(&tcp_socket_list_lock);
+    struct tcp_hash_bucket *b = s->bucket;
+    DEBUG_ASSERT(b);
+
+    mutex_acquire(&b->lock);
 
     DEBUG_ASSERT(list_in_list(&s->node));
     list_delete(&s->node);
+    s->bucket = NULL;
 
-    mutex_release(&tcp_socket_list_lock);
+    mutex_release(&b->lock);
 }
 
 static void inc_socket_ref(tcp_socket_t *s) {
@@ -302,11 +729,15 @@ static bool dec_socket_ref(tcp_socket_t *s) {
         event_destroy(&s->tx_event);
         event_destroy(&s->rx_event);
         event_destroy(&s->connect_event);
+        event_destroy(&s->rx_lend_event);
 
+        free_ooo_segments(s);
+        wait_for_tx_refs(s);
+        event_destroy(&s->tx_refs_event);
         free(s->rx_buffer_raw);
         free(s->tx_buffer);
 
-        free(s);
+        slab_free(&tcp_socket_cache, s);
     }
     return (oldval == 1);
 }
@@ -348,6 +779,10 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
         TRACEF("REJECT: packet too large for buffer\n");
         return;
     }
+    if (header_len < sizeof(tcp_header_t)) {
+        TRACEF("REJECT: header length %zu too short\n", header_len);
+        return;
+    }
 
     /* checksum */
     if (FORCE_TCP_CHECKSUM || (p->flags & PKTBUF_FLAG_CKSUM_TCP_GOOD) == 0) {
@@ -381,6 +816,9 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
     size_t data_len = p->dlen - header_len;
     uint32_t highest_sequence = header->seq_num + ((data_len > 0) ? (data_len - 1) : 0);
 
+    tcp_options_t options;
+    tcp_parse_options((const uint8_t *)(header + 1), header_len - sizeof(tcp_header_t), &options);
+
     /* see if it matches a socket we have */
     tcp_socket_t *s = lookup_socket(src_ip, dst_ip, header->source_port, header->dest_port);
     if (!s) {
@@ -396,6 +834,18 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
 
     mutex_acquire(&s->lock);
 
+    /* remember their latest timestamp to echo back, ignoring old segments */
+    if (s->ts_ok && options.has_timestamp &&
+            SEQUENCE_LTE(header->seq_num, s->rx_win_low) && SEQUENCE_GTE(options.ts_val, s->ts_recent)) {
+        s->ts_recent = options.ts_val;
+    }
+
+    /* windows are only scaled outside of SYNs */
+    uint32_t win_size = header->win_size;
+    if (!(packet_flags & PKT_SYN) && s->wscale_ok) {
+        win_size <<= s->snd_wscale;
+    }
+
     /* check to see if they're resetting us */
     if (packet_flags & PKT_RST) {
         if (s->state != STATE_CLOSED && s->state != STATE_LISTEN) {
@@ -421,8 +871,8 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
             if (s->accepted != NULL)
                 goto done;
 
-            /* make a new accept socket */
-            tcp_socket_t *accept_socket = create_tcp_socket(true);
+            /* make a new accept socket, with the buffer sizes set on the listen socket */
+            tcp_socket_t *accept_socket = create_tcp_socket(true, s->rx_win_size, s->tx_buffer_size);
             if (!accept_socket)
                 goto done;
 
@@ -433,9 +883,20 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
             accept_socket->remote_port = header->source_port;
             accept_socket->state = STATE_SYN_RCVD;
 
+            /* use the options they offered */
+            if (options.mss > 0) {
+                accept_socket->mss = MIN(options.mss, DEFAULT_MSS);
+            }
+            accept_socket->wscale_ok = options.wscale >= 0;
+            accept_socket->snd_wscale = accept_socket->wscale_ok ? options.wscale : 0;
+            accept_socket->rcv_wscale = accept_socket->wscale_ok ? RX_WINDOW_SCALE : 0;
+            accept_socket->sack_ok = options.sack_permitted;
+            accept_socket->ts_ok = options.has_timestamp;
+            accept_socket->ts_recent = options.ts_val;
+
             mutex_acquire(&accept_socket->lock);
 
-            add_socket_to_list(accept_socket);
+            add_socket_to_hash(accept_socket);
 
             /* remember their sequence */
             accept_socket->rx_win_low = header->seq_num + 1;
@@ -445,18 +906,12 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
             s->accepted = accept_socket;
             sem_post(&s->accept_sem, true);
 
-            /* set up a mss option for sending back */
-            tcp_mss_option_t mss_option;
-            mss_option.kind = 0x2;
-            mss_option.len = 0x4;
-            mss_option.mss = ntohs(s->mss); // XXX make sure we fit in their mss
-
             /* send a response */
-            tcp_socket_send(accept_socket, NULL, 0, PKT_ACK|PKT_SYN, &mss_option, sizeof(mss_option),
-                            accept_socket->tx_win_low);
+            tcp_socket_send(accept_socket, NULL, PKT_ACK|PKT_SYN, accept_socket->tx_win_low);
 
             /* SYN consumed a sequence */
             accept_socket->tx_win_low++;
+            accept_socket->tx_highest_seq = accept_socket->tx_win_low;
 
             mutex_release(&accept_socket->lock);
             break;
@@ -474,8 +929,12 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
                     goto send_reset;
                 }
 
-                s->tx_win_high = s->tx_win_low + header->win_size;
+                s->tx_win_high = s->tx_win_low + win_size;
                 s->tx_highest_seq = s->tx_win_low;
+                tcp_cc_init(s);
+                if (s->ts_ok && options.has_timestamp && options.ts_ecr != 0) {
+                    tcp_rtt_sample(s, (uint32_t)current_time() - options.ts_ecr);
+                }
 
                 s->state = STATE_ESTABLISHED;
             } else {
@@ -508,9 +967,24 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
             s->rx_win_low = header->seq_num + 1;
             s->rx_win_high = s->rx_win_low + s->rx_win_size - 1;
 
+            // keep whichever of the options we offered they agreed to
+            if (options.mss > 0) {
+                s->mss = MIN(options.mss, DEFAULT_MSS);
+            }
+            s->wscale_ok = s->wscale_ok && options.wscale >= 0;
+            s->snd_wscale = s->wscale_ok ? options.wscale : 0;
+            s->rcv_wscale = s->wscale_ok ? s->rcv_wscale : 0;
+            s->sack_ok = s->sack_ok && options.sack_permitted;
+            s->ts_ok = s->ts_ok && options.has_timestamp;
+            s->ts_recent = options.ts_val;
+
             s->tx_win_low++;
-            s->tx_win_high = s->tx_win_low + header->win_size;
+            s->tx_win_high = s->tx_win_low + win_size;
             s->tx_highest_seq = s->tx_win_low;
+            tcp_cc_init(s);
+            if (s->ts_ok && options.ts_ecr != 0) {
+                tcp_rtt_sample(s, (uint32_t)current_time() - options.ts_ecr);
+            }
 
             s->state = STATE_ESTABLISHED;
 
@@ -525,7 +999,7 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
         case STATE_ESTABLISHED:
             if (packet_flags & PKT_ACK) {
                 /* they're acking us */
-                handle_ack(s, header->ack_num, header->win_size);
+                handle_ack(s, header->ack_num, win_size, &options, data_len > 0);
             }
 
             if (data_len > 0) {
@@ -551,7 +1025,7 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
         case STATE_CLOSE_WAIT:
             if (packet_flags & PKT_ACK) {
                 /* they're acking us */
-                handle_ack(s, header->ack_num, header->win_size);
+                handle_ack(s, header->ack_num, win_size, &options, data_len > 0);
             }
             if (packet_flags & PKT_FIN) {
                 /* they must have missed our ack, ack them again */
@@ -560,17 +1034,23 @@ void tcp_input(pktbuf_t *p, uint32_t src_ip, uint32_t dst_ip) {
             break;
         case STATE_LAST_ACK:
             if (packet_flags & PKT_ACK) {
-                /* they're acking our FIN, probably */
+                handle_ack(s, header->ack_num, win_size, &options, data_len > 0);
+            }
+            if (fin_acked(s)) {
+                /* they're acking our FIN */
                 tcp_remote_close(s);
 
                 /* tcp_close() was already called on us, remove us from the list and drop the ref */
-                remove_socket_from_list(s);
+                remove_socket_from_hash(s);
                 dec_socket_ref(s);
             }
             break;
         case STATE_FIN_WAIT_1:
             if (packet_flags & PKT_ACK) {
-                /* they're acking our FIN, probably */
+                handle_ack(s, header->ack_num, win_size, &options, data_len > 0);
+            }
+            if (fin_acked(s)) {
+                /* they're acking our FIN */
                 s->state = STATE_FIN_WAIT_2;
                 /* drop into fin_wait_2 state logic, in case they were FINning us too */
                 goto fin_wait_2;
@@ -595,7 +1075,10 @@ fin_wait_2:
             break;
         case STATE_CLOSING:
             if (packet_flags & PKT_ACK) {
-                /* they're acking our FIN, probably */
+                handle_ack(s, header->ack_num, win_size, &options, data_len > 0);
+            }
+            if (fin_acked(s)) {
+                /* they're acking our FIN */
                 s->state = STATE_TIME_WAIT;
 
                 /* set timed wait timer */
@@ -621,8 +1104,84 @@ send_reset:
     LTRACEF("SEND RST\n");
     if (!(packet_flags & PKT_RST)) {
         tcp_send(src_ip, header->source_port, dst_ip, header->dest_port,
-                 NULL, 0, PKT_RST, NULL, 0, 0, header->ack_num, 0);
+                 NULL, PKT_RST, NULL, 0, 0, header->ack_num, 0, 0);
+    }
+}
+
+static void free_ooo_segments(tcp_socket_t *s) {
+    tcp_ooo_segment_t *seg, *temp;
+    list_for_every_entry_safe(&s->rx_ooo_list, seg, temp, tcp_ooo_segment_t, node) {
+        list_delete(&seg->node);
+        free(seg);
+    }
+    s->rx_ooo_count = 0;
+}
+
+/* hold onto a segment that arrived past a hole, keeping the list sorted by sequence */
+static void queue_ooo_segment(tcp_socket_t *s, const void *data, size_t len, uint32_t sequence) {
+    DEBUG_ASSERT(is_mutex_held(&s->lock));
+
+    tcp_ooo_segment_t *seg;
+    tcp_ooo_segment_t *insert_after = NULL;
+    list_for_every_entry(&s->rx_ooo_list, seg, tcp_ooo_segment_t, node) {
+        if (SEQUENCE_GT(seg->sequence, sequence)) {
+            break;
+        }
+        /* already have all of it, probably a retransmit */
+        if (SEQUENCE_GTE(seg->sequence + seg->len, sequence + len)) {
+            s->rx_ooo_last = sequence;
+            return;
+        }
+        insert_after = seg;
+    }
+
+    if (s->rx_ooo_count >= MAX_OOO_SEGMENTS) {
+        return;
+    }
+
+    seg = malloc(sizeof(tcp_ooo_segment_t) + len);
+    if (!seg) {
+        return;
+    }
+    seg->sequence = sequence;
+    seg->len = len;
+    memcpy(seg->data, data, len);
+
+    if (insert_after) {
+        list_add_after(&insert_after->node, &seg->node);
+    } else {
+        list_add_head(&s->rx_ooo_list, &seg->node);
     }
+    s->rx_ooo_count++;
+    s->rx_ooo_last = sequence;
+}
+
+/* move any queued segments that are now in order into the receive buffer, returning true
+ * if anything was moved */
+static bool drain_ooo_segments(tcp_socket_t *s) {
+    DEBUG_ASSERT(is_mutex_held(&s->lock));
+
+    bool drained = false;
+    tcp_ooo_segment_t *seg, *temp;
+    list_for_every_entry_safe(&s->rx_ooo_list, seg, temp, tcp_ooo_segment_t, node) {
+        if (SEQUENCE_GT(seg->sequence, s->rx_win_low)) {
+            /* still a hole in front of this one */
+            break;
+        }
+
+        uint32_t end = seg->sequence + seg->len;
+        if (SEQUENCE_GT(end, s->rx_win_low)) {
+            uint32_t offset = s->rx_win_low - seg->sequence;
+            s->rx_win_low += cbuf_write(&s->rx_buffer, seg->data + offset, seg->len - offset, false);
+        }
+
+        list_delete(&seg->node);
+        free(seg);
+        s->rx_ooo_count--;
+        drained = true;
+    }
+
+    return drained;
 }
 
 static void handle_data(tcp_socket_t *s, const void *data, size_t len, uint32_t sequence) {
@@ -634,53 +1193,65 @@ static void handle_data(tcp_socket_t *s, const void *data, size_t len, uint32_t
     DEBUG_ASSERT(data);
     DEBUG_ASSERT(len > 0);
 
-    /* see if it matches our current window */
+    /* trim off anything below the window, we already have it */
     uint32_t sequence_top = sequence + len - 1;
-    if (SEQUENCE_LTE(sequence, s->rx_win_low) && SEQUENCE_GTE(sequence_top, s->rx_win_low)) {
-        /* it intersects the bottom of our window, so it's in order */
+    if (SEQUENCE_LT(sequence_top, s->rx_win_low) || SEQUENCE_GT(sequence, s->rx_win_high)) {
+        // completely out of our window, drop
+        // duplicately ack the last thing we really got
+        send_ack(s);
+        return;
+    }
+    if (SEQUENCE_LT(sequence, s->rx_win_low)) {
+        size_t offset = s->rx_win_low - sequence;
+        data = (const uint8_t *)data + offset;
+        len -= offset;
+        sequence = s->rx_win_low;
+    }
 
-        /* copy the data we need to our cbuf */
-        size_t offset = sequence - s->rx_win_low;
-        size_t copy_len = MIN(s->rx_win_high - s->rx_win_low, len - offset);
+    /* and anything past the top of the window, which is inclusive */
+    len = MIN(len, s->rx_win_high - sequence + 1);
 
-        DEBUG_ASSERT(offset < len);
+    if (sequence != s->rx_win_low) {
+        /* it's past a hole, hold onto it and ack immediately so they see the hole */
+        LTRACEF("out of order, sequence %u rx_win_low %u len %zu\n", sequence, s->rx_win_low, len);
+        queue_ooo_segment(s, data, len, sequence);
+        send_ack(s);
+        return;
+    }
 
-        LTRACEF("copying from offset %zu, len %zu\n", offset, copy_len);
+    /* it's in order, copy the data to our cbuf */
+    LTRACEF("copying len %zu\n", len);
 
-        s->rx_win_low += copy_len;
+    /* only ack what the cbuf actually took */
+    len = cbuf_write(&s->rx_buffer, data, len, false);
+    s->rx_win_low += len;
 
-        cbuf_write(&s->rx_buffer, (uint8_t *)data + offset, copy_len, false);
-        event_signal(&s->rx_event, true);
+    /* see if it filled a hole in front of data we were holding */
+    bool filled_hole = drain_ooo_segments(s);
 
-        /* keep a counter if they've been sending a full mss */
-        if (copy_len >= s->mss) {
-            s->rx_full_mss_count++;
-        } else {
-            s->rx_full_mss_count = 0;
-        }
+    event_signal(&s->rx_event, true);
 
-        /* immediately ack if we're more than halfway into our buffer or they've sent 2 or more full packets */
-        if (s->rx_full_mss_count >= 2 ||
-                (int)(s->rx_win_low + s->rx_win_size - s->rx_win_high) > (int)s->rx_win_size / 2) {
-            send_ack(s);
-            s->rx_full_mss_count = 0;
-        } else {
-            tcp_timer_set(s, &s->ack_delay_timer, &handle_delayed_ack_timeout, DELAYED_ACK_TIMEOUT);
-        }
+    /* keep a counter if they've been sending a full mss */
+    if (len >= tcp_tx_mss(s)) {
+        s->rx_full_mss_count++;
     } else {
-        // either out of order or completely out of our window, drop
-        // duplicately ack the last thing we really got
+        s->rx_full_mss_count = 0;
+    }
+
+    /* immediately ack if we're more than halfway into our buffer, they've sent 2 or more full
+     * packets, or we just filled a hole */
+    if (filled_hole || s->rx_full_mss_count >= 2 ||
+            (int)(s->rx_win_low + s->rx_win_size - s->rx_win_high) > (int)s->rx_win_size / 2) {
         send_ack(s);
+        s->rx_full_mss_count = 0;
+    } else {
+        tcp_timer_set(s, &s->ack_delay_timer, &handle_delayed_ack_timeout, DELAYED_ACK_TIMEOUT);
     }
 }
 
-static status_t tcp_socket_send(tcp_socket_t *s, const void *data, size_t len, tcp_flags_t flags,
-                                const void *options, size_t options_length, uint32_t sequence) {
+static status_t tcp_socket_send(tcp_socket_t *s, pktbuf_t *data, tcp_flags_t flags, uint32_t sequence) {
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(is_mutex_held(&s->lock));
-    DEBUG_ASSERT(len == 0 || data);
-    DEBUG_ASSERT(options_length == 0 || options);
-    DEBUG_ASSERT((options_length % 4) == 0);
 
     // calculate the new right edge of the rx window
     uint32_t rx_win_high = s->rx_win_low + s->rx_win_size - cbuf_space_used(&s->rx_buffer) - 1;
@@ -688,7 +1259,7 @@ static status_t tcp_socket_send(tcp_socket_t *s, const void *data, size_t len, t
     LTRACEF("rx_win_low %u rx_win_size %u read_buf_len %zu, new win high %u\n",
             s->rx_win_low, s->rx_win_size, cbuf_space_used(&s->rx_buffer), rx_win_high);
 
-    uint16_t win_size;
+    uint32_t win_size;
     if (SEQUENCE_GTE(rx_win_high, s->rx_win_high)) {
         s->rx_win_high = rx_win_high;
         win_size = rx_win_high - s->rx_win_low;
@@ -698,17 +1269,88 @@ static status_t tcp_socket_send(tcp_socket_t *s, const void *data, size_t len, t
         win_size = s->rx_win_high - s->rx_win_low;
     }
 
+    // the window in a SYN is never scaled
+    if (!(flags & PKT_SYN) && s->wscale_ok) {
+        win_size >>= s->rcv_wscale;
+    }
+    win_size = MIN(win_size, 0xffff);
+
     // we are piggybacking a pending ACK, so clear the delayed ACK timer
     if (flags & PKT_ACK) {
         tcp_timer_cancel(s, &s->ack_delay_timer);
     }
 
-    status_t err = tcp_send(s->remote_ip, s->remote_port, s->local_ip, s->local_port, data, len, flags,
-                            options, options_length, (flags & PKT_ACK) ? s->rx_win_low : 0, sequence, win_size);
+    uint8_t options[TCP_MAX_OPTIONS_LENGTH];
+    size_t data_len = data ? pktbuf_chain_len(data) : 0;
+    size_t options_length = tcp_build_options(s, options, flags, data_len);
+
+    status_t err = tcp_send(s->remote_ip, s->remote_port, s->local_ip, s->local_port, data, flags,
+                            options, options_length, (flags & PKT_ACK) ? s->rx_win_low : 0, sequence, win_size,
+                            tcp_tx_mss(s));
 
     return err;
 }
 
+/* send len bytes out of the tx buffer starting at sequence */
+/* called as the nic frees a packet part that points into the tx ring, possibly from
+ * interrupt context */
+static void tcp_tx_ref_release(void *buf, void *arg) {
+    tcp_socket_t *s = arg;
+
+    int oldval = atomic_add(&s->tx_refs, -1);
+    DEBUG_ASSERT(oldval > 0);
+    if (oldval == 1)
+        event_signal(&s->tx_refs_event, false);
+}
+
+/* wait for the nic to let go of anything pointing into the tx ring before it's freed.
+ * nothing new can be sent out of it meanwhile, the caller holds the lock or the last ref */
+static void wait_for_tx_refs(tcp_socket_t *s) {
+    event_wait(&s->tx_refs_event);
+}
+
+/* free a chain from pktbuf_alloc_ref() that was never handed out, without running
+ * the release callbacks for it */
+static void free_unused_refs(pktbuf_t *p) {
+    for (pktbuf_t *part = p; part; part = part->next) {
+        part->cb = NULL;
+    }
+    pktbuf_free_chain(p, true);
+}
+
+static status_t tcp_send_tx_data(tcp_socket_t *s, uint32_t sequence, uint32_t len) {
+    DEBUG_ASSERT(is_mutex_held(&s->lock));
+    DEBUG_ASSERT(SEQUENCE_GTE(sequence, s->tx_win_low));
+    DEBUG_ASSERT(sequence - s->tx_win_low + len <= s->tx_buffer_offset);
+
+    /* point the packet straight at the ring rather than copying out of it. the data may
+     * wrap around the end */
+    uint32_t index = (s->tx_buffer_head + (sequence - s->tx_win_low)) % s->tx_buffer_size;
+    uint32_t first = MIN(len, s->tx_buffer_size - index);
+    pktbuf_t *data = pktbuf_alloc_ref(s->tx_buffer + index, first, &tcp_tx_ref_release, s);
+    if (data && len > first) {
+        pktbuf_t *wrapped = pktbuf_alloc_ref(s->tx_buffer, len - first, &tcp_tx_ref_release, s);
+        if (!wrapped) {
+            free_unused_refs(data);
+            data = NULL;
+        } else {
+            pktbuf_chain(data, wrapped);
+        }
+    }
+    if (!data)
+        return ERR_NO_MEMORY;
+
+    /* the ring has to stay put until the nic is done with every part */
+    int parts = 0;
+    for (pktbuf_t *part = data; part; part = part->next) {
+        parts++;
+    }
+    if (atomic_add(&s->tx_refs, parts) == 0)
+        event_unsignal(&s->tx_refs_event);
+
+    return tcp_socket_send(s, data, PKT_ACK|PKT_PSH, sequence);
+}
+
 static void send_ack(tcp_socket_t *s) {
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(is_mutex_held(&s->lock));
@@ -716,20 +1358,29 @@ static void send_ack(tcp_socket_t *s) {
     if (s->state != STATE_ESTABLISHED && s->state != STATE_CLOSE_WAIT && s->state != STATE_FIN_WAIT_2)
         return;
 
-    tcp_socket_send(s, NULL, 0, PKT_ACK, NULL, 0, s->tx_win_low);
+    tcp_socket_send(s, NULL, PKT_ACK, s->tx_win_low);
 }
 
-static status_t tcp_send(ipv4_addr dest_ip, uint16_t dest_port, ipv4_addr src_ip, uint16_t src_port, const void *buf,
-                         size_t len, tcp_flags_t flags, const void *options, size_t options_length, uint32_t ack, uint32_t sequence, uint16_t window_size) {
-    DEBUG_ASSERT(len == 0 || buf);
+/* send a segment, with data (if any) following the header as more parts of the packet.
+ * the data is freed along with the packet, or right away if it can't be sent. more than
+ * gso_size bytes of data is left for the nic to split up */
+static status_t tcp_send(ipv4_addr dest_ip, uint16_t dest_port, ipv4_addr src_ip, uint16_t src_port, pktbuf_t *data,
+                         tcp_flags_t flags, const void *options, size_t options_length, uint32_t ack, uint32_t sequence, uint16_t window_size,
+                         uint16_t gso_size) {
     DEBUG_ASSERT(options_length == 0 || options);
     DEBUG_ASSERT((options_length % 4) == 0);
 
     pktbuf_t *p = pktbuf_alloc();
-    if (!p)
+    if (!p) {
+        if (data)
+            pktbuf_free_chain(data, true);
         return ERR_NO_MEMORY;
+    }
 
-    tcp_header_t *header = pktbuf_prepend(p, sizeof(tcp_header_t) + options_length);
+    /* leave just enough room in front for the ip and ethernet headers and build the tcp
+     * header in the data area, so options don't eat into the space for lower layers */
+    pktbuf_reset(p, sizeof(struct ipv4_hdr) + sizeof(struct eth_hdr));
+    tcp_header_t *header = pktbuf_append(p, sizeof(tcp_header_t) + options_length);
     DEBUG_ASSERT(header);
 
     /* fill in the header */
@@ -744,21 +1395,31 @@ static status_t tcp_send(ipv4_addr dest_ip, uint16_t dest_port, ipv4_addr src_ip
     if (options)
         memcpy(header + 1, options, options_length);
 
-    /* append the data */
-    if (len > 0)
-        pktbuf_append_data(p, buf, len);
+    if (data)
+        pktbuf_chain(p, data);
 
-    /* compute the checksum */
-    /* XXX get the tx ckecksum capability from the nic */
-    if (FORCE_TCP_CHECKSUM || true) {
-        tcp_pseudo_header_t pheader;
-        pheader.source_addr = src_ip;
-        pheader.dest_addr = dest_ip;
-        pheader.zero = 0;
-        pheader.protocol = IP_PROTO_TCP;
-        pheader.tcp_length = htons(p->dlen);
+    uint32_t tcp_length = pktbuf_chain_len(p);
+    if (data && gso_size > 0 && tcp_length - p->dlen > gso_size) {
+        DEBUG_ASSERT(minip_eth_caps & MINIP_ETH_CAP_TSO4);
+        p->flags |= PKTBUF_FLAG_TSO;
+        p->gso_size = gso_size;
+    }
 
-        header->checksum = cksum_pheader(&pheader, p->data, p->dlen);
+    /* compute the checksum, or as much of it as the nic won't */
+    tcp_pseudo_header_t pheader;
+    pheader.source_addr = src_ip;
+    pheader.dest_addr = dest_ip;
+    pheader.zero = 0;
+    pheader.protocol = IP_PROTO_TCP;
+    pheader.tcp_length = htons(tcp_length);
+
+    if (!FORCE_TCP_CHECKSUM && (minip_eth_caps & MINIP_ETH_CAP_TX_CSUM_TCP)) {
+        header->checksum = ones_sum16(0, &pheader, sizeof(pheader));
+        p->flags |= PKTBUF_FLAG_CSUM_PARTIAL;
+        p->csum_start = 0;
+        p->csum_offset = offsetof(tcp_header_t, checksum);
+    } else {
+        header->checksum = cksum_pheader_chain(&pheader, p);
     }
 
     if (LOCAL_TRACE) {
@@ -771,7 +1432,94 @@ static status_t tcp_send(ipv4_addr dest_ip, uint16_t dest_port, ipv4_addr src_ip
     return err;
 }
 
-static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size) {
+/* fold the SACK blocks from an ack into the ranges we know they hold, and forget
+ * anything at or below the cumulative ack */
+static void update_sacked(tcp_socket_t *s, uint32_t ack, const tcp_options_t *options) {
+    DEBUG_ASSERT(is_mutex_held(&s->lock));
+
+    for (uint32_t i = 0; s->sack_ok && i < options->sack_count; i++) {
+        tcp_sack_block_t b = options->sack[i];
+        if (!SEQUENCE_LT(b.start, b.end) || SEQUENCE_LTE(b.end, ack) || SEQUENCE_GT(b.end, s->tx_highest_seq)) {
+            continue;
+        }
+
+        /* merge it with any range it overlaps or touches */
+        for (uint32_t j = 0; j < s->tx_sacked_count;) {
+            tcp_sack_block_t *r = &s->tx_sacked[j];
+            if (SEQUENCE_LTE(r->start, b.end) && SEQUENCE_LTE(b.start, r->end)) {
+                b.start = SEQUENCE_LT(r->start, b.start) ? r->start : b.start;
+                b.end = SEQUENCE_GT(r->end, b.end) ? r->end : b.end;
+                *r = s->tx_sacked[--s->tx_sacked_count];
+            } else {
+                j++;
+            }
+        }
+        if (s->tx_sacked_count < countof(s->tx_sacked)) {
+            s->tx_sacked[s->tx_sacked_count++] = b;
+        }
+    }
+
+    for (uint32_t j = 0; j < s->tx_sacked_count;) {
+        tcp_sack_block_t *r = &s->tx_sacked[j];
+        if (SEQUENCE_LTE(r->end, ack)) {
+            *r = s->tx_sacked[--s->tx_sacked_count];
+        } else {
+            if (SEQUENCE_LT(r->start, ack)) {
+                r->start = ack;
+            }
+            j++;
+        }
+    }
+}
+
+/* retransmit up to max_segments segments out of the holes they haven't told us they
+ * hold, picking up where the last call left off */
+static uint32_t tcp_sack_retransmit(tcp_socket_t *s, uint32_t max_segments) {
+    DEBUG_ASSERT(is_mutex_held(&s->lock));
+
+    uint32_t sent = 0;
+    const uint32_t data_end = tx_sent_data_end(s);
+    uint32_t sequence = SEQUENCE_LT(s->tx_rexmit_next, s->tx_win_low) ? s->tx_win_low : s->tx_rexmit_next;
+    while (max_segments > 0 && SEQUENCE_LT(sequence, data_end)) {
+        /* skip over anything they hold, otherwise find where the hole ends */
+        uint32_t hole_end = data_end;
+        bool covered = false;
+        for (uint32_t i = 0; i < s->tx_sacked_count; i++) {
+            const tcp_sack_block_t *r = &s->tx_sacked[i];
+            if (SEQUENCE_LTE(r->start, sequence) && SEQUENCE_LT(sequence, r->end)) {
+                sequence = r->end;
+                covered = true;
+                break;
+            }
+            if (SEQUENCE_GT(r->start, sequence) && SEQUENCE_LT(r->start, hole_end)) {
+                hole_end = r->start;
+            }
+        }
+        if (covered) {
+            continue;
+        }
+
+        uint32_t len = MIN(tcp_tx_mss(s), hole_end - sequence);
+        LTRACEF("s %p, retransmitting %u bytes at %u\n", s, len, sequence);
+        tcp_send_tx_data(s, sequence, len);
+        s->stat_retransmits++;
+
+        sequence += len;
+        max_segments--;
+        sent++;
+    }
+
+    s->tx_rexmit_next = sequence;
+
+    /* Karn's algorithm, an ack for a retransmitted segment is no measure of the rtt */
+    if (sent > 0) {
+        s->rtt_timing = false;
+    }
+
+    return sent;
+}
+
+static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size, const tcp_options_t *options, bool has_data) {
     LTRACEF("socket %p ack sequence %u, win_size %u\n", s, sequence, win_size);
 
     DEBUG_ASSERT(s);
@@ -779,12 +1527,45 @@ static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size) {
 
     LTRACEF("s %p, tx_win_low %u tx_win_high %u tx_highest_seq %u bufsize %u offset %u\n",
             s, s->tx_win_low, s->tx_win_high, s->tx_highest_seq, s->tx_buffer_size, s->tx_buffer_offset);
-    if (SEQUENCE_LTE(sequence, s->tx_win_low)) {
+    if (SEQUENCE_LT(sequence, s->tx_win_low)) {
         /* they're acking stuff we've already received an ack for */
         return;
     } else if (SEQUENCE_GT(sequence, s->tx_highest_seq)) {
         /* they're acking stuff we haven't sent */
         return;
+    }
+
+    update_sacked(s, sequence, options);
+
+    if (sequence == s->tx_win_low) {
+        uint32_t tx_win_high = s->tx_win_low + win_size;
+        bool window_update = (tx_win_high != s->tx_win_high);
+        s->tx_win_high = tx_win_high;
+
+        /* a duplicate ack while data is outstanding means something past the ack
+         * got there ahead of something that didn't */
+        if (!window_update && !has_data && s->tx_highest_seq != s->tx_win_low) {
+            s->tx_dup_acks++;
+            if (s->tx_in_recovery) {
+                /* another segment has left the network. fill the next hole they've told us
+                 * about with it if there is one, otherwise inflate the window to let a new
+                 * segment out in its place */
+                if (!s->tx_rto_recovery && (!s->sack_ok || tcp_sack_retransmit(s, 1) == 0)) {
+                    s->tx_cwnd += tcp_tx_mss(s);
+                }
+            } else if (s->tx_dup_acks >= DUP_ACK_THRESHOLD && SEQUENCE_GTE(sequence, s->tx_recover)) {
+                /* fast retransmit starting at the first hole, and fast recovery. don't start
+                 * it again for losses out of the window that was outstanding at the last one */
+                s->stat_fast_retransmits++;
+                s->tx_ssthresh = tcp_loss_ssthresh(s);
+                s->tx_cwnd = s->tx_ssthresh + DUP_ACK_THRESHOLD * tcp_tx_mss(s);
+                s->tx_in_recovery = true;
+                s->tx_rto_recovery = false;
+                s->tx_recover = s->tx_highest_seq;
+                s->tx_rexmit_next = s->tx_win_low;
+                tcp_sack_retransmit(s, 1);
+            }
+        }
     } else {
         /* their ack is somewhere in our window */
         uint32_t acked_len;
@@ -793,25 +1574,71 @@ static void handle_ack(tcp_socket_t *s, uint32_t sequence, uint32_t win_size) {
 
         LTRACEF("acked len %u\n", acked_len);
 
-        DEBUG_ASSERT(acked_len <= s->tx_buffer_size);
-        DEBUG_ASSERT(acked_len <= s->tx_buffer_offset);
+        /* the FIN takes up a sequence but isn't in the buffer */
+        uint32_t acked_data = MIN(acked_len, s->tx_buffer_offset);
 
-        memmove(s->tx_buffer, s->tx_buffer + acked_len, s->tx_buffer_offset - acked_len);
+        DEBUG_ASSERT(acked_data <= s->tx_buffer_size);
 
-        s->tx_buffer_offset -= acked_len;
+        s->tx_buffer_head = (s->tx_buffer_head + acked_data) % s->tx_buffer_size;
+        s->tx_buffer_offset -= acked_data;
         s->tx_win_low += acked_len;
         s->tx_win_high = s->tx_win_low + win_size;
+        s->tx_dup_acks = 0;
+
+        /* measure the round trip, off the timestamp they echoed if we have them */
+        if (s->ts_ok && options->has_timestamp && options->ts_ecr != 0) {
+            tcp_rtt_sample(s, (uint32_t)current_time() - options->ts_ecr);
+        } else if (s->rtt_timing && SEQUENCE_GTE(sequence, s->rtt_seq)) {
+            tcp_rtt_sample(s, current_time() - s->rtt_start);
+            s->rtt_timing = false;
+        }
+
+        const uint32_t mss = tcp_tx_mss(s);
+        if (!s->tx_in_recovery) {
+            tcp_cwnd_open(s, acked_len);
+        } else if (SEQUENCE_GTE(s->tx_win_low, s->tx_recover)) {
+            /* everything that was outstanding when the loss was noticed is acked */
+            if (s->tx_rto_recovery) {
+                tcp_cwnd_open(s, acked_len);
+            } else {
+                /* deflate the window back down from fast recovery */
+                uint32_t flight = s->tx_highest_seq - s->tx_win_low;
+                s->tx_cwnd = MIN(s->tx_ssthresh, flight + mss);
+            }
+            s->tx_in_recovery = false;
+            s->tx_rto_recovery = false;
+        } else if (s->tx_rto_recovery) {
+            /* still resending what was outstanding at the timeout, slow start as we go and
+             * tcp_write_pending_data() sends the next of it */
+            tcp_cwnd_open(s, acked_len);
+        } else {
+            /* partial ack, the next hole is lost too. take the acked data out of the
+             * inflated window and send the hole */
+            s->tx_cwnd = (s->tx_cwnd > acked_len) ? s->tx_cwnd - acked_len : 0;
+            if (acked_len >= mss) {
+                s->tx_cwnd += mss;
+            }
+            s->tx_cwnd = MAX(s->tx_cwnd, mss);
+
+            if (!s->sack_ok) {
+                s->tx_rexmit_next = s->tx_win_low;
+            }
+            tcp_sack_retransmit(s, 1);
+        }
 
         /* cancel or reset our retransmit timer */
         if (s->tx_win_low == s->tx_highest_seq) {
             tcp_timer_cancel(s, &s->retransmit_timer);
         } else {
-            tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, RETRANSMIT_TIMEOUT);
+            tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, s->rto);
         }
 
         /* we have opened the transmit buffer */
         event_signal(&s->tx_event, true);
     }
+
+    /* the window may have opened up for data we're holding */
+    tcp_write_pending_data(s);
 }
 
 static ssize_t tcp_write_pending_data(tcp_socket_t *s) {
@@ -823,24 +1650,80 @@ static ssize_t tcp_write_pending_data(tcp_socket_t *s) {
     DEBUG_ASSERT(s->tx_buffer_size > 0);
     DEBUG_ASSERT(s->tx_buffer_offset <= s->tx_buffer_size);
 
+    /* nothing can follow the FIN */
+    if (s->tx_fin_sent)
+        return 0;
+
+    /* after a timeout everything past the retransmit point is presumed lost, resend it as
+     * the congestion window opens before sending anything new */
+    if (s->tx_in_recovery && s->tx_rto_recovery) {
+        uint32_t rexmit_next = SEQUENCE_LT(s->tx_rexmit_next, s->tx_win_low) ? s->tx_win_low : s->tx_rexmit_next;
+        uint32_t pipe = rexmit_next - s->tx_win_low;
+        if (pipe < s->tx_cwnd) {
+            tcp_sack_retransmit(s, (s->tx_cwnd - pipe) / tcp_tx_mss(s));
+        }
+        if (SEQUENCE_LT(s->tx_rexmit_next, tx_sent_data_end(s))) {
+            return 0;
+        }
+    }
+
     /* do we have any new data to send? */
     uint32_t outstanding = (s->tx_highest_seq - s->tx_win_low);
     uint32_t pending = s->tx_buffer_offset - outstanding;
     LTRACEF("outstanding %u, pending %u\n", outstanding, pending);
 
+    /* only send what fits in both the window they've advertised and the congestion window */
+    uint32_t win_end = s->tx_win_high;
+    if (SEQUENCE_LT(s->tx_win_low + s->tx_cwnd, win_end)) {
+        win_end = s->tx_win_low + s->tx_cwnd;
+    }
+    uint32_t window = SEQUENCE_GT(win_end, s->tx_highest_seq) ? win_end - s->tx_highest_seq : 0;
+
     /* send packets that cover the pending area of the window */
+    const uint32_t mss = tcp_tx_mss(s);
+    const uint32_t tso_max = tcp_tx_tso_max(s);
     uint32_t offset = 0;
-    while (offset < pending) {
-        uint32_t tosend = MIN(s->mss, pending - offset);
+    while (offset < pending && offset < window) {
+        uint32_t tosend = MIN(tso_max, pending - offset);
+        if (tosend > window - offset) {
+            uint32_t room = window - offset;
+            if (room >= mss) {
+                /* cut a large segment back to the whole segments that fit */
+                tosend = room - room % mss;
+            } else {
+                /* don't dribble out a runt segment while there are acks coming that will
+                 * open the window further */
+                if (s->tx_highest_seq != s->tx_win_low)
+                    break;
+                tosend = room;
+            }
+        }
+
+        /* time a segment if the timestamps aren't doing it for us */
+        if (!s->ts_ok && !s->rtt_timing) {
+            s->rtt_timing = true;
+            s->rtt_seq = s->tx_highest_seq + tosend;
+            s->rtt_start = current_time();
+        }
 
-        tcp_socket_send(s, s->tx_buffer + outstanding + offset, tosend, PKT_ACK|PKT_PSH, NULL, 0, s->tx_highest_seq);
+        tcp_send_tx_data(s, s->tx_highest_seq, tosend);
         s->tx_highest_seq += tosend;
         offset += tosend;
     }
 
-    /* reset the retransmit timer if we sent anything */
-    if (offset > 0) {
-        tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, RETRANSMIT_TIMEOUT);
+    /* once all the data is out, follow it with the FIN if we're closing */
+    bool sent_fin = false;
+    if (s->tx_fin_queued && s->tx_highest_seq == s->tx_win_low + s->tx_buffer_offset) {
+        tcp_socket_send(s, NULL, PKT_ACK|PKT_FIN, s->tx_highest_seq);
+        s->tx_highest_seq++;
+        s->tx_fin_sent = true;
+        sent_fin = true;
+    }
+
+    /* reset the retransmit timer if we sent anything, or if we have data the window
+     * won't let us send so it can probe for the window opening */
+    if (offset > 0 || sent_fin || (outstanding == 0 && s->tx_buffer_offset > 0)) {
+        tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, s->rto);
     }
 
     return offset;
@@ -850,20 +1733,52 @@ static ssize_t tcp_retransmit(tcp_socket_t *s) {
     DEBUG_ASSERT(s);
     DEBUG_ASSERT(is_mutex_held(&s->lock));
 
-    if (s->state != STATE_ESTABLISHED && s->state != STATE_CLOSE_WAIT)
+    if (s->state != STATE_ESTABLISHED && s->state != STATE_CLOSE_WAIT &&
+            s->state != STATE_FIN_WAIT_1 && s->state != STATE_CLOSING && s->state != STATE_LAST_ACK)
         return 0;
 
-    /* how much data have we sent but not gotten an ack for? */
-    uint32_t outstanding = (s->tx_highest_seq - s->tx_win_low);
-    if (outstanding == 0)
+    if (s->tx_win_low == s->tx_highest_seq && (s->tx_fin_sent || s->tx_buffer_offset == 0))
         return 0;
 
-    uint32_t tosend = MIN(s->mss, outstanding);
+    /* back the timer off, RFC 6298 section 5.5 */
+    s->stat_timeouts++;
+    s->rto = MIN(s->rto * 2, (uint32_t)MAX_RTO);
+    s->rtt_timing = false;
 
-    LTRACEF("s %p, tosend %u seq %u\n", s, tosend, s->tx_win_low);
-    tcp_socket_send(s, s->tx_buffer, tosend, PKT_ACK|PKT_PSH, NULL, 0, s->tx_win_low);
+    /* how much data have we sent but not gotten an ack for? */
+    uint32_t outstanding = (tx_sent_data_end(s) - s->tx_win_low);
+    if (outstanding == 0) {
+        if (s->tx_fin_sent) {
+            /* only the FIN is left */
+            LTRACEF("s %p, retransmitting FIN seq %u\n", s, s->tx_win_low);
+            tcp_socket_send(s, NULL, PKT_ACK|PKT_FIN, s->tx_win_low);
+            s->stat_retransmits++;
+            return 1;
+        }
 
-    return tosend;
+        /* their window is closed on data we have, probe it with a byte */
+        LTRACEF("s %p, window probe seq %u\n", s, s->tx_highest_seq);
+        tcp_send_tx_data(s, s->tx_highest_seq, 1);
+        s->tx_highest_seq++;
+        return 1;
+    }
+
+    /* a segment was lost, collapse the congestion window and resend everything that was
+     * outstanding as it opens back up, RFC 5681 section 3.1. the threshold is only cut
+     * the first time a segment is retransmitted */
+    if (!s->tx_in_recovery || !s->tx_rto_recovery) {
+        s->tx_ssthresh = tcp_loss_ssthresh(s);
+    }
+    s->tx_cwnd = tcp_tx_mss(s);
+    s->tx_cwnd_acked = 0;
+    s->tx_dup_acks = 0;
+    s->tx_in_recovery = true;
+    s->tx_rto_recovery = true;
+    s->tx_recover = s->tx_highest_seq;
+    s->tx_rexmit_next = s->tx_win_low;
+
+    LTRACEF("s %p, seq %u\n", s, s->tx_win_low);
+    return tcp_sack_retransmit(s, 1);
 }
 
 static void handle_retransmit_timeout(void *_s) {
@@ -878,7 +1793,7 @@ static void handle_retransmit_timeout(void *_s) {
     if (tcp_retransmit(s) == 0)
         goto done;
 
-    tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, RETRANSMIT_TIMEOUT);
+    tcp_timer_set(s, &s->retransmit_timer, &handle_retransmit_timeout, s->rto);
 
 done:
     mutex_release(&s->lock);
@@ -910,7 +1825,7 @@ static void handle_time_wait_timeout(void *_s) {
     DEBUG_ASSERT(s->state == STATE_TIME_WAIT);
 
     /* remove us from the list and drop the last ref */
-    remove_socket_from_list(s);
+    remove_socket_from_hash(s);
     dec_socket_ref(s);
 
     mutex_release(&s->lock);
@@ -945,35 +1860,54 @@ static void tcp_remote_close(tcp_socket_t *s) {
     tcp_wakeup_waiters(s);
 }
 
-static tcp_socket_t *create_tcp_socket(bool alloc_buffers) {
+static tcp_socket_t *create_tcp_socket(bool alloc_buffers, uint32_t rx_buffer_size, uint32_t tx_buffer_size) {
     tcp_socket_t *s;
 
-    s = calloc(1, sizeof(tcp_socket_t));
+    s = slab_alloc(&tcp_socket_cache);
     if (!s)
         return NULL;
+    memset(s, 0, sizeof(*s));
+
+    /* sockets that aren't listening hold onto the sizes to hand to the sockets they accept */
+    s->rx_win_size = rx_buffer_size;
+    s->tx_buffer_size = tx_buffer_size;
+
+    if (alloc_buffers) {
+        s->rx_buffer_raw = malloc(s->rx_win_size);
+        s->tx_buffer = malloc(s->tx_buffer_size);
+        if (!s->rx_buffer_raw || !s->tx_buffer) {
+            free(s->rx_buffer_raw);
+            free(s->tx_buffer);
+            slab_free(&tcp_socket_cache, s);
+            return NULL;
+        }
+        cbuf_initialize_etc(&s->rx_buffer, s->rx_win_size, s->rx_buffer_raw);
+    }
 
     mutex_init(&s->lock);
     s->ref = 1; // start with the ref already bumped
 
     s->state = STATE_CLOSED;
-    s->rx_win_size = DEFAULT_RX_WINDOW_SIZE;
     event_init(&s->rx_event, false, 0);
+    event_init(&s->rx_lend_event, true, 0);
+    list_initialize(&s->rx_ooo_list);
 
     s->mss = DEFAULT_MSS;
 
+    /* offer all the options we support, the SYN exchange trims this down */
+    s->wscale_ok = true;
+    s->rcv_wscale = RX_WINDOW_SCALE;
+    s->sack_ok = true;
+    s->ts_ok = true;
+
     s->tx_win_low = rand();
     s->tx_win_high = s->tx_win_low;
     s->tx_highest_seq = s->tx_win_low;
     event_init(&s->tx_event, true, 0);
+    event_init(&s->tx_refs_event, true, 0);
 
-    if (alloc_buffers) {
-        // XXX check for error
-        s->rx_buffer_raw = malloc(s->rx_win_size);
-        cbuf_initialize_etc(&s->rx_buffer, s->rx_win_size, s->rx_buffer_raw);
-
-        s->tx_buffer_size = DEFAULT_TX_BUFFER_SIZE;
-        s->tx_buffer = malloc(s->tx_buffer_size);
-    }
+    s->rto = INITIAL_RTO;
+    tcp_cc_init(s);
 
     sem_init(&s->accept_sem, 0);
     event_init(&s->connect_event, false, 0);
@@ -981,14 +1915,104 @@ static tcp_socket_t *create_tcp_socket(bool alloc_buffers) {
     return s;
 }
 
+/* round a requested buffer size to what we can use, 0 if it's out of range */
+static uint32_t tcp_buffer_size(uint32_t size) {
+    if (size < MIN_SOCKET_BUFFER_SIZE || size > MAX_SOCKET_BUFFER_SIZE)
+        return 0;
+
+    /* the receive side is a cbuf, which needs a power of 2 */
+    return round_up_pow2_u32(size);
+}
+
+static status_t resize_rx_buffer(tcp_socket_t *s, uint32_t size) {
+    DEBUG_ASSERT(is_mutex_held(&s->lock));
+
+    if (size < s->rx_win_size)
+        return ERR_INVALID_ARGS;
+    if (size == s->rx_win_size)
+        return NO_ERROR;
+    if (s->rx_lent_len > 0)
+        return ERR_BUSY;
+
+    uint8_t *raw = malloc(size);
+    if (!raw)
+        return ERR_NO_MEMORY;
+
+    /* move whatever hasn't been read yet over to the new buffer */
+    size_t used = cbuf_space_used(&s->rx_buffer);
+    uint8_t *temp = NULL;
+    if (used > 0) {
+        temp = malloc(used);
+        if (!temp) {
+            free(raw);
+            return ERR_NO_MEMORY;
+        }
+        cbuf_read(&s->rx_buffer, temp, used, false);
+    }
+
+    free(s->rx_buffer_raw);
+    s->rx_buffer_raw = raw;
+    s->rx_win_size = size;
+    cbuf_initialize_etc(&s->rx_buffer, s->rx_win_size, s->rx_buffer_raw);
+    if (temp) {
+        cbuf_write(&s->rx_buffer, temp, used, false);
+        free(temp);
+    }
+
+    return NO_ERROR;
+}
+
+static status_t resize_tx_buffer(tcp_socket_t *s, uint32_t size) {
+    DEBUG_ASSERT(is_mutex_held(&s->lock));
+
+    if (size < s->tx_buffer_size)
+        return ERR_INVALID_ARGS;
+    if (size == s->tx_buffer_size)
+        return NO_ERROR;
+
+    uint8_t *buf = malloc(size);
+    if (!buf)
+        return ERR_NO_MEMORY;
+
+    /* unwrap the ring into the start of the new buffer */
+    uint32_t first = MIN(s->tx_buffer_offset, s->tx_buffer_size - s->tx_buffer_head);
+    memcpy(buf, s->tx_buffer + s->tx_buffer_head, first);
+    memcpy(buf + first, s->tx_buffer, s->tx_buffer_offset - first);
+
+    wait_for_tx_refs(s);
+    free(s->tx_buffer);
+    s->tx_buffer = buf;
+    s->tx_buffer_size = size;
+    s->tx_buffer_head = 0;
+
+    /* there's room to write again */
+    event_signal(&s->tx_event, true);
+
+    return NO_ERROR;
+}
+
 /* user api */
+void tcp_init(void) {
+    for (size_t i = 0; i < countof(tcp_conn_hash); i++) {
+        mutex_init(&tcp_conn_hash[i].lock);
+        list_initialize(&tcp_conn_hash[i].list);
+    }
+    for (size_t i = 0; i < countof(tcp_listen_hash); i++) {
+        mutex_init(&tcp_listen_hash[i].lock);
+        list_initialize(&tcp_listen_hash[i].list);
+    }
+
+    slab_cache_init(&tcp_socket_cache, "tcp socket", sizeof(tcp_socket_t), __alignof(tcp_socket_t),
+                    SLAB_FLAG_CACHE_ALIGN, NULL);
+}
+
 status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port) {
     tcp_socket_t *s;
 
     if (!handle)
         return ERR_INVALID_ARGS;
 
-    s = create_tcp_socket(true);
+    s = create_tcp_socket(true, DEFAULT_RX_WINDOW_SIZE, DEFAULT_TX_BUFFER_SIZE);
     if (!s)
         return ERR_NO_MEMORY;
 
@@ -1011,15 +2035,9 @@ status_t tcp_connect(tcp_socket_t **handle, uint32_t addr, uint16_t port) {
     mutex_acquire(&s->lock);
 
     s->state = STATE_SYN_SENT;
-    add_socket_to_list(s);
+    add_socket_to_hash(s);
 
-    /* set up a mss option for sending back */
-    tcp_mss_option_t mss_option;
-    mss_option.kind = 0x2;
-    mss_option.len = 0x4;
-    mss_option.mss = ntohs(s->mss);
-
-    tcp_send(s->remote_ip, s->remote_port, s->local_ip, s->local_port, NULL, 0, PKT_SYN, &mss_option, 0x4, 0, s->tx_win_low, s->rx_win_size);
+    tcp_socket_send(s, NULL, PKT_SYN, s->tx_win_low);
 
     // TODO: handle retransmit
 
@@ -1048,7 +2066,7 @@ status_t tcp_open_listen(tcp_socket_t **handle, uint16_t port) {
     if (!handle)
         return ERR_INVALID_ARGS;
 
-    s = create_tcp_socket(false);
+    s = create_tcp_socket(false, DEFAULT_RX_WINDOW_SIZE, DEFAULT_TX_BUFFER_SIZE);
     if (!s)
         return ERR_NO_MEMORY;
 
@@ -1059,7 +2077,7 @@ status_t tcp_open_listen(tcp_socket_t **handle, uint16_t port) {
     /* go to listen state */
     s->state = STATE_LISTEN;
 
-    add_socket_to_list(s);
+    add_socket_to_hash(s);
 
     *handle = s;
 
@@ -1092,6 +2110,24 @@ status_t tcp_accept_timeout(tcp_socket_t *listen_socket, tcp_socket_t **accept_s
     return NO_ERROR;
 }
 
+/* data was taken out of the receive buffer, tell the other end if the window opened up */
+static void tcp_rx_consumed(tcp_socket_t *s) {
+    DEBUG_ASSERT(is_mutex_held(&s->lock));
+
+    /* if we've used up the last byte in the read buffer, unsignal the read event */
+    size_t remaining_bytes = cbuf_space_used(&s->rx_buffer);
+    if (s->state == STATE_ESTABLISHED && remaining_bytes == 0) {
+        event_unsignal(&s->rx_event);
+    }
+
+    /* we've read something, make sure the other end knows that our window is opening */
+    uint32_t new_rx_win_size = s->rx_win_size - remaining_bytes;
+
+    /* if we've opened it enough, send an ack */
+    if (new_rx_win_size >= s->mss && s->rx_win_high - s->rx_win_low < s->mss)
+        send_ack(s);
+}
+
 ssize_t tcp_read(tcp_socket_t *socket, void *buf, size_t len) {
     LTRACEF("socket %p, buf %p, len %zu\n", socket, buf, len);
     if (!socket)
@@ -1111,6 +2147,13 @@ retry:
 
     mutex_acquire(&s->lock);
 
+    /* the front of the buffer is lent out by tcp_read_pktbuf(), wait for it to come back */
+    if (s->rx_lent_len > 0) {
+        mutex_release(&s->lock);
+        event_wait(&s->rx_lend_event);
+        goto retry;
+    }
+
     /* try to read some data from the receive buffer, even if we're closed */
     ret = cbuf_read(&s->rx_buffer, buf, len, false);
     if (ret == 0) {
@@ -1126,18 +2169,111 @@ retry:
         goto retry;
     }
 
-    /* if we've used up the last byte in the read buffer, unsignal the read event */
-    size_t remaining_bytes = cbuf_space_used(&s->rx_buffer);
-    if (s->state == STATE_ESTABLISHED && remaining_bytes == 0) {
+    tcp_rx_consumed(s);
+
+out:
+    mutex_release(&s->lock);
+    dec_socket_ref(s);
+
+    return ret;
+}
+
+/* the pktbuf from tcp_read_pktbuf() is being freed, possibly from interrupt context */
+static void tcp_rx_lend_release(void *buf, void *arg) {
+    tcp_socket_t *s = arg;
+
+    int oldval = atomic_add(&s->rx_lent_parts, -1);
+    DEBUG_ASSERT(oldval > 0);
+
+    /* all of it is back, hand the ref tcp_read_pktbuf() took to the timer that cleans up */
+    if (oldval == 1)
+        net_timer_set(&s->rx_lend_timer, &handle_rx_lend_returned, s, 0);
+}
+
+static void handle_rx_lend_returned(void *_s) {
+    tcp_socket_t *s = _s;
+
+    mutex_acquire(&s->lock);
+
+    /* drop the data out of the buffer */
+    DEBUG_ASSERT(s->rx_lent_len > 0);
+    cbuf_read(&s->rx_buffer, NULL, s->rx_lent_len, false);
+    s->rx_lent_len = 0;
+    tcp_rx_consumed(s);
+    event_signal(&s->rx_lend_event, false);
+
+    mutex_release(&s->lock);
+
+    dec_socket_ref(s);
+}
+
+ssize_t tcp_read_pktbuf(tcp_socket_t *socket, pktbuf_t **p) {
+    LTRACEF("socket %p\n", socket);
+    if (!socket || !p)
+        return ERR_INVALID_ARGS;
+
+    tcp_socket_t *s = socket;
+    inc_socket_ref(s);
+
+    ssize_t ret = 0;
+retry:
+    /* block on available data */
+    event_wait(&s->rx_event);
+
+    mutex_acquire(&s->lock);
+
+    /* only one can be lent out at a time, wait for the last one to come back */
+    if (s->rx_lent_len > 0) {
+        mutex_release(&s->lock);
+        event_wait(&s->rx_lend_event);
+        goto retry;
+    }
+
+    iovec_t regions[2];
+    size_t len = cbuf_peek(&s->rx_buffer, regions);
+    if (len == 0) {
+        /* check to see if we've closed */
+        if (s->state != STATE_ESTABLISHED) {
+            ret = ERR_CHANNEL_CLOSED;
+            goto out;
+        }
+
+        /* we must have raced with another thread */
         event_unsignal(&s->rx_event);
+        mutex_release(&s->lock);
+        goto retry;
     }
 
-    /* we've read something, make sure the other end knows that our window is opening */
-    uint32_t new_rx_win_size = s->rx_win_size - remaining_bytes;
+    /* point a pktbuf at the data where it sits in the receive buffer, which may wrap */
+    size_t first = MIN(regions[0].iov_len, (size_t)MAX_RX_LEND);
+    size_t second = MIN(regions[1].iov_len, MAX_RX_LEND - first);
+    pktbuf_t *head = pktbuf_alloc_ref(regions[0].iov_base, first, &tcp_rx_lend_release, s);
+    if (head && second > 0) {
+        pktbuf_t *wrapped = pktbuf_alloc_ref(regions[1].iov_base, second, &tcp_rx_lend_release, s);
+        if (!wrapped) {
+            free_unused_refs(head);
+            head = NULL;
+        } else {
+            pktbuf_chain(head, wrapped);
+        }
+    }
+    if (!head) {
+        ret = ERR_NO_MEMORY;
+        goto out;
+    }
 
-    /* if we've opened it enough, send an ack */
-    if (new_rx_win_size >= s->mss && s->rx_win_high - s->rx_win_low < s->mss)
-        send_ack(s);
+    /* the data stays in the buffer, holding the window closed over it, until it's freed */
+    int parts = 0;
+    for (pktbuf_t *part = head; part; part = part->next) {
+        parts++;
+    }
+    atomic_add(&s->rx_lent_parts, parts);
+    s->rx_lent_len = first + second;
+    event_unsignal(&s->rx_lend_event);
+    inc_socket_ref(s);
+
+    *p = head;
+    ret = first + second;
 
 out:
     mutex_release(&s->lock);
@@ -1185,7 +2321,11 @@ ssize_t tcp_write(tcp_socket_t *socket, const void *buf, size_t len) {
             continue;
         }
 
-        memcpy(s->tx_buffer + s->tx_buffer_offset, (uint8_t *)buf + off, to_copy);
+        /* append to the ring, which may wrap */
+        uint32_t tail = (s->tx_buffer_head + s->tx_buffer_offset) % s->tx_buffer_size;
+        size_t first = MIN(to_copy, s->tx_buffer_size - tail);
+        memcpy(s->tx_buffer + tail, (uint8_t *)buf + off, first);
+        memcpy(s->tx_buffer, (uint8_t *)buf + off + first, to_copy - first);
         s->tx_buffer_offset += to_copy;
 
         /* if this has completely filled it, unsignal the event */
@@ -1206,6 +2346,50 @@ ssize_t tcp_write(tcp_socket_t *socket, const void *buf, size_t len) {
     return len;
 }
 
+status_t tcp_setsockopt(tcp_socket_t *socket, tcp_sockopt_t opt, uint32_t value) {
+    if (!socket)
+        return ERR_INVALID_ARGS;
+
+    uint32_t size = tcp_buffer_size(value);
+    if (size == 0)
+        return ERR_INVALID_ARGS;
+
+    tcp_socket_t *s = socket;
+    inc_socket_ref(s);
+    mutex_acquire(&s->lock);
+
+    status_t err;
+    bool has_buffers = (s->state != STATE_LISTEN);
+    switch (opt) {
+        case TCP_SOCKOPT_RCVBUF:
+            if (has_buffers) {
+                err = resize_rx_buffer(s, size);
+                /* let them know about the bigger window */
+                if (err == NO_ERROR)
+                    send_ack(s);
+            } else {
+                s->rx_win_size = size;
+                err = NO_ERROR;
+            }
+            break;
+        case TCP_SOCKOPT_SNDBUF:
+            if (has_buffers) {
+                err = resize_tx_buffer(s, size);
+            } else {
+                s->tx_buffer_size = size;
+                err = NO_ERROR;
+            }
+            break;
+        default:
+            err = ERR_NOT_SUPPORTED;
+    }
+
+    mutex_release(&s->lock);
+    dec_socket_ref(s);
+
+    return err;
+}
+
 status_t tcp_close(tcp_socket_t *socket) {
     if (!socket)
         return ERR_INVALID_ARGS;
@@ -1222,7 +2406,7 @@ status_t tcp_close(tcp_socket_t *socket) {
         case STATE_CLOSED:
         case STATE_LISTEN:
             /* we can directly remove this socket */
-            remove_socket_from_list(s);
+            remove_socket_from_hash(s);
 
             /* drop any timers that may be pending on this */
             tcp_timer_cancel(s, &s->ack_delay_timer);
@@ -1236,17 +2420,17 @@ status_t tcp_close(tcp_socket_t *socket) {
         case STATE_SYN_RCVD:
         case STATE_ESTABLISHED:
             s->state = STATE_FIN_WAIT_1;
-            tcp_socket_send(s, NULL, 0, PKT_ACK|PKT_FIN, NULL, 0, s->tx_win_low);
-            s->tx_win_low++;
+
+            /* the FIN goes out behind any data still in the buffer */
+            s->tx_fin_queued = true;
+            tcp_write_pending_data(s);
 
             /* stick around and wait for them to FIN us */
             break;
         case STATE_CLOSE_WAIT:
             s->state = STATE_LAST_ACK;
-            tcp_socket_send(s, NULL, 0, PKT_ACK|PKT_FIN, NULL, 0, s->tx_win_low);
-            s->tx_win_low++;
-
-            // XXX set up fin retransmit timer here
+            s->tx_fin_queued = true;
+            tcp_write_pending_data(s);
             break;
         case STATE_SYN_SENT:
         case STATE_FIN_WAIT_1:
@@ -1276,6 +2460,16 @@ out:
 }
 
 /* debug stuff */
+static void tcp_print_rate(const char *what, uint64_t bytes, lk_bigtime_t usecs) {
+    if (usecs == 0)
+        usecs = 1;
+
+    /* MB/s with two decimal places, without dragging in floating point */
+    uint64_t rate = bytes * 100 * 1000000 / usecs / (1024 * 1024);
+    printf("%s %llu bytes in %llu usecs, %llu.%02llu MB/s\n", what, (unsigned long long)bytes,
+           (unsigned long long)usecs, (unsigned long long)(rate / 100), (unsigned long long)(rate % 100));
+}
+
 static int cmd_tcp(int argc, const console_cmd_args *argv) {
     if (argc < 2) {
 notenoughargs:
@@ -1285,17 +2479,26 @@ usage:
         printf("usage: %s listenclose <port>\n", argv[0].str);
         printf("usage: %s listen <port>\n", argv[0].str);
         printf("usage: %s debug\n", argv[0].str);
+        printf("usage: %s bench <ip> <port> <megabytes> [bufsize]\n", argv[0].str);
+        printf("usage: %s sink <port> [bufsize]\n", argv[0].str);
         return ERR_INVALID_ARGS;
     }
 
     if (!strcmp(argv[1].str, "sockets")) {
 
-        mutex_acquire(&tcp_socket_list_lock);
-        tcp_socket_t *s = NULL;
-        list_for_every_entry(&tcp_socket_list, s, tcp_socket_t, node) {
-            dump_socket(s);
+        struct tcp_hash_bucket *tables[] = { tcp_listen_hash, tcp_conn_hash };
+        size_t sizes[] = { countof(tcp_listen_hash), countof(tcp_conn_hash) };
+        for (size_t t = 0; t < countof(tables); t++) {
+            for (size_t i = 0; i < sizes[t]; i++) {
+                struct tcp_hash_bucket *b = &tables[t][i];
+                mutex_acquire(&b->lock);
+                tcp_socket_t *s = NULL;
+                list_for_every_entry(&b->list, s, tcp_socket_t, node) {
+                    dump_socket(s);
+                }
+                mutex_release(&b->lock);
+            }
         }
-        mutex_release(&tcp_socket_list_lock);
     } else if (!strcmp(argv[1].str, "listenclose")) {
         /* listen for a connection, accept it, then immediately close it */
         if (argc < 3) goto notenoughargs;
@@ -1348,6 +2551,89 @@ usage:
 
         err = tcp_close(handle);
         printf("tcp_close returns %d\n", err);
+    } else if (!strcmp(argv[1].str, "bench")) {
+        /* connect and push data as fast as possible, pair with 'sink' on another
+         * machine or a discard server on the other end of a tap */
+        if (argc < 5) goto notenoughargs;
+
+        uint32_t addr = minip_parse_ipaddr(argv[2].str, strlen(argv[2].str));
+        uint64_t total = (uint64_t)argv[4].u * 1024 * 1024;
+        uint32_t bufsize = (argc >= 6) ? argv[5].u : 256 * 1024;
+
+        tcp_socket_t *handle = NULL;
+        status_t err = tcp_connect(&handle, addr, argv[3].u);
+        if (err < 0) {
+            printf("tcp_connect returns %d\n", err);
+            return err;
+        }
+        tcp_setsockopt(handle, TCP_SOCKOPT_SNDBUF, bufsize);
+        tcp_setsockopt(handle, TCP_SOCKOPT_RCVBUF, bufsize);
+
+        const size_t chunk = 64 * 1024;
+        uint8_t *buf = malloc(chunk);
+        if (!buf) {
+            tcp_close(handle);
+            return ERR_NO_MEMORY;
+        }
+        memset(buf, 0x55, chunk);
+
+        uint64_t sent = 0;
+        lk_bigtime_t t = current_time_hires();
+        while (sent < total) {
+            ssize_t ret = tcp_write(handle, buf, MIN(chunk, total - sent));
+            if (ret < 0) {
+                printf("tcp_write returns %ld\n", ret);
+                break;
+            }
+            sent += ret;
+        }
+        t = current_time_hires() - t;
+
+        dump_socket(handle);
+        tcp_close(handle);
+        free(buf);
+
+        tcp_print_rate("sent", sent, t);
+    } else if (!strcmp(argv[1].str, "sink")) {
+        /* accept one connection and read until it closes */
+        if (argc < 3) goto notenoughargs;
+
+        uint32_t bufsize = (argc >= 4) ? argv[3].u : 256 * 1024;
+
+        tcp_socket_t *handle = NULL;
+        status_t err = tcp_open_listen(&handle, argv[2].u);
+        if (err < 0) {
+            printf("tcp_open_listen returns %d\n", err);
+            return err;
+        }
+        tcp_setsockopt(handle, TCP_SOCKOPT_RCVBUF, bufsize);
+        tcp_setsockopt(handle, TCP_SOCKOPT_SNDBUF, bufsize);
+
+        tcp_socket_t *accepted;
+        err = tcp_accept(handle, &accepted);
+        if (err < 0) {
+            printf("tcp_accept returns %d\n", err);
+            tcp_close(handle);
+            return err;
+        }
+
+        /* take the data straight out of the socket buffer, there's nothing to copy it to */
+        uint64_t received = 0;
+        lk_bigtime_t t = current_time_hires();
+        for (;;) {
+            pktbuf_t *p;
+            ssize_t ret = tcp_read_pktbuf(accepted, &p);
+            if (ret <= 0)
+                break;
+            received += ret;
+            pktbuf_free_chain(p, true);
+        }
+        t = current_time_hires() - t;
+
+        tcp_close(accepted);
+        tcp_close(handle);
+
+        tcp_print_rate("received", received, t);
     } else if (!strcmp(argv[1].str, "debug")) {
         tcp_debug = !tcp_debug;
         printf("tcp debug now %u\n", tcp_debug);
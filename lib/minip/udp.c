@@ -15,6 +15,7 @@
 #include <iovec.h>
 #include <lk/list.h>
 #include <malloc.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <lk/trace.h>
 
@@ -144,8 +145,25 @@ status_t udp_send_iovec(const iovec_t *iov, uint iov_count, udp_socket_t *handle
     minip_build_mac_hdr(eth, handle->mac, ETH_TYPE_IPV4);
     minip_build_ipv4_hdr(ip, handle->host, IP_PROTO_UDP, len + sizeof(udp_hdr_t));
 
+    if (minip_eth_caps & MINIP_ETH_CAP_TX_CSUM_UDP) {
+        /* the nic sums the udp header and payload on top of the pseudo header */
+        struct {
+            uint32_t src_addr;
+            uint32_t dst_addr;
+            uint8_t zero;
+            uint8_t proto;
+            uint16_t len;
+        } __PACKED pheader = { ip->src_addr, ip->dst_addr, 0, IP_PROTO_UDP, udp->len };
+
+        udp->chksum = ones_sum16(0, &pheader, sizeof(pheader));
+        p->flags |= PKTBUF_FLAG_CSUM_PARTIAL;
+        p->csum_start = (uint8_t *)udp - p->data;
+        p->csum_offset = offsetof(udp_hdr_t, chksum);
+    }
 #if (MINIP_USE_UDP_CHECKSUM != 0)
-    udp->chksum = rfc768_chksum(ip, udp);
+    else {
+        udp->chksum = rfc768_chksum(ip, udp);
+    }
 #endif
 
     LTRACEF("packet paylod len %ld\n", len);
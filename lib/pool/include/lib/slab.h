@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#pragma once
+
+#include <arch/ops.h>
+#include <kernel/mutex.h>
+#include <kernel/spinlock.h>
+#include <lib/pool.h>
+#include <lk/compiler.h>
+#include <lk/list.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+__BEGIN_CDECLS
+
+/**
+ * A growable allocator for fixed size objects.
+ *
+ * Objects are carved out of slabs of whole pages, taken from the pmm as the cache
+ * needs them, and kept on a pool_t free list. Each cpu keeps a short list of free
+ * objects in front of that, so allocating and freeing usually only touches cpu
+ * local state. Slabs are held until the cache is destroyed.
+ *
+ * Typical usage:
+ *
+ * static slab_cache_t foo_cache;
+ *
+ * slab_cache_init(&foo_cache, "foo", sizeof(foo_t), __alignof(foo_t), 0, NULL);
+ *
+ * foo_t *foo = slab_alloc(&foo_cache);
+ * ...
+ * slab_free(&foo_cache, foo);
+ */
+
+/* pad objects out to a cache line so they never share one */
+#define SLAB_FLAG_CACHE_ALIGN 0x1
+
+/* Called on every object as it is handed out by slab_alloc(). */
+typedef void (*slab_ctor_t)(void *object);
+
+/* Private: a cpu's list of free objects. */
+struct slab_cpu_cache {
+    spin_lock_t lock;
+    uint count;
+    pool_t free;
+    ulong allocs;
+    ulong frees;
+} __CPU_ALIGN;
+
+typedef struct slab_cache {
+    // Private:
+    struct list_node node;
+    const char *name;
+    size_t object_size;
+    size_t align;
+    size_t first_offset;
+    size_t slab_size;
+    uint slab_objects;
+    uint flags;
+    slab_ctor_t ctor;
+
+    /* serializes growing the cache */
+    mutex_t grow_lock;
+
+    /* the free objects not held by any cpu and the slabs they came from */
+    spin_lock_t lock;
+    pool_t free;
+    size_t free_count;
+    size_t total_count;
+    uint slab_count;
+    struct list_node slabs;
+
+    struct slab_cpu_cache cpu[SMP_MAX_CPUS];
+} slab_cache_t;
+
+/**
+ * Initialize a cache of objects of object_size bytes aligned to align. The alignment
+ * must be a power of two no larger than a page. name is not copied. ctor may be NULL.
+ */
+void slab_cache_init(slab_cache_t *cache, const char *name, size_t object_size, size_t align,
+                     uint flags, slab_ctor_t ctor);
+
+/**
+ * Return all of the cache's slabs to the pmm. Every object must have been freed.
+ */
+void slab_cache_destroy(slab_cache_t *cache);
+
+/**
+ * Allocate an object from the cache. May block to grow the cache, so like malloc()
+ * must not be called from interrupt context or with a spinlock held.
+ * Returns NULL if the cache is empty and can't grow.
+ */
+void *slab_alloc(slab_cache_t *cache);
+
+/**
+ * Return an object to the cache. Never blocks, so is safe to call with a spinlock held.
+ */
+void slab_free(slab_cache_t *cache, void *object);
+
+__END_CDECLS
@@ -3,6 +3,7 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 MODULE := $(LOCAL_DIR)
 
 MODULE_SRCS += \
-	$(LOCAL_DIR)/pool.c
+	$(LOCAL_DIR)/pool.c \
+	$(LOCAL_DIR)/slab.c
 
 include make/module.mk
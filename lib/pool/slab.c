@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2026 Travis Geiselbrecht
+ *
+ * Use of this source code is governed by a MIT-style
+ * license that can be found in the LICENSE file or at
+ * https://opensource.org/licenses/MIT
+ */
+#include <lib/slab.h>
+
+#include <arch/defines.h>
+#include <assert.h>
+#include <lk/console_cmd.h>
+#include <lk/debug.h>
+#include <lk/err.h>
+#include <lk/pow2.h>
+#include <lk/trace.h>
+#include <stdio.h>
+#include <string.h>
+
+#if WITH_KERNEL_VM
+#include <kernel/vm.h>
+#else
+#include <malloc.h>
+#endif
+
+#define LOCAL_TRACE 0
+
+/*
+ * Each slab starts with a small header, the rest is cut into objects that are fed to
+ * the cache's pool. Slabs are sized to hold at least SLAB_MIN_OBJECTS objects.
+ *
+ * A cpu's list holds at most SLAB_CPU_DEPTH objects. When it overflows or runs dry,
+ * SLAB_CPU_BATCH objects move between it and the cache wide pool in one go, so the
+ * shared lock is taken once per batch rather than once per object.
+ */
+#define SLAB_MIN_OBJECTS 8
+#define SLAB_CPU_DEPTH 16
+#define SLAB_CPU_BATCH (SLAB_CPU_DEPTH / 2)
+
+struct slab {
+    struct list_node node;
+};
+
+static mutex_t cache_list_lock = MUTEX_INITIAL_VALUE(cache_list_lock);
+static struct list_node cache_list = LIST_INITIAL_VALUE(cache_list);
+
+void slab_cache_init(slab_cache_t *cache, const char *name, size_t object_size, size_t align,
+                     uint flags, slab_ctor_t ctor) {
+    DEBUG_ASSERT(cache);
+    DEBUG_ASSERT(object_size > 0);
+    DEBUG_ASSERT(ispow2(align) && align <= PAGE_SIZE);
+
+    memset(cache, 0, sizeof(*cache));
+
+    if (flags & SLAB_FLAG_CACHE_ALIGN)
+        align = MAX(align, CACHE_LINE);
+
+    cache->name = name;
+    cache->flags = flags;
+    cache->ctor = ctor;
+    cache->align = POOL_STORAGE_ALIGN(object_size, align);
+    cache->object_size = POOL_PADDED_OBJECT_SIZE(object_size, align);
+    cache->first_offset = ROUNDUP(sizeof(struct slab), cache->align);
+    cache->slab_size = ROUNDUP(cache->first_offset + cache->object_size * SLAB_MIN_OBJECTS, PAGE_SIZE);
+    cache->slab_objects = (cache->slab_size - cache->first_offset) / cache->object_size;
+
+    mutex_init(&cache->grow_lock);
+    spin_lock_init(&cache->lock);
+    list_initialize(&cache->slabs);
+    for (uint i = 0; i < SMP_MAX_CPUS; i++)
+        spin_lock_init(&cache->cpu[i].lock);
+
+    LTRACEF("cache '%s' object size %zu align %zu, %u objects per %zu byte slab\n",
+            name, cache->object_size, cache->align, cache->slab_objects, cache->slab_size);
+
+    mutex_acquire(&cache_list_lock);
+    list_add_tail(&cache_list, &cache->node);
+    mutex_release(&cache_list_lock);
+}
+
+/* move every object held by the cpus back to the cache wide pool */
+static void flush_cpu_caches(slab_cache_t *cache) {
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        struct slab_cpu_cache *c = &cache->cpu[i];
+
+        arch_interrupt_saved_state_t state = spin_lock_irqsave(&c->lock);
+        spin_lock(&cache->lock);
+        void *object;
+        while ((object = pool_alloc(&c->free))) {
+            pool_free(&cache->free, object);
+            cache->free_count++;
+        }
+        c->count = 0;
+        spin_unlock(&cache->lock);
+        spin_unlock_irqrestore(&c->lock, state);
+    }
+}
+
+void slab_cache_destroy(slab_cache_t *cache) {
+    DEBUG_ASSERT(cache);
+
+    mutex_acquire(&cache_list_lock);
+    list_delete(&cache->node);
+    mutex_release(&cache_list_lock);
+
+    flush_cpu_caches(cache);
+    DEBUG_ASSERT(cache->free_count == cache->total_count);
+
+    struct slab *slab;
+    while ((slab = list_remove_head_type(&cache->slabs, struct slab, node))) {
+#if WITH_KERNEL_VM
+        pmm_free_kpages(slab, cache->slab_size / PAGE_SIZE);
+#else
+        free(slab);
+#endif
+    }
+
+    mutex_destroy(&cache->grow_lock);
+}
+
+/* add a slab's worth of objects to the cache wide pool */
+static status_t slab_grow(slab_cache_t *cache) {
+#if WITH_KERNEL_VM
+    struct slab *slab = pmm_alloc_kpages(cache->slab_size / PAGE_SIZE, NULL);
+#else
+    struct slab *slab = memalign(PAGE_SIZE, cache->slab_size);
+#endif
+    if (!slab)
+        return ERR_NO_MEMORY;
+
+    LTRACEF("cache '%s' slab %p\n", cache->name, slab);
+
+    /* string the new objects together first, then splice the chain in front of the
+     * pool. The first object pool_init() frees ends up at the tail of the chain. */
+    uint8_t *objects = (uint8_t *)slab + cache->first_offset;
+    pool_t chain = { NULL };
+    pool_init(&chain, cache->object_size, cache->align, cache->slab_objects, objects);
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->lock);
+    list_add_tail(&cache->slabs, &slab->node);
+    *(void **)objects = cache->free.next_free;
+    cache->free.next_free = chain.next_free;
+    cache->free_count += cache->slab_objects;
+    cache->total_count += cache->slab_objects;
+    cache->slab_count++;
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    return NO_ERROR;
+}
+
+/* take up to count objects from the cache wide pool, returns how many were taken */
+static uint take_batch(slab_cache_t *cache, pool_t *batch, uint count) {
+    uint taken = 0;
+
+    arch_interrupt_saved_state_t state = spin_lock_irqsave(&cache->lock);
+    void *object;
+    while (taken < count && (object = pool_alloc(&cache->free))) {
+        pool_free(batch, object);
+        taken++;
+    }
+    cache->free_count -= taken;
+    spin_unlock_irqrestore(&cache->lock, state);
+
+    return taken;
+}
+
+/* the current cpu's list was empty, refill it from the cache wide pool, growing it if need be */
+static void *slab_refill(slab_cache_t *cache) {
+    pool_t batch = { NULL };
+
+    if (take_batch(cache, &batch, SLAB_CPU_BATCH) == 0) {
+        mutex_acquire(&cache->grow_lock);
+        /* someone else may have grown it while we waited */
+        if (take_batch(cache, &batch, SLAB_CPU_BATCH) == 0) {
+            if (slab_grow(cache) == NO_ERROR)
+                take_batch(cache, &batch, SLAB_CPU_BATCH);
+        }
+        mutex_release(&cache->grow_lock);
+    }
+
+    void *result = pool_alloc(&batch);
+    if (!result)
+        return NULL;
+
+    /* we may have moved cpus, stash the rest on whichever one we're on now */
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct slab_cpu_cache *c = &cache->cpu[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    void *object;
+    while (c->count < SLAB_CPU_DEPTH && (object = pool_alloc(&batch))) {
+        pool_free(&c->free, object);
+        c->count++;
+    }
+    c->allocs++;
+    spin_unlock_irqrestore(&c->lock, state);
+
+    /* and anything that didn't fit goes back */
+    if (batch.next_free) {
+        state = spin_lock_irqsave(&cache->lock);
+        while ((object = pool_alloc(&batch))) {
+            pool_free(&cache->free, object);
+            cache->free_count++;
+        }
+        spin_unlock_irqrestore(&cache->lock, state);
+    }
+
+    return result;
+}
+
+void *slab_alloc(slab_cache_t *cache) {
+    DEBUG_ASSERT(cache);
+
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct slab_cpu_cache *c = &cache->cpu[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    void *object = pool_alloc(&c->free);
+    if (object) {
+        c->count--;
+        c->allocs++;
+    }
+    spin_unlock_irqrestore(&c->lock, state);
+
+    if (!object)
+        object = slab_refill(cache);
+
+    if (object && cache->ctor)
+        cache->ctor(object);
+
+    LTRACEF_LEVEL(2, "cache '%s' returns %p\n", cache->name, object);
+    return object;
+}
+
+void slab_free(slab_cache_t *cache, void *object) {
+    DEBUG_ASSERT(cache);
+    DEBUG_ASSERT(object);
+
+    LTRACEF_LEVEL(2, "cache '%s' object %p\n", cache->name, object);
+
+    pool_t spill = { NULL };
+
+    arch_interrupt_saved_state_t state = arch_interrupt_save();
+    struct slab_cpu_cache *c = &cache->cpu[arch_curr_cpu_num()];
+    spin_lock(&c->lock);
+    pool_free(&c->free, object);
+    c->frees++;
+    if (++c->count > SLAB_CPU_DEPTH) {
+        for (uint i = 0; i < SLAB_CPU_BATCH; i++)
+            pool_free(&spill, pool_alloc(&c->free));
+        c->count -= SLAB_CPU_BATCH;
+    }
+    spin_unlock(&c->lock);
+
+    if (spill.next_free) {
+        spin_lock(&cache->lock);
+        while ((object = pool_alloc(&spill))) {
+            pool_free(&cache->free, object);
+            cache->free_count++;
+        }
+        spin_unlock(&cache->lock);
+    }
+    arch_interrupt_restore(state);
+}
+
+static void dump_cache(slab_cache_t *cache) {
+    size_t cached = 0;
+    ulong allocs = 0;
+    ulong frees = 0;
+    for (uint i = 0; i < SMP_MAX_CPUS; i++) {
+        cached += cache->cpu[i].count;
+        allocs += cache->cpu[i].allocs;
+        frees += cache->cpu[i].frees;
+    }
+
+    printf("%-16s %6zu %6u %8zu %8zu %8zu %10lu %10lu\n", cache->name, cache->object_size,
+           cache->slab_count, cache->total_count, cache->total_count - cache->free_count - cached,
+           cached, allocs, frees);
+}
+
+static int cmd_slab(int argc, const console_cmd_args *argv) {
+    printf("%-16s %6s %6s %8s %8s %8s %10s %10s\n", "name", "size", "slabs", "objects", "in use",
+           "on cpus", "allocs", "frees");
+
+    mutex_acquire(&cache_list_lock);
+    slab_cache_t *cache;
+    list_for_every_entry(&cache_list, cache, slab_cache_t, node) {
+        dump_cache(cache);
+    }
+    mutex_release(&cache_list_lock);
+
+    return NO_ERROR;
+}
+
+STATIC_COMMAND_START
+#if LK_DEBUGLEVEL > 0
+STATIC_COMMAND("slab", "slab cache statistics", &cmd_slab)
+#endif
+STATIC_COMMAND_END(slab);
@@ -62,6 +62,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
+#include <sys/types.h>
 
 __BEGIN_CDECLS
 
@@ -412,4 +413,12 @@ bool run_all_tests(void);
 bool expect_bytes_eq(const uint8_t *expected, const uint8_t *actual, size_t len,
                      const char *msg);
 
+/*
+ * Runs routine on count threads at once, passing each the next element of the
+ * args array, stride bytes apart. Returns the usecs from releasing them to the
+ * last one finishing, or 0 if they couldn't all be started.
+ */
+lk_bigtime_t unittest_run_threads(const char *name, uint count, int (*routine)(void *),
+                                  void *args, size_t stride);
+
 __END_CDECLS
@@ -10,8 +10,12 @@
  */
 #include <lib/unittest.h>
 
+#include <kernel/event.h>
+#include <kernel/thread.h>
 #include <lk/debug.h>
+#include <platform.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <stddef.h>
@@ -59,6 +63,56 @@ void unittest_set_output_function (_printf_engine_output_func fun, void *arg) {
     out_func_arg = arg;
 }
 
+struct unittest_thread {
+    thread_t *thread;
+    event_t *start;
+    int (*routine)(void *);
+    void *arg;
+};
+
+static int unittest_thread_entry(void *arg) {
+    struct unittest_thread *ut = arg;
+
+    event_wait(ut->start);
+    return ut->routine(ut->arg);
+}
+
+lk_bigtime_t unittest_run_threads(const char *name, uint count, int (*routine)(void *),
+                                  void *args, size_t stride) {
+    struct unittest_thread *threads = calloc(count, sizeof(*threads));
+    if (!threads)
+        return 0;
+
+    /* everyone waits on the start event so they all hit the code under test together */
+    event_t start;
+    event_init(&start, false, 0);
+
+    uint created;
+    for (created = 0; created < count; created++) {
+        struct unittest_thread *ut = &threads[created];
+        ut->start = &start;
+        ut->routine = routine;
+        ut->arg = (uint8_t *)args + created * stride;
+        ut->thread = thread_create(name, &unittest_thread_entry, ut, DEFAULT_PRIORITY,
+                                   DEFAULT_STACK_SIZE);
+        if (!ut->thread)
+            break;
+        thread_resume(ut->thread);
+    }
+
+    lk_bigtime_t t = current_time_hires();
+    event_signal(&start, true);
+    for (uint i = 0; i < created; i++) {
+        thread_join(threads[i].thread, NULL, INFINITE_TIME);
+    }
+    t = current_time_hires() - t;
+
+    event_destroy(&start);
+    free(threads);
+
+    return (created == count) ? MAX(t, 1ull) : 0;
+}
+
 /* test case for unittests itself */
 static bool unittest_printf_tests(void) {
     BEGIN_TEST;
@@ -199,13 +199,18 @@ status_t platform_allocate_interrupts(size_t count, uint align_log2, bool msi,
 
     arch_interrupt_saved_state_t state = spin_lock_irqsave(&lock);
 
-    // find a free interrupt
+    // find a run of count free interrupts
     status_t err = ERR_NOT_FOUND;
-    for (unsigned int i = 0; i < INT_VECTORS; i++) {
-        if (!int_table[i].flags.allocated) {
-            int_table[i].flags.allocated = true;
-            *vector = i;
-            LTRACEF("found irq %#x\n", i);
+    size_t run = 0;
+    for (unsigned int i = 0; i < INT_VECTORS && count > 0; i++) {
+        run = int_table[i].flags.allocated ? 0 : run + 1;
+        if (run == count) {
+            unsigned int base = i + 1 - count;
+            for (unsigned int j = base; j <= i; j++) {
+                int_table[j].flags.allocated = true;
+            }
+            *vector = base;
+            LTRACEF("found irq %#x\n", base);
             err = NO_ERROR;
             break;
         }
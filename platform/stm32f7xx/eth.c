@@ -325,14 +325,14 @@ status_t stm32_eth_send_minip_pkt(void *arg, pktbuf_t *p) {
 
     DEBUG_ASSERT(p && p->dlen);
 
-    if (!(p->flags & PKTBUF_FLAG_EOF)) {
-        /* can't handle multi part packets yet */
-        PANIC_UNIMPLEMENTED;
-
-        return ERR_NOT_IMPLEMENTED;
+    /* can't handle multi part packets, gather them into the first part */
+    status_t err = pktbuf_linearize(p);
+    if (err < 0) {
+        pktbuf_free_chain(p, true);
+        return err;
     }
 
-    status_t err = eth_send(p->data, p->dlen);
+    err = eth_send(p->data, p->dlen);
 
     pktbuf_free(p, true);
 
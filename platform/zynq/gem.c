@@ -177,10 +177,15 @@ int gem_send_raw_pkt(void *arg, struct pktbuf *p) {
         goto err;
     }
 
+    // the tx table takes a single buffer per packet, gather multi part packets into the first part
+    ret = pktbuf_linearize(p);
+    if (ret < 0) {
+        pktbuf_free_chain(p, true);
+        goto err;
+    }
+
     /* make sure the output buffer is fully written to memory before
      * placing on the outgoing list. */
-
-    // XXX handle multi part buffers
     arch_clean_cache_range((vaddr_t)p->data, p->dlen);
 
     arch_interrupt_saved_state_t irqstate = spin_lock_irqsave(&lock);